@@ -0,0 +1,559 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <float.h>
+#include <xmmintrin.h>
+
+class Aabb
+{
+public:
+	Vec3f min;
+	Vec3f max;
+
+	Aabb()
+		: min(FLT_MAX)
+		, max(-FLT_MAX)
+	{
+	}
+
+	Aabb( const Vec3f _min, const Vec3f _max )
+		: min(_min)
+		, max(_max)
+	{
+	}
+
+	void grow( const Vec3f p )
+	{
+		min = Vec3f(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+		max = Vec3f(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+	}
+	void grow( const Aabb& box )
+	{
+		grow(box.min);
+		grow(box.max);
+	}
+
+	bool empty() const
+	{
+		return min.x > max.x;
+	}
+
+	Vec3f center() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	// half the surface area, only used for SAH ratios
+	f32 halfArea() const
+	{
+		if (empty())
+		{
+			return 0;
+		}
+		Vec3f e = max - min;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+// 32 bytes, two per cache line; the slab test loads min and max as 4 floats, first and count
+// land in the lane it ignores
+struct BvhNode
+{
+	f32 min[3];
+	u32 first;		// leaf: first item, inner: left child, the right child follows it
+	f32 max[3];
+	u32 count;		// item count for leaves, 0 for inner nodes
+};
+
+// Bounding volume hierarchy over anything with a bounding box, built top-down with a binned SAH.
+// Leaves are ranges of 'items', which index the boxes given to build().
+class Bvh
+{
+public:
+	enum { BinCount = 16 };
+	enum { MaxDepth = 64 };
+
+	std::vector<BvhNode> nodes;
+	std::vector<u32> items;
+
+	void clear()
+	{
+		nodes.clear();
+		items.clear();
+	}
+
+	bool empty() const
+	{
+		return nodes.empty();
+	}
+
+	Aabb bounds() const
+	{
+		return empty() ? Aabb() : Aabb(Vec3f(nodes[0].min[0], nodes[0].min[1], nodes[0].min[2]), Vec3f(nodes[0].max[0], nodes[0].max[1], nodes[0].max[2]));
+	}
+
+	// leaves get at most maxLeafSize items
+	void build( const Aabb* boxes, const u32 count, const u32 maxLeafSize )
+	{
+		clear();
+		if (count == 0)
+		{
+			return;
+		}
+
+		// the build works on a copy of the boxes it reorders, not through 'items', to read memory in order
+		buildItems.resize(count);
+		Task root = { 0, 0, count, 0, Aabb(), Aabb() };
+		for (u32 i = 0; i < count; ++i)
+		{
+			for (u32 axis = 0; axis < 4; ++axis)
+			{
+				buildItems[i].min[axis] = boxes[i].min[axis];
+				buildItems[i].max[axis] = boxes[i].max[axis];
+			}
+			buildItems[i].index = i;
+			root.box.grow(boxes[i]);
+			root.centerBox.grow(boxes[i].center());
+		}
+		nodes.reserve(2 * count / std::max(maxLeafSize, 1u) + 1);
+
+		std::vector<Task> tasks;
+		nodes.push_back(BvhNode());
+		tasks.push_back(root);
+
+		while (!tasks.empty())
+		{
+			Task task = tasks.back();
+			tasks.pop_back();
+			setBounds(nodes[task.node], task.box);
+
+			// nodes are split down to the leaf size, the SAH only chooses where
+			Task left, right;
+			if (task.count <= maxLeafSize || task.depth + 1 >= MaxDepth || !partition(task, left, right))
+			{
+				nodes[task.node].first = task.first;
+				nodes[task.node].count = task.count;
+				continue;
+			}
+
+			left.node = u32(nodes.size());
+			right.node = left.node + 1;
+			nodes.push_back(BvhNode());
+			nodes.push_back(BvhNode());
+			nodes[task.node].first = left.node;
+			nodes[task.node].count = 0;
+			tasks.push_back(left);
+			tasks.push_back(right);
+		}
+
+		items.resize(count);
+		for (u32 i = 0; i < count; ++i)
+		{
+			items[i] = buildItems[i].index;
+		}
+		std::vector<BuildItem>().swap(buildItems);
+		std::vector<BvhNode>(nodes).swap(nodes);
+	}
+
+	// entry distance into the node's box, FLT_MAX when missed or further than tmax
+	static f32 intersectNode( const BvhNode& node, const __m128& pos, const __m128& invDir, const f32 tmax )
+	{
+		f32 tNear = 0;
+		f32 tFar = tmax;
+		return intersect_box(tNear, tFar, pos, invDir, node.min, node.max) ? tNear : FLT_MAX;
+	}
+
+	// nearest child first, leaf(first, count, tmax) tests the items of a leaf and lowers tmax on a hit
+	template<typename F>
+	void traverse( const Ray& ray, f32& tmax, const F& leaf ) const
+	{
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		const __m128 pos = _mm_setr_ps(ray.pos.x, ray.pos.y, ray.pos.z, 0);
+		const __m128 invDir = _mm_div_ps(_mm_set1_ps(1), _mm_setr_ps(ray.dir.x, ray.dir.y, ray.dir.z, 1));
+		if (intersectNode(nodes[0], pos, invDir, tmax) == FLT_MAX)
+		{
+			return;
+		}
+
+		// far children wait on the stack with their entry distance, skipped if a closer hit was found since
+		u32 stack[MaxDepth];
+		f32 stackDist[MaxDepth];
+		u32 stackSize = 0;
+		u32 current = 0;
+		for (;;)
+		{
+			const BvhNode& node = nodes[current];
+			if (node.count)
+			{
+				leaf(node.first, node.count, tmax);
+			}
+			else
+			{
+				u32 closer = node.first;
+				u32 further = node.first + 1;
+				f32 tCloser = intersectNode(nodes[closer], pos, invDir, tmax);
+				f32 tFurther = intersectNode(nodes[further], pos, invDir, tmax);
+				if (tFurther < tCloser)
+				{
+					swap(closer, further);
+					swap(tCloser, tFurther);
+				}
+				if (tCloser != FLT_MAX)
+				{
+					if (tFurther != FLT_MAX)
+					{
+						stack[stackSize] = further;
+						stackDist[stackSize] = tFurther;
+						++stackSize;
+					}
+					current = closer;
+					continue;
+				}
+			}
+
+			do
+			{
+				if (stackSize == 0)
+				{
+					return;
+				}
+				--stackSize;
+			}
+			while (stackDist[stackSize] > tmax);
+			current = stack[stackSize];
+		}
+	}
+
+	// any hit closer than tmax, for shadow rays: children in any order, stops as soon as
+	// leaf(first, count, tmax) returns true
+	template<typename F>
+	bool occluded( const Ray& ray, const f32 tmax, const F& leaf ) const
+	{
+		if (nodes.empty())
+		{
+			return false;
+		}
+
+		const __m128 pos = _mm_setr_ps(ray.pos.x, ray.pos.y, ray.pos.z, 0);
+		const __m128 invDir = _mm_div_ps(_mm_set1_ps(1), _mm_setr_ps(ray.dir.x, ray.dir.y, ray.dir.z, 1));
+		if (intersectNode(nodes[0], pos, invDir, tmax) == FLT_MAX)
+		{
+			return false;
+		}
+
+		u32 stack[MaxDepth];
+		u32 stackSize = 0;
+		u32 current = 0;
+		for (;;)
+		{
+			const BvhNode& node = nodes[current];
+			if (node.count)
+			{
+				if (leaf(node.first, node.count, tmax))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				bool left = intersectNode(nodes[node.first], pos, invDir, tmax) != FLT_MAX;
+				bool right = intersectNode(nodes[node.first + 1], pos, invDir, tmax) != FLT_MAX;
+				if (left || right)
+				{
+					if (left && right)
+					{
+						stack[stackSize++] = node.first + 1;
+					}
+					current = left ? node.first : node.first + 1;
+					continue;
+				}
+			}
+
+			if (stackSize == 0)
+			{
+				return false;
+			}
+			current = stack[--stackSize];
+		}
+	}
+
+	// Any hit for the rays of a packet at once, the mask of those occluded among 'active': a node is visited
+	// when any ray still unoccluded enters it, leaf(first, count, mask) tests the items against the rays in
+	// mask and returns those that hit. Rays drop out as they are occluded, the walk stops when none is left.
+	template<typename F>
+	int occluded4( const RayPacket4& rays, const int active, const F& leaf ) const
+	{
+		if (nodes.empty() || !(intersect_box_packet4(rays, nodes[0].min, nodes[0].max) & active))
+		{
+			return 0;
+		}
+
+		int occluded = 0;
+		u32 stack[MaxDepth];
+		u32 stackSize = 0;
+		u32 current = 0;
+		for (;;)
+		{
+			const int open = active & ~occluded;
+			const BvhNode& node = nodes[current];
+			if (node.count)
+			{
+				occluded |= leaf(node.first, node.count, open) & open;
+				if (!(active & ~occluded))
+				{
+					return occluded;
+				}
+			}
+			else
+			{
+				bool left = (intersect_box_packet4(rays, nodes[node.first].min, nodes[node.first].max) & open) != 0;
+				bool right = (intersect_box_packet4(rays, nodes[node.first + 1].min, nodes[node.first + 1].max) & open) != 0;
+				if (left || right)
+				{
+					if (left && right)
+					{
+						stack[stackSize++] = node.first + 1;
+					}
+					current = left ? node.first : node.first + 1;
+					continue;
+				}
+			}
+
+			if (stackSize == 0)
+			{
+				return occluded;
+			}
+			current = stack[--stackSize];
+		}
+	}
+
+private:
+	// SSE min/max on x, y, z (w unused), the build spends its time binning these
+	struct BuildItem
+	{
+		f32 min[4];
+		f32 max[4];
+		u32 index;
+	};
+
+	struct Task
+	{
+		u32 node;
+		u32 first;
+		u32 count;
+		u32 depth;
+		Aabb box;
+		Aabb centerBox;
+	};
+
+	struct Bin
+	{
+		__m128 min;
+		__m128 max;
+		__m128 centerMin;
+		__m128 centerMax;
+		u32 count;
+
+		void clear()
+		{
+			min = centerMin = _mm_set1_ps(FLT_MAX);
+			max = centerMax = _mm_set1_ps(-FLT_MAX);
+			count = 0;
+		}
+
+		void add( const __m128 itemMin, const __m128 itemMax, const __m128 center )
+		{
+			min = _mm_min_ps(min, itemMin);
+			max = _mm_max_ps(max, itemMax);
+			centerMin = _mm_min_ps(centerMin, center);
+			centerMax = _mm_max_ps(centerMax, center);
+			++count;
+		}
+
+		void add( const Bin& bin )
+		{
+			min = _mm_min_ps(min, bin.min);
+			max = _mm_max_ps(max, bin.max);
+			centerMin = _mm_min_ps(centerMin, bin.centerMin);
+			centerMax = _mm_max_ps(centerMax, bin.centerMax);
+			count += bin.count;
+		}
+
+		f32 halfArea() const
+		{
+			if (count == 0)
+			{
+				return 0;
+			}
+			f32 e[4];
+			_mm_storeu_ps(e, _mm_sub_ps(max, min));
+			return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+		}
+
+		void toTask( Task& task ) const
+		{
+			f32 v[4][4];
+			_mm_storeu_ps(v[0], min);
+			_mm_storeu_ps(v[1], max);
+			_mm_storeu_ps(v[2], centerMin);
+			_mm_storeu_ps(v[3], centerMax);
+			task.box = Aabb(Vec3f(v[0][0], v[0][1], v[0][2]), Vec3f(v[1][0], v[1][1], v[1][2]));
+			task.centerBox = Aabb(Vec3f(v[2][0], v[2][1], v[2][2]), Vec3f(v[3][0], v[3][1], v[3][2]));
+		}
+	};
+
+	std::vector<BuildItem> buildItems;	// only while building
+
+	static void setBounds( BvhNode& node, const Aabb& box )
+	{
+		for (u32 axis = 0; axis < 3; ++axis)
+		{
+			node.min[axis] = box.min[axis];
+			node.max[axis] = box.max[axis];
+		}
+	}
+
+	// reorders the items of the task and fills both sides, their bounds come from the bins
+	bool partition( const Task& task, Task& left, Task& right )
+	{
+		f32 lo[3], scales[3];
+		for (u32 axis = 0; axis < 3; ++axis)
+		{
+			const f32 extent = task.centerBox.max[axis] - task.centerBox.min[axis];
+			lo[axis] = task.centerBox.min[axis];
+			scales[axis] = extent > 0 ? BinCount / extent : 0;
+		}
+
+		Bin bins[3][BinCount];
+		for (u32 axis = 0; axis < 3; ++axis)
+		{
+			for (u32 bin = 0; bin < BinCount; ++bin)
+			{
+				bins[axis][bin].clear();
+			}
+		}
+
+		BuildItem* first = &buildItems[task.first];
+		BuildItem* end = first + task.count;
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (const BuildItem* item = first; item < end; ++item)
+		{
+			const __m128 itemMin = _mm_loadu_ps(item->min);
+			const __m128 itemMax = _mm_loadu_ps(item->max);
+			const __m128 center = _mm_mul_ps(_mm_add_ps(itemMin, itemMax), half);
+			for (u32 axis = 0; axis < 3; ++axis)
+			{
+				bins[axis][binOf(*item, lo, scales, axis)].add(itemMin, itemMax, center);
+			}
+		}
+
+		f32 bestCost = FLT_MAX;
+		u32 bestAxis = 0;
+		u32 bestBin = 0;
+		for (u32 axis = 0; axis < 3; ++axis)
+		{
+			if (scales[axis] == 0)
+			{
+				continue;
+			}
+
+			// sweep from the right, then from the left evaluating the cost of every split
+			f32 rightAreas[BinCount];
+			u32 rightCounts[BinCount];
+			Bin rightSide;
+			rightSide.clear();
+			for (u32 bin = BinCount - 1; bin > 0; --bin)
+			{
+				rightSide.add(bins[axis][bin]);
+				rightAreas[bin] = rightSide.halfArea();
+				rightCounts[bin] = rightSide.count;
+			}
+
+			Bin leftSide;
+			leftSide.clear();
+			for (u32 bin = 0; bin + 1 < BinCount; ++bin)
+			{
+				leftSide.add(bins[axis][bin]);
+				if (leftSide.count == 0 || rightCounts[bin + 1] == 0)
+				{
+					continue;
+				}
+				f32 cost = leftSide.halfArea() * leftSide.count + rightAreas[bin + 1] * rightCounts[bin + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = bin;
+				}
+			}
+		}
+
+		Bin leftSide, rightSide;
+		leftSide.clear();
+		rightSide.clear();
+		u32 split;
+		if (bestCost == FLT_MAX)
+		{
+			// all centers coincide: split the range in the middle
+			split = task.count / 2;
+			for (u32 i = 0; i < task.count; ++i)
+			{
+				const __m128 itemMin = _mm_loadu_ps(first[i].min);
+				const __m128 itemMax = _mm_loadu_ps(first[i].max);
+				(i < split ? leftSide : rightSide).add(itemMin, itemMax, _mm_mul_ps(_mm_add_ps(itemMin, itemMax), half));
+			}
+		}
+		else
+		{
+			BuildItem* l = first;
+			BuildItem* r = end;
+			for (;;)
+			{
+				while (l < r && binOf(*l, lo, scales, bestAxis) <= bestBin)
+				{
+					++l;
+				}
+				while (l < r && binOf(r[-1], lo, scales, bestAxis) > bestBin)
+				{
+					--r;
+				}
+				if (l >= r)
+				{
+					break;
+				}
+				--r;
+				BuildItem tmp = *l;
+				*l = *r;
+				*r = tmp;
+				++l;
+			}
+			split = u32(l - first);
+
+			for (u32 bin = 0; bin < BinCount; ++bin)
+			{
+				(bin <= bestBin ? leftSide : rightSide).add(bins[bestAxis][bin]);
+			}
+		}
+
+		leftSide.toTask(left);
+		rightSide.toTask(right);
+		left.first = task.first;
+		left.count = split;
+		right.first = task.first + split;
+		right.count = task.count - split;
+		left.depth = right.depth = task.depth + 1;
+		return split > 0 && split < task.count;
+	}
+
+	// the center is computed as in Aabb::center, so items land in the same bin every time
+	static u32 binOf( const BuildItem& item, const f32* lo, const f32* scales, const u32 axis )
+	{
+		const f32 center = (item.min[axis] + item.max[axis]) * 0.5f;
+		return std::min(u32((center - lo[axis]) * scales[axis]), u32(BinCount - 1));
+	}
+};
@@ -0,0 +1,1130 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Headless modes for render farms and benchmarking, selected on the command line.
+// They run before any window or GL context is created.
+struct CommandLine
+{
+	enum Mode
+	{
+		Mode_Gui,
+		Mode_Batch,			// render once and write the image
+		Mode_BenchFormats,	// render once and time every export format
+		Mode_Poster,		// render in bands straight into a mapped raw file, for pictures larger than memory
+		Mode_Convert,		// write the scene to another scene file, text or binary
+		Mode_BenchRender,	// time the render stages on the scene
+		Mode_BenchVariance,	// path tracing noise with and without light sampling, at equal time
+		Mode_BenchShading,	// every shading model, specialized render loops against the per-ray switch
+		Mode_BenchFastMath,	// every shading model, approximate square roots against exact ones, with the image difference
+		Mode_BenchVector,	// reflect and Ray::at written with Vector3 operators against the fused madd/msub
+	};
+
+	Mode mode;
+	Vec2u size;
+	char scene[256];	// scene file, the built-in scene when empty
+	bool generate;		// a generated scene instead
+	SceneGenerator generator;
+	char obj[256];		// mesh added to the scene, fitted into the room
+	char output[256];	// extension picks the format, unless given with --format
+	int format;			// ExportFormat, -1 when not given
+	bool denoise;
+	bool aa;
+	u32 repeat;
+	u32 bandRows;
+	int shading;		// ShadingModel, -1 when not given
+	u32 shadowSamples;	// 0 when not given
+	u32 pathSamples;	// 0 when not given
+	u32 cacheRays;		// 0 when not given
+	bool noCache;		// path-cache computes every pixel's irradiance
+	f32 gridCell;		// 0 when not given
+	u32 photons;		// 0 when not given
+	u32 gatherCount;	// 0 when not given
+	f32 gatherRadius;	// 0 when not given
+	int rayDepth;		// -1 when not given
+	u32 aoSamples;		// 0 when not given
+	f32 giDist;			// 0 when not given
+	int isa;			// CpuIsa, -1 when not given
+	bool fastMath;
+
+	CommandLine()
+		: mode(Mode_Gui)
+		, size(1024, 1024)
+		, generate(false)
+		, format(-1)
+		, denoise(false)
+		, aa(true)
+		, repeat(3)
+		, bandRows(64)
+		, shading(-1)
+		, shadowSamples(0)
+		, pathSamples(0)
+		, cacheRays(0)
+		, noCache(false)
+		, gridCell(0)
+		, photons(0)
+		, gatherCount(0)
+		, gatherRadius(0)
+		, rayDepth(-1)
+		, aoSamples(0)
+		, giDist(0)
+		, isa(-1)
+		, fastMath(false)
+	{
+		scene[0] = 0;
+		obj[0] = 0;
+		strcpy(output, "out");
+	}
+};
+
+inline void printUsage( const char* exe )
+{
+	printf("usage: %s [mode] [options]\n", exe);
+	printf("modes (default opens the window):\n");
+	printf("  --batch               render once and write the image\n");
+	printf("  --bench-formats       render once and time every export format\n");
+	printf("  --poster              render in bands into a mapped raw/rawf file, for any size\n");
+	printf("  --convert <file>      write the scene to a scene file, text if it ends in .txt, else binary\n");
+	printf("  --bench-render        time the render stages, best of --repeat runs\n");
+	printf("  --bench-variance      path tracing noise with light sampling and MIS vs BSDF sampling, at equal time\n");
+	printf("  --bench-shading       every shading model, compile-time specialized render loop vs per-ray switch\n");
+	printf("  --bench-fast-math     every shading model, rsqrt/rcp estimates vs exact math, and how far the images differ\n");
+	printf("  --bench-vector        reflect and Ray::at with Vector3 operators vs fused madd/msub, on 1M rays\n");
+	printf("options:\n");
+	printf("  --scene <file>        text or binary scene, default is the built-in scene (also for the window)\n");
+	printf("  --generate <layout>   generated scene instead, one of:");
+	for (int i = 0; i < SceneLayout_Count; ++i)
+	{
+		printf(" %s", SceneLayoutKeys[i]);
+	}
+	printf("\n");
+	printf("  --count <N>           generated sphere or instance count, default 1000\n");
+	printf("  --seed <N>            generator seed, default 1\n");
+	printf("  --lights <N>          generated light count, more than 1 are small sphere lights, default 1\n");
+	printf("  --obj <file>          add an OBJ mesh to the scene, scaled to stand in the room\n");
+	printf("  --size <W>x<H> | <N>  image size, default 1024x1024\n");
+	printf("  --output <name>       output file, the extension picks the format, default out.png\n");
+	printf("  --format <ext>        output format, one of:");
+	for (int i = 0; i < ExportFormat_Count; ++i)
+	{
+		printf(" %s", ExportFormatExtensions[i]);
+	}
+	printf("\n");
+	printf("  --shading <model>     shading model, one of:");
+	for (int i = 0; i < ShadingModel_Count; ++i)
+	{
+		printf(" %s", ShadingModelKeys[i]);
+	}
+	printf("\n");
+	printf("  --shadow-samples <N>  shadow rays per shaded point whatever the light count, default 16\n");
+	printf("  --path-samples <N>    paths per pixel of the path traced models, default 8\n");
+	printf("  --cache-rays <N>      hemisphere rays per irradiance cache record (path-cache), default 256\n");
+	printf("  --no-cache            path-cache computes the irradiance of every pixel instead\n");
+	printf("  --grid-cell <size>    radiance grid cell size (path-grid), default 0.5\n");
+	printf("  --photons <N>         photons emitted (photon), default 100000\n");
+	printf("  --gather-count <N>    nearest photons in an estimate, default 128\n");
+	printf("  --gather-radius <r>   furthest photon in an estimate, default 0.5\n");
+	printf("  --ray-depth <N>       mirror and glass bounces of the models other than path, default 8\n");
+	printf("  --ao-samples <N>      ambient occlusion rays per shaded point (ao), default 16\n");
+	printf("  --gi-dist <d>         reach of the gi-normal, gi-reflect and ao rays, default 1\n");
+	printf("  --isa <set>           SIMD kernels, the widest the CPU has (%s) unless narrowed to one of:", CpuIsaKeys[detect_cpu_isa()]);
+	for (int i = 0; i < CpuIsa_Count; ++i)
+	{
+		printf(" %s", CpuIsaKeys[i]);
+	}
+	printf("\n");
+	printf("  --fast-math           rsqrt/rcp estimates for primary rays, sphere and box hits, normals and shadow rays\n");
+	printf("  --denoise             run the denoiser\n");
+	printf("  --no-aa               skip edge antialiasing\n");
+	printf("  --repeat <N>          benchmark runs, the best is kept, default 3\n");
+	printf("  --band <rows>         poster rows rendered at once, default 64\n");
+}
+
+inline bool parseSize( const char* arg, Vec2u& size )
+{
+	unsigned w = 0, h = 0;
+	int count = sscanf(arg, "%ux%u", &w, &h);
+	if (count == 1)
+	{
+		h = w;
+	}
+	if (count < 1 || w == 0 || h == 0)
+	{
+		return false;
+	}
+	size = Vec2u(w, h);
+	return true;
+}
+
+// false on bad arguments, after printing why
+inline bool parseCommandLine( int argc, char** argv, CommandLine& cl )
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--batch") == 0)
+		{
+			cl.mode = CommandLine::Mode_Batch;
+		}
+		else if (strcmp(arg, "--bench-formats") == 0)
+		{
+			cl.mode = CommandLine::Mode_BenchFormats;
+		}
+		else if (strcmp(arg, "--poster") == 0)
+		{
+			cl.mode = CommandLine::Mode_Poster;
+		}
+		else if (strcmp(arg, "--bench-render") == 0)
+		{
+			cl.mode = CommandLine::Mode_BenchRender;
+		}
+		else if (strcmp(arg, "--bench-variance") == 0)
+		{
+			cl.mode = CommandLine::Mode_BenchVariance;
+		}
+		else if (strcmp(arg, "--bench-shading") == 0)
+		{
+			cl.mode = CommandLine::Mode_BenchShading;
+		}
+		else if (strcmp(arg, "--bench-fast-math") == 0)
+		{
+			cl.mode = CommandLine::Mode_BenchFastMath;
+		}
+		else if (strcmp(arg, "--bench-vector") == 0)
+		{
+			cl.mode = CommandLine::Mode_BenchVector;
+		}
+		else if (strcmp(arg, "--fast-math") == 0)
+		{
+			cl.fastMath = true;
+		}
+		else if (strcmp(arg, "--denoise") == 0)
+		{
+			cl.denoise = true;
+		}
+		else if (strcmp(arg, "--no-aa") == 0)
+		{
+			cl.aa = false;
+		}
+		else if (strcmp(arg, "--no-cache") == 0)
+		{
+			cl.noCache = true;
+		}
+		else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)
+		{
+			printUsage(argv[0]);
+			return false;
+		}
+		else if (!value)
+		{
+			fprintf(stderr, "unknown or incomplete option %s\n", arg);
+			printUsage(argv[0]);
+			return false;
+		}
+		else if (strcmp(arg, "--size") == 0)
+		{
+			if (!parseSize(value, cl.size))
+			{
+				fprintf(stderr, "bad size %s\n", value);
+				return false;
+			}
+			++i;
+		}
+		else if (strcmp(arg, "--scene") == 0)
+		{
+			snprintf(cl.scene, sizeof(cl.scene), "%s", value);
+			++i;
+		}
+		else if (strcmp(arg, "--generate") == 0)
+		{
+			int layout = findSceneLayout(value);
+			if (layout < 0)
+			{
+				fprintf(stderr, "unknown layout %s\n", value);
+				return false;
+			}
+			cl.generate = true;
+			cl.generator.layout = SceneLayout(layout);
+			++i;
+		}
+		else if (strcmp(arg, "--count") == 0)
+		{
+			cl.generator.count = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--seed") == 0)
+		{
+			cl.generator.seed = u32(strtoul(value, NULL, 10));
+			++i;
+		}
+		else if (strcmp(arg, "--lights") == 0)
+		{
+			cl.generator.lightCount = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--shading") == 0)
+		{
+			cl.shading = findShadingModel(value);
+			if (cl.shading < 0)
+			{
+				fprintf(stderr, "unknown shading model %s\n", value);
+				return false;
+			}
+			++i;
+		}
+		else if (strcmp(arg, "--shadow-samples") == 0)
+		{
+			cl.shadowSamples = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--path-samples") == 0)
+		{
+			cl.pathSamples = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--cache-rays") == 0)
+		{
+			cl.cacheRays = std::max(8, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--grid-cell") == 0)
+		{
+			cl.gridCell = std::max(1e-3f, f32(atof(value)));
+			++i;
+		}
+		else if (strcmp(arg, "--photons") == 0)
+		{
+			cl.photons = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--gather-count") == 0)
+		{
+			cl.gatherCount = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--gather-radius") == 0)
+		{
+			cl.gatherRadius = std::max(1e-3f, f32(atof(value)));
+			++i;
+		}
+		else if (strcmp(arg, "--ray-depth") == 0)
+		{
+			cl.rayDepth = std::min(std::max(0, atoi(value)), int(Scene::MaxRayDepth));
+			++i;
+		}
+		else if (strcmp(arg, "--ao-samples") == 0)
+		{
+			cl.aoSamples = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--isa") == 0)
+		{
+			cl.isa = find_cpu_isa(value);
+			if (cl.isa < 0)
+			{
+				fprintf(stderr, "unknown instruction set %s\n", value);
+				return false;
+			}
+			++i;
+		}
+		else if (strcmp(arg, "--gi-dist") == 0)
+		{
+			cl.giDist = std::max(1e-3f, f32(atof(value)));
+			++i;
+		}
+		else if (strcmp(arg, "--obj") == 0)
+		{
+			snprintf(cl.obj, sizeof(cl.obj), "%s", value);
+			++i;
+		}
+		else if (strcmp(arg, "--convert") == 0)
+		{
+			cl.mode = CommandLine::Mode_Convert;
+			snprintf(cl.output, sizeof(cl.output), "%s", value);
+			++i;
+		}
+		else if (strcmp(arg, "--output") == 0)
+		{
+			snprintf(cl.output, sizeof(cl.output), "%s", value);
+			++i;
+		}
+		else if (strcmp(arg, "--format") == 0)
+		{
+			cl.format = findExportFormat(value);
+			if (cl.format < 0)
+			{
+				fprintf(stderr, "unknown format %s\n", value);
+				return false;
+			}
+			++i;
+		}
+		else if (strcmp(arg, "--repeat") == 0)
+		{
+			cl.repeat = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--band") == 0)
+		{
+			cl.bandRows = std::max(1, atoi(value));
+			++i;
+		}
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", arg);
+			printUsage(argv[0]);
+			return false;
+		}
+	}
+	if (cl.generate && cl.scene[0])
+	{
+		fprintf(stderr, "--scene and --generate are exclusive\n");
+		return false;
+	}
+	return true;
+}
+
+// the --obj mesh, standing on the floor in the middle of the room
+inline bool addObjMesh( Scene& scene, const char* filename )
+{
+	Timer timer;
+	Mesh mesh;
+	if (!loadObj(filename, mesh))
+	{
+		return false;
+	}
+	f32 loadMs = timer.elapsedMs();
+
+	mesh.fit(Vec3f(0, 0, 0), 3);
+	mesh.build();
+	printf("loaded %s in %.1f ms, built in %.1f ms, %u triangles, %u vertices, %u BVH nodes, %.1f MB\n", filename, loadMs,
+		timer.elapsedMs() - loadMs, mesh.triangleCount(), mesh.vertexCount(), mesh.nodeCount(), mesh.memoryUsage() / (1024.f * 1024.f));
+
+	const char* slash = std::max(strrchr(filename, '/'), strrchr(filename, '\\'));
+	mesh.name = scene.storeName(slash ? slash + 1 : filename);
+	mesh.material = scene.addMaterial(white);
+	scene.meshes.push_back(std::move(mesh));
+	return true;
+}
+
+// the built-in scene, the --scene file or a generated scene, plus the --obj mesh
+// falls back to the built-in scene when a file can't be loaded
+inline bool setupScene( Tracer& tracer, const CommandLine& cl )
+{
+	tracer.initScene();
+	if (cl.generate)
+	{
+		Timer timer;
+		tracer.generator = cl.generator;
+		tracer.generator.generate(tracer.scene);
+		printf("%s in %.1f ms\n", tracer.scene.description.c_str(), timer.elapsedMs());
+	}
+	else if (cl.scene[0])
+	{
+		Timer timer;
+		if (!loadScene(cl.scene, tracer.scene))
+		{
+			tracer.initScene();
+			return false;
+		}
+		printf("loaded %s in %.1f ms, %u spheres, %u planes, %u boxes, %llu triangles\n", cl.scene, timer.elapsedMs(),
+			u32(tracer.scene.spheres.size()), u32(tracer.scene.planes.size()), u32(tracer.scene.boxes.size()), tracer.scene.triangleCount());
+	}
+
+	if (cl.obj[0] && !addObjMesh(tracer.scene, cl.obj))
+	{
+		tracer.initScene();
+		return false;
+	}
+
+	if (cl.shading >= 0)
+	{
+		tracer.scene.shadingModel = ShadingModel(cl.shading);
+	}
+	if (cl.shadowSamples)
+	{
+		tracer.scene.shadowSamples = cl.shadowSamples;
+	}
+	if (cl.pathSamples)
+	{
+		tracer.scene.pathSamples = cl.pathSamples;
+	}
+	if (cl.cacheRays)
+	{
+		tracer.scene.irradianceCache.rays = cl.cacheRays;
+	}
+	tracer.scene.irradianceCache.enabled = !cl.noCache;
+	tracer.scene.irradianceCache.clear();
+	if (cl.gridCell)
+	{
+		tracer.scene.radianceGrid.cellSize = cl.gridCell;
+	}
+	tracer.scene.radianceGrid.clear();
+	if (cl.photons)
+	{
+		tracer.scene.photonMap.photonCount = cl.photons;
+	}
+	if (cl.gatherCount)
+	{
+		tracer.scene.photonMap.gatherCount = cl.gatherCount;
+	}
+	if (cl.gatherRadius)
+	{
+		tracer.scene.photonMap.gatherRadius = cl.gatherRadius;
+	}
+	tracer.scene.photonMap.clear();
+	if (cl.rayDepth >= 0)
+	{
+		tracer.scene.maxRayDepth = cl.rayDepth;
+	}
+	if (cl.aoSamples)
+	{
+		tracer.scene.aoSamples = cl.aoSamples;
+	}
+	if (cl.giDist)
+	{
+		tracer.scene.giMaxDist = cl.giDist;
+	}
+	tracer.scene.fastMath = cl.fastMath;
+
+	if (!tracer.scene.instances.empty())
+	{
+		size_t flattened = 0;
+		size_t shared = tracer.scene.assetMemory(&flattened);
+		printf("%u instances of %u assets: %.2f MB, %.2f MB with a copy per instance\n", u32(tracer.scene.instances.size()),
+			u32(tracer.scene.meshAssets.size() + tracer.scene.sphereAssets.size()), shared / (1024.f * 1024.f), flattened / (1024.f * 1024.f));
+	}
+	return true;
+}
+
+// renders with the command line scene and settings
+inline bool renderHeadless( Tracer& tracer, const CommandLine& cl )
+{
+	tracer.initImage(cl.size);
+	if (!setupScene(tracer, cl))
+	{
+		return false;
+	}
+	tracer.denoiser.enabled = cl.denoise;
+	tracer.aaEnabled = cl.aa;
+
+	Timer timer;
+	tracer.render();
+	printf("rendered %ux%u in %.1f ms (primary %.1f, aa %.1f, denoise %.1f, tonemap %.1f)\n",
+		cl.size.x, cl.size.y, timer.elapsedMs(),
+		tracer.timings.primary, tracer.timings.aa, tracer.timings.denoise, tracer.timings.tonemap);
+	if (tracer.scene.shadingModel == ShadingModel_PathCached && tracer.scene.irradianceCache.enabled)
+	{
+		printf("irradiance cache: %u records, %.2f%% of lookups computed one\n", tracer.scene.irradianceCache.size(),
+			tracer.scene.irradianceCache.missRate() * 100);
+	}
+	if (tracer.scene.shadingModel == ShadingModel_PathGrid)
+	{
+		printf("radiance grid: %u of %u cells\n", tracer.scene.radianceGrid.size(), tracer.scene.radianceGrid.capacity());
+	}
+	if (tracer.scene.shadingModel == ShadingModel_Photon)
+	{
+		const PhotonMap& map = tracer.scene.photonMap;
+		printf("photon map: %u photons stored of %u emitted, %.2f MB, emit %.1f ms, build %.1f ms, gather in primary\n",
+			map.size(), map.emitted, map.memoryUsage() / (1024.f * 1024.f), map.emitMs, map.buildMs);
+	}
+	return true;
+}
+
+// the format comes from --format, else from the output extension, else the default and the extension is added
+inline ExportFormat outputFormat( const CommandLine& cl, const ExportFormat defaultFormat, char* filename, const u32 filenameSize )
+{
+	int format = cl.format;
+	const char* dot = strrchr(cl.output, '.');
+	if (format < 0 && dot)
+	{
+		format = findExportFormat(dot + 1);
+	}
+	if (format < 0)
+	{
+		format = defaultFormat;
+	}
+	if (dot && findExportFormat(dot + 1) == format)
+	{
+		snprintf(filename, filenameSize, "%s", cl.output);
+	}
+	else
+	{
+		snprintf(filename, filenameSize, "%s.%s", cl.output, ExportFormatExtensions[format]);
+	}
+	return ExportFormat(format);
+}
+
+// the whole picture is in memory, indexed with u32
+inline bool fitsInCore( const Vec2u size )
+{
+	if (u64(size.x) * size.y > 0xffffffffu)
+	{
+		fprintf(stderr, "%ux%u is too large to render in memory, use --poster\n", size.x, size.y);
+		return false;
+	}
+	return true;
+}
+
+inline int runBatch( const CommandLine& cl )
+{
+	char filename[300];
+	const ExportFormat format = outputFormat(cl, ExportFormat_PNG, filename, sizeof(filename));
+	if (!fitsInCore(cl.size))
+	{
+		return 1;
+	}
+
+	static Tracer tracer;
+	if (!renderHeadless(tracer, cl))
+	{
+		return 1;
+	}
+
+	Timer timer;
+	if (!writeImage(format, filename, tracer.imageSize, tracer.image, tracer.outputRadiance()))
+	{
+		fprintf(stderr, "failed to write %s\n", filename);
+		return 1;
+	}
+	printf("wrote %s, %ld KB in %.1f ms\n", filename, fileSize(filename) / 1024, timer.elapsedMs());
+	return 0;
+}
+
+// encode time and size of every format, on the same render
+inline int runFormatBenchmark( const CommandLine& cl )
+{
+	if (!fitsInCore(cl.size))
+	{
+		return 1;
+	}
+
+	static Tracer tracer;
+	if (!renderHeadless(tracer, cl))
+	{
+		return 1;
+	}
+
+	const u32 pixelCount = tracer.imageSize.x * tracer.imageSize.y;
+	const f32 imageBytes = pixelCount * sizeof(RGBA);
+
+	printf("%-36s %10s %10s %10s %8s\n", "format", "ms", "MB/s", "KB", "ratio");
+	for (int format = 0; format < ExportFormat_Count; ++format)
+	{
+		char filename[300];
+		snprintf(filename, sizeof(filename), "%s.bench.%s", cl.output, ExportFormatExtensions[format]);
+
+		f32 best = 0;
+		long size = -1;
+		for (u32 run = 0; run < cl.repeat; ++run)
+		{
+			Timer timer;
+			bool ok = writeImage(ExportFormat(format), filename, tracer.imageSize, tracer.image, tracer.outputRadiance());
+			f32 ms = timer.elapsedMs();
+			if (!ok)
+			{
+				break;
+			}
+			best = run == 0 ? ms : std::min(best, ms);
+			size = fileSize(filename);
+		}
+		remove(filename);
+
+		if (size < 0)
+		{
+			printf("%-36s failed\n", ExportFormatNames[format]);
+			continue;
+		}
+		// throughput and ratio are relative to the 8-bit RGBA image, for every format
+		printf("%-36s %10.2f %10.0f %10ld %8.3f\n", ExportFormatNames[format], best,
+			imageBytes / (1024 * 1024) / (best / 1000), size / 1024, size / imageBytes);
+	}
+	return 0;
+}
+
+// Renders a picture of any size into a mapped raw file, one band of rows at a time.
+// Only the band being rendered is in memory, the OS writes finished bands back to disk;
+// file offsets are 64-bit, the tracer only ever sees a band.
+inline int runPoster( const CommandLine& cl )
+{
+	char filename[300];
+	const ExportFormat format = outputFormat(cl, ExportFormat_RawRGBA8, filename, sizeof(filename));
+	if (format != ExportFormat_RawRGBA8 && format != ExportFormat_RawFloat)
+	{
+		fprintf(stderr, "posters are written as %s or %s\n", ExportFormatExtensions[ExportFormat_RawRGBA8], ExportFormatExtensions[ExportFormat_RawFloat]);
+		return 1;
+	}
+
+	static Tracer tracer;
+	if (!setupScene(tracer, cl))
+	{
+		return 1;
+	}
+	tracer.denoiser.enabled = cl.denoise;
+	tracer.aaEnabled = cl.aa;
+
+	// AA compares neighbouring rows and the denoiser filters across them: bands are rendered with
+	// extra rows on both sides, thrown away, so the seams match a render in one go
+	u32 apron = 1;
+	if (tracer.denoiser.enabled)
+	{
+		apron += 2 * ((1u << tracer.denoiser.iterations) - 1);
+	}
+
+	const u32 w = cl.size.x;
+	const u32 h = cl.size.y;
+	const u32 bandRows = std::min(cl.bandRows, h);
+	if (!fitsInCore(Vec2u(w, bandRows + 2 * apron)))
+	{
+		return 1;
+	}
+
+	const u32 channelCount = 4;
+	const u32 bytesPerChannel = format == ExportFormat_RawFloat ? sizeof(f32) : sizeof(u8);
+	const image_write_fast::RawHeader header = image_write_fast::makeRawHeader(w, h, channelCount, bytesPerChannel);
+	const u64 rowBytes = u64(w) * channelCount * bytesPerChannel;
+
+	MappedFile file;
+	if (!file.create(filename, header.dataOffset + rowBytes * h))
+	{
+		fprintf(stderr, "failed to create %s\n", filename);
+		return 1;
+	}
+	MappedFile::View view = file.map(0, sizeof(header));
+	if (!view.data)
+	{
+		fprintf(stderr, "failed to map %s\n", filename);
+		return 1;
+	}
+	memcpy(view.data, &header, sizeof(header));
+	file.unmap(view);
+
+	Timer timer;
+	const u32 bandCount = (h + bandRows - 1) / bandRows;
+	size_t bandMemory = 0;
+	for (u32 band = 0; band < bandCount; ++band)
+	{
+		// rows from the top, [top, bottom) is written, [renderTop, renderBottom) rendered
+		const u32 top = band * bandRows;
+		const u32 bottom = std::min(h, top + bandRows);
+		const u32 renderTop = top > apron ? top - apron : 0;
+		const u32 renderBottom = std::min(h, bottom + apron);
+
+		tracer.initImage(Vec2u(w, renderBottom - renderTop));
+		tracer.setView(cl.size, Vec2u(0, h - renderBottom));
+		tracer.render();
+
+		const size_t bandBytes = size_t((bottom - top) * rowBytes);
+		view = file.map(header.dataOffset + top * rowBytes, bandBytes);
+		if (!view.data)
+		{
+			fprintf(stderr, "\nfailed to map rows %u-%u of %s\n", top, bottom, filename);
+			return 1;
+		}
+		const u32 skip = (top - renderTop) * w;
+		const void* rows = bytesPerChannel == sizeof(f32) ? (const void*)tracer.outputRadiance()[skip].value : (const void*)&tracer.image[skip];
+		memcpy(view.data, rows, bandBytes);
+		file.unmap(view);
+		bandMemory = std::max(bandMemory, tracer.imageMemory());
+
+		printf("\rband %u/%u, %.1f s", band + 1, bandCount, timer.elapsedMs() / 1000);
+		fflush(stdout);
+	}
+	tracer.freeImage();
+
+	printf("\nwrote %s, %ux%u, %.1f MB, %u bands of %u rows (+%u apron), %.1f MB per band in memory\n",
+		filename, w, h, (header.dataOffset + rowBytes * h) / (1024.f * 1024.f),
+		bandCount, bandRows, apron, bandMemory / (1024.f * 1024.f));
+	return 0;
+}
+
+// each stage keeps its best time, the scene description goes with the results so they can be reproduced
+inline int runRenderBenchmark( const CommandLine& cl )
+{
+	static Tracer tracer;
+	tracer.initImage(cl.size);
+	if (!setupScene(tracer, cl))
+	{
+		return 1;
+	}
+	tracer.denoiser.enabled = cl.denoise;
+	tracer.aaEnabled = cl.aa;
+
+	Tracer::Timings best;
+	memset(&best, 0, sizeof(best));
+	for (u32 run = 0; run < cl.repeat; ++run)
+	{
+		tracer.render();
+		const Tracer::Timings& t = tracer.timings;
+		printf("run %u: %.2f ms (primary %.2f, aa %.2f, denoise %.2f, tonemap %.2f)\n", run, t.total, t.primary, t.aa, t.denoise, t.tonemap);
+		if (run == 0)
+		{
+			best = t;
+			continue;
+		}
+		best.primary = std::min(best.primary, t.primary);
+		best.aa = std::min(best.aa, t.aa);
+		best.denoise = std::min(best.denoise, t.denoise);
+		best.tonemap = std::min(best.tonemap, t.tonemap);
+		best.total = std::min(best.total, t.total);
+	}
+
+	printf("scene: %s (%u spheres, %u planes, %u boxes, %llu triangles, %u instances, %u lights)\n", tracer.scene.description.c_str(), u32(tracer.scene.spheres.size()), u32(tracer.scene.planes.size()), u32(tracer.scene.boxes.size()), tracer.scene.triangleCount(), u32(tracer.scene.instances.size()), u32(tracer.scene.lights.size()));
+	printf("image: %ux%u, aa %s, denoise %s, %u workers, %s\n", cl.size.x, cl.size.y, cl.aa ? "on" : "off", cl.denoise ? "on" : "off", workerCount(), CpuIsaNames[cpu_isa()]);
+
+	// bytes per sphere, plane and box in each array: the geometry every ray walks through, the material shading
+	// reads for the one hit, the prim with its name; then the geometry of the whole scene
+	const Scene& scene = tracer.scene;
+	const size_t hotBytes = scene.sphereGeometry.size() * sizeof(SphereGeometry) + scene.planeGeometry.size() * sizeof(PlaneGeometry) + scene.boxGeometry.size() * sizeof(BoxGeometry);
+	printf("prims: geometry sphere %u, plane %u, box %u bytes, material %u, prim %u; %.1f KB read by every ray\n",
+		u32(sizeof(SphereGeometry)), u32(sizeof(PlaneGeometry)), u32(sizeof(BoxGeometry)), u32(sizeof(Material)), u32(sizeof(Prim)), hotBytes / 1024.f);
+	printf("best:  %.2f ms (primary %.2f, aa %.2f, denoise %.2f, tonemap %.2f), %.2f Mrays/s primary\n",
+		best.total, best.primary, best.aa, best.denoise, best.tonemap,
+		cl.size.x * cl.size.y / (best.primary * 1000));
+	if (cl.aa)
+	{
+		printf("aa:    %.1f%% of the pixels refined with %s%s\n", tracer.aaRefinedPercent(), ShadingModelNames[tracer.scene.shadingModel],
+			Scene::isNoisy(tracer.scene.shadingModel) ? ", noisy: prim edges only" : "");
+	}
+	return 0;
+}
+
+// Renders each path tracing technique twice with independent seeds: half the mean squared difference of the
+// two renders is the variance of one, no reference image needed. Variance falls as 1 / time for an unbiased
+// estimator, so variance * time compares the techniques at equal time. Point lights become small sphere
+// lights, BSDF sampling alone never finds them and would converge to another image.
+inline int runVarianceBenchmark( const CommandLine& cl )
+{
+	static Tracer tracer;
+	tracer.initImage(cl.size);
+	if (!setupScene(tracer, cl))
+	{
+		return 1;
+	}
+
+	Scene& scene = tracer.scene;
+	u32 converted = 0;
+	for (u32 i = 0; i < scene.lights.size(); ++i)
+	{
+		if (scene.lights[i].type == LightType_Point)
+		{
+			scene.lights[i].type = LightType_Sphere;
+			scene.lights[i].radius = 0.1f;
+			++converted;
+		}
+	}
+	scene.updateLights();
+
+	printf("scene: %s (%u lights, %u made spheres of radius 0.1)\n", scene.description.c_str(), u32(scene.lights.size()), converted);
+	printf("image: %ux%u, %u paths per pixel, %u workers\n", cl.size.x, cl.size.y, scene.pathSamples, workerCount());
+
+	const ShadingModel models[] = { ShadingModel_PathBsdf, ShadingModel_Path };
+	f32 cost[2];
+	const u32 pixelCount = cl.size.x * cl.size.y;
+	std::vector<Color> first(pixelCount);
+	for (u32 m = 0; m < 2; ++m)
+	{
+		scene.shadingModel = models[m];
+		f32 ms = 0;
+		for (u32 run = 0; run < 2; ++run)
+		{
+			scene.pathSeed = run;
+			Timer timer;
+			tracer.renderPrimary();
+			ms += timer.elapsedMs() / 2;
+			if (run == 0)
+			{
+				first = tracer.frame.radiance;
+			}
+		}
+
+		double squares = 0, sum = 0;
+		for (u32 i = 0; i < pixelCount; ++i)
+		{
+			const Color a = first[i];
+			const Color b = tracer.frame.radiance[i];
+			squares += sq(a.r - b.r) + sq(a.g - b.g) + sq(a.b - b.b);
+			sum += a.r + a.g + a.b + b.r + b.g + b.b;
+		}
+		const f32 variance = f32(squares / (2 * 3 * pixelCount));
+		cost[m] = variance * ms;
+		printf("%-34s %8.1f ms, variance %.4g, mean %.4f\n", ShadingModelNames[models[m]], ms, variance, sum / (6 * pixelCount));
+	}
+	printf("equal-time variance reduction with light sampling: %.1fx\n", cost[1] > 0 ? cost[0] / cost[1] : 0.f);
+	return 0;
+}
+
+// The primary render of every shading model, through the render loop instantiated for the model and the
+// scene's features and through the generic loop switching on the model for every ray, best of --repeat runs
+// each. The caches are cleared before every run so both pay for filling them; the photon map is built once.
+inline int runShadingBenchmark( const CommandLine& cl )
+{
+	static Tracer tracer;
+	tracer.initImage(cl.size);
+	if (!setupScene(tracer, cl))
+	{
+		return 1;
+	}
+
+	Scene& scene = tracer.scene;
+	printf("scene: %s, flat prims %s, specular prims %s\n", scene.description.c_str(), scene.hasFlatPrims() ? "yes" : "no", scene.hasSpecularPrims() ? "yes" : "no");
+	printf("image: %ux%u, %u workers, %s, best of %u runs\n", cl.size.x, cl.size.y, workerCount(), CpuIsaNames[cpu_isa()], cl.repeat);
+	printf("%-34s %12s %12s %8s %10s\n", "model", "switch ms", "special ms", "speedup", "max diff");
+
+	const u32 pixelCount = cl.size.x * cl.size.y;
+	std::vector<Color> generic(pixelCount);
+	for (int m = 0; m < ShadingModel_Count; ++m)
+	{
+		scene.shadingModel = ShadingModel(m);
+		tracer.updatePhotonMap();
+
+		f32 best[2] = { FLT_MAX, FLT_MAX };
+		for (u32 run = 0; run < std::max(cl.repeat, 1u); ++run)
+		{
+			for (u32 specialized = 0; specialized < 2; ++specialized)
+			{
+				scene.irradianceCache.clear();
+				scene.radianceGrid.clear();
+				tracer.specializedShading = specialized != 0;
+				Timer timer;
+				tracer.renderPrimary();
+				best[specialized] = std::min(best[specialized], timer.elapsedMs());
+				if (!specialized)
+				{
+					generic = tracer.frame.radiance;
+				}
+			}
+		}
+
+		f32 maxDiff = 0;
+		for (u32 i = 0; i < pixelCount; ++i)
+		{
+			const Color delta = generic[i] - tracer.frame.radiance[i];
+			maxDiff = std::max(maxDiff, std::max(fabsf(delta.r), std::max(fabsf(delta.g), fabsf(delta.b))));
+		}
+		printf("%-34s %12.2f %12.2f %7.3fx %10.3g\n", ShadingModelNames[m], best[0], best[1], best[1] > 0 ? best[0] / best[1] : 0.f, maxDiff);
+	}
+	tracer.specializedShading = true;
+	return 0;
+}
+
+// The primary render of every shading model with exact and with approximate square roots and reciprocals,
+// best of --repeat runs each, and how far apart the two images are: the largest channel difference, the pixels
+// off by more than one 8-bit step, the PSNR of the radiance clamped to [0, 1] and the shift of the mean.
+// Hits at silhouettes and where prims meet may flip to the neighbour, the other pixels move by about 1e-5. The samplers are seeded from the hit positions,
+// so the models drawing random rays get other noise from the slightly moved hits: their PSNR is the noise's,
+// the mean shift tells whether the estimate moved.
+inline int runFastMathBenchmark( const CommandLine& cl )
+{
+	static Tracer tracer;
+	tracer.initImage(cl.size);
+	if (!setupScene(tracer, cl))
+	{
+		return 1;
+	}
+
+	Scene& scene = tracer.scene;
+	printf("scene: %s\n", scene.description.c_str());
+	printf("image: %ux%u, %u workers, %s, best of %u runs\n", cl.size.x, cl.size.y, workerCount(), CpuIsaNames[cpu_isa()], cl.repeat);
+	printf("%-34s %10s %10s %8s %10s %10s %9s %11s\n", "model", "exact ms", "fast ms", "speedup", "max diff", "px > 1/255", "PSNR dB", "mean shift");
+
+	const u32 pixelCount = cl.size.x * cl.size.y;
+	std::vector<Color> exact(pixelCount);
+	for (int m = 0; m < ShadingModel_Count; ++m)
+	{
+		scene.shadingModel = ShadingModel(m);
+
+		f32 best[2] = { FLT_MAX, FLT_MAX };
+		for (u32 run = 0; run < std::max(cl.repeat, 1u); ++run)
+		{
+			for (u32 fast = 0; fast < 2; ++fast)
+			{
+				scene.fastMath = fast != 0;
+				scene.irradianceCache.clear();
+				scene.radianceGrid.clear();
+				scene.photonMap.clear();
+				tracer.updatePhotonMap();
+				Timer timer;
+				tracer.renderPrimary();
+				best[fast] = std::min(best[fast], timer.elapsedMs());
+				if (!fast)
+				{
+					exact = tracer.frame.radiance;
+				}
+			}
+		}
+
+		f32 maxDiff = 0;
+		u32 visible = 0;
+		double squares = 0, shift = 0;
+		for (u32 i = 0; i < pixelCount; ++i)
+		{
+			const Color a = exact[i];
+			const Color b = tracer.frame.radiance[i];
+			const Color delta = a - b;
+			const f32 diff = std::max(fabsf(delta.r), std::max(fabsf(delta.g), fabsf(delta.b)));
+			maxDiff = std::max(maxDiff, diff);
+			visible += diff > 1 / 255.f;
+			squares += sq(clamp(0, 1, a.r) - clamp(0, 1, b.r)) + sq(clamp(0, 1, a.g) - clamp(0, 1, b.g)) + sq(clamp(0, 1, a.b) - clamp(0, 1, b.b));
+			shift += delta.r + delta.g + delta.b;
+		}
+		const double mse = squares / (3 * pixelCount);
+		const double psnr = mse > 0 ? -10 * log10(mse) : INFINITY;
+		printf("%-34s %10.2f %10.2f %7.3fx %10.3g %10u %9.1f %11.2g\n", ShadingModelNames[m], best[0], best[1], best[1] > 0 ? best[0] / best[1] : 0.f,
+			maxDiff, visible, psnr, shift / (3 * pixelCount));
+	}
+	scene.fastMath = cl.fastMath;
+	return 0;
+}
+
+// The two compound expressions of every bounce, reflect and Ray::at, written with the Vector3 operators
+// (a temporary per operator) and with the fused madd/msub, over the same random rays, best of --repeat runs. Whether the temporaries cost
+// anything depends on the compiler folding them: compare the builds. Without FMA the results must match bit for bit. With it (make FMA=1)
+// they differ by the rounding of the product, reported relative to the magnitude of the result; GCC fuses the operator form too unless
+// built with -ffp-contract=off, madd/msub are fused whatever the contraction setting.
+inline int runVectorBenchmark( const CommandLine& cl )
+{
+	const u32 count = 1 << 20;
+	std::vector<Ray> rays(count);
+	std::vector<Vec3f> normals(count);
+	std::vector<f32> dists(count);
+	Random random(1);
+	for (u32 i = 0; i < count; ++i)
+	{
+		rays[i].pos = Vec3f(random.uniform(-4, 4), random.uniform(0, 8), random.uniform(-4, 4));
+		rays[i].dir = Vec3f(random.uniform(-1, 1), random.uniform(-1, 1), random.uniform(0.1f, 1)).normalized();
+		normals[i] = Vec3f(random.uniform(-1, 1), random.uniform(0.1f, 1), random.uniform(-1, 1)).normalized();
+		dists[i] = random.uniform(0, 10);
+	}
+
+	// both read and write every element, so neither loop can be dropped
+	std::vector<Vec3f> out[2] = { std::vector<Vec3f>(count), std::vector<Vec3f>(count) };
+	f32 best[2][2] = { { FLT_MAX, FLT_MAX }, { FLT_MAX, FLT_MAX } };
+	for (u32 run = 0; run < std::max(cl.repeat, 1u); ++run)
+	{
+		// the forms take turns at going first
+		for (u32 pass = 0; pass < 2; ++pass)
+		{
+			const u32 fused = pass ^ (run & 1);
+			Vec3f* result = &out[fused][0];
+			Timer timer;
+			if (fused)
+			{
+				for (u32 i = 0; i < count; ++i)
+				{
+					const Vec3f& dir = rays[i].dir;
+					result[i] = dir.msub(normals[i], 2.f * dir.dot(normals[i]));
+				}
+			}
+			else
+			{
+				for (u32 i = 0; i < count; ++i)
+				{
+					const Vec3f& dir = rays[i].dir;
+					const Vec3f& normal = normals[i];
+					result[i] = dir - normal * (2.f * dir.dot(normal));
+				}
+			}
+			best[0][fused] = std::min(best[0][fused], timer.elapsedMs());
+
+			timer.reset();
+			if (fused)
+			{
+				for (u32 i = 0; i < count; ++i)
+				{
+					result[i] = rays[i].pos.madd(rays[i].dir, dists[i]) + result[i];
+				}
+			}
+			else
+			{
+				for (u32 i = 0; i < count; ++i)
+				{
+					result[i] = rays[i].pos + rays[i].dir * dists[i] + result[i];
+				}
+			}
+			best[1][fused] = std::min(best[1][fused], timer.elapsedMs());
+		}
+	}
+
+#ifdef PT_VECTOR_FMA
+	// one rounding less, a few ulp of the operands at most
+	f32 maxError = 0;
+	for (u32 i = 0; i < count; ++i)
+	{
+		maxError = std::max(maxError, (out[1][i] - out[0][i]).mag() / std::max(out[0][i].mag(), 1e-6f));
+	}
+	const bool same = maxError < 1e-5f;
+	printf("%u rays, best of %u runs, fused with FMA, max relative difference %.3g\n", count, std::max(cl.repeat, 1u), maxError);
+#else
+	const bool same = memcmp(&out[0][0], &out[1][0], count * sizeof(Vec3f)) == 0;
+	printf("%u rays, best of %u runs, results %s\n", count, std::max(cl.repeat, 1u), same ? "identical" : "DIFFER");
+#endif
+	printf("%-10s %12s %12s %8s\n", "", "operators ns", "fused ns", "speedup");
+	const char* names[] = { "reflect", "Ray::at" };
+	for (u32 e = 0; e < 2; ++e)
+	{
+		printf("%-10s %12.3f %12.3f %7.3fx\n", names[e], best[e][0] * 1e6f / count, best[e][1] * 1e6f / count, best[e][1] > 0 ? best[e][0] / best[e][1] : 0.f);
+	}
+	return same ? 0 : 1;
+}
+
+inline int runConvert( const CommandLine& cl )
+{
+	static Tracer tracer;
+	if (!setupScene(tracer, cl))
+	{
+		return 1;
+	}
+
+	Timer timer;
+	if (!saveScene(cl.output, tracer.scene))
+	{
+		fprintf(stderr, "failed to write %s\n", cl.output);
+		return 1;
+	}
+	printf("wrote %s, %ld KB in %.1f ms\n", cl.output, fileSize(cl.output) / 1024, timer.elapsedMs());
+	return 0;
+}
+
+// the exit code of a headless mode, or -1 to open the window with the settings in cl
+inline int runCommandLine( int argc, char** argv, CommandLine& cl )
+{
+	if (!parseCommandLine(argc, argv, cl))
+	{
+		return 1;
+	}
+
+	// before any scene is built, the mesh leaves follow the kernels
+	if (cl.isa >= 0 && set_cpu_isa(CpuIsa(cl.isa)) != cl.isa)
+	{
+		fprintf(stderr, "%s is not available, using %s\n", CpuIsaNames[cl.isa], CpuIsaNames[cpu_isa()]);
+	}
+
+	switch (cl.mode)
+	{
+		case CommandLine::Mode_Gui:
+			return -1;
+		case CommandLine::Mode_Batch:
+			return runBatch(cl);
+		case CommandLine::Mode_BenchFormats:
+			return runFormatBenchmark(cl);
+		case CommandLine::Mode_Poster:
+			return runPoster(cl);
+		case CommandLine::Mode_Convert:
+			return runConvert(cl);
+		case CommandLine::Mode_BenchRender:
+			return runRenderBenchmark(cl);
+		case CommandLine::Mode_BenchVariance:
+			return runVarianceBenchmark(cl);
+		case CommandLine::Mode_BenchShading:
+			return runShadingBenchmark(cl);
+		case CommandLine::Mode_BenchFastMath:
+			return runFastMathBenchmark(cl);
+		case CommandLine::Mode_BenchVector:
+			return runVectorBenchmark(cl);
+	}
+	return -1;
+}
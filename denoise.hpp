@@ -0,0 +1,217 @@
+#pragma once
+
+#include <xmmintrin.h>
+#include <vector>
+#include <string.h>
+
+#include "parallel.hpp"
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010)
+// a 5x5 B3-spline kernel dilated by 2^i at iteration i, each tap weighted down
+// across color, normal, depth and albedo discontinuities of the primary hits
+class Denoiser
+{
+public:
+	bool enabled;
+	u32 iterations;
+	f32 sigmaColor;
+	f32 sigmaNormal;
+	f32 sigmaDepth;
+	f32 sigmaAlbedo;
+
+	Denoiser()
+		: enabled(false)
+		, iterations(4)
+		, sigmaColor(0.5f)
+		, sigmaNormal(32)
+		, sigmaDepth(0.5f)
+		, sigmaAlbedo(0.1f)
+	{
+	}
+
+	// filters radiance into output and leaves radiance untouched, guides are indexed like radiance
+	// pixels with depth == FLT_MAX are background and copied as they are
+	void apply( const Vec2u size, const Color* radiance, Color* output, const Vec3f* normals, const f32* depths, const Color* albedos )
+	{
+		const u32 pixelCount = size.x * size.y;
+		scratch.resize(pixelCount);
+
+		const Color* src = radiance;
+
+		for (u32 i = 0; i < iterations; ++i)
+		{
+			// ping-pong between scratch and output so that the last pass lands in output
+			Color* dst = (iterations - 1 - i) % 2 == 0 ? output : &scratch[0];
+
+			Pass pass;
+			pass.size = size;
+			pass.step = 1 << i;
+			// color differences shrink as the image gets smoother, tighten the color sigma accordingly
+			f32 sigmaColor_i = sigmaColor / (1 << i);
+			pass.invSigmaColor2 = 1.f / std::max(sigmaColor_i * sigmaColor_i, 1e-8f);
+			pass.sigmaNormal = sigmaNormal;
+			pass.invSigmaDepth = 1.f / std::max(sigmaDepth * pass.step, 1e-8f);
+			pass.invSigmaAlbedo2 = 1.f / std::max(sigmaAlbedo * sigmaAlbedo, 1e-8f);
+			pass.src = src;
+			pass.dst = dst;
+			pass.normals = normals;
+			pass.depths = depths;
+			pass.albedos = albedos;
+
+			parallelFor(size.y, 8, [&]( u32 begin, u32 end )
+			{
+				for (u32 row = begin; row < end; ++row)
+				{
+					filterRow(pass, row);
+				}
+			});
+
+			src = dst;
+		}
+	}
+
+	bool onGui()
+	{
+		bool changed = false;
+
+		ImGui::BeginProperty("Denoise");
+		changed |= ImGui::Checkbox("", &enabled);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		if (!enabled)
+		{
+			return changed;
+		}
+
+		ImGui::BeginProperty("Iterations");
+		changed |= ImGui::SliderInt("", (int*)&iterations, 1, 6);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Sigma color");
+		changed |= ImGui::DragFloat("", &sigmaColor, 0.01f, 0.001f, 10.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Sigma normal");
+		changed |= ImGui::DragFloat("", &sigmaNormal, 1.f, 0.f, 256.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Sigma depth");
+		changed |= ImGui::DragFloat("", &sigmaDepth, 0.01f, 0.001f, 10.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Sigma albedo");
+		changed |= ImGui::DragFloat("", &sigmaAlbedo, 0.01f, 0.001f, 10.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		return changed;
+	}
+
+	size_t memoryUsage() const
+	{
+		return scratch.capacity() * sizeof(Color);
+	}
+
+private:
+	std::vector<Color> scratch;
+
+	struct Pass
+	{
+		Vec2u size;
+		i32 step;
+		f32 invSigmaColor2;
+		f32 sigmaNormal;
+		f32 invSigmaDepth;
+		f32 invSigmaAlbedo2;
+		const Color* src;
+		Color* dst;
+		const Vec3f* normals;
+		const f32* depths;
+		const Color* albedos;
+	};
+
+	static f32 hsum( __m128 v )
+	{
+		__m128 high = _mm_movehl_ps(v, v);
+		__m128 sum2 = _mm_add_ps(v, high);
+		__m128 sum1 = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1));
+		return _mm_cvtss_f32(sum1);
+	}
+
+	static void filterRow( const Pass& pass, const u32 row )
+	{
+		static const f32 kernel[5] = { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+
+		const i32 width = pass.size.x;
+		const i32 height = pass.size.y;
+
+		for (i32 x = 0; x < width; ++x)
+		{
+			const u32 p = x + row * width;
+			if (pass.depths[p] == FLT_MAX)
+			{
+				pass.dst[p] = pass.src[p];
+				continue;
+			}
+
+			const __m128 colorP = _mm_loadu_ps(pass.src[p].value);
+			const __m128 normalP = _mm_loadu_ps(pass.normals[p].value);
+			const __m128 albedoP = _mm_loadu_ps(pass.albedos[p].value);
+			const f32 depthP = pass.depths[p];
+
+			__m128 sum = _mm_setzero_ps();
+			f32 weightSum = 0;
+
+			for (i32 ky = 0; ky < 5; ++ky)
+			{
+				i32 y = i32(row) + (ky - 2) * pass.step;
+				if (y < 0 || y >= height)
+				{
+					continue;
+				}
+
+				for (i32 kx = 0; kx < 5; ++kx)
+				{
+					i32 qx = x + (kx - 2) * pass.step;
+					if (qx < 0 || qx >= width)
+					{
+						continue;
+					}
+
+					const u32 q = qx + y * width;
+					const __m128 colorQ = _mm_loadu_ps(pass.src[q].value);
+
+					f32 weight = kernel[kx] * kernel[ky];
+					if (q != p)
+					{
+						const f32 normalDot = hsum(_mm_mul_ps(normalP, _mm_loadu_ps(pass.normals[q].value)));
+						if (normalDot <= 0)
+						{
+							continue;
+						}
+
+						const __m128 colorDelta = _mm_sub_ps(colorP, colorQ);
+						const __m128 albedoDelta = _mm_sub_ps(albedoP, _mm_loadu_ps(pass.albedos[q].value));
+
+						// all edge stopping functions are exponentials, so they share a single exp
+						f32 exponent = hsum(_mm_mul_ps(colorDelta, colorDelta)) * pass.invSigmaColor2;
+						exponent += (1 - normalDot) * pass.sigmaNormal;
+						exponent += fabsf(depthP - pass.depths[q]) * pass.invSigmaDepth;
+						exponent += hsum(_mm_mul_ps(albedoDelta, albedoDelta)) * pass.invSigmaAlbedo2;
+						weight *= expf(-exponent);
+					}
+
+					sum = _mm_add_ps(sum, _mm_mul_ps(colorQ, _mm_set1_ps(weight)));
+					weightSum += weight;
+				}
+			}
+
+			_mm_storeu_ps(pass.dst[p].value, _mm_div_ps(sum, _mm_set1_ps(weightSum)));
+		}
+	}
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#include "math/png_stream.h"
+#include "math/image_write_fast.h"
+
+enum ExportFormat
+{
+	ExportFormat_PNG,
+	ExportFormat_HDR,
+	ExportFormat_BMP,
+	ExportFormat_TGA,
+	ExportFormat_PPM,
+	ExportFormat_PFM,
+	ExportFormat_QOI,
+	ExportFormat_RawRGBA8,
+	ExportFormat_RawFloat,
+};
+static const char* ExportFormatNames[] = { "PNG", "HDR (linear radiance)", "BMP", "TGA", "PPM", "PFM (linear radiance)", "QOI", "Raw RGBA8 (mapped)", "Raw float (mapped, linear radiance)" };
+static const char* ExportFormatExtensions[] = { "png", "hdr", "bmp", "tga", "ppm", "pfm", "qoi", "raw", "rawf" };
+static const int ExportFormat_Count = sizeof(ExportFormatNames) / sizeof(ExportFormatNames[0]);
+
+// float formats are written from the radiance buffer, before tonemapping
+inline bool exportsRadiance( const ExportFormat format )
+{
+	return format == ExportFormat_HDR || format == ExportFormat_PFM || format == ExportFormat_RawFloat;
+}
+
+// by extension, -1 if unknown
+inline int findExportFormat( const char* extension )
+{
+	for (int i = 0; i < ExportFormat_Count; ++i)
+	{
+		if (strcmp(extension, ExportFormatExtensions[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// synchronous, only the buffer matching the format is read
+// rowsDone is only updated by the streaming PNG writer, other formats are done in one go
+inline bool writeImage( const ExportFormat format, const char* filename, const Vec2u size, const RGBA* image, const Color* radiance, std::atomic<int>* rowsDone = NULL )
+{
+	const u32 channelCount = 4;
+	const int w = size.x;
+	const int h = size.y;
+	const int stride = w * channelCount;
+
+	switch (format)
+	{
+		case ExportFormat_PNG:
+			return png_stream::writePng(filename, w, h, channelCount, image, stride, rowsDone);
+		case ExportFormat_HDR:
+			return stbi_write_hdr(filename, w, h, channelCount, radiance[0].value) != 0;
+		case ExportFormat_BMP:
+			return stbi_write_bmp(filename, w, h, channelCount, image) != 0;
+		case ExportFormat_TGA:
+			return stbi_write_tga(filename, w, h, channelCount, image) != 0;
+		case ExportFormat_PPM:
+			return image_write_fast::writePpm(filename, w, h, channelCount, image, stride);
+		case ExportFormat_PFM:
+			return image_write_fast::writePfm(filename, w, h, channelCount, radiance[0].value);
+		case ExportFormat_QOI:
+			return image_write_fast::writeQoi(filename, w, h, channelCount, image, stride);
+		case ExportFormat_RawRGBA8:
+			return image_write_fast::writeRaw(filename, w, h, channelCount, sizeof(u8), image);
+		case ExportFormat_RawFloat:
+			return image_write_fast::writeRaw(filename, w, h, channelCount, sizeof(f32), radiance[0].value);
+	}
+	return false;
+}
+
+inline long fileSize( const char* filename )
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+	{
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return size;
+}
+
+// Writes the image to disk on a worker thread, from a snapshot taken when the export starts,
+// so the GUI keeps running and the tracer is free to overwrite its buffers.
+class Exporter
+{
+public:
+	char basename[256];		// the extension comes from the format
+	ExportFormat format;
+
+	Exporter()
+		: format(ExportFormat_PNG)
+		, busy(false)
+		, rowsDone(0)
+		, rowCount(0)
+	{
+		strcpy(basename, "out");
+		lastResult[0] = 0;
+	}
+	~Exporter()
+	{
+		wait();
+	}
+
+	// false if an export is already running
+	bool start( const RGBA* image, const Color* radiance, const Vec2u size )
+	{
+		if (busy)
+		{
+			return false;
+		}
+		wait();
+
+		snapshotSize = size;
+		snapshotFormat = format;
+		u32 pixelCount = size.x * size.y;
+		if (exportsRadiance(format))
+		{
+			radianceSnapshot.assign(radiance, radiance + pixelCount);
+		}
+		else
+		{
+			imageSnapshot.assign(image, image + pixelCount);
+		}
+		snprintf(filename, sizeof(filename), "%s.%s", basename, ExportFormatExtensions[format]);
+
+		rowCount = size.y;
+		rowsDone = 0;
+		busy = true;
+		worker = std::thread(&Exporter::run, this);
+		return true;
+	}
+
+	void wait()
+	{
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+	}
+
+	bool isBusy() const
+	{
+		return busy;
+	}
+
+	f32 progress() const
+	{
+		return rowCount ? f32(rowsDone) / rowCount : 0.f;
+	}
+
+	// returns true when an export is requested
+	bool onGui()
+	{
+		ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2,2));
+		ImGui::Columns(2);
+		ImGui::Separator();
+
+		ImGui::BeginProperty("Export name");
+		ImGui::InputText("", basename, sizeof(basename));
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Export format");
+		ImGui::Combo("", (int*)&format, ExportFormatNames, ExportFormat_Count);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::Columns(1);
+		ImGui::Separator();
+		ImGui::PopStyleVar();
+
+		bool requested = false;
+		if (busy)
+		{
+			char overlay[300];
+			snprintf(overlay, sizeof(overlay), "%s %d%%", filename, int(progress() * 100));
+			ImGui::ProgressBar(progress(), ImVec2(-1, 0), overlay);
+		}
+		else
+		{
+			requested = ImGui::Button("Export");
+			if (lastResult[0])
+			{
+				ImGui::SameLine();
+				ImGui::Text("%s", lastResult);
+			}
+		}
+		return requested;
+	}
+
+private:
+	std::thread worker;
+	std::atomic<bool> busy;
+	std::atomic<int> rowsDone;
+	int rowCount;
+
+	char filename[300];
+	char lastResult[400];
+	Vec2u snapshotSize;
+	ExportFormat snapshotFormat;
+	std::vector<RGBA> imageSnapshot;
+	std::vector<Color> radianceSnapshot;
+
+	void run()
+	{
+		Timer timer;
+
+		bool ok = writeImage(snapshotFormat, filename, snapshotSize,
+			imageSnapshot.empty() ? NULL : &imageSnapshot[0],
+			radianceSnapshot.empty() ? NULL : &radianceSnapshot[0],
+			&rowsDone);
+		rowsDone = rowCount;
+
+		if (ok)
+		{
+			snprintf(lastResult, sizeof(lastResult), "wrote %s, %ld KB in %.0f ms", filename, fileSize(filename) / 1024, timer.elapsedMs());
+		}
+		else
+		{
+			snprintf(lastResult, sizeof(lastResult), "failed to write %s", filename);
+		}
+
+		// snapshots are only needed while encoding
+		std::vector<RGBA>().swap(imageSnapshot);
+		std::vector<Color>().swap(radianceSnapshot);
+
+		busy = false;
+	}
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+
+// per-pixel primary samples, indexed like the RGBA image
+// prim/pos/normal/depth/albedo describe the primary hit, depth is FLT_MAX for background pixels
+class FrameBuffer
+{
+public:
+	std::vector<Color> radiance;
+	std::vector<const Prim*> prim;
+	std::vector<Vec3f> pos;
+	std::vector<Vec3f> normal;
+	std::vector<f32> depth;
+	std::vector<Color> albedo;
+
+	u32 size() const
+	{
+		return u32(radiance.size());
+	}
+
+	void resize( const u32 pixelCount )
+	{
+		radiance.resize(pixelCount);
+		prim.resize(pixelCount);
+		pos.resize(pixelCount);
+		normal.resize(pixelCount);
+		depth.resize(pixelCount);
+		albedo.resize(pixelCount);
+	}
+
+	size_t memoryUsage() const
+	{
+		return (radiance.capacity() + albedo.capacity()) * sizeof(Color)
+			+ prim.capacity() * sizeof(const Prim*)
+			+ (pos.capacity() + normal.capacity()) * sizeof(Vec3f)
+			+ depth.capacity() * sizeof(f32);
+	}
+
+	void swap( FrameBuffer& other )
+	{
+		radiance.swap(other.radiance);
+		prim.swap(other.prim);
+		pos.swap(other.pos);
+		normal.swap(other.normal);
+		depth.swap(other.depth);
+		albedo.swap(other.albedo);
+	}
+
+	void setSample( const u32 i, const Color& color, const Scene::Hit& hit, const Scene& scene )
+	{
+		radiance[i] = color;
+		prim[i] = hit.prim;
+
+		if (hit)
+		{
+			pos[i] = hit.pos;
+			normal[i] = hit.normal;
+			depth[i] = hit.dist;
+			albedo[i] = scene.materials[hit.material].color;
+		}
+		else
+		{
+			pos[i] = Vec3f(0);
+			normal[i] = Vec3f(0);
+			depth[i] = FLT_MAX;
+			albedo[i] = Color(0);
+		}
+	}
+
+	void copySample( const u32 i, const FrameBuffer& src, const u32 iSrc )
+	{
+		radiance[i] = src.radiance[iSrc];
+		prim[i] = src.prim[iSrc];
+		pos[i] = src.pos[iSrc];
+		normal[i] = src.normal[iSrc];
+		depth[i] = src.depth[iSrc];
+		albedo[i] = src.albedo[iSrc];
+	}
+};
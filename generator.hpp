@@ -0,0 +1,357 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include "math/random.h"
+
+enum SceneLayout
+{
+	SceneLayout_Uniform,
+	SceneLayout_Clustered,
+	SceneLayout_Sphereflake,
+	SceneLayout_Instanced,
+};
+static const char* SceneLayoutNames[] = { "Uniform", "Clustered", "Sphereflake", "Instanced" };
+static const char* SceneLayoutKeys[] = { "uniform", "clustered", "sphereflake", "instanced" };
+static const int SceneLayout_Count = sizeof(SceneLayoutNames) / sizeof(SceneLayoutNames[0]);
+
+// by command line key, -1 if unknown
+inline int findSceneLayout( const char* key )
+{
+	for (int i = 0; i < SceneLayout_Count; ++i)
+	{
+		if (strcmp(key, SceneLayoutKeys[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Fills a scene with 'count' spheres for scaling tests, inside the room of the built-in scene.
+// The instanced layout places 'count' instances of one small sphereflake instead.
+// One light is the point light of the built-in scene, more are small colored sphere lights sharing its power.
+// Layout, count and seed fully determine the scene: the description records them, and the
+// same description gives the same scene on every machine.
+class SceneGenerator
+{
+public:
+	SceneLayout layout;
+	u32 count;
+	u32 seed;
+	u32 lightCount;
+
+	SceneGenerator()
+		: layout(SceneLayout_Uniform)
+		, count(1000)
+		, seed(1)
+		, lightCount(1)
+	{
+	}
+
+	void generate( Scene& scene ) const
+	{
+		Random random(seed);
+
+		scene.camPos = Vec3f(0, 3, -8);
+		generateLights(scene);
+
+		scene.clearPrims();
+		scene.addPlane("bottom", PlaneGeometry(AxisY, -0.0001f), white);
+		scene.addPlane("top", PlaneGeometry(AxisY, +6), white);
+		scene.addPlane("back", PlaneGeometry(AxisZ, +4), white);
+		scene.addPlane("left", PlaneGeometry(AxisX, -4), red);
+		scene.addPlane("right", PlaneGeometry(AxisX, +4), green);
+
+		scene.sphereGeometry.reserve(layout == SceneLayout_Instanced ? 0 : count);
+		scene.spheres.reserve(layout == SceneLayout_Instanced ? 0 : count);
+		scene.materials.reserve(scene.materials.size() + count);
+		switch (layout)
+		{
+			case SceneLayout_Uniform:
+				generateUniform(scene, random);
+				break;
+			case SceneLayout_Clustered:
+				generateClustered(scene, random);
+				break;
+			case SceneLayout_Sphereflake:
+				generateSphereflake(scene, random);
+				break;
+			case SceneLayout_Instanced:
+				generateInstanced(scene, random);
+				break;
+		}
+
+		nameItems(scene);
+		scene.updateLights();
+		scene.updateInstances();
+		scene.description = describe();
+	}
+
+	std::string describe() const
+	{
+		char text[128];
+		int length = snprintf(text, sizeof(text), "generated %s, %u %s, seed %u", SceneLayoutKeys[layout], count,
+			layout == SceneLayout_Instanced ? "instances" : "spheres", seed);
+		if (lightCount > 1)
+		{
+			snprintf(text + length, sizeof(text) - length, ", %u lights", lightCount);
+		}
+		return text;
+	}
+
+	// returns true when a new scene is requested
+	bool onGui()
+	{
+		ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2,2));
+		ImGui::Columns(2);
+		ImGui::Separator();
+
+		ImGui::BeginProperty("Generator");
+		ImGui::Combo("", (int*)&layout, SceneLayoutNames, SceneLayout_Count);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Sphere count");
+		ImGui::DragInt("", (int*)&count, 10.f, 1, 10000000);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Seed");
+		ImGui::DragInt("", (int*)&seed, 1.f, 0, 0x7fffffff);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Light count");
+		ImGui::DragInt("", (int*)&lightCount, 1.f, 1, 100000);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::Columns(1);
+		ImGui::Separator();
+		ImGui::PopStyleVar();
+
+		count = std::max(count, 1u);
+		lightCount = std::max(lightCount, 1u);
+		return ImGui::Button("Generate");
+	}
+
+private:
+	// the spheres go inside the room, in front of the back wall
+	static Vec3f roomMin() { return Vec3f(-4, 0, -4); }
+	static Vec3f roomMax() { return Vec3f(4, 6, 4); }
+
+	// radius giving a similar fill ratio whatever the count
+	f32 radiusFor( const u32 n ) const
+	{
+		Vec3f extent = roomMax() - roomMin();
+		f32 volume = extent.x * extent.y * extent.z;
+		return 0.3f * cbrtf(volume / std::max(n, 1u));
+	}
+
+	static Color randomColor( Random& random )
+	{
+		return Color(random.uniform(0.2f, 1.f), random.uniform(0.2f, 1.f), random.uniform(0.2f, 1.f), 1);
+	}
+
+	static Vec3f clampToRoom( const Vec3f p, const f32 margin )
+	{
+		return Vec3f(
+			clamp(roomMin().x + margin, roomMax().x - margin, p.x),
+			clamp(roomMin().y + margin, roomMax().y - margin, p.y),
+			clamp(roomMin().z + margin, roomMax().z - margin, p.z));
+	}
+
+	// lights have their own random sequence, adding some doesn't move the spheres
+	void generateLights( Scene& scene ) const
+	{
+		scene.lights.clear();
+		if (lightCount <= 1)
+		{
+			scene.lights.push_back(Light(NULL, LightType_Point, Vec3f(0, 3, 0), white, 1));
+			return;
+		}
+
+		Random random(seed, 1);
+		const Vec3f lo = Vec3f(roomMin().x, 3, roomMin().z) + Vec3f(0.5f);
+		const Vec3f hi = roomMax() - Vec3f(0.5f);
+		scene.lights.reserve(lightCount);
+		for (u32 i = 0; i < lightCount; ++i)
+		{
+			Vec3f pos(random.uniform(lo.x, hi.x), random.uniform(lo.y, hi.y), random.uniform(lo.z, hi.z));
+			scene.lights.push_back(Light(NULL, LightType_Sphere, pos, randomColor(random), 1));
+			scene.lights.back().radius = 0.15f;
+		}
+
+		// as bright as the single white light all together
+		f32 power = 0;
+		for (u32 i = 0; i < lightCount; ++i)
+		{
+			power += scene.lights[i].power();
+		}
+		for (u32 i = 0; i < lightCount; ++i)
+		{
+			scene.lights[i].intensity = 1 / power;
+		}
+	}
+
+	void generateUniform( Scene& scene, Random& random ) const
+	{
+		const f32 radius = radiusFor(count);
+		const Vec3f lo = roomMin() + Vec3f(radius);
+		const Vec3f hi = roomMax() - Vec3f(radius);
+		for (u32 i = 0; i < count; ++i)
+		{
+			Vec3f pos(random.uniform(lo.x, hi.x), random.uniform(lo.y, hi.y), random.uniform(lo.z, hi.z));
+			scene.addSphere(NULL, SphereGeometry(pos, radius), randomColor(random));
+		}
+	}
+
+	// gaussian blobs around ~sqrt(count) centers, one color per cluster
+	void generateClustered( Scene& scene, Random& random ) const
+	{
+		const u32 clusterCount = std::max(1u, u32(sqrtf(f32(count)) / 2));
+		const f32 radius = radiusFor(count) * 0.5f;
+		const f32 spread = radiusFor(clusterCount) * 0.5f;
+
+		std::vector<Vec3f> centers(clusterCount);
+		std::vector<Color> colors(clusterCount);
+		for (u32 c = 0; c < clusterCount; ++c)
+		{
+			centers[c] = Vec3f(random.uniform(roomMin().x, roomMax().x), random.uniform(roomMin().y, roomMax().y), random.uniform(roomMin().z, roomMax().z));
+			colors[c] = randomColor(random);
+		}
+
+		for (u32 i = 0; i < count; ++i)
+		{
+			u32 c = random.index(clusterCount);
+			Vec3f offset(random.normal(), random.normal(), random.normal());
+			Vec3f pos = clampToRoom(centers[c] + offset * spread, radius);
+			scene.addSphere(NULL, SphereGeometry(pos, radius), colors[c]);
+		}
+	}
+
+	struct FlakeSphere
+	{
+		Vec3f pos;
+		Vec3f axis;		// away from the parent
+		f32 radius;
+	};
+
+	// Haines' sphereflake: every sphere carries 9 spheres a third of its size, 6 around its
+	// equator and 3 on top, built breadth first until 'count' spheres
+	static void buildSphereflake( const Vec3f pos, const f32 radius, const u32 count, std::vector<FlakeSphere>& nodes )
+	{
+		nodes.clear();
+		nodes.reserve(count);
+		FlakeSphere root = { pos, Vec3f(0, 1, 0), radius };
+		nodes.push_back(root);
+
+		for (u32 i = 0; nodes.size() < count; ++i)
+		{
+			const FlakeSphere parent = nodes[i];
+
+			// basis around the parent axis
+			Vec3f tangent, bitangent;
+			makeBasis(parent.axis, tangent, bitangent);
+
+			for (u32 k = 0; k < 9 && nodes.size() < count; ++k)
+			{
+				// 6 at 90 degrees from the axis, 3 at 35
+				f32 elevation = k < 6 ? 1.5707964f : 0.6108652f;
+				f32 azimuth = k < 6 ? k * 1.0471976f : (k - 6) * 2.0943952f + 0.5235988f;
+				Vec3f dir = (tangent * cosf(azimuth) + bitangent * sinf(azimuth)) * sinf(elevation) + parent.axis * cosf(elevation);
+
+				FlakeSphere child;
+				child.radius = parent.radius / 3;
+				child.pos = parent.pos + dir * (parent.radius + child.radius);
+				child.axis = dir;
+				nodes.push_back(child);
+			}
+		}
+	}
+
+	// the seed only picks colors
+	void generateSphereflake( Scene& scene, Random& random ) const
+	{
+		std::vector<FlakeSphere> nodes;
+		buildSphereflake(Vec3f(0, 2.5f, 0), 1.5f, count, nodes);
+		const FlakeSphere& root = nodes[0];
+
+		// one color per level
+		Color levelColor = randomColor(random);
+		f32 levelRadius = root.radius;
+		for (u32 i = 0; i < nodes.size(); ++i)
+		{
+			if (nodes[i].radius < levelRadius)
+			{
+				levelRadius = nodes[i].radius;
+				levelColor = randomColor(random);
+			}
+			scene.addSphere(NULL, SphereGeometry(nodes[i].pos, nodes[i].radius), levelColor);
+		}
+	}
+
+	// one sphereflake of two levels (91 spheres, about 2 units wide) instanced all over the room
+	void generateInstanced( Scene& scene, Random& random ) const
+	{
+		std::vector<FlakeSphere> nodes;
+		buildSphereflake(Vec3f(0), 1, 91, nodes);
+		scene.sphereAssets.resize(1);
+		SphereSet& flake = scene.sphereAssets[0];
+		for (u32 i = 0; i < nodes.size(); ++i)
+		{
+			flake.add(nodes[i].pos, nodes[i].radius);
+		}
+		flake.build();
+
+		const f32 scale = radiusFor(count) * 0.5f;
+		const Vec3f lo = roomMin() + Vec3f(scale * 2);
+		const Vec3f hi = roomMax() - Vec3f(scale * 2);
+		scene.instances.reserve(count);
+		for (u32 i = 0; i < count; ++i)
+		{
+			Vec3f pos(random.uniform(lo.x, hi.x), random.uniform(lo.y, hi.y), random.uniform(lo.z, hi.z));
+			Vec3f rotation(random.uniform(0, 360), random.uniform(0, 360), random.uniform(0, 360));
+			scene.instances.push_back(Instance(NULL, InstanceAsset_Spheres, 0, pos, rotation, scale * random.uniform(0.5f, 1.5f), scene.addMaterial(randomColor(random))));
+		}
+	}
+
+	// "Sphere <i>", "Instance <i>" and "Light <i>" in the scene's name storage, "Sphereflake" for the asset
+	static void nameItems( Scene& scene )
+	{
+		const u32 lightsBegin = u32(scene.spheres.size() + scene.instances.size());
+		std::vector<u32> offsets(lightsBegin + scene.lights.size() + 1);
+		scene.nameStorage.clear();
+		for (u32 i = 0; i < offsets.size(); ++i)
+		{
+			char name[32];
+			int length = i < scene.spheres.size() ? snprintf(name, sizeof(name), "Sphere %u", i)
+				: i < lightsBegin ? snprintf(name, sizeof(name), "Instance %u", u32(i - scene.spheres.size()))
+				: i + 1 < offsets.size() ? snprintf(name, sizeof(name), "Light %u", i - lightsBegin)
+				: snprintf(name, sizeof(name), "Sphereflake");
+			offsets[i] = u32(scene.nameStorage.size());
+			scene.nameStorage.insert(scene.nameStorage.end(), name, name + length + 1);
+		}
+		for (u32 i = 0; i < scene.spheres.size(); ++i)
+		{
+			scene.spheres[i].name = &scene.nameStorage[offsets[i]];
+		}
+		for (u32 i = 0; i < scene.instances.size(); ++i)
+		{
+			scene.instances[i].name = &scene.nameStorage[offsets[scene.spheres.size() + i]];
+		}
+		for (u32 i = 0; i < scene.lights.size(); ++i)
+		{
+			scene.lights[i].name = &scene.nameStorage[offsets[lightsBegin + i]];
+		}
+		for (u32 i = 0; i < scene.sphereAssets.size(); ++i)
+		{
+			scene.sphereAssets[i].name = &scene.nameStorage[offsets.back()];
+		}
+	}
+};
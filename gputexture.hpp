@@ -0,0 +1,259 @@
+#pragma once
+
+#include <vector>
+#include <string.h>
+
+// Display texture for the RGBA image, updated incrementally.
+// Storage is allocated once per resolution (immutable when glTexStorage2D is available),
+// only tiles that differ from the last upload are sent, packed through a ring of pixel
+// buffer objects so the copy to the GPU overlaps with rendering the next frame.
+class GpuTexture
+{
+public:
+	enum { TileSize = 32 };
+	enum { RingSize = 3 };
+
+	GLuint id;
+	Vec2u size;
+
+	u32 tileCount;
+	u32 dirtyTileCount;
+	u32 uploadedBytes;
+
+	GpuTexture()
+		: id(0)
+		, size(0)
+		, tileCount(0)
+		, dirtyTileCount(0)
+		, uploadedBytes(0)
+		, ringIndex(0)
+		, allDirty(true)
+	{
+		memset(pbos, 0, sizeof(pbos));
+		memset(fences, 0, sizeof(fences));
+		memset(pboCapacity, 0, sizeof(pboCapacity));
+	}
+	void upload( const RGBA* image, const Vec2u imageSize )
+	{
+		if (id == 0 || imageSize.x != size.x || imageSize.y != size.y)
+		{
+			allocate(imageSize);
+		}
+
+		findDirtyTiles(image);
+		if (dirtyTileCount == 0)
+		{
+			uploadedBytes = 0;
+			return;
+		}
+
+		const u32 slot = ringIndex;
+		ringIndex = (ringIndex + 1) % RingSize;
+
+		// the buffer was last used RingSize uploads ago, this only blocks if the GPU is that far behind
+		if (fences[slot])
+		{
+			glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, ~GLuint64(0));
+			glDeleteSync(fences[slot]);
+			fences[slot] = 0;
+		}
+
+		uploadedBytes = dirtyTileCount * TileSize * TileSize * sizeof(RGBA);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[slot]);
+		if (pboCapacity[slot] < uploadedBytes)
+		{
+			pboCapacity[slot] = uploadedBytes;
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, pboCapacity[slot], NULL, GL_STREAM_DRAW);
+		}
+
+		u8* staging = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, uploadedBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (!staging)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			uploadDirect(image);
+			return;
+		}
+
+		// horizontal runs of dirty tiles go as one rectangle, packed tightly in the buffer
+		std::vector<Rect> rects;
+		u32 offset = 0;
+		forEachDirtyRun([&]( const Rect& rect )
+		{
+			for (u32 y = 0; y < rect.h; ++y)
+			{
+				memcpy(staging + offset + y * rect.w * sizeof(RGBA), &image[rect.x + (rect.y + y) * size.x], rect.w * sizeof(RGBA));
+			}
+			rects.push_back(rect);
+			rects.back().offset = offset;
+			offset += rect.w * rect.h * sizeof(RGBA);
+		});
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		uploadedBytes = offset;
+
+		glBindTexture(GL_TEXTURE_2D, id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		for (u32 i = 0; i < rects.size(); ++i)
+		{
+			const Rect& rect = rects[i];
+			glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)(size_t)rect.offset);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// needs the GL context, the Tracer outlives it so this is called from Tracer::shutdown rather than a destructor
+	void release()
+	{
+		for (u32 i = 0; i < RingSize; ++i)
+		{
+			if (fences[i])
+			{
+				glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+		}
+		if (pbos[0])
+		{
+			glDeleteBuffers(RingSize, pbos);
+			memset(pbos, 0, sizeof(pbos));
+			memset(pboCapacity, 0, sizeof(pboCapacity));
+		}
+		if (id)
+		{
+			glDeleteTextures(1, &id);
+			id = 0;
+		}
+	}
+
+private:
+	struct Rect
+	{
+		u32 x, y, w, h;
+		u32 offset;
+	};
+
+	GLuint pbos[RingSize];
+	GLsync fences[RingSize];
+	u32 pboCapacity[RingSize];
+	u32 ringIndex;
+	bool allDirty;
+
+	Vec2u tiles;
+	std::vector<u8> dirty;
+	std::vector<RGBA> uploaded;	// what the texture currently holds
+
+	void allocate( const Vec2u imageSize )
+	{
+		release();
+
+		size = imageSize;
+		tiles = Vec2u((size.x + TileSize - 1) / TileSize, (size.y + TileSize - 1) / TileSize);
+		tileCount = tiles.x * tiles.y;
+
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_2D, id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		if (glTexStorage2D)
+		{
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size.x, size.y);
+		}
+		else
+		{
+			// pre GL 4.2 without ARB_texture_storage, still only allocated once
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		}
+
+		glGenBuffers(RingSize, pbos);
+
+		uploaded.resize(size.x * size.y);
+		dirty.resize(tileCount);
+		allDirty = true;
+	}
+
+	Rect tileRect( const u32 tx, const u32 ty ) const
+	{
+		Rect rect;
+		rect.x = tx * TileSize;
+		rect.y = ty * TileSize;
+		rect.w = std::min(u32(TileSize), size.x - rect.x);
+		rect.h = std::min(u32(TileSize), size.y - rect.y);
+		rect.offset = 0;
+		return rect;
+	}
+
+	// compares against the last uploaded image, and updates it
+	void findDirtyTiles( const RGBA* image )
+	{
+		if (allDirty)
+		{
+			memcpy(&uploaded[0], image, size.x * size.y * sizeof(RGBA));
+			std::fill(dirty.begin(), dirty.end(), 1);
+			dirtyTileCount = tileCount;
+			allDirty = false;
+			return;
+		}
+
+		dirtyTileCount = 0;
+		for (u32 ty = 0; ty < tiles.y; ++ty)
+		{
+			for (u32 tx = 0; tx < tiles.x; ++tx)
+			{
+				Rect rect = tileRect(tx, ty);
+
+				bool tileDirty = false;
+				for (u32 y = rect.y; y < rect.y + rect.h; ++y)
+				{
+					u32 i = rect.x + y * size.x;
+					if (memcmp(&uploaded[i], &image[i], rect.w * sizeof(RGBA)) != 0)
+					{
+						memcpy(&uploaded[i], &image[i], rect.w * sizeof(RGBA));
+						tileDirty = true;
+					}
+				}
+
+				dirty[tx + ty * tiles.x] = tileDirty;
+				dirtyTileCount += tileDirty;
+			}
+		}
+	}
+
+	template<typename F>
+	void forEachDirtyRun( const F& func ) const
+	{
+		for (u32 ty = 0; ty < tiles.y; ++ty)
+		{
+			for (u32 tx = 0; tx < tiles.x; ++tx)
+			{
+				if (!dirty[tx + ty * tiles.x])
+				{
+					continue;
+				}
+
+				Rect rect = tileRect(tx, ty);
+				while (tx + 1 < tiles.x && dirty[tx + 1 + ty * tiles.x])
+				{
+					++tx;
+					rect.w += tileRect(tx, ty).w;
+				}
+				func(rect);
+			}
+		}
+	}
+
+	// mapping failed, plain synchronous sub-rect uploads
+	void uploadDirect( const RGBA* image )
+	{
+		glBindTexture(GL_TEXTURE_2D, id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, size.x);
+		forEachDirtyRun([&]( const Rect& rect )
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, &image[rect.x + rect.y * size.x]);
+		});
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	}
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <vector>
+#include <math.h>
+
+// Spheres as an instanceable asset, SoA and reordered along their BVH so a leaf reads contiguous memory.
+class SphereSet
+{
+public:
+	const char* name;
+	std::vector<f32> x, y, z, radius;
+
+	SphereSet()
+		: name(NULL)
+	{
+	}
+
+	u32 count() const
+	{
+		return u32(x.size());
+	}
+
+	void add( const Vec3f pos, const f32 r )
+	{
+		x.push_back(pos.x);
+		y.push_back(pos.y);
+		z.push_back(pos.z);
+		radius.push_back(r);
+	}
+
+	Vec3f center( const u32 i ) const
+	{
+		return Vec3f(x[i], y[i], z[i]);
+	}
+
+	void build()
+	{
+		const u32 n = count();
+		std::vector<Aabb> boxes(n);
+		for (u32 i = 0; i < n; ++i)
+		{
+			boxes[i] = Aabb(center(i) - Vec3f(radius[i]), center(i) + Vec3f(radius[i]));
+		}
+		bvh.build(n ? &boxes[0] : NULL, n, 4);
+
+		// leaves index the spheres directly once they are in tree order
+		reorder(x);
+		reorder(y);
+		reorder(z);
+		reorder(radius);
+		std::vector<u32>().swap(bvh.items);
+	}
+
+	Aabb bounds() const
+	{
+		return bvh.bounds();
+	}
+
+	// subIndex is the sphere
+	bool intersect( const Ray& ray, f32& dist, u32& subIndex ) const
+	{
+		bool hit = false;
+		bvh.traverse(ray, dist, [&]( u32 first, u32 count, f32& tmax )
+		{
+			for (u32 i = first; i < first + count; ++i)
+			{
+				if (intersect_sphere(tmax, ray.dir, ray.pos, center(i), radius[i]))
+				{
+					subIndex = i;
+					hit = true;
+				}
+			}
+		});
+		return hit;
+	}
+
+	bool occluded( const Ray& ray, const f32 dist ) const
+	{
+		return bvh.occluded(ray, dist, [&]( u32 first, u32 count, f32 tmax )
+		{
+			for (u32 i = first; i < first + count; ++i)
+			{
+				f32 t = tmax;
+				if (intersect_sphere(t, ray.dir, ray.pos, center(i), radius[i]))
+				{
+					return true;
+				}
+			}
+			return false;
+		});
+	}
+
+	int occluded4( const RayPacket4& rays, const int active ) const
+	{
+		return bvh.occluded4(rays, active, [&]( u32 first, u32 count, int open )
+		{
+			int hits = 0;
+			for (u32 i = first; i < first + count && (open & ~hits); ++i)
+			{
+				hits |= occluded_sphere_packet4(rays, center(i), radius[i], open & ~hits);
+			}
+			return hits;
+		});
+	}
+
+	Vec3f getNormal( const Vec3f hitPos, const u32 subIndex ) const
+	{
+		return (hitPos - center(subIndex)).normalized();
+	}
+
+	Vec3f getNormalFast( const Vec3f hitPos, const u32 subIndex ) const
+	{
+		return normalized_fast(hitPos - center(subIndex));
+	}
+
+	size_t memoryUsage() const
+	{
+		return (x.capacity() + y.capacity() + z.capacity() + radius.capacity()) * sizeof(f32)
+			+ bvh.nodes.capacity() * sizeof(BvhNode);
+	}
+
+private:
+	Bvh bvh;
+
+	void reorder( std::vector<f32>& values ) const
+	{
+		std::vector<f32> sorted(values.size());
+		for (u32 i = 0; i < sorted.size(); ++i)
+		{
+			sorted[i] = values[bvh.items[i]];
+		}
+		values.swap(sorted);
+	}
+};
+
+enum InstanceAsset
+{
+	InstanceAsset_Mesh,
+	InstanceAsset_Spheres,
+};
+static const char* InstanceAssetNames[] = { "Mesh", "Spheres" };
+static const int InstanceAsset_Count = sizeof(InstanceAssetNames) / sizeof(InstanceAssetNames[0]);
+
+// A placed copy of a mesh or sphere set asset: rotation, uniform scale and position, with its own material.
+// Rays are moved into the asset's space, the asset and its BVH are shared by all its instances.
+// After editing the transform or the asset index, call Scene::updateInstances.
+class Instance : public Prim
+{
+public:
+	InstanceAsset assetType;
+	u32 asset;			// index in Scene::meshAssets or Scene::sphereAssets
+	Vec3f pos;
+	Vec3f rotation;		// degrees around x, y then z
+	f32 scale;
+
+	Instance()
+		: assetType(InstanceAsset_Mesh)
+		, asset(0)
+		, scale(1)
+		, mesh(NULL)
+		, sphereSet(NULL)
+	{
+	}
+
+	Instance( const char* _name, const InstanceAsset _assetType, const u32 _asset, const Vec3f _pos, const Vec3f _rotation, const f32 _scale, const u32 _material )
+		: Prim(_name, _material)
+		, assetType(_assetType)
+		, asset(_asset)
+		, pos(_pos)
+		, rotation(_rotation)
+		, scale(_scale)
+		, mesh(NULL)
+		, sphereSet(NULL)
+	{
+	}
+
+	// resolves the asset and caches the matrix and world bounds, false if the asset doesn't exist
+	bool update( const std::vector<Mesh>& meshAssets, const std::vector<SphereSet>& sphereAssets )
+	{
+		mesh = assetType == InstanceAsset_Mesh && asset < meshAssets.size() ? &meshAssets[asset] : NULL;
+		sphereSet = assetType == InstanceAsset_Spheres && asset < sphereAssets.size() ? &sphereAssets[asset] : NULL;
+		scale = std::max(scale, 1e-6f);
+
+		// rows of R = Rz * Ry * Rx, world = R * local * scale + pos
+		const f32 toRadians = Pi / 180;
+		const f32 cx = cosf(rotation.x * toRadians), sx = sinf(rotation.x * toRadians);
+		const f32 cy = cosf(rotation.y * toRadians), sy = sinf(rotation.y * toRadians);
+		const f32 cz = cosf(rotation.z * toRadians), sz = sinf(rotation.z * toRadians);
+		rows[0] = Vec3f(cz * cy, cz * sy * sx - sz * cx, cz * sy * cx + sz * sx);
+		rows[1] = Vec3f(sz * cy, sz * sy * sx + cz * cx, sz * sy * cx - cz * sx);
+		rows[2] = Vec3f(-sy, cy * sx, cy * cx);
+
+		worldBounds = Aabb();
+		const Aabb local = mesh ? mesh->treeBounds() : sphereSet ? sphereSet->bounds() : Aabb();
+		if (!local.empty())
+		{
+			for (u32 corner = 0; corner < 8; ++corner)
+			{
+				Vec3f p(corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y, corner & 4 ? local.max.z : local.min.z);
+				worldBounds.grow(toWorldDir(p) * scale + pos);
+			}
+		}
+		return mesh || sphereSet;
+	}
+
+	Aabb bounds() const
+	{
+		return worldBounds;
+	}
+
+	// the local direction stays unit length, so local distances are world distances over the scale
+	bool intersect( const Ray& ray, f32& dist, u32& subIndex ) const
+	{
+		const Ray local(toLocal(ray.pos), toLocalDir(ray.dir));
+		f32 localDist = dist == FLT_MAX ? FLT_MAX : dist / scale;
+		bool hit = mesh ? mesh->intersect(local, localDist, subIndex)
+			: sphereSet ? sphereSet->intersect(local, localDist, subIndex)
+			: false;
+		if (hit)
+		{
+			dist = localDist * scale;
+		}
+		return hit;
+	}
+
+	bool occluded( const Ray& ray, const f32 dist ) const
+	{
+		const Ray local(toLocal(ray.pos), toLocalDir(ray.dir));
+		const f32 localDist = dist == FLT_MAX ? FLT_MAX : dist / scale;
+		return mesh ? mesh->occluded(local, localDist)
+			: sphereSet ? sphereSet->occluded(local, localDist)
+			: false;
+	}
+
+	// the packet is moved into the asset's space lane by lane
+	int occluded4( const RayPacket4& rays, const int active ) const
+	{
+		RayPacket4 local;
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			const Vec3f rayPos(rays.position[0][lane], rays.position[1][lane], rays.position[2][lane]);
+			const Vec3f rayDir(rays.direction[0][lane], rays.direction[1][lane], rays.direction[2][lane]);
+			const f32 tFar = rays.tFar[lane];
+			set_ray_packet4(local, lane, toLocal(rayPos), toLocalDir(rayDir), tFar == FLT_MAX ? FLT_MAX : tFar / scale);
+		}
+		return mesh ? mesh->occluded4(local, active)
+			: sphereSet ? sphereSet->occluded4(local, active)
+			: 0;
+	}
+
+	Vec3f getNormal( const Vec3f hitPos, const u32 subIndex ) const
+	{
+		const Vec3f local = toLocal(hitPos);
+		return toWorldDir(mesh ? mesh->getNormal(local, subIndex) : sphereSet->getNormal(local, subIndex));
+	}
+
+	Vec3f getNormalFast( const Vec3f hitPos, const u32 subIndex ) const
+	{
+		const Vec3f local = toLocal(hitPos);
+		return toWorldDir(mesh ? mesh->getNormalFast(local, subIndex) : sphereSet->getNormalFast(local, subIndex));
+	}
+
+	// triangles have no inside, their normal is flipped towards the ray
+	bool twoSided() const
+	{
+		return mesh != NULL;
+	}
+
+private:
+	Vec3f rows[3];
+	Aabb worldBounds;
+	const Mesh* mesh;
+	const SphereSet* sphereSet;
+
+	Vec3f toWorldDir( const Vec3f v ) const
+	{
+		return Vec3f(rows[0].dot(v), rows[1].dot(v), rows[2].dot(v));
+	}
+
+	// R^T v
+	Vec3f toLocalDir( const Vec3f v ) const
+	{
+		return rows[0] * v.x + rows[1] * v.y + rows[2] * v.z;
+	}
+
+	Vec3f toLocal( const Vec3f p ) const
+	{
+		return toLocalDir(p - pos) * (1 / scale);
+	}
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <math.h>
+
+// Ward's irradiance cache, with Ward and Heckbert's gradients.
+// A record holds the irradiance arriving at a point from its hemisphere, its rotational and translational
+// gradients, and the harmonic mean distance R of what its rays hit. It is reused around the point while
+// Ward's error estimate |p - pi| / R + sqrt(1 - n.ni) stays under 'accuracy'; a query outside every record's
+// range asks for a new one. Records live in world space, in a hash grid of cells as wide as the largest
+// reuse range, every record listed in the cells its range overlaps: they survive camera moves, and are only
+// cleared when the geometry, the lights or the settings they were computed with change.
+// Render threads share the cache. The cells hash to a fixed table of buckets, each an append-only list of
+// blocks whose entries are published with a release store of the count, so lookups read them without
+// locking; inserts take a lock among themselves. Cells sharing a bucket only cost a few more records to
+// test, a record out of range of the point never passes the error test.
+class IrradianceCache
+{
+public:
+	struct Record
+	{
+		Vec3f pos;
+		Vec3f normal;
+		Vec3f irradiance;
+		f32 radius;					// harmonic mean distance, clamped
+		Vec3f rotation[3];			// gradient of each channel, rotating the normal
+		Vec3f translation[3];		// gradient of each channel, moving the point
+	};
+
+	bool enabled;
+	f32 accuracy;		// 'a' in Ward's paper, larger reuses records further
+	f32 minSpacing;		// record radius clamp, in world units
+	f32 maxSpacing;
+	u32 rays;			// hemisphere rays per record
+
+	IrradianceCache()
+		: enabled(true)
+		, accuracy(0.3f)
+		, minSpacing(0.05f)
+		, maxSpacing(2)
+		, rays(256)
+		, buckets(BucketCount)
+		, lookups(0)
+		, misses(0)
+	{
+		clear();
+	}
+
+	// not thread safe, call it between frames
+	void clear()
+	{
+		records.clear();
+		blocks.clear();
+		for (u32 i = 0; i < BucketCount; ++i)
+		{
+			buckets[i].head.store(NULL, std::memory_order_relaxed);
+			buckets[i].tail = NULL;
+		}
+		cellSize = std::max(accuracy * maxSpacing * 2, 1e-3f);
+		lookups.store(0, std::memory_order_relaxed);
+		misses.store(0, std::memory_order_relaxed);
+	}
+
+	u32 size() const
+	{
+		return u32(records.size());
+	}
+
+	// share of lookups that had to compute a record
+	f32 missRate() const
+	{
+		const u64 total = lookups.load(std::memory_order_relaxed);
+		return total ? f32(misses.load(std::memory_order_relaxed)) / total : 0.f;
+	}
+
+	// weighted average of the records in range, extrapolated with their gradients; false if there is none
+	bool lookup( const Vec3f pos, const Vec3f normal, Vec3f& irradiance )
+	{
+		lookups.fetch_add(1, std::memory_order_relaxed);
+
+		const Bucket& bucket = buckets[bucketOf(cellKey(pos))];
+		f32 weightSum = 0;
+		Vec3f sum(0);
+		for (const Block* block = bucket.head.load(std::memory_order_acquire); block; block = block->next.load(std::memory_order_acquire))
+		{
+			const u32 count = block->count.load(std::memory_order_acquire);
+			for (u32 i = 0; i < count; ++i)
+			{
+				const Record& record = *block->records[i];
+				const Vec3f offset = pos - record.pos;
+
+				// records in front of the point see another part of the scene
+				if (offset.dot(normal + record.normal) * 0.5f < -0.01f * record.radius)
+				{
+					continue;
+				}
+
+				const f32 error = sqrtf(offset.dot(offset)) / record.radius + sqrtf(std::max(0.f, 1 - normal.dot(record.normal)));
+				if (error >= accuracy)
+				{
+					continue;
+				}
+
+				const f32 weight = 1 / std::max(error, 1e-4f);
+				// the gradients are estimated from noisy paths, they may adjust a record by half at most
+				const Vec3f turn = record.normal.cross(normal);
+				Vec3f estimate;
+				for (u32 c = 0; c < 3; ++c)
+				{
+					const f32 change = turn.dot(record.rotation[c]) + offset.dot(record.translation[c]);
+					estimate[c] = record.irradiance[c] + clamp(-0.5f * record.irradiance[c], 0.5f * record.irradiance[c], change);
+				}
+				sum += estimate * weight;
+				weightSum += weight;
+			}
+		}
+
+		if (weightSum == 0)
+		{
+			misses.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		irradiance = sum * (1 / weightSum);
+		return true;
+	}
+
+	void insert( Record record )
+	{
+		record.radius = clamp(minSpacing, maxSpacing, record.radius);
+		const f32 range = record.radius * accuracy;
+
+		// the range is at most half a cell, it overlaps 8 cells at most
+		u32 targets[8];
+		u32 targetCount = 0;
+		const i64 x0 = cellCoord(record.pos.x - range), x1 = cellCoord(record.pos.x + range);
+		const i64 y0 = cellCoord(record.pos.y - range), y1 = cellCoord(record.pos.y + range);
+		const i64 z0 = cellCoord(record.pos.z - range), z1 = cellCoord(record.pos.z + range);
+		for (i64 z = z0; z <= z1; ++z)
+		{
+			for (i64 y = y0; y <= y1; ++y)
+			{
+				for (i64 x = x0; x <= x1; ++x)
+				{
+					// cells sharing a bucket list the record once
+					const u32 target = bucketOf(cellKey(x, y, z));
+					if (targetCount < 8 && std::find(targets, targets + targetCount, target) == targets + targetCount)
+					{
+						targets[targetCount++] = target;
+					}
+				}
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		records.push_back(record);
+		const Record* stored = &records.back();
+		for (u32 t = 0; t < targetCount; ++t)
+		{
+			append(buckets[targets[t]], stored);
+		}
+	}
+
+	// returns true when the cache was cleared
+	bool onGui()
+	{
+		bool changed = false;
+
+		ImGui::BeginProperty("Irradiance cache");
+		changed |= ImGui::Checkbox("", &enabled);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Cache accuracy");
+		changed |= ImGui::DragFloat("", &accuracy, 0.01f, 0.01f, 2.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Cache min spacing");
+		changed |= ImGui::DragFloat("", &minSpacing, 0.01f, 0.001f, 100.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Cache max spacing");
+		changed |= ImGui::DragFloat("", &maxSpacing, 0.01f, 0.001f, 100.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Cache rays");
+		changed |= ImGui::DragInt("", (int*)&rays, 4.f, 8, 4096);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::Text("%u records, %.1f%% misses", size(), missRate() * 100);
+		if (ImGui::Button("Clear cache"))
+		{
+			changed = true;
+		}
+
+		if (changed)
+		{
+			maxSpacing = std::max(maxSpacing, minSpacing);
+			clear();
+		}
+		return changed;
+	}
+
+private:
+	enum { BucketCount = 1 << 16 };
+
+	// written by inserts only, under the lock: an entry is visible once count covers it
+	struct Block
+	{
+		enum { Capacity = 14 };
+
+		std::atomic<u32> count;
+		std::atomic<Block*> next;
+		const Record* records[Capacity];
+
+		Block()
+			: count(0)
+			, next(NULL)
+		{
+		}
+	};
+
+	struct Bucket
+	{
+		std::atomic<Block*> head;
+		Block* tail;		// inserts only
+
+		Bucket()
+			: head(NULL)
+			, tail(NULL)
+		{
+		}
+	};
+
+	// deques so that the records and blocks readers point to stay where they are as they grow
+	std::mutex mutex;
+	std::deque<Record> records;
+	std::deque<Block> blocks;
+	std::vector<Bucket> buckets;
+	f32 cellSize;
+	std::atomic<u64> lookups;
+	std::atomic<u64> misses;
+
+	// under the lock, the new block is linked once its first entry is written
+	void append( Bucket& bucket, const Record* record )
+	{
+		Block* tail = bucket.tail;
+		const u32 count = tail ? tail->count.load(std::memory_order_relaxed) : Block::Capacity;
+		if (count < Block::Capacity)
+		{
+			tail->records[count] = record;
+			tail->count.store(count + 1, std::memory_order_release);
+			return;
+		}
+
+		blocks.emplace_back();
+		Block* block = &blocks.back();
+		block->records[0] = record;
+		block->count.store(1, std::memory_order_relaxed);
+		if (tail)
+		{
+			tail->next.store(block, std::memory_order_release);
+		}
+		else
+		{
+			bucket.head.store(block, std::memory_order_release);
+		}
+		bucket.tail = block;
+	}
+
+	i64 cellCoord( const f32 v ) const
+	{
+		return i64(floorf(v / cellSize));
+	}
+
+	static u64 cellKey( const i64 x, const i64 y, const i64 z )
+	{
+		return (u64(x) & 0x1fffff) | (u64(y) & 0x1fffff) << 21 | (u64(z) & 0x1fffff) << 42;
+	}
+
+	u64 cellKey( const Vec3f pos ) const
+	{
+		return cellKey(cellCoord(pos.x), cellCoord(pos.y), cellCoord(pos.z));
+	}
+
+	static u32 bucketOf( u64 key )
+	{
+		key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+		key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+		key ^= key >> 31;
+		return u32(key) & (BucketCount - 1);
+	}
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <math.h>
+
+enum LightType
+{
+	LightType_Point,
+	LightType_Sphere,
+	LightType_Rect,
+};
+static const char* LightTypeNames[] = { "Point", "Sphere", "Rect" };
+static const char* LightTypeKeys[] = { "point", "sphere", "rect" };
+static const int LightType_Count = sizeof(LightTypeNames) / sizeof(LightTypeNames[0]);
+
+// Radiant intensity of a light of intensity 1 in the path tracer, which has physical lights: a white
+// surface facing such a light 3 units away (the built-in scene's light over the floor) comes out white.
+static constexpr f32 LightRadiantScale = 9 * Pi;
+
+// by scene file key, -1 if unknown
+inline int findLightType( const char* key )
+{
+	for (int i = 0; i < LightType_Count; ++i)
+	{
+		if (strcmp(key, LightTypeKeys[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Lights are only seen through shading, camera rays go through them.
+// As the original single light, they don't fall off with distance: a shaded point gets color * intensity
+// times its Lambert term. Area lights are sampled over their surface, which is what softens the shadows:
+// a sphere over the disk it shows to the shaded point, a rectangle (centered on pos, spanned by edge1 and
+// edge2) uniformly.
+// The path tracer sees them as physical lights instead: radiant intensity falling off with the squared
+// distance, spread over the surface of area lights as a uniform radiance (rects emit on both sides).
+class Light
+{
+public:
+	const char* name;
+	LightType type;
+	Vec3f pos;
+	Color color;
+	f32 intensity;
+	f32 radius;			// sphere
+	Vec3f edge1;		// rect
+	Vec3f edge2;
+
+	Light()
+		: name(NULL)
+		, type(LightType_Point)
+		, color(white)
+		, intensity(1)
+		, radius(0.5f)
+		, edge1(1, 0, 0)
+		, edge2(0, 0, 1)
+	{
+	}
+
+	Light( const char* _name, const LightType _type, const Vec3f _pos, const Color _color, const f32 _intensity )
+		: name(_name)
+		, type(_type)
+		, pos(_pos)
+		, color(_color)
+		, intensity(_intensity)
+		, radius(0.5f)
+		, edge1(1, 0, 0)
+		, edge2(0, 0, 1)
+	{
+	}
+
+	// point of the light for the sample (u, v) in [0, 1)^2, as seen from 'from'
+	Vec3f sample( const Vec3f from, const f32 u, const f32 v ) const
+	{
+		switch (type)
+		{
+			case LightType_Sphere:
+			{
+				Vec3f axis = from - pos;
+				if (axis.dot(axis) == 0)
+				{
+					return pos;
+				}
+				axis = axis.normalized();
+				Vec3f tangent, bitangent;
+				makeBasis(axis, tangent, bitangent);
+				f32 r = radius * sqrtf(u);
+				f32 angle = TwoPi * v;
+				return pos + tangent * (r * cosf(angle)) + bitangent * (r * sinf(angle));
+			}
+			case LightType_Rect:
+				return pos + edge1 * (u - 0.5f) + edge2 * (v - 0.5f);
+			default:
+				return pos;
+		}
+	}
+
+	// what the light emits, for picking among many in proportion
+	f32 power() const
+	{
+		return intensity * (0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b);
+	}
+
+	// point lights can't be hit by a ray, only sampled
+	bool isDelta() const
+	{
+		return type == LightType_Point;
+	}
+
+	Aabb bounds() const
+	{
+		Aabb box;
+		if (type == LightType_Sphere)
+		{
+			box = Aabb(pos - Vec3f(radius), pos + Vec3f(radius));
+		}
+		else if (type == LightType_Rect)
+		{
+			box.grow(pos - edge1 * 0.5f - edge2 * 0.5f);
+			box.grow(pos + edge1 * 0.5f - edge2 * 0.5f);
+			box.grow(pos - edge1 * 0.5f + edge2 * 0.5f);
+			box.grow(pos + edge1 * 0.5f + edge2 * 0.5f);
+		}
+		return box;
+	}
+
+	// path tracer units: the radiance of an area light, which seen head-on gives the intensity of a point light
+	Vec3f radiance() const
+	{
+		const f32 area = type == LightType_Sphere ? Pi * radius * radius : edge1.cross(edge2).mag();
+		return area > 0 ? Vec3f(color.r, color.g, color.b) * (intensity * LightRadiantScale / area) : Vec3f(0);
+	}
+
+	// Direction towards a point of the light, its distance, and what arrives along it over the solid angle pdf
+	// (I / d^2 for a point light, whose pdf is returned as 0). Spheres are sampled in the cone they subtend,
+	// rects over their area. False when there's nothing to sample, from inside a sphere or edge-on to a rect.
+	bool sampleIncident( const Vec3f from, const f32 u, const f32 v, Vec3f& dir, f32& dist, Vec3f& incident, f32& pdf ) const
+	{
+		switch (type)
+		{
+			case LightType_Sphere:
+			{
+				Vec3f axis = pos - from;
+				const f32 distSq = axis.dot(axis);
+				if (distSq <= radius * radius)
+				{
+					return false;
+				}
+				const f32 centerDist = sqrtf(distSq);
+				axis = axis * (1 / centerDist);
+				const f32 cosMax = sqrtf(1 - radius * radius / distSq);
+				const f32 oneMinusCosMax = radius * radius / distSq / (1 + cosMax);
+				const f32 cosTheta = 1 - u * oneMinusCosMax;
+				const f32 sinTheta = sqrtf(std::max(0.f, 1 - cosTheta * cosTheta));
+				const f32 angle = TwoPi * v;
+
+				Vec3f tangent, bitangent;
+				makeBasis(axis, tangent, bitangent);
+				dir = (tangent * cosf(angle) + bitangent * sinf(angle)) * sinTheta + axis * cosTheta;
+
+				// the near side of the sphere along dir
+				const f32 along = centerDist * cosTheta;
+				dist = along - sqrtf(std::max(0.f, radius * radius - (distSq - along * along)));
+				pdf = 1 / (TwoPi * oneMinusCosMax);
+				incident = radiance() * (1 / pdf);
+				return true;
+			}
+			case LightType_Rect:
+			{
+				const Vec3f toLight = sample(from, u, v) - from;
+				const f32 distSq = toLight.dot(toLight);
+				const Vec3f normal = edge1.cross(edge2);
+				const f32 area = normal.mag();
+				if (distSq == 0 || area == 0)
+				{
+					return false;
+				}
+				dist = sqrtf(distSq);
+				dir = toLight * (1 / dist);
+				const f32 cosLight = fabsf(normal.dot(dir)) / area;
+				if (cosLight <= 0)
+				{
+					return false;
+				}
+				pdf = distSq / (area * cosLight);
+				incident = radiance() * (1 / pdf);
+				return true;
+			}
+			default:
+			{
+				const Vec3f toLight = pos - from;
+				const f32 distSq = toLight.dot(toLight);
+				if (distSq == 0)
+				{
+					return false;
+				}
+				dist = sqrtf(distSq);
+				dir = toLight * (1 / dist);
+				pdf = 0;
+				incident = Vec3f(color.r, color.g, color.b) * (intensity * LightRadiantScale / distSq);
+				return true;
+			}
+		}
+	}
+
+	// path tracer units: all that leaves the light, 4 pi I for points and spheres, 2 pi I for two sided rects
+	Vec3f flux() const
+	{
+		const f32 solidAngle = type == LightType_Rect ? 2 * Pi : 4 * Pi;
+		return Vec3f(color.r, color.g, color.b) * (intensity * LightRadiantScale * solidAngle);
+	}
+
+	// A photon leaving the light, for (u1, u2, u3, u4) in [0, 1)^4, each direction as likely as the light emits
+	// it: uniform over the sphere from a point light, cosine weighted around the surface normal of area lights.
+	void sampleEmission( const f32 u1, const f32 u2, f32 u3, const f32 u4, Vec3f& origin, Vec3f& dir ) const
+	{
+		// uniform over the sphere
+		const f32 z = 1 - 2 * u1;
+		const f32 ring = sqrtf(std::max(0.f, 1 - z * z));
+		const Vec3f sphereDir(ring * cosf(TwoPi * u2), ring * sinf(TwoPi * u2), z);
+
+		Vec3f normal;
+		switch (type)
+		{
+			case LightType_Sphere:
+				origin = pos + sphereDir * radius;
+				normal = sphereDir;
+				break;
+			case LightType_Rect:
+			{
+				// u3 also picks the side
+				const bool back = u3 >= 0.5f;
+				u3 = back ? u3 * 2 - 1 : u3 * 2;
+				origin = pos + edge1 * (u1 - 0.5f) + edge2 * (u2 - 0.5f);
+				normal = edge1.cross(edge2).normalized();
+				if (back)
+				{
+					normal = normal * -1.f;
+				}
+				break;
+			}
+			default:
+				origin = pos;
+				dir = sphereDir;
+				return;
+		}
+
+		dir = cosineHemisphere(normal, u3, u4);
+	}
+
+	// a ray finding the light closer than dist, with the pdf sampleIncident has for that direction
+	bool intersect( const Ray& ray, f32& dist, f32& pdf ) const
+	{
+		switch (type)
+		{
+			case LightType_Sphere:
+			{
+				const Vec3f toCenter = pos - ray.pos;
+				const f32 distSq = toCenter.dot(toCenter);
+				if (distSq <= radius * radius || !intersect_sphere(dist, ray.dir, ray.pos, pos, radius))
+				{
+					return false;
+				}
+				const f32 cosMax = sqrtf(1 - radius * radius / distSq);
+				pdf = 1 / (TwoPi * (radius * radius / distSq / (1 + cosMax)));
+				return true;
+			}
+			case LightType_Rect:
+			{
+				const Vec3f normal = edge1.cross(edge2);
+				const f32 areaSq = normal.dot(normal);
+				const f32 facing = normal.dot(ray.dir);
+				if (facing == 0 || areaSq == 0)
+				{
+					return false;
+				}
+				const f32 t = normal.dot(pos - ray.pos) / facing;
+				if (t <= 0 || t >= dist)
+				{
+					return false;
+				}
+
+				// coordinates along the edges, in [-1/2, 1/2] inside
+				const Vec3f local = ray.at(t) - pos;
+				const f32 a = local.cross(edge2).dot(normal) / areaSq;
+				const f32 b = edge1.cross(local).dot(normal) / areaSq;
+				if (fabsf(a) > 0.5f || fabsf(b) > 0.5f)
+				{
+					return false;
+				}
+				dist = t;
+				pdf = t * t / fabsf(facing);
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+};
@@ -7,14 +7,21 @@
 #include <GL/gl3w.h>    // This example is using gl3w to access OpenGL functions (because it is small). You may use glew/glad/glLoadGen/etc. whatever already works for you.
 #include <GLFW/glfw3.h>
 #include "tracer.hpp"
+#include "cli.hpp"
 
 static void error_callback(int error, const char* description)
 {
 	fprintf(stderr, "Error %d: %s\n", error, description);
 }
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
+	// Headless modes exit here, before any window is created
+	CommandLine cl;
+	int headless = runCommandLine(argc, argv, cl);
+	if (headless >= 0)
+		return headless;
+
 	// Setup window
 	glfwSetErrorCallback(error_callback);
 	if (!glfwInit())
@@ -43,6 +50,7 @@ int main(int, char**)
 	//io.Fonts->AddFontFromFileTTF("c:\\Windows\\Fonts\\ArialUni.ttf", 18.0f, NULL, io.Fonts->GetGlyphRangesJapanese());
 
 	static Tracer tracer;
+	setupScene(tracer, cl);
 	tracer.init();
 
 	// Main loop
@@ -95,6 +103,7 @@ int main(int, char**)
 	}
 
 	// Cleanup
+	tracer.shutdown();
 	ImGui_ImplGlfwGL3_Shutdown();
 	glfwTerminate();
 
@@ -0,0 +1,106 @@
+//------------------------------------------------------------------------------
+// Sampling an index in proportion to a weight
+//------------------------------------------------------------------------------
+#ifndef PT_H_ALIAS_TABLE
+#define PT_H_ALIAS_TABLE
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <vector>
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// AliasTable
+//------------------------------------------------------------------------------
+/// \brief Walker's alias method, built with Vose's algorithm.
+///
+/// Every slot holds a probability and an alias: a slot is picked uniformly,
+/// then either the slot itself or its alias. Building is O(n), sampling is
+/// O(1) whatever the number of weights and how skewed they are.
+class AliasTable
+{
+public:
+    /// Negative weights count as 0. If all are 0, indices are uniform.
+    void build(const float * weights, const uint32_t count)
+    {
+        probability.assign(count, 1.0f);
+        alias.resize(count);
+        pdfs.assign(count, count ? 1.0f / count : 0.0f);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            alias[i] = i;
+        }
+
+        double total = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            total += weights[i] > 0 ? weights[i] : 0;
+        }
+        if (total <= 0)
+        {
+            return;
+        }
+
+        // slots under the average lend their spare probability to the
+        // ones above it
+        std::vector<double> scaled(count);
+        std::vector<uint32_t> small, large;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const double weight = weights[i] > 0 ? weights[i] : 0;
+            pdfs[i] = float(weight / total);
+            scaled[i] = weight / total * count;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty())
+        {
+            const uint32_t s = small.back();
+            const uint32_t l = large.back();
+            small.pop_back();
+            probability[s] = float(scaled[s]);
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1;
+            if (scaled[l] < 1)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // what is left is 1 up to rounding, those slots keep themselves
+    }
+
+    /// u in [0, 1): the integer part of u * size() picks the slot, the
+    /// fraction picks between the slot and its alias.
+    uint32_t sample(const float u, float & pdf) const
+    {
+        const uint32_t count = size();
+        const float scaled = u * count;
+        uint32_t slot = uint32_t(scaled);
+        slot = slot < count ? slot : count - 1;
+        const uint32_t index = scaled - slot < probability[slot] ? slot : alias[slot];
+        pdf = pdfs[index];
+        return index;
+    }
+
+    /// probability of sampling index
+    float pdf(const uint32_t index) const
+    {
+        return pdfs[index];
+    }
+
+    uint32_t size() const
+    {
+        return uint32_t(pdfs.size());
+    }
+
+    bool empty() const
+    {
+        return pdfs.empty();
+    }
+
+private:
+    std::vector<float> probability;
+    std::vector<uint32_t> alias;
+    std::vector<float> pdfs;
+};
+
+#endif
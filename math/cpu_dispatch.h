@@ -0,0 +1,162 @@
+//------------------------------------------------------------------------------
+// Picking the widest SIMD kernels the CPU runs, at run time
+//------------------------------------------------------------------------------
+#ifndef PT_H_CPU_DISPATCH
+#define PT_H_CPU_DISPATCH
+//------------------------------------------------------------------------------
+#include <string.h>
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// PT_TARGET
+//------------------------------------------------------------------------------
+/// \brief Compiles one function for a wider instruction set than the rest of
+/// the build, so the binary still runs on any x86-64 CPU: the function may
+/// only be called once cpu_isa() says the CPU has it.
+///
+/// MSVC compiles any intrinsic wherever it is used, it needs no attribute.
+#if defined(__GNUC__)
+#define PT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PT_TARGET(isa)
+#endif
+
+//------------------------------------------------------------------------------
+// PT_NO_FMA
+//------------------------------------------------------------------------------
+/// \brief Keeps GCC from fusing the products and sums of a function into
+/// FMAs, which round differently: it does wherever the target has them, and
+/// "avx512f" does. Kernels that must give the same results on every
+/// instruction set use it. A function is only inlined into callers with the
+/// same setting, so the kernels calling each other all need it.
+#if defined(__GNUC__) && !defined(__clang__)
+#define PT_NO_FMA __attribute__((optimize("fp-contract=off")))
+#else
+#define PT_NO_FMA
+#endif
+
+//------------------------------------------------------------------------------
+// CpuIsa
+//------------------------------------------------------------------------------
+/// \brief Instruction sets the kernels have a variant for, each a superset of
+/// the one before. SSE2 is part of x86-64, it is the baseline of the build.
+enum CpuIsa
+{
+    CpuIsa_Sse2,
+    CpuIsa_Sse41,
+    CpuIsa_Avx2,
+    CpuIsa_Avx512,
+};
+static const char * CpuIsaNames[] = { "SSE2", "SSE4.1", "AVX2", "AVX-512" };
+static const char * CpuIsaKeys[] = { "sse2", "sse4.1", "avx2", "avx512" };
+static const int CpuIsa_Count = sizeof(CpuIsaNames) / sizeof(CpuIsaNames[0]);
+
+/// by command line key, -1 if unknown
+inline int find_cpu_isa(const char * key)
+{
+    for (int i = 0; i < CpuIsa_Count; ++i)
+    {
+        if (strcmp(key, CpuIsaKeys[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+// detect_cpu_isa
+//------------------------------------------------------------------------------
+/// \brief The widest instruction set of the CPU that the OS also saves the
+/// registers of (XGETBV): AVX needs the ymm state, AVX-512 the opmask and zmm
+/// states as well.
+inline CpuIsa detect_cpu_isa()
+{
+    unsigned int regs[4] = { 0, 0, 0, 0 };     // eax, ebx, ecx, edx
+    unsigned int leaf7[4] = { 0, 0, 0, 0 };
+#ifdef _WIN32
+    int info[4];
+    __cpuid(info, 0);
+    const unsigned int maxLeaf = unsigned(info[0]);
+    __cpuid(info, 1);
+    memcpy(regs, info, sizeof(regs));
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        memcpy(leaf7, info, sizeof(leaf7));
+    }
+#else
+    const unsigned int maxLeaf = __get_cpuid_max(0, NULL);
+    __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+    if (maxLeaf >= 7)
+    {
+        __cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+    }
+#endif
+
+    const bool sse41 = (regs[2] >> 19 & 1) != 0;
+    const bool osxsave = (regs[2] >> 27 & 1) != 0;
+    const bool avx = (regs[2] >> 28 & 1) != 0;
+    if (!sse41)
+    {
+        return CpuIsa_Sse2;
+    }
+    if (!osxsave || !avx)
+    {
+        return CpuIsa_Sse41;
+    }
+
+    unsigned long long xcr0;
+#ifdef _WIN32
+    xcr0 = _xgetbv(0);
+#else
+    unsigned int xcrLow, xcrHigh;
+    __asm__ __volatile__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+    xcr0 = (unsigned long long)xcrHigh << 32 | xcrLow;
+#endif
+
+    const bool ymm = (xcr0 & 0x6) == 0x6;
+    const bool zmm = (xcr0 & 0xe6) == 0xe6;
+    const bool avx2 = (leaf7[1] >> 5 & 1) != 0;
+    const bool avx512f = (leaf7[1] >> 16 & 1) != 0;
+    if (!ymm || !avx2)
+    {
+        return CpuIsa_Sse41;
+    }
+    return zmm && avx512f ? CpuIsa_Avx512 : CpuIsa_Avx2;
+}
+
+//------------------------------------------------------------------------------
+// cpu_isa
+//------------------------------------------------------------------------------
+/// \brief The instruction set the kernels use, the CPU's widest unless
+/// set_cpu_isa chose another. Kernels switch on it once per call, which
+/// works on a whole leaf or range.
+inline CpuIsa & cpu_isa_selection()
+{
+    static CpuIsa selected = detect_cpu_isa();
+    return selected;
+}
+
+inline CpuIsa cpu_isa()
+{
+    return cpu_isa_selection();
+}
+
+/// Narrows the kernels to an instruction set, to compare the variants.
+/// Returns what is used: never wider than the CPU has. Call it before the
+/// scene is built, mesh leaves are sized for the kernels.
+inline CpuIsa set_cpu_isa(const CpuIsa isa)
+{
+    const CpuIsa best = detect_cpu_isa();
+    cpu_isa_selection() = isa < best ? isa : best;
+    return cpu_isa_selection();
+}
+
+//------------------------------------------------------------------------------
+#endif
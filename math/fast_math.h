@@ -0,0 +1,86 @@
+//------------------------------------------------------------------------------
+// Approximate square roots and reciprocals, for where full precision is wasted
+//------------------------------------------------------------------------------
+#ifndef PT_H_FAST_MATH
+#define PT_H_FAST_MATH
+//------------------------------------------------------------------------------
+#include "vector.h"
+#include <xmmintrin.h>
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// newton_or_estimate
+//------------------------------------------------------------------------------
+/// \brief The refined value, or the estimate where refining gave NaN: the
+/// step multiplies 0 by infinity when the estimate is infinite.
+inline __m128 newton_or_estimate(const __m128 refined, const __m128 estimate)
+{
+    const __m128 nan = _mm_cmpunord_ps(refined, refined);
+    return _mm_or_ps(_mm_and_ps(nan, estimate), _mm_andnot_ps(nan, refined));
+}
+
+//------------------------------------------------------------------------------
+// rsqrt_fast
+//------------------------------------------------------------------------------
+/// \brief 1 / sqrt(x) from the rsqrtss estimate (12 bits) refined by one
+/// Newton-Raphson step.
+///
+/// Relative error below 3e-7 (a few ulp) for any normal positive x, against
+/// half an ulp for 1 / sqrtf(x). Infinity for 0, NaN for negative x.
+inline float rsqrt_fast(const float x)
+{
+    const __m128 v = _mm_set_ss(x);
+    const __m128 y = _mm_rsqrt_ss(v);
+    // y * (1.5 - 0.5 * x * y * y)
+    const __m128 yy = _mm_mul_ss(_mm_mul_ss(v, y), y);
+    const __m128 refined = _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), y),
+                                      _mm_sub_ss(_mm_set_ss(3.0f), yy));
+    return _mm_cvtss_f32(newton_or_estimate(refined, y));
+}
+
+//------------------------------------------------------------------------------
+// rcp_fast
+//------------------------------------------------------------------------------
+/// \brief 1 / x from the rcpps estimate (12 bits) refined by one
+/// Newton-Raphson step, in the four lanes or for one float.
+///
+/// Relative error below 2.5e-7 for any normal x whose reciprocal is normal
+/// too. Infinity of the same sign for 0, 0 where the reciprocal is denormal.
+inline __m128 rcp_fast4(const __m128 x)
+{
+    const __m128 y = _mm_rcp_ps(x);
+    // y * (2 - x * y)
+    const __m128 refined = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(2.0f),
+                                                    _mm_mul_ps(x, y)));
+    return newton_or_estimate(refined, y);
+}
+
+inline float rcp_fast(const float x)
+{
+    return _mm_cvtss_f32(rcp_fast4(_mm_set_ss(x)));
+}
+
+//------------------------------------------------------------------------------
+// sqrt_fast
+//------------------------------------------------------------------------------
+/// \brief sqrt(x) as x * rsqrt_fast(x), within the error of rsqrt_fast.
+/// 0 for 0.
+inline float sqrt_fast(const float x)
+{
+    return x > 0.0f ? x * rsqrt_fast(x) : 0.0f;
+}
+
+//------------------------------------------------------------------------------
+// normalized_fast
+//------------------------------------------------------------------------------
+/// \brief v / |v| with rsqrt_fast: each element is within 3e-7 of
+/// v.normalized() relative to the length, about 1e-7 more for the rounding of
+/// the dot product.
+/// NaN for a zero vector, as normalized().
+inline Vec3f normalized_fast(const Vec3f & v)
+{
+    return v * rsqrt_fast(v.magSq());
+}
+
+//------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,284 @@
+//------------------------------------------------------------------------------
+// Fast image writers: PPM/PFM, QOI and raw mapped dumps
+//------------------------------------------------------------------------------
+#ifndef PT_H_IMAGE_WRITE_FAST
+#define PT_H_IMAGE_WRITE_FAST
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "mapped_file.h"
+//------------------------------------------------------------------------------
+
+/// Writers for formats that favour encode speed over size, for batch renders
+/// where the output is post-processed by another tool anyway.
+///
+/// All writers take top-down rows of 'comp' interleaved channels (3 or 4) and
+/// drop alpha when the format has none.
+namespace image_write_fast
+{
+
+//------------------------------------------------------------------------------
+// writePpm
+//------------------------------------------------------------------------------
+/// \brief Binary PPM (P6), 8-bit rgb.
+inline bool writePpm(const char * filename, int w, int h, int comp, const void * data, int stride)
+{
+    FILE * f = fopen(filename, "wb");
+    if (!f)
+    {
+        return false;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", w, h);
+
+    bool ok = true;
+    std::vector<uint8_t> row(size_t(w) * 3);
+    for (int y = 0; y < h && ok; ++y)
+    {
+        const uint8_t * src = static_cast<const uint8_t *>(data) + size_t(y) * stride;
+        if (comp == 3)
+        {
+            ok = fwrite(src, 1, row.size(), f) == row.size();
+            continue;
+        }
+        for (int x = 0; x < w; ++x)
+        {
+            row[x * 3 + 0] = src[x * comp + 0];
+            row[x * 3 + 1] = src[x * comp + 1];
+            row[x * 3 + 2] = src[x * comp + 2];
+        }
+        ok = fwrite(&row[0], 1, row.size(), f) == row.size();
+    }
+    return fclose(f) == 0 && ok;
+}
+
+//------------------------------------------------------------------------------
+// writePfm
+//------------------------------------------------------------------------------
+/// \brief Portable float map, 32-bit float rgb, little endian.
+///
+/// PFM rows go bottom to top, the negative scale in the header marks little
+/// endian data.
+inline bool writePfm(const char * filename, int w, int h, int comp, const float * data)
+{
+    FILE * f = fopen(filename, "wb");
+    if (!f)
+    {
+        return false;
+    }
+    fprintf(f, "PF\n%d %d\n-1.0\n", w, h);
+
+    bool ok = true;
+    std::vector<float> row(size_t(w) * 3);
+    for (int y = h - 1; y >= 0 && ok; --y)
+    {
+        const float * src = data + size_t(y) * w * comp;
+        for (int x = 0; x < w; ++x)
+        {
+            row[x * 3 + 0] = src[x * comp + 0];
+            row[x * 3 + 1] = src[x * comp + 1];
+            row[x * 3 + 2] = src[x * comp + 2];
+        }
+        ok = fwrite(&row[0], sizeof(float), row.size(), f) == row.size();
+    }
+    return fclose(f) == 0 && ok;
+}
+
+//------------------------------------------------------------------------------
+// writeQoi
+//------------------------------------------------------------------------------
+/// \brief "Quite OK Image" format, lossless, 8-bit rgba.
+///
+/// Single pass with a 64 entry color cache, runs and small deltas against the
+/// previous pixel. Roughly PNG sized for rendered images at a fraction of the
+/// encode time. See https://qoiformat.org/qoi-specification.pdf
+inline bool writeQoi(const char * filename, int w, int h, int comp, const void * data, int stride)
+{
+    enum
+    {
+        OpIndex = 0x00,
+        OpDiff  = 0x40,
+        OpLuma  = 0x80,
+        OpRun   = 0xc0,
+        OpRgb   = 0xfe,
+        OpRgba  = 0xff,
+    };
+
+    struct Pixel
+    {
+        uint8_t r, g, b, a;
+
+        bool operator==(const Pixel & p) const { return r == p.r && g == p.g && b == p.b && a == p.a; }
+        int hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) & 63; }
+    };
+
+    FILE * f = fopen(filename, "wb");
+    if (!f)
+    {
+        return false;
+    }
+
+    // worst case is 5 bytes per pixel, flushed per row
+    std::vector<uint8_t> out;
+    out.reserve(size_t(w) * 5 + 14);
+
+    const uint8_t header[14] =
+    {
+        'q', 'o', 'i', 'f',
+        uint8_t(w >> 24), uint8_t(w >> 16), uint8_t(w >> 8), uint8_t(w),
+        uint8_t(h >> 24), uint8_t(h >> 16), uint8_t(h >> 8), uint8_t(h),
+        uint8_t(comp), 0,   // sRGB with linear alpha
+    };
+    out.insert(out.end(), header, header + sizeof(header));
+
+    Pixel cache[64];
+    memset(cache, 0, sizeof(cache));
+    Pixel prev = { 0, 0, 0, 255 };
+    int run = 0;
+
+    bool ok = true;
+    for (int y = 0; y < h && ok; ++y)
+    {
+        const uint8_t * src = static_cast<const uint8_t *>(data) + size_t(y) * stride;
+        for (int x = 0; x < w; ++x, src += comp)
+        {
+            Pixel px = { src[0], src[1], src[2], uint8_t(comp == 4 ? src[3] : 255) };
+
+            if (px == prev)
+            {
+                ++run;
+                if (run == 62 || (x == w - 1 && y == h - 1))
+                {
+                    out.push_back(uint8_t(OpRun | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)
+            {
+                out.push_back(uint8_t(OpRun | (run - 1)));
+                run = 0;
+            }
+
+            const int index = px.hash();
+            if (cache[index] == px)
+            {
+                out.push_back(uint8_t(OpIndex | index));
+            }
+            else
+            {
+                cache[index] = px;
+
+                if (px.a == prev.a)
+                {
+                    const int8_t dr = int8_t(px.r - prev.r);
+                    const int8_t dg = int8_t(px.g - prev.g);
+                    const int8_t db = int8_t(px.b - prev.b);
+                    const int8_t drg = int8_t(dr - dg);
+                    const int8_t dbg = int8_t(db - dg);
+
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    {
+                        out.push_back(uint8_t(OpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    }
+                    else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+                    {
+                        out.push_back(uint8_t(OpLuma | (dg + 32)));
+                        out.push_back(uint8_t((drg + 8) << 4 | (dbg + 8)));
+                    }
+                    else
+                    {
+                        const uint8_t op[4] = { OpRgb, px.r, px.g, px.b };
+                        out.insert(out.end(), op, op + 4);
+                    }
+                }
+                else
+                {
+                    const uint8_t op[5] = { OpRgba, px.r, px.g, px.b, px.a };
+                    out.insert(out.end(), op, op + 5);
+                }
+            }
+            prev = px;
+        }
+
+        ok = out.empty() || fwrite(&out[0], 1, out.size(), f) == out.size();
+        out.clear();
+    }
+
+    static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    ok = ok && fwrite(end, 1, sizeof(end), f) == sizeof(end);
+    return fclose(f) == 0 && ok;
+}
+
+//------------------------------------------------------------------------------
+// Raw dumps
+//------------------------------------------------------------------------------
+/// \brief Header of the raw dumps, followed by the pixels at 'dataOffset'.
+///
+/// The pixels are the framebuffer bytes as is: top-down rows of 'channels'
+/// interleaved values of 'bytesPerChannel' bytes (1 = unorm8, 4 = float),
+/// native endianness.
+struct RawHeader
+{
+    char magic[4];      ///< "YRAW"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t bytesPerChannel;
+    uint32_t dataOffset;
+    uint32_t reserved;
+};
+
+enum { RawVersion = 1 };
+
+inline RawHeader makeRawHeader(uint32_t w, uint32_t h, uint32_t channels, uint32_t bytesPerChannel)
+{
+    RawHeader header;
+    memcpy(header.magic, "YRAW", 4);
+    header.version = RawVersion;
+    header.width = w;
+    header.height = h;
+    header.channels = channels;
+    header.bytesPerChannel = bytesPerChannel;
+    header.dataOffset = sizeof(RawHeader);
+    header.reserved = 0;
+    return header;
+}
+
+inline uint64_t rawPayloadSize(const RawHeader & header)
+{
+    return uint64_t(header.width) * header.height * header.channels * header.bytesPerChannel;
+}
+
+/// \brief Dumps the framebuffer into a mapped file.
+///
+/// No encoding and no staging buffer: the pixels go straight from the
+/// framebuffer into the page cache, the OS writes them back asynchronously.
+inline bool writeRaw(const char * filename, int w, int h, int comp, int bytesPerChannel, const void * data)
+{
+    const RawHeader header = makeRawHeader(w, h, comp, bytesPerChannel);
+    const uint64_t payload = rawPayloadSize(header);
+
+    MappedFile file;
+    if (!file.create(filename, header.dataOffset + payload))
+    {
+        return false;
+    }
+    MappedFile::View view = file.map(0, size_t(header.dataOffset + payload));
+    if (!view.data)
+    {
+        return false;
+    }
+    memcpy(view.data, &header, sizeof(header));
+    memcpy(view.data + header.dataOffset, data, size_t(payload));
+    file.unmap(view);
+    return true;
+}
+
+} // namespace image_write_fast
+
+#endif
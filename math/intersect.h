@@ -3,6 +3,20 @@
 //------------------------------------------------------------------------------
 #include "vector.h"
 #include <limits>
+#include <math.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+// GCC 12 warns about the undefined upper lanes the AVX-512 intrinsics start from
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <immintrin.h>
+#endif
+#include "cpu_dispatch.h"
+#include "fast_math.h"
 
 //------------------------------------------------------------------------------
 // sq
@@ -16,6 +30,9 @@ T sq(T a)
 //------------------------------------------------------------------------------
 // intersect_sphere
 //------------------------------------------------------------------------------
+/// \brief FastMath takes the square root with sqrt_fast, the distance is then
+/// within 3e-7 of the exact one relative to the distance to the center.
+template <bool FastMath>
 inline bool intersect_sphere(float & t, const Vec3f & rayDirection,
                              const Vec3f & rayPosition,
                              const Vec3f & spherePosition,
@@ -32,8 +49,9 @@ inline bool intersect_sphere(float & t, const Vec3f & rayDirection,
         return false;
     }
 
-    float d_a = -rayDirection.dot(center.inverse()) + sqrt(root);
-    float d_b = -rayDirection.dot(center.inverse()) - sqrt(root);
+    const float s = FastMath ? sqrt_fast(root) : sqrt(root);
+    float d_a = -rayDirection.dot(center.inverse()) + s;
+    float d_b = -rayDirection.dot(center.inverse()) - s;
 
     // Intersections behind the camera
     // don't count.
@@ -56,6 +74,15 @@ inline bool intersect_sphere(float & t, const Vec3f & rayDirection,
     return true;
 }
 
+inline bool intersect_sphere(float & t, const Vec3f & rayDirection,
+                             const Vec3f & rayPosition,
+                             const Vec3f & spherePosition,
+                             const float sphereRadius)
+{
+    return intersect_sphere<false>(t, rayDirection, rayPosition,
+                                   spherePosition, sphereRadius);
+}
+
 //------------------------------------------------------------------------------
 // intersect_plane
 //------------------------------------------------------------------------------
@@ -104,3 +131,838 @@ inline bool intersect_plane(float & t, const Vec3f & rayDirection,
     return true;
 }
 
+//------------------------------------------------------------------------------
+// intersect_plane
+//------------------------------------------------------------------------------
+/// Plane through planePosition, of any orientation. planeNormal is unit
+/// length, with w = 0.
+inline bool intersect_plane(float & t, const Vec3f & rayDirection,
+                            const Vec3f & rayPosition,
+                            const Vec3f & planePosition,
+                            const Vec3f & planeNormal)
+{
+    const float bottom = rayDirection.dot(planeNormal);
+    if (bottom == 0.0f)
+    {
+        return false;
+    }
+    const float d = (planePosition - rayPosition).dot(planeNormal) / bottom;
+    if (d < 0.0f || d > t)
+    {
+        return false;
+    }
+    t = d;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// intersect_box
+//------------------------------------------------------------------------------
+/// \brief Slab test of a ray against an axis aligned box, branchless (SSE).
+///
+/// rayPosition and invDirection hold x, y, z in their first 3 lanes, boxMin
+/// and boxMax point to x, y, z followed by a 4th float which is read and
+/// ignored. [tNear, tFar] is the part of the ray to test; it is clipped to
+/// the box and the function returns whether anything is left of it. On a
+/// miss, tNear and tFar are meaningless.
+///
+/// A ray parallel to an axis and starting on one of the box's planes gives
+/// 0 * inf = NaN on that axis; the axis is then ignored, as a ray inside the
+/// slab would be.
+inline bool intersect_box(float & tNear, float & tFar,
+                          const __m128 & rayPosition,
+                          const __m128 & invDirection,
+                          const float * boxMin, const float * boxMax)
+{
+    // the 4th float is cleared first, it may be an integer, which reads as a
+    // (very slow) denormal
+    const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_loadu_ps(boxMin), xyz), rayPosition), invDirection);
+    const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_loadu_ps(boxMax), xyz), rayPosition), invDirection);
+
+    // lanes that are NaN, and the 4th lane, don't constrain the range
+    const __m128 valid = _mm_and_ps(_mm_cmpord_ps(t0, t1), xyz);
+    const __m128 slabNear = _mm_or_ps(_mm_and_ps(valid, _mm_min_ps(t0, t1)), _mm_andnot_ps(valid, _mm_set1_ps(-FLT_MAX)));
+    const __m128 slabFar = _mm_or_ps(_mm_and_ps(valid, _mm_max_ps(t0, t1)), _mm_andnot_ps(valid, _mm_set1_ps(FLT_MAX)));
+
+    // the ray is in the box from the last slab entered to the first slab left
+    __m128 enter = _mm_max_ps(slabNear, _mm_movehl_ps(slabNear, slabNear));
+    __m128 exit = _mm_min_ps(slabFar, _mm_movehl_ps(slabFar, slabFar));
+    enter = _mm_max_ss(_mm_max_ss(enter, _mm_shuffle_ps(enter, enter, 1)), _mm_set_ss(tNear));
+    exit = _mm_min_ss(_mm_min_ss(exit, _mm_shuffle_ps(exit, exit, 1)), _mm_set_ss(tFar));
+
+    tNear = _mm_cvtss_f32(enter);
+    tFar = _mm_cvtss_f32(exit);
+    return _mm_comile_ss(enter, exit) != 0;
+}
+
+//------------------------------------------------------------------------------
+// intersect_triangle
+//------------------------------------------------------------------------------
+/// Moller-Trumbore. edge1 = v1 - v0, edge2 = v2 - v0, u and v are the
+/// barycentric weights of v1 and v2 at the hit.
+inline bool intersect_triangle(float & t, float & u, float & v,
+                               const Vec3f & rayDirection,
+                               const Vec3f & rayPosition,
+                               const Vec3f & v0,
+                               const Vec3f & edge1,
+                               const Vec3f & edge2)
+{
+    const Vec3f p = rayDirection.cross(edge2);
+    const float det = edge1.dot(p);
+
+    // Parallel to the triangle, or degenerate.
+    if (fabsf(det) < 1e-12f)
+    {
+        return false;
+    }
+    const float invDet = 1.0f / det;
+
+    const Vec3f s = rayPosition - v0;
+    const float bu = s.dot(p) * invDet;
+    if (bu < 0.0f || bu > 1.0f)
+    {
+        return false;
+    }
+
+    const Vec3f q = s.cross(edge1);
+    const float bv = rayDirection.dot(q) * invDet;
+    if (bv < 0.0f || bu + bv > 1.0f)
+    {
+        return false;
+    }
+
+    const float d = edge2.dot(q) * invDet;
+    if (d < 0.0f || d > t)
+    {
+        return false;
+    }
+
+    t = d;
+    u = bu;
+    v = bv;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// TrianglePacket4
+//------------------------------------------------------------------------------
+/// \brief 4 triangles in SoA layout, for intersect_triangle4.
+///
+/// [axis][lane], lanes without a triangle have zero edges and never hit.
+struct TrianglePacket4
+{
+    float v0[3][4];
+    float edge1[3][4];
+    float edge2[3][4];
+};
+
+//------------------------------------------------------------------------------
+// intersect_triangle4
+//------------------------------------------------------------------------------
+/// Moller-Trumbore against the 4 triangles of a packet at once (SSE).
+/// Returns the lane of the closest hit nearer than t and updates t, u and v,
+/// or returns -1.
+PT_NO_FMA
+inline int intersect_triangle4(float & t, float & u, float & v,
+                               const Vec3f & rayDirection,
+                               const Vec3f & rayPosition,
+                               const TrianglePacket4 & packet)
+{
+    const __m128 dx = _mm_set1_ps(rayDirection.x);
+    const __m128 dy = _mm_set1_ps(rayDirection.y);
+    const __m128 dz = _mm_set1_ps(rayDirection.z);
+
+    const __m128 e1x = _mm_loadu_ps(packet.edge1[0]);
+    const __m128 e1y = _mm_loadu_ps(packet.edge1[1]);
+    const __m128 e1z = _mm_loadu_ps(packet.edge1[2]);
+    const __m128 e2x = _mm_loadu_ps(packet.edge2[0]);
+    const __m128 e2y = _mm_loadu_ps(packet.edge2[1]);
+    const __m128 e2z = _mm_loadu_ps(packet.edge2[2]);
+
+    // p = d x edge2
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+    const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // s = o - v0
+    const __m128 sx = _mm_sub_ps(_mm_set1_ps(rayPosition.x), _mm_loadu_ps(packet.v0[0]));
+    const __m128 sy = _mm_sub_ps(_mm_set1_ps(rayPosition.y), _mm_loadu_ps(packet.v0[1]));
+    const __m128 sz = _mm_sub_ps(_mm_set1_ps(rayPosition.z), _mm_loadu_ps(packet.v0[2]));
+
+    const __m128 bu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+    // q = s x edge1
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+    const __m128 bv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+    const __m128 d = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+    // NaNs from degenerate lanes fail every comparison
+    const __m128 zero = _mm_setzero_ps();
+    __m128 hit = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(bu, zero));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(bv, zero));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(bu, bv), _mm_set1_ps(1.0f)));
+    hit = _mm_and_ps(hit, _mm_cmpge_ps(d, zero));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(d, _mm_set1_ps(t)));
+
+    int mask = _mm_movemask_ps(hit);
+    if (!mask)
+    {
+        return -1;
+    }
+
+    float ds[4], us[4], vs[4];
+    _mm_storeu_ps(ds, d);
+    _mm_storeu_ps(us, bu);
+    _mm_storeu_ps(vs, bv);
+
+    int closest = -1;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        if ((mask >> lane) & 1 && ds[lane] <= t)
+        {
+            t = ds[lane];
+            closest = lane;
+        }
+    }
+    u = us[closest];
+    v = vs[closest];
+    return closest;
+}
+
+//------------------------------------------------------------------------------
+// RayPacket4
+//------------------------------------------------------------------------------
+/// \brief 4 rays in SoA layout, for the packet occlusion tests.
+///
+/// [axis][lane], directions are unit length. A ray is tested over
+/// [0, tFar]; lanes left unused are masked out by the callers.
+struct RayPacket4
+{
+    float position[3][4];
+    float direction[3][4];
+    float invDirection[3][4];
+    float tFar[4];
+};
+
+//------------------------------------------------------------------------------
+// set_ray_packet4
+//------------------------------------------------------------------------------
+inline void set_ray_packet4(RayPacket4 & packet, const int lane,
+                            const Vec3f & rayPosition,
+                            const Vec3f & rayDirection,
+                            const float tFar)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        packet.position[axis][lane] = rayPosition[axis];
+        packet.direction[axis][lane] = rayDirection[axis];
+        packet.invDirection[axis][lane] = 1.0f / rayDirection[axis];
+    }
+    packet.tFar[lane] = tFar;
+}
+
+//------------------------------------------------------------------------------
+// intersect_box_packet4
+//------------------------------------------------------------------------------
+/// Slab test of the 4 rays of a packet against one box (SSE). Returns a mask
+/// with bit i set when ray i enters the box before its tFar. As in
+/// intersect_box, an axis giving NaN doesn't constrain the ray.
+inline int intersect_box_packet4(const RayPacket4 & packet,
+                                 const float * boxMin,
+                                 const float * boxMax)
+{
+    __m128 enter = _mm_setzero_ps();
+    __m128 exit = _mm_loadu_ps(packet.tFar);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const __m128 position = _mm_loadu_ps(packet.position[axis]);
+        const __m128 invDirection = _mm_loadu_ps(packet.invDirection[axis]);
+        const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin[axis]), position), invDirection);
+        const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax[axis]), position), invDirection);
+        const __m128 valid = _mm_cmpord_ps(t0, t1);
+        enter = _mm_or_ps(_mm_and_ps(valid, _mm_max_ps(enter, _mm_min_ps(t0, t1))), _mm_andnot_ps(valid, enter));
+        exit = _mm_or_ps(_mm_and_ps(valid, _mm_min_ps(exit, _mm_max_ps(t0, t1))), _mm_andnot_ps(valid, exit));
+    }
+    return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+}
+
+//------------------------------------------------------------------------------
+// occluded_triangle_packet4
+//------------------------------------------------------------------------------
+/// Moller-Trumbore of the 4 rays of a packet against each triangle of a
+/// TrianglePacket4 in turn (SSE). Returns the mask of the rays of 'active'
+/// that hit any of them before their tFar.
+PT_NO_FMA
+inline int occluded_triangle_packet4(const RayPacket4 & rays,
+                                     const TrianglePacket4 & triangles,
+                                     int active)
+{
+    const __m128 dx = _mm_loadu_ps(rays.direction[0]);
+    const __m128 dy = _mm_loadu_ps(rays.direction[1]);
+    const __m128 dz = _mm_loadu_ps(rays.direction[2]);
+    const __m128 ox = _mm_loadu_ps(rays.position[0]);
+    const __m128 oy = _mm_loadu_ps(rays.position[1]);
+    const __m128 oz = _mm_loadu_ps(rays.position[2]);
+    const __m128 tFar = _mm_loadu_ps(rays.tFar);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    int hits = 0;
+    for (int lane = 0; lane < 4 && (active & ~hits); ++lane)
+    {
+        const __m128 e1x = _mm_set1_ps(triangles.edge1[0][lane]);
+        const __m128 e1y = _mm_set1_ps(triangles.edge1[1][lane]);
+        const __m128 e1z = _mm_set1_ps(triangles.edge1[2][lane]);
+        const __m128 e2x = _mm_set1_ps(triangles.edge2[0][lane]);
+        const __m128 e2y = _mm_set1_ps(triangles.edge2[1][lane]);
+        const __m128 e2z = _mm_set1_ps(triangles.edge2[2][lane]);
+
+        // p = d x edge2
+        const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+        const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+        const __m128 invDet = _mm_div_ps(one, det);
+
+        // s = o - v0
+        const __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(triangles.v0[0][lane]));
+        const __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(triangles.v0[1][lane]));
+        const __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(triangles.v0[2][lane]));
+
+        const __m128 bu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+        // q = s x edge1
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+        const __m128 bv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+        const __m128 d = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+        // empty lanes of the triangle packet have a zero determinant
+        __m128 hit = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(bu, zero));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(bv, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(bu, bv), one));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(d, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(d, tFar));
+        hits |= _mm_movemask_ps(hit);
+    }
+    return hits & active;
+}
+
+//------------------------------------------------------------------------------
+// occluded_sphere_packet4
+//------------------------------------------------------------------------------
+/// The rays of 'active' that hit the sphere before their tFar (SSE), as
+/// intersect_sphere: the nearest intersection in front of the ray counts.
+inline int occluded_sphere_packet4(const RayPacket4 & rays,
+                                   const Vec3f & spherePosition,
+                                   const float sphereRadius,
+                                   const int active)
+{
+    // o = position - center, b = d.o, c = o.o - r^2, t = -b -+ sqrt(b^2 - c)
+    const __m128 ox = _mm_sub_ps(_mm_loadu_ps(rays.position[0]), _mm_set1_ps(spherePosition.x));
+    const __m128 oy = _mm_sub_ps(_mm_loadu_ps(rays.position[1]), _mm_set1_ps(spherePosition.y));
+    const __m128 oz = _mm_sub_ps(_mm_loadu_ps(rays.position[2]), _mm_set1_ps(spherePosition.z));
+    const __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(rays.direction[0]), ox),
+        _mm_mul_ps(_mm_loadu_ps(rays.direction[1]), oy)), _mm_mul_ps(_mm_loadu_ps(rays.direction[2]), oz));
+    const __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz)),
+        _mm_set1_ps(sphereRadius * sphereRadius));
+    const __m128 root = _mm_sub_ps(_mm_mul_ps(b, b), c);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 s = _mm_sqrt_ps(_mm_max_ps(root, zero));
+    const __m128 tNear = _mm_sub_ps(_mm_sub_ps(zero, b), s);
+    const __m128 tFarHit = _mm_add_ps(_mm_sub_ps(zero, b), s);
+    const __m128 tFar = _mm_loadu_ps(rays.tFar);
+
+    // from inside, the far intersection is the one in front
+    const __m128 nearInFront = _mm_and_ps(_mm_cmpge_ps(tNear, zero), _mm_cmple_ps(tNear, tFar));
+    const __m128 farInFront = _mm_and_ps(_mm_cmpge_ps(tFarHit, zero), _mm_cmple_ps(tFarHit, tFar));
+    const __m128 hit = _mm_and_ps(_mm_cmpge_ps(root, zero), _mm_or_ps(nearInFront, _mm_and_ps(_mm_cmplt_ps(tNear, zero), farInFront)));
+    return _mm_movemask_ps(hit) & active;
+}
+
+//------------------------------------------------------------------------------
+// Triangle packet kernels, one variant per instruction set
+//------------------------------------------------------------------------------
+/// The AVX2 and AVX-512 variants test 2 or 4 packets (8 or 16 triangles) at
+/// once with the same operations as intersect_triangle4, so they find the
+/// same triangle at the same distance. All of them, the SSE ones and the
+/// dispatchers too, are PT_NO_FMA: "avx512f" has FMA, and so has every
+/// target of an -mfma build. SSE4.1 adds nothing to these kernels, it uses
+/// the SSE2 one.
+///
+/// Only the triangle kernels have wider variants. The slab tests are one ray
+/// against one box (3 lanes) or a packet of 4 rays against one box, and the
+/// BVH visits one node at a time: a wider register has nothing more to hold.
+/// The sphere tests are one ray against one sphere, or 4 rays against one;
+/// testing 8 or 16 spheres at once would take a different kernel over SoA
+/// leaves of that many spheres, not a wider version of these.
+
+/// Moller-Trumbore of the 8 triangles of packets a and b, lanes 0-3 are a's.
+/// Returns the mask of the hits nearer than t, with their distance and
+/// barycentric coordinates.
+PT_TARGET("avx2") PT_NO_FMA
+inline int intersect_triangle8_avx2(const float t, const __m256 dx,
+                                    const __m256 dy, const __m256 dz,
+                                    const Vec3f & rayPosition,
+                                    const TrianglePacket4 & a,
+                                    const TrianglePacket4 & b,
+                                    float ds[8], float us[8], float vs[8])
+{
+#define PT_LOAD_PAIR(field) _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(a.field)), _mm_loadu_ps(b.field), 1)
+    const __m256 e1x = PT_LOAD_PAIR(edge1[0]);
+    const __m256 e1y = PT_LOAD_PAIR(edge1[1]);
+    const __m256 e1z = PT_LOAD_PAIR(edge1[2]);
+    const __m256 e2x = PT_LOAD_PAIR(edge2[0]);
+    const __m256 e2y = PT_LOAD_PAIR(edge2[1]);
+    const __m256 e2z = PT_LOAD_PAIR(edge2[2]);
+
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(rayPosition.x), PT_LOAD_PAIR(v0[0]));
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(rayPosition.y), PT_LOAD_PAIR(v0[1]));
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(rayPosition.z), PT_LOAD_PAIR(v0[2]));
+#undef PT_LOAD_PAIR
+
+    const __m256 bu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+    const __m256 bv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+    const __m256 d = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 hit = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-12f), _CMP_GT_OQ);
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(bu, zero, _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(bv, zero, _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(bu, bv), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(d, _mm256_set1_ps(t), _CMP_LE_OQ));
+
+    const int mask = _mm256_movemask_ps(hit);
+    if (mask && ds)
+    {
+        _mm256_storeu_ps(ds, d);
+        _mm256_storeu_ps(us, bu);
+        _mm256_storeu_ps(vs, bv);
+    }
+    return mask;
+}
+
+/// The same for the 16 triangles of 4 packets.
+PT_TARGET("avx512f") PT_NO_FMA
+inline int intersect_triangle16_avx512(const float t, const __m512 dx,
+                                       const __m512 dy, const __m512 dz,
+                                       const Vec3f & rayPosition,
+                                       const TrianglePacket4 * packets,
+                                       float ds[16], float us[16], float vs[16])
+{
+#define PT_LOAD_QUAD(field) _mm512_insertf32x4(_mm512_insertf32x4(_mm512_insertf32x4(_mm512_castps128_ps512(_mm_loadu_ps(packets[0].field)), \
+    _mm_loadu_ps(packets[1].field), 1), _mm_loadu_ps(packets[2].field), 2), _mm_loadu_ps(packets[3].field), 3)
+    const __m512 e1x = PT_LOAD_QUAD(edge1[0]);
+    const __m512 e1y = PT_LOAD_QUAD(edge1[1]);
+    const __m512 e1z = PT_LOAD_QUAD(edge1[2]);
+    const __m512 e2x = PT_LOAD_QUAD(edge2[0]);
+    const __m512 e2y = PT_LOAD_QUAD(edge2[1]);
+    const __m512 e2z = PT_LOAD_QUAD(edge2[2]);
+
+    const __m512 px = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+    const __m512 py = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+    const __m512 pz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+
+    const __m512 det = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, px), _mm512_mul_ps(e1y, py)), _mm512_mul_ps(e1z, pz));
+    const __m512 absDet = _mm512_abs_ps(det);
+    const __m512 invDet = _mm512_div_ps(_mm512_set1_ps(1.0f), det);
+
+    const __m512 sx = _mm512_sub_ps(_mm512_set1_ps(rayPosition.x), PT_LOAD_QUAD(v0[0]));
+    const __m512 sy = _mm512_sub_ps(_mm512_set1_ps(rayPosition.y), PT_LOAD_QUAD(v0[1]));
+    const __m512 sz = _mm512_sub_ps(_mm512_set1_ps(rayPosition.z), PT_LOAD_QUAD(v0[2]));
+#undef PT_LOAD_QUAD
+
+    const __m512 bu = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, px), _mm512_mul_ps(sy, py)), _mm512_mul_ps(sz, pz)), invDet);
+
+    const __m512 qx = _mm512_sub_ps(_mm512_mul_ps(sy, e1z), _mm512_mul_ps(sz, e1y));
+    const __m512 qy = _mm512_sub_ps(_mm512_mul_ps(sz, e1x), _mm512_mul_ps(sx, e1z));
+    const __m512 qz = _mm512_sub_ps(_mm512_mul_ps(sx, e1y), _mm512_mul_ps(sy, e1x));
+
+    const __m512 bv = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)), invDet);
+    const __m512 d = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)), invDet);
+
+    const __m512 zero = _mm512_setzero_ps();
+    __mmask16 hit = _mm512_cmp_ps_mask(absDet, _mm512_set1_ps(1e-12f), _CMP_GT_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, bu, zero, _CMP_GE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, bv, zero, _CMP_GE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, _mm512_add_ps(bu, bv), _mm512_set1_ps(1.0f), _CMP_LE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, d, zero, _CMP_GE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, d, _mm512_set1_ps(t), _CMP_LE_OQ);
+
+    if (hit && ds)
+    {
+        _mm512_storeu_ps(ds, d);
+        _mm512_storeu_ps(us, bu);
+        _mm512_storeu_ps(vs, bv);
+    }
+    return int(hit);
+}
+
+/// The closest of the masked hits in lane order, as intersect_triangle4 picks
+/// it: updates t, u and v, returns the lane or -1.
+PT_NO_FMA
+inline int closest_lane(const int mask, const int lanes, float & t,
+                        float & u, float & v, const float * ds,
+                        const float * us, const float * vs)
+{
+    int closest = -1;
+    for (int lane = 0; lane < lanes; ++lane)
+    {
+        if ((mask >> lane) & 1 && ds[lane] <= t)
+        {
+            t = ds[lane];
+            closest = lane;
+        }
+    }
+    if (closest >= 0)
+    {
+        u = us[closest];
+        v = vs[closest];
+    }
+    return closest;
+}
+
+PT_TARGET("avx2") PT_NO_FMA
+inline int intersect_triangle_packets_avx2(float & t, float & u, float & v,
+                                           const Vec3f & rayDirection,
+                                           const Vec3f & rayPosition,
+                                           const TrianglePacket4 * packets,
+                                           const int count)
+{
+    const __m256 dx = _mm256_set1_ps(rayDirection.x);
+    const __m256 dy = _mm256_set1_ps(rayDirection.y);
+    const __m256 dz = _mm256_set1_ps(rayDirection.z);
+    int closest = -1;
+    int p = 0;
+    for (; p + 2 <= count; p += 2)
+    {
+        float ds[8], us[8], vs[8];
+        const int mask = intersect_triangle8_avx2(t, dx, dy, dz, rayPosition, packets[p], packets[p + 1], ds, us, vs);
+        const int lane = mask ? closest_lane(mask, 8, t, u, v, ds, us, vs) : -1;
+        if (lane >= 0)
+        {
+            closest = p * 4 + lane;
+        }
+    }
+    if (p < count)
+    {
+        const int lane = intersect_triangle4(t, u, v, rayDirection, rayPosition, packets[p]);
+        if (lane >= 0)
+        {
+            closest = p * 4 + lane;
+        }
+    }
+    return closest;
+}
+
+PT_TARGET("avx512f") PT_NO_FMA
+inline int intersect_triangle_packets_avx512(float & t, float & u, float & v,
+                                             const Vec3f & rayDirection,
+                                             const Vec3f & rayPosition,
+                                             const TrianglePacket4 * packets,
+                                             const int count)
+{
+    const __m512 dx = _mm512_set1_ps(rayDirection.x);
+    const __m512 dy = _mm512_set1_ps(rayDirection.y);
+    const __m512 dz = _mm512_set1_ps(rayDirection.z);
+    int closest = -1;
+    int p = 0;
+    for (; p + 4 <= count; p += 4)
+    {
+        float ds[16], us[16], vs[16];
+        const int mask = intersect_triangle16_avx512(t, dx, dy, dz, rayPosition, packets + p, ds, us, vs);
+        const int lane = mask ? closest_lane(mask, 16, t, u, v, ds, us, vs) : -1;
+        if (lane >= 0)
+        {
+            closest = p * 4 + lane;
+        }
+    }
+    if (p < count)
+    {
+        const int rest = intersect_triangle_packets_avx2(t, u, v, rayDirection, rayPosition, packets + p, count - p);
+        if (rest >= 0)
+        {
+            closest = p * 4 + rest;
+        }
+    }
+    return closest;
+}
+
+//------------------------------------------------------------------------------
+// intersect_triangle_packets
+//------------------------------------------------------------------------------
+/// Closest hit nearer than t among 'count' consecutive packets, with the
+/// kernel of the given instruction set. Returns packet * 4 + lane and updates
+/// t, u and v, or returns -1.
+PT_NO_FMA
+inline int intersect_triangle_packets(const CpuIsa isa, float & t,
+                                      float & u, float & v,
+                                      const Vec3f & rayDirection,
+                                      const Vec3f & rayPosition,
+                                      const TrianglePacket4 * packets,
+                                      const int count)
+{
+    if (isa >= CpuIsa_Avx512 && count >= 4)
+    {
+        return intersect_triangle_packets_avx512(t, u, v, rayDirection, rayPosition, packets, count);
+    }
+    if (isa >= CpuIsa_Avx2 && count >= 2)
+    {
+        return intersect_triangle_packets_avx2(t, u, v, rayDirection, rayPosition, packets, count);
+    }
+    int closest = -1;
+    for (int p = 0; p < count; ++p)
+    {
+        const int lane = intersect_triangle4(t, u, v, rayDirection, rayPosition, packets[p]);
+        if (lane >= 0)
+        {
+            closest = p * 4 + lane;
+        }
+    }
+    return closest;
+}
+
+PT_TARGET("avx2") PT_NO_FMA
+inline bool occluded_triangle_packets_avx2(const float t,
+                                           const Vec3f & rayDirection,
+                                           const Vec3f & rayPosition,
+                                           const TrianglePacket4 * packets,
+                                           const int count)
+{
+    const __m256 dx = _mm256_set1_ps(rayDirection.x);
+    const __m256 dy = _mm256_set1_ps(rayDirection.y);
+    const __m256 dz = _mm256_set1_ps(rayDirection.z);
+    int p = 0;
+    for (; p + 2 <= count; p += 2)
+    {
+        if (intersect_triangle8_avx2(t, dx, dy, dz, rayPosition, packets[p], packets[p + 1], NULL, NULL, NULL))
+        {
+            return true;
+        }
+    }
+    float d = t, u, v;
+    return p < count && intersect_triangle4(d, u, v, rayDirection, rayPosition, packets[p]) >= 0;
+}
+
+PT_TARGET("avx512f") PT_NO_FMA
+inline bool occluded_triangle_packets_avx512(const float t,
+                                             const Vec3f & rayDirection,
+                                             const Vec3f & rayPosition,
+                                             const TrianglePacket4 * packets,
+                                             const int count)
+{
+    const __m512 dx = _mm512_set1_ps(rayDirection.x);
+    const __m512 dy = _mm512_set1_ps(rayDirection.y);
+    const __m512 dz = _mm512_set1_ps(rayDirection.z);
+    int p = 0;
+    for (; p + 4 <= count; p += 4)
+    {
+        if (intersect_triangle16_avx512(t, dx, dy, dz, rayPosition, packets + p, NULL, NULL, NULL))
+        {
+            return true;
+        }
+    }
+    return p < count && occluded_triangle_packets_avx2(t, rayDirection, rayPosition, packets + p, count - p);
+}
+
+//------------------------------------------------------------------------------
+// occluded_triangle_packets
+//------------------------------------------------------------------------------
+/// Whether any triangle of 'count' consecutive packets is nearer than t.
+PT_NO_FMA
+inline bool occluded_triangle_packets(const CpuIsa isa, const float t,
+                                      const Vec3f & rayDirection,
+                                      const Vec3f & rayPosition,
+                                      const TrianglePacket4 * packets,
+                                      const int count)
+{
+    if (isa >= CpuIsa_Avx512 && count >= 4)
+    {
+        return occluded_triangle_packets_avx512(t, rayDirection, rayPosition, packets, count);
+    }
+    if (isa >= CpuIsa_Avx2 && count >= 2)
+    {
+        return occluded_triangle_packets_avx2(t, rayDirection, rayPosition, packets, count);
+    }
+    for (int p = 0; p < count; ++p)
+    {
+        float d = t, u, v;
+        if (intersect_triangle4(d, u, v, rayDirection, rayPosition, packets[p]) >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// occluded_triangle_packet4, per instruction set
+//------------------------------------------------------------------------------
+/// The 4 rays of the packet in both halves of the register, against a
+/// triangle per half: 2 triangles per step instead of 1.
+PT_TARGET("avx2") PT_NO_FMA
+inline int occluded_triangle_packet4_avx2(const RayPacket4 & rays,
+                                          const TrianglePacket4 & triangles,
+                                          const int active)
+{
+#define PT_LOAD_RAYS(field) _mm256_broadcast_ps((const __m128 *)rays.field)
+    const __m256 dx = PT_LOAD_RAYS(direction[0]);
+    const __m256 dy = PT_LOAD_RAYS(direction[1]);
+    const __m256 dz = PT_LOAD_RAYS(direction[2]);
+    const __m256 ox = PT_LOAD_RAYS(position[0]);
+    const __m256 oy = PT_LOAD_RAYS(position[1]);
+    const __m256 oz = PT_LOAD_RAYS(position[2]);
+    const __m256 tFar = PT_LOAD_RAYS(tFar);
+#undef PT_LOAD_RAYS
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    int hits = 0;
+    for (int lane = 0; lane < 4 && (active & ~hits); lane += 2)
+    {
+#define PT_LOAD_PAIR(field) _mm256_set_m128(_mm_set1_ps(triangles.field[lane + 1]), _mm_set1_ps(triangles.field[lane]))
+        const __m256 e1x = PT_LOAD_PAIR(edge1[0]);
+        const __m256 e1y = PT_LOAD_PAIR(edge1[1]);
+        const __m256 e1z = PT_LOAD_PAIR(edge1[2]);
+        const __m256 e2x = PT_LOAD_PAIR(edge2[0]);
+        const __m256 e2y = PT_LOAD_PAIR(edge2[1]);
+        const __m256 e2z = PT_LOAD_PAIR(edge2[2]);
+
+        const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+        const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+        const __m256 invDet = _mm256_div_ps(one, det);
+
+        const __m256 sx = _mm256_sub_ps(ox, PT_LOAD_PAIR(v0[0]));
+        const __m256 sy = _mm256_sub_ps(oy, PT_LOAD_PAIR(v0[1]));
+        const __m256 sz = _mm256_sub_ps(oz, PT_LOAD_PAIR(v0[2]));
+#undef PT_LOAD_PAIR
+
+        const __m256 bu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+        const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+        const __m256 bv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+        const __m256 d = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+        __m256 hit = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-12f), _CMP_GT_OQ);
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(bu, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(bv, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(bu, bv), one, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(d, tFar, _CMP_LE_OQ));
+
+        // a ray is occluded by either triangle
+        const int mask = _mm256_movemask_ps(hit);
+        hits |= (mask | mask >> 4) & 0xf;
+    }
+    return hits & active;
+}
+
+/// The 4 rays of the packet in each quarter of the register, against the 4
+/// triangles at once, one per quarter.
+PT_TARGET("avx512f") PT_NO_FMA
+inline int occluded_triangle_packet4_avx512(const RayPacket4 & rays,
+                                            const TrianglePacket4 & triangles,
+                                            const int active)
+{
+    const __m512i rayLanes = _mm512_setr_epi32(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+    const __m512i triangleLanes = _mm512_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+#define PT_LOAD_RAYS(field) _mm512_maskz_permutexvar_ps(0xffff, rayLanes, _mm512_zextps128_ps512(_mm_loadu_ps(rays.field)))
+#define PT_LOAD_TRIANGLES(field) _mm512_maskz_permutexvar_ps(0xffff, triangleLanes, _mm512_zextps128_ps512(_mm_loadu_ps(triangles.field)))
+    const __m512 dx = PT_LOAD_RAYS(direction[0]);
+    const __m512 dy = PT_LOAD_RAYS(direction[1]);
+    const __m512 dz = PT_LOAD_RAYS(direction[2]);
+    const __m512 e1x = PT_LOAD_TRIANGLES(edge1[0]);
+    const __m512 e1y = PT_LOAD_TRIANGLES(edge1[1]);
+    const __m512 e1z = PT_LOAD_TRIANGLES(edge1[2]);
+    const __m512 e2x = PT_LOAD_TRIANGLES(edge2[0]);
+    const __m512 e2y = PT_LOAD_TRIANGLES(edge2[1]);
+    const __m512 e2z = PT_LOAD_TRIANGLES(edge2[2]);
+
+    const __m512 px = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+    const __m512 py = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+    const __m512 pz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+
+    const __m512 det = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, px), _mm512_mul_ps(e1y, py)), _mm512_mul_ps(e1z, pz));
+    const __m512 absDet = _mm512_abs_ps(det);
+    const __m512 invDet = _mm512_div_ps(_mm512_set1_ps(1.0f), det);
+
+    const __m512 sx = _mm512_sub_ps(PT_LOAD_RAYS(position[0]), PT_LOAD_TRIANGLES(v0[0]));
+    const __m512 sy = _mm512_sub_ps(PT_LOAD_RAYS(position[1]), PT_LOAD_TRIANGLES(v0[1]));
+    const __m512 sz = _mm512_sub_ps(PT_LOAD_RAYS(position[2]), PT_LOAD_TRIANGLES(v0[2]));
+
+    const __m512 bu = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, px), _mm512_mul_ps(sy, py)), _mm512_mul_ps(sz, pz)), invDet);
+
+    const __m512 qx = _mm512_sub_ps(_mm512_mul_ps(sy, e1z), _mm512_mul_ps(sz, e1y));
+    const __m512 qy = _mm512_sub_ps(_mm512_mul_ps(sz, e1x), _mm512_mul_ps(sx, e1z));
+    const __m512 qz = _mm512_sub_ps(_mm512_mul_ps(sx, e1y), _mm512_mul_ps(sy, e1x));
+
+    const __m512 bv = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)), invDet);
+    const __m512 d = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)), invDet);
+
+    const __m512 zero = _mm512_setzero_ps();
+    __mmask16 hit = _mm512_cmp_ps_mask(absDet, _mm512_set1_ps(1e-12f), _CMP_GT_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, bu, zero, _CMP_GE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, bv, zero, _CMP_GE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, _mm512_add_ps(bu, bv), _mm512_set1_ps(1.0f), _CMP_LE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, d, zero, _CMP_GE_OQ);
+    hit = _mm512_mask_cmp_ps_mask(hit, d, PT_LOAD_RAYS(tFar), _CMP_LE_OQ);
+#undef PT_LOAD_RAYS
+#undef PT_LOAD_TRIANGLES
+
+    // a ray is occluded by any of the triangles
+    const int mask = int(hit);
+    return (mask | mask >> 4 | mask >> 8 | mask >> 12) & active & 0xf;
+}
+
+/// occluded_triangle_packet4 with the kernel of the given instruction set.
+PT_NO_FMA
+inline int occluded_triangle_packet4(const CpuIsa isa,
+                                     const RayPacket4 & rays,
+                                     const TrianglePacket4 & triangles,
+                                     const int active)
+{
+    if (isa >= CpuIsa_Avx512)
+    {
+        return occluded_triangle_packet4_avx512(rays, triangles, active);
+    }
+    if (isa >= CpuIsa_Avx2)
+    {
+        return occluded_triangle_packet4_avx2(rays, triangles, active);
+    }
+    return occluded_triangle_packet4(rays, triangles, active);
+}
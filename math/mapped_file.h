@@ -0,0 +1,258 @@
+//------------------------------------------------------------------------------
+// Memory-mapped files
+//------------------------------------------------------------------------------
+#ifndef PT_H_MAPPED_FILE
+#define PT_H_MAPPED_FILE
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// MappedFile
+//------------------------------------------------------------------------------
+/// \brief A file that is read or written through mapped views.
+///
+/// Views can cover any byte range, offsets don't need to be aligned: the view
+/// is widened to the mapping granularity internally. Sizes and offsets are
+/// 64-bit so files larger than 4GB work on 64-bit builds.
+///
+/// \code
+/// MappedFile file;
+/// file.create("out.raw", size);
+/// MappedFile::View view = file.map(0, size);
+/// memcpy(view.data, pixels, size);
+/// file.unmap(view);
+/// \endcode
+class MappedFile
+{
+public:
+    struct View
+    {
+        uint8_t * data;
+        void * base;
+        size_t baseSize;
+
+        View() : data(NULL), base(NULL), baseSize(0) {}
+    };
+
+    MappedFile()
+        : fileSize(0), writable(false)
+#ifdef _WIN32
+        , file(INVALID_HANDLE_VALUE), mapping(NULL)
+#else
+        , fd(-1)
+#endif
+    {
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    /// Creates (or truncates) a file of 'size' bytes, opened read/write.
+    bool create(const char * filename, uint64_t size)
+    {
+        close();
+        writable = true;
+        fileSize = size;
+#ifdef _WIN32
+        file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        return createMapping();
+#else
+        fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (ftruncate(fd, off_t(size)) != 0)
+        {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    /// Opens an existing file, read only unless 'forWriting'.
+    bool open(const char * filename, bool forWriting = false)
+    {
+        close();
+        writable = forWriting;
+#ifdef _WIN32
+        file = CreateFileA(filename, GENERIC_READ | (forWriting ? GENERIC_WRITE : 0),
+                           FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER size;
+        GetFileSizeEx(file, &size);
+        fileSize = uint64_t(size.QuadPart);
+        return createMapping();
+#else
+        fd = ::open(filename, forWriting ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close();
+            return false;
+        }
+        fileSize = uint64_t(st.st_size);
+        return true;
+#endif
+    }
+
+    bool isOpen() const
+    {
+#ifdef _WIN32
+        return file != INVALID_HANDLE_VALUE;
+#else
+        return fd >= 0;
+#endif
+    }
+
+    uint64_t size() const
+    {
+        return fileSize;
+    }
+
+    /// Maps [offset, offset + size), data is NULL on failure.
+    View map(uint64_t offset, size_t size) const
+    {
+        View view;
+        if (!isOpen() || size == 0 || offset + size > fileSize)
+        {
+            return view;
+        }
+
+        const uint64_t alignedOffset = offset - offset % granularity();
+        const size_t slack = size_t(offset - alignedOffset);
+#ifdef _WIN32
+        void * base = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                    DWORD(alignedOffset >> 32), DWORD(alignedOffset),
+                                    slack + size);
+        if (!base)
+        {
+            return view;
+        }
+#else
+        void * base = mmap(NULL, slack + size,
+                           PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED,
+                           fd, off_t(alignedOffset));
+        if (base == MAP_FAILED)
+        {
+            return view;
+        }
+#endif
+        view.base = base;
+        view.baseSize = slack + size;
+        view.data = static_cast<uint8_t *>(base) + slack;
+        return view;
+    }
+
+    /// Releases a view, dirty pages are written back by the OS in the background.
+    void unmap(View & view) const
+    {
+        if (!view.base)
+        {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(view.base);
+#else
+        munmap(view.base, view.baseSize);
+#endif
+        view = View();
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (mapping)
+        {
+            CloseHandle(mapping);
+            mapping = NULL;
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+        fileSize = 0;
+    }
+
+    /// Offsets given to the OS must be multiples of this.
+    static uint64_t granularity()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwAllocationGranularity;
+#else
+        return uint64_t(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+private:
+    uint64_t fileSize;
+    bool writable;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+
+    bool createMapping()
+    {
+        if (fileSize == 0)
+        {
+            return true;
+        }
+        mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                     DWORD(fileSize >> 32), DWORD(fileSize), NULL);
+        if (!mapping)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+#else
+    int fd;
+#endif
+
+    // not copyable, it owns the handles
+    MappedFile(const MappedFile &);
+    MappedFile & operator=(const MappedFile &);
+};
+
+#endif
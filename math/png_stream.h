@@ -0,0 +1,496 @@
+//------------------------------------------------------------------------------
+// Streaming, multithreaded PNG writer
+//------------------------------------------------------------------------------
+#ifndef PT_H_PNG_STREAM
+#define PT_H_PNG_STREAM
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+//------------------------------------------------------------------------------
+
+namespace png_stream
+{
+
+//------------------------------------------------------------------------------
+// crc32
+//------------------------------------------------------------------------------
+inline uint32_t crc32(uint32_t crc, const uint8_t * data, size_t size)
+{
+    struct Table
+    {
+        uint32_t value[256];
+
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                {
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                value[i] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i != size; ++i)
+    {
+        crc = table.value[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+//------------------------------------------------------------------------------
+// adler32
+//------------------------------------------------------------------------------
+inline uint32_t adler32(uint32_t adler, const uint8_t * data, size_t size)
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+
+    while (size)
+    {
+        // largest n such that b can't overflow before the modulo
+        size_t n = size < 5552 ? size : 5552;
+        size -= n;
+        while (n--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return a | (b << 16);
+}
+
+//------------------------------------------------------------------------------
+// BitWriter
+//------------------------------------------------------------------------------
+/// \brief Appends bits LSB first to a byte vector, as deflate expects.
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<uint8_t> & output)
+        : out(output), buffer(0), count(0)
+    {
+    }
+
+    void write(uint32_t bits, int bitCount)
+    {
+        buffer |= bits << count;
+        count += bitCount;
+        while (count >= 8)
+        {
+            out.push_back(uint8_t(buffer));
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+
+    /// Huffman codes are defined MSB first.
+    void writeCode(uint32_t code, int bitCount)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < bitCount; ++i)
+        {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        write(reversed, bitCount);
+    }
+
+    void alignToByte()
+    {
+        if (count)
+        {
+            write(0, 8 - count);
+        }
+    }
+
+private:
+    std::vector<uint8_t> & out;
+    uint32_t buffer;
+    int count;
+};
+
+//------------------------------------------------------------------------------
+// deflate with the fixed Huffman tables
+//------------------------------------------------------------------------------
+inline void writeLiteral(BitWriter & bits, int symbol)
+{
+    if (symbol <= 143)
+    {
+        bits.writeCode(0x30 + symbol, 8);
+    }
+    else if (symbol <= 255)
+    {
+        bits.writeCode(0x190 + symbol - 144, 9);
+    }
+    else if (symbol <= 279)
+    {
+        bits.writeCode(symbol - 256, 7);
+    }
+    else
+    {
+        bits.writeCode(0xc0 + symbol - 280, 8);
+    }
+}
+
+inline void writeMatch(BitWriter & bits, int length, int distance)
+{
+    static const int lengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int lengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const int distBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const int distExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    int l = 28;
+    while (lengthBase[l] > length)
+    {
+        --l;
+    }
+    writeLiteral(bits, 257 + l);
+    bits.write(length - lengthBase[l], lengthExtra[l]);
+
+    int d = 29;
+    while (distBase[d] > distance)
+    {
+        --d;
+    }
+    bits.writeCode(d, 5);
+    bits.write(distance - distBase[d], distExtra[d]);
+}
+
+/// \brief Compresses data as a single fixed Huffman deflate block.
+///
+/// Matches never reach before 'data', so strips can be compressed independently
+/// and concatenated: unless 'last', the block is followed by an empty stored
+/// block (a sync flush) which leaves the stream byte aligned.
+inline void deflateStrip(std::vector<uint8_t> & out, const uint8_t * data,
+                         size_t size, bool last)
+{
+    const int hashBits = 15;
+    const size_t window = 32768;
+    const size_t maxLength = 258;
+    const int maxChain = 16;
+
+    BitWriter bits(out);
+    bits.write(last ? 1 : 0, 1);
+    bits.write(1, 2);
+
+    std::vector<int32_t> head(size_t(1) << hashBits, -1);
+    std::vector<int32_t> prev(window, -1);
+
+    struct
+    {
+        uint32_t operator()(const uint8_t * p) const
+        {
+            uint32_t v = (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+            return (v * 2654435761u) >> (32 - hashBits);
+        }
+    } hash;
+
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t bestLength = 0;
+        size_t bestDistance = 0;
+
+        if (i + 3 <= size)
+        {
+            const size_t limit = size - i < maxLength ? size - i : maxLength;
+            const uint32_t h = hash(data + i);
+
+            // prev is indexed modulo the window so stale links can show up,
+            // every candidate is verified against the data so they only cost time
+            int32_t candidate = head[h];
+            for (int chain = 0; chain < maxChain && candidate >= 0; ++chain)
+            {
+                const size_t c = size_t(candidate);
+                if (c >= i || i - c > window)
+                {
+                    break;
+                }
+
+                if (data[c + bestLength] == data[i + bestLength])
+                {
+                    size_t length = 0;
+                    while (length < limit && data[c + length] == data[i + length])
+                    {
+                        ++length;
+                    }
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = i - c;
+                        if (length == limit)
+                        {
+                            break;
+                        }
+                    }
+                }
+                candidate = prev[c & (window - 1)];
+            }
+
+            prev[i & (window - 1)] = head[h];
+            head[h] = int32_t(i);
+        }
+
+        if (bestLength >= 3)
+        {
+            writeMatch(bits, int(bestLength), int(bestDistance));
+            for (size_t k = 1; k < bestLength; ++k)
+            {
+                size_t p = i + k;
+                if (p + 3 <= size)
+                {
+                    uint32_t h = hash(data + p);
+                    prev[p & (window - 1)] = head[h];
+                    head[h] = int32_t(p);
+                }
+            }
+            i += bestLength;
+        }
+        else
+        {
+            writeLiteral(bits, data[i]);
+            ++i;
+        }
+    }
+
+    writeLiteral(bits, 256);
+
+    if (!last)
+    {
+        bits.write(0, 1);
+        bits.write(0, 2);
+        bits.alignToByte();
+        out.push_back(0x00);
+        out.push_back(0x00);
+        out.push_back(0xff);
+        out.push_back(0xff);
+    }
+    else
+    {
+        bits.alignToByte();
+    }
+}
+
+//------------------------------------------------------------------------------
+// PNG row filters
+//------------------------------------------------------------------------------
+inline uint8_t paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = p > a ? p - a : a - p;
+    int pb = p > b ? p - b : b - p;
+    int pc = p > c ? p - c : c - p;
+    if (pa <= pb && pa <= pc)
+    {
+        return uint8_t(a);
+    }
+    if (pb <= pc)
+    {
+        return uint8_t(b);
+    }
+    return uint8_t(c);
+}
+
+/// \brief Writes the filter type byte followed by the filtered row.
+///
+/// Tries the 5 filters and keeps the one with the smallest sum of absolute
+/// values, the usual heuristic. 'prev' is NULL for the first row.
+inline void filterRow(uint8_t * out, const uint8_t * row, const uint8_t * prev,
+                      size_t size, int bpp, std::vector<uint8_t> & scratch)
+{
+    scratch.resize(size);
+
+    uint32_t bestScore = ~0u;
+    for (int filter = 0; filter < 5; ++filter)
+    {
+        uint32_t score = 0;
+        for (size_t i = 0; i != size; ++i)
+        {
+            int a = i >= size_t(bpp) ? row[i - bpp] : 0;
+            int b = prev ? prev[i] : 0;
+            int c = prev && i >= size_t(bpp) ? prev[i - bpp] : 0;
+
+            uint8_t predicted = 0;
+            switch (filter)
+            {
+                case 1: predicted = uint8_t(a); break;
+                case 2: predicted = uint8_t(b); break;
+                case 3: predicted = uint8_t((a + b) >> 1); break;
+                case 4: predicted = paeth(a, b, c); break;
+            }
+
+            uint8_t v = uint8_t(row[i] - predicted);
+            scratch[i] = v;
+            score += v < 128 ? v : 256 - v;
+        }
+
+        if (score < bestScore)
+        {
+            bestScore = score;
+            out[0] = uint8_t(filter);
+            memcpy(out + 1, &scratch[0], size);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// writePng
+//------------------------------------------------------------------------------
+inline void writeChunk(FILE * f, const char type[4], const uint8_t * data, size_t size)
+{
+    uint8_t header[8] = {
+        uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size),
+        uint8_t(type[0]), uint8_t(type[1]), uint8_t(type[2]), uint8_t(type[3]) };
+    uint32_t crc = crc32(0, header + 4, 4);
+    crc = crc32(crc, data, size);
+    uint8_t footer[4] = {
+        uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+
+    fwrite(header, 1, 8, f);
+    if (size)
+    {
+        fwrite(data, 1, size, f);
+    }
+    fwrite(footer, 1, 4, f);
+}
+
+/// \brief Writes an 8-bit RGB (comp 3) or RGBA (comp 4) PNG from top-down rows.
+///
+/// The image is cut in strips of 'rowsPerStrip' rows. Each strip is filtered and
+/// deflated on its own thread, batches of strips are written in order as soon as
+/// they are done, so memory stays at a few strips whatever the image size.
+/// Strips don't share a dictionary, which costs a few percent of file size.
+/// 'rowsDone', if given, is advanced as rows reach the file.
+///
+/// \return true on success.
+inline bool writePng(const char * filename, int w, int h, int comp,
+                     const void * data, size_t strideBytes,
+                     std::atomic<int> * rowsDone = NULL, int rowsPerStrip = 32)
+{
+    if (w <= 0 || h <= 0 || (comp != 3 && comp != 4))
+    {
+        return false;
+    }
+
+    FILE * f = fopen(filename, "wb");
+    if (!f)
+    {
+        return false;
+    }
+
+    static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    fwrite(signature, 1, 8, f);
+
+    const uint8_t ihdr[13] = {
+        uint8_t(w >> 24), uint8_t(w >> 16), uint8_t(w >> 8), uint8_t(w),
+        uint8_t(h >> 24), uint8_t(h >> 16), uint8_t(h >> 8), uint8_t(h),
+        8, uint8_t(comp == 4 ? 6 : 2), 0, 0, 0 };
+    writeChunk(f, "IHDR", ihdr, sizeof(ihdr));
+
+    const uint8_t * pixels = static_cast<const uint8_t *>(data);
+    const size_t rowBytes = size_t(w) * comp;
+    const int stripCount = (h + rowsPerStrip - 1) / rowsPerStrip;
+
+    unsigned threadCount = std::thread::hardware_concurrency();
+    threadCount = threadCount ? threadCount : 1;
+
+    struct Strip
+    {
+        std::vector<uint8_t> filtered;
+        std::vector<uint8_t> compressed;
+    };
+    std::vector<Strip> strips(threadCount);
+
+    uint32_t adler = 1;
+    bool first = true;
+    for (int batch = 0; batch < stripCount; batch += threadCount)
+    {
+        const int batchCount = stripCount - batch < int(threadCount) ? stripCount - batch : int(threadCount);
+
+        std::vector<std::thread> workers;
+        for (int s = 0; s < batchCount; ++s)
+        {
+            workers.push_back(std::thread([&, s]()
+            {
+                const int strip = batch + s;
+                const int y0 = strip * rowsPerStrip;
+                const int y1 = y0 + rowsPerStrip < h ? y0 + rowsPerStrip : h;
+
+                Strip & out = strips[s];
+                out.filtered.resize((y1 - y0) * (rowBytes + 1));
+                out.compressed.clear();
+
+                std::vector<uint8_t> scratch;
+                for (int y = y0; y < y1; ++y)
+                {
+                    const uint8_t * row = pixels + y * strideBytes;
+                    const uint8_t * prev = y ? row - strideBytes : NULL;
+                    filterRow(&out.filtered[(y - y0) * (rowBytes + 1)], row, prev, rowBytes, comp, scratch);
+                }
+
+                deflateStrip(out.compressed, &out.filtered[0], out.filtered.size(), strip == stripCount - 1);
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t)
+        {
+            workers[t].join();
+        }
+
+        for (int s = 0; s < batchCount; ++s)
+        {
+            Strip & strip = strips[s];
+            adler = adler32(adler, &strip.filtered[0], strip.filtered.size());
+
+            if (first)
+            {
+                // zlib header: deflate, 32K window, no preset dictionary
+                strip.compressed.insert(strip.compressed.begin(), 0x01);
+                strip.compressed.insert(strip.compressed.begin(), 0x78);
+                first = false;
+            }
+            if (batch + s == stripCount - 1)
+            {
+                strip.compressed.push_back(uint8_t(adler >> 24));
+                strip.compressed.push_back(uint8_t(adler >> 16));
+                strip.compressed.push_back(uint8_t(adler >> 8));
+                strip.compressed.push_back(uint8_t(adler));
+            }
+            writeChunk(f, "IDAT", &strip.compressed[0], strip.compressed.size());
+
+            if (rowsDone)
+            {
+                const int y0 = (batch + s) * rowsPerStrip;
+                *rowsDone = y0 + rowsPerStrip < h ? y0 + rowsPerStrip : h;
+            }
+        }
+    }
+
+    writeChunk(f, "IEND", NULL, 0);
+
+    bool ok = ferror(f) == 0;
+    ok &= fclose(f) == 0;
+    return ok;
+}
+
+} // namespace png_stream
+
+#endif
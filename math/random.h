@@ -0,0 +1,71 @@
+//------------------------------------------------------------------------------
+// Seeded random numbers
+//------------------------------------------------------------------------------
+#ifndef PT_H_RANDOM
+#define PT_H_RANDOM
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <math.h>
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Random
+//------------------------------------------------------------------------------
+/// \brief PCG32 generator (O'Neill 2014, XSH RR variant).
+///
+/// Small state, good statistical quality and the same sequence on every
+/// platform and compiler for a given seed, unlike rand() or the distributions
+/// of <random>, so a seed is enough to reproduce a result.
+class Random
+{
+public:
+    explicit Random(uint64_t seed = 0, uint64_t sequence = 0)
+    {
+        state = 0;
+        increment = (sequence << 1) | 1;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next()
+    {
+        const uint64_t old = state;
+        state = old * 6364136223846793005ull + increment;
+        const uint32_t xorShifted = uint32_t(((old >> 18) ^ old) >> 27);
+        const uint32_t rotation = uint32_t(old >> 59);
+        return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+    }
+
+    /// [0, 1), 24 random bits so every value is exactly representable
+    float uniform()
+    {
+        return (next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /// [min, max)
+    float uniform(float min, float max)
+    {
+        return min + (max - min) * uniform();
+    }
+
+    /// [0, count), with a negligible bias for small counts
+    uint32_t index(uint32_t count)
+    {
+        return uint32_t((uint64_t(next()) * count) >> 32);
+    }
+
+    /// standard normal distribution, Box-Muller (one of the pair is dropped)
+    float normal()
+    {
+        const float u1 = 1.0f - uniform();      // (0, 1], log is finite
+        const float u2 = uniform();
+        return sqrtf(-2.0f * logf(u1)) * cosf(6.28318531f * u2);
+    }
+
+private:
+    uint64_t state;
+    uint64_t increment;
+};
+
+#endif
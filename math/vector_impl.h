@@ -196,6 +196,59 @@ Vector3<T, D> Vector3<T, D>::overwrite(size_t index, T value) const
     return result;
 }
 
+//------------------------------------------------------------------------------
+template <typename T, size_t D>
+Vector3<T, D> Vector3<T, D>::madd(const Vector3& rhs, const T scale) const
+{
+    Vector3 result;
+
+    for (size_t i = 0; i != D; ++i)
+    {
+        result.value[i] = value[i] + rhs.value[i] * scale;
+    }
+    return result;
+}
+
+//------------------------------------------------------------------------------
+template <typename T, size_t D>
+Vector3<T, D> Vector3<T, D>::msub(const Vector3& rhs, const T scale) const
+{
+    Vector3 result;
+
+    for (size_t i = 0; i != D; ++i)
+    {
+        result.value[i] = value[i] - rhs.value[i] * scale;
+    }
+    return result;
+}
+
+#ifdef PT_VECTOR_FMA
+//------------------------------------------------------------------------------
+template <>
+inline Vector3<float, 4> Vector3<float, 4>::madd(const Vector3& rhs,
+                                                 const float scale) const
+{
+    Vector3 result;
+    _mm_storeu_ps(result.value, _mm_fmadd_ps(_mm_loadu_ps(rhs.value),
+                                             _mm_set1_ps(scale),
+                                             _mm_loadu_ps(value)));
+    return result;
+}
+
+//------------------------------------------------------------------------------
+template <>
+inline Vector3<float, 4> Vector3<float, 4>::msub(const Vector3& rhs,
+                                                 const float scale) const
+{
+    Vector3 result;
+    // -(rhs * scale) + this
+    _mm_storeu_ps(result.value, _mm_fnmadd_ps(_mm_loadu_ps(rhs.value),
+                                              _mm_set1_ps(scale),
+                                              _mm_loadu_ps(value)));
+    return result;
+}
+#endif
+
 //------------------------------------------------------------------------------
 template <typename T, size_t D>
 T Vector3<T, D>::dot(const Vector3& rhs) const
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+// Indexed triangle mesh, vertex positions and triangle indices are stored SoA.
+// build() makes a BVH over the triangles and packs every leaf into SIMD packets of 4 triangles,
+// after that a leaf is one call of the triangle kernel of cpu_isa(), which tests 1, 2 or 4 packets at once;
+// the leaves hold as many. Edit the arrays, then build() again.
+class Mesh : public Prim
+{
+public:
+	std::vector<f32> x, y, z;		// vertex positions
+	std::vector<u32> i0, i1, i2;	// vertex indices of each triangle
+
+	// file the mesh was loaded from, if any, and the transform applied to it since
+	std::string source;
+	Vec3f offset;
+	f32 scale;
+
+	Mesh()
+		: offset(0)
+		, scale(1)
+	{
+	}
+
+	Mesh( const char* _name, const u32 _material )
+		: Prim(_name, _material)
+		, offset(0)
+		, scale(1)
+	{
+	}
+
+	u32 vertexCount() const
+	{
+		return u32(x.size());
+	}
+	u32 triangleCount() const
+	{
+		return u32(i0.size());
+	}
+
+	Vec3f vertex( const u32 i ) const
+	{
+		return Vec3f(x[i], y[i], z[i]);
+	}
+
+	Aabb bounds() const
+	{
+		Aabb box;
+		for (u32 i = 0; i < vertexCount(); ++i)
+		{
+			box.grow(vertex(i));
+		}
+		return box;
+	}
+
+	// scales the vertices around the origin, then offsets them
+	void transform( const Vec3f _offset, const f32 _scale )
+	{
+		for (u32 i = 0; i < vertexCount(); ++i)
+		{
+			x[i] = x[i] * _scale + _offset.x;
+			y[i] = y[i] * _scale + _offset.y;
+			z[i] = z[i] * _scale + _offset.z;
+		}
+		offset = offset * _scale + _offset;
+		scale *= _scale;
+	}
+
+	// scales and moves the mesh so it stands on 'floor', centered, 'height' tall (or as wide on another axis)
+	void fit( const Vec3f floor, const f32 height )
+	{
+		Aabb box = bounds();
+		if (box.empty())
+		{
+			return;
+		}
+		Vec3f extent = box.max - box.min;
+		f32 size = std::max(extent.x, std::max(extent.y, extent.z));
+		f32 scale = size > 0 ? height / size : 1;
+		Vec3f center = box.center();
+		transform(Vec3f(floor.x - center.x * scale, floor.y - box.min.y * scale, floor.z - center.z * scale), scale);
+	}
+
+	void build()
+	{
+		const u32 count = triangleCount();
+		std::vector<Aabb> boxes(count);
+		for (u32 t = 0; t < count; ++t)
+		{
+			boxes[t].grow(vertex(i0[t]));
+			boxes[t].grow(vertex(i1[t]));
+			boxes[t].grow(vertex(i2[t]));
+		}
+		const CpuIsa isa = cpu_isa();
+		bvh.build(count ? &boxes[0] : NULL, count, isa >= CpuIsa_Avx512 ? 16 : isa >= CpuIsa_Avx2 ? 8 : 4);
+
+		// leaves are re-pointed at their packets: first = first packet, count = packet count
+		u32 packetCount = 0;
+		for (u32 n = 0; n < bvh.nodes.size(); ++n)
+		{
+			packetCount += (bvh.nodes[n].count + 3) / 4;
+		}
+		packets.clear();
+		packetTriangles.clear();
+		packets.reserve(packetCount);
+		packetTriangles.reserve(packetCount * 4);
+		for (u32 n = 0; n < bvh.nodes.size(); ++n)
+		{
+			BvhNode& node = bvh.nodes[n];
+			if (node.count == 0)
+			{
+				continue;
+			}
+
+			const u32 firstPacket = u32(packets.size());
+			for (u32 i = 0; i < node.count; i += 4)
+			{
+				TrianglePacket4 packet;
+				memset(&packet, 0, sizeof(packet));
+				for (u32 lane = 0; lane < 4; ++lane)
+				{
+					u32 triangle = i + lane < node.count ? bvh.items[node.first + i + lane] : NoTriangle;
+					packetTriangles.push_back(triangle);
+					if (triangle == NoTriangle)
+					{
+						continue;
+					}
+					Vec3f v0 = vertex(i0[triangle]);
+					Vec3f e1 = vertex(i1[triangle]) - v0;
+					Vec3f e2 = vertex(i2[triangle]) - v0;
+					for (u32 axis = 0; axis < 3; ++axis)
+					{
+						packet.v0[axis][lane] = v0[axis];
+						packet.edge1[axis][lane] = e1[axis];
+						packet.edge2[axis][lane] = e2[axis];
+					}
+				}
+				packets.push_back(packet);
+			}
+			node.first = firstPacket;
+			node.count = u32(packets.size()) - firstPacket;
+		}
+
+		// the packets hold everything the intersection needs
+		std::vector<u32>().swap(bvh.items);
+	}
+
+	// subIndex is the triangle
+	bool intersect( const Ray& ray, f32& dist, u32& subIndex ) const
+	{
+		bool hit = false;
+		const CpuIsa isa = cpu_isa();
+		bvh.traverse(ray, dist, [&]( u32 first, u32 count, f32& tmax )
+		{
+			f32 u, v;
+			int triangle = intersect_triangle_packets(isa, tmax, u, v, ray.dir, ray.pos, &packets[first], int(count));
+			if (triangle >= 0)
+			{
+				subIndex = packetTriangles[first * 4 + triangle];
+				hit = true;
+			}
+		});
+		return hit;
+	}
+
+	// any triangle closer than dist
+	bool occluded( const Ray& ray, const f32 dist ) const
+	{
+		const CpuIsa isa = cpu_isa();
+		return bvh.occluded(ray, dist, [&]( u32 first, u32 count, f32 tmax )
+		{
+			return occluded_triangle_packets(isa, tmax, ray.dir, ray.pos, &packets[first], int(count));
+		});
+	}
+
+	// the rays of 'active' occluded closer than their tFar
+	int occluded4( const RayPacket4& rays, const int active ) const
+	{
+		const CpuIsa isa = cpu_isa();
+		return bvh.occluded4(rays, active, [&]( u32 first, u32 count, int open )
+		{
+			int hits = 0;
+			for (u32 p = first; p < first + count && (open & ~hits); ++p)
+			{
+				hits |= occluded_triangle_packet4(isa, rays, packets[p], open & ~hits);
+			}
+			return hits;
+		});
+	}
+
+	// geometric normal, from the winding
+	Vec3f getNormal( const Vec3f hitPos, const u32 subIndex ) const
+	{
+		Vec3f v0 = vertex(i0[subIndex]);
+		return (vertex(i1[subIndex]) - v0).cross(vertex(i2[subIndex]) - v0).normalized();
+	}
+
+	Vec3f getNormalFast( const Vec3f hitPos, const u32 subIndex ) const
+	{
+		Vec3f v0 = vertex(i0[subIndex]);
+		return normalized_fast((vertex(i1[subIndex]) - v0).cross(vertex(i2[subIndex]) - v0));
+	}
+
+	// bounds of the built mesh, without going through the vertices
+	Aabb treeBounds() const
+	{
+		return bvh.bounds();
+	}
+
+	u32 nodeCount() const
+	{
+		return u32(bvh.nodes.size());
+	}
+
+	size_t memoryUsage() const
+	{
+		return (x.capacity() + y.capacity() + z.capacity()) * sizeof(f32)
+			+ (i0.capacity() + i1.capacity() + i2.capacity()) * sizeof(u32)
+			+ bvh.nodes.capacity() * sizeof(BvhNode)
+			+ packets.capacity() * sizeof(TrianglePacket4)
+			+ packetTriangles.capacity() * sizeof(u32);
+	}
+
+private:
+	enum { NoTriangle = 0xffffffffu };
+
+	Bvh bvh;
+	std::vector<TrianglePacket4> packets;
+	std::vector<u32> packetTriangles;	// 4 per packet, the triangle in each lane
+};
@@ -0,0 +1,412 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "parallel.hpp"
+#include "math/mapped_file.h"
+
+// Wavefront OBJ, positions and faces only: 'v' and 'f' lines, everything else is skipped.
+// Faces may use the v, v/vt, v//vn and v/vt/vn forms and negative (relative) indices, polygons
+// are fanned into triangles.
+//
+// The file is mapped and cut into line-aligned chunks parsed in parallel, in two passes: the
+// first counts the vertices and triangles of every chunk, a prefix sum gives each chunk where
+// to write, the second parses straight into the mesh arrays.
+
+namespace obj
+{
+	inline bool isSpace( const char c )
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline const char* skipSpaces( const char* p, const char* end )
+	{
+		while (p < end && isSpace(*p))
+		{
+			++p;
+		}
+		return p;
+	}
+
+	inline const char* skipLine( const char* p, const char* end )
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		return eol ? eol + 1 : end;
+	}
+
+	// [-]digits[.digits][e[-]digits], NULL if there is no number at p
+	inline const char* parseFloat( const char* p, const char* end, f32& value )
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+
+		// 19 digits fit a u64, further ones only move the exponent
+		u64 mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+		int significant = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+		{
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + u64(*p - '0');
+				significant += mantissa != 0;
+			}
+			else
+			{
+				++exponent;
+			}
+		}
+		if (p < end && *p == '.')
+		{
+			for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+			{
+				if (significant < 19)
+				{
+					mantissa = mantissa * 10 + u64(*p - '0');
+					significant += mantissa != 0;
+					--exponent;
+				}
+			}
+		}
+		if (digits == 0)
+		{
+			return NULL;
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			++p;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negativeExponent = *p == '-';
+				++p;
+			}
+			int e = 0;
+			for (; p < end && *p >= '0' && *p <= '9'; ++p)
+			{
+				e = std::min(e * 10 + (*p - '0'), 1000);
+			}
+			exponent += negativeExponent ? -e : e;
+		}
+
+		double result = double(mantissa);
+		for (; exponent > 22; exponent -= 22)
+		{
+			result *= 1e22;
+		}
+		for (; exponent < -22; exponent += 22)
+		{
+			result /= 1e22;
+		}
+		result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+
+		value = f32(negative ? -result : result);
+		return p;
+	}
+
+	inline const char* parseInt( const char* p, const char* end, i32& value )
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+		const char* first = p;
+		i64 result = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			result = std::min(result * 10 + (*p - '0'), i64(0x7fffffff));
+		}
+		if (p == first)
+		{
+			return NULL;
+		}
+		value = i32(negative ? -result : result);
+		return p;
+	}
+
+	// after the 'f', the number of corners of the face
+	inline u32 countCorners( const char* p, const char* end )
+	{
+		u32 corners = 0;
+		for (;;)
+		{
+			p = skipSpaces(p, end);
+			if (p == end || *p == '\n' || *p == '#')
+			{
+				return corners;
+			}
+			++corners;
+			while (p < end && !isSpace(*p) && *p != '\n')
+			{
+				++p;
+			}
+		}
+	}
+
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		u32 vertexCount;
+		u32 triangleCount;
+		u32 firstVertex;
+		u32 firstTriangle;
+		const char* error;		// the line that failed, NULL if all went well
+	};
+
+	inline void countChunk( Chunk& chunk )
+	{
+		u64 vertexCount = 0;
+		u64 triangleCount = 0;
+		for (const char* p = chunk.begin; p < chunk.end; p = skipLine(p, chunk.end))
+		{
+			const char* line = skipSpaces(p, chunk.end);
+			if (chunk.end - line < 2 || !isSpace(line[1]))
+			{
+				continue;
+			}
+			if (line[0] == 'v')
+			{
+				++vertexCount;
+			}
+			else if (line[0] == 'f')
+			{
+				u32 corners = countCorners(line + 1, chunk.end);
+				triangleCount += corners >= 3 ? corners - 2 : 0;
+				if (corners < 3)
+				{
+					chunk.error = chunk.error ? chunk.error : line;
+				}
+			}
+		}
+		if (vertexCount > 0xffffffffu || triangleCount > 0xffffffffu)
+		{
+			chunk.error = chunk.begin;
+		}
+		chunk.vertexCount = u32(vertexCount);
+		chunk.triangleCount = u32(triangleCount);
+	}
+
+	inline void parseChunk( Chunk& chunk, const u32 totalVertexCount, Mesh& mesh )
+	{
+		u32 vertex = chunk.firstVertex;
+		u32 triangle = chunk.firstTriangle;
+		for (const char* p = chunk.begin; p < chunk.end && !chunk.error; p = skipLine(p, chunk.end))
+		{
+			const char* line = skipSpaces(p, chunk.end);
+			if (chunk.end - line < 2 || !isSpace(line[1]))
+			{
+				continue;
+			}
+
+			if (line[0] == 'v')
+			{
+				const char* q = line + 1;
+				f32 v[3];
+				for (u32 axis = 0; axis < 3 && q; ++axis)
+				{
+					q = parseFloat(skipSpaces(q, chunk.end), chunk.end, v[axis]);
+				}
+				if (!q)
+				{
+					chunk.error = line;
+					break;
+				}
+				mesh.x[vertex] = v[0];
+				mesh.y[vertex] = v[1];
+				mesh.z[vertex] = v[2];
+				++vertex;
+			}
+			else if (line[0] == 'f')
+			{
+				const u32 corners = countCorners(line + 1, chunk.end);
+				const char* q = line + 1;
+				u32 first = 0, previous = 0;
+				for (u32 corner = 0; corner < corners; ++corner)
+				{
+					// relative indices count back from the last vertex read so far
+					i32 index;
+					q = parseInt(skipSpaces(q, chunk.end), chunk.end, index);
+					i64 resolved = !q || index == 0 ? -1 : index > 0 ? i64(index) - 1 : i64(vertex) + index;
+					if (resolved < 0 || resolved >= totalVertexCount)
+					{
+						chunk.error = line;
+						break;
+					}
+					while (q < chunk.end && !isSpace(*q) && *q != '\n')
+					{
+						++q;
+					}
+
+					const u32 current = u32(resolved);
+					if (corner == 0)
+					{
+						first = current;
+					}
+					else if (corner >= 2)
+					{
+						mesh.i0[triangle] = first;
+						mesh.i1[triangle] = previous;
+						mesh.i2[triangle] = current;
+						++triangle;
+					}
+					previous = current;
+				}
+			}
+		}
+	}
+
+	inline u32 lineNumber( const char* begin, const char* at )
+	{
+		u32 line = 1;
+		for (const char* p = begin; p < at; ++p)
+		{
+			line += *p == '\n';
+		}
+		return line;
+	}
+}
+
+// fills the vertex and index arrays, the caller transforms the mesh then builds it
+inline bool loadObj( const char* filename, Mesh& mesh )
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		fprintf(stderr, "can't open %s\n", filename);
+		return false;
+	}
+	const u64 size = file.size();
+	MappedFile::View view = size ? file.map(0, size_t(size)) : MappedFile::View();
+	if (size && !view.data)
+	{
+		fprintf(stderr, "can't map %s\n", filename);
+		return false;
+	}
+	const char* data = (const char*)view.data;
+	const char* end = data + size;
+
+	// chunks of at least 1MB, starting on a line
+	const u64 chunkSize = std::max(u64(1) << 20, size / (workerCount() * 8) + 1);
+	std::vector<obj::Chunk> chunks;
+	for (const char* p = data; p < end; )
+	{
+		obj::Chunk chunk;
+		memset(&chunk, 0, sizeof(chunk));
+		chunk.begin = p;
+		chunk.end = u64(end - p) > chunkSize ? obj::skipLine(p + chunkSize, end) : end;
+		chunks.push_back(chunk);
+		p = chunk.end;
+	}
+	const u32 chunkCount = u32(chunks.size());
+
+	parallelFor(chunkCount, 1, [&]( u32 begin, u32 end )
+	{
+		for (u32 i = begin; i < end; ++i)
+		{
+			obj::countChunk(chunks[i]);
+		}
+	});
+
+	u64 vertexCount = 0;
+	u64 triangleCount = 0;
+	for (u32 i = 0; i < chunkCount; ++i)
+	{
+		chunks[i].firstVertex = u32(vertexCount);
+		chunks[i].firstTriangle = u32(triangleCount);
+		vertexCount += chunks[i].vertexCount;
+		triangleCount += chunks[i].triangleCount;
+	}
+
+	bool ok = vertexCount <= 0xffffffffu && triangleCount <= 0xffffffffu;
+	if (!ok)
+	{
+		fprintf(stderr, "%s: too many vertices or triangles\n", filename);
+	}
+	else
+	{
+		mesh.x.resize(size_t(vertexCount));
+		mesh.y.resize(size_t(vertexCount));
+		mesh.z.resize(size_t(vertexCount));
+		mesh.i0.resize(size_t(triangleCount));
+		mesh.i1.resize(size_t(triangleCount));
+		mesh.i2.resize(size_t(triangleCount));
+
+		parallelFor(chunkCount, 1, [&]( u32 begin, u32 end )
+		{
+			for (u32 i = begin; i < end; ++i)
+			{
+				if (!chunks[i].error)
+				{
+					obj::parseChunk(chunks[i], u32(vertexCount), mesh);
+				}
+			}
+		});
+
+		// the first error in the file
+		for (u32 i = 0; i < chunkCount && ok; ++i)
+		{
+			if (chunks[i].error)
+			{
+				const char* line = chunks[i].error;
+				const char* eol = (const char*)memchr(line, '\n', end - line);
+				eol = eol ? eol : end;
+				fprintf(stderr, "%s(%u): can't parse '%.*s'\n", filename, obj::lineNumber(data, line), int(eol - line), line);
+				ok = false;
+			}
+		}
+		if (ok && triangleCount == 0)
+		{
+			fprintf(stderr, "%s: no triangles\n", filename);
+			ok = false;
+		}
+	}
+
+	file.unmap(view);
+	if (!ok)
+	{
+		mesh.x.clear();
+		mesh.y.clear();
+		mesh.z.clear();
+		mesh.i0.clear();
+		mesh.i1.clear();
+		mesh.i2.clear();
+		return false;
+	}
+	mesh.source = filename;
+	return true;
+}
+
+// positions and triangles only, %.9g round-trips floats exactly
+inline bool saveObj( const char* filename, const Mesh& mesh )
+{
+	FILE* f = fopen(filename, "w");
+	if (!f)
+	{
+		return false;
+	}
+	fprintf(f, "# %s, %u vertices, %u triangles\n", mesh.name, mesh.vertexCount(), mesh.triangleCount());
+	for (u32 i = 0; i < mesh.vertexCount(); ++i)
+	{
+		fprintf(f, "v %.9g %.9g %.9g\n", mesh.x[i], mesh.y[i], mesh.z[i]);
+	}
+	for (u32 i = 0; i < mesh.triangleCount(); ++i)
+	{
+		fprintf(f, "f %u %u %u\n", mesh.i0[i] + 1, mesh.i1[i] + 1, mesh.i2[i] + 1);
+	}
+	return fclose(f) == 0;
+}
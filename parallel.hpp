@@ -0,0 +1,49 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+inline u32 workerCount()
+{
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// calls func(begin, end) over [0, count) in chunks of 'grain' items, spread over all hardware threads
+// the calling thread takes part, chunks are handed out dynamically so uneven rows balance out
+template<typename F>
+void parallelFor( const u32 count, const u32 grain, const F& func )
+{
+	const u32 chunkCount = (count + grain - 1) / grain;
+	const u32 threadCount = std::min(workerCount(), chunkCount);
+	if (threadCount <= 1)
+	{
+		if (count)
+		{
+			func(0u, count);
+		}
+		return;
+	}
+
+	std::atomic<u32> nextChunk(0);
+	auto worker = [&]()
+	{
+		for (u32 chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++)
+		{
+			u32 begin = chunk * grain;
+			func(begin, std::min(begin + grain, count));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (u32 i = 1; i < threadCount; ++i)
+	{
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (u32 i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "parallel.hpp"
+
+// Photons left by light paths on diffuse surfaces, and the irradiance they give around a point.
+// The photons are kept in a flat array ordered as an implicit balanced kd-tree: the photon in the middle of
+// a range splits it on its axis, the lower half of the range holds the photons below it, the upper half
+// those above; no pointers, and the top of the tree, which every query goes through, is a few cache lines.
+// Gathering finds the gatherCount nearest photons within gatherRadius with a bounded max-heap, and divides
+// their power by the area of the disk they cover.
+class PhotonMap
+{
+public:
+	struct Photon
+	{
+		f32 pos[3];
+		f32 power[3];		// flux, rgb
+		f32 dir[3];			// travel direction, towards the surface
+		u32 axis;			// split axis in the tree
+
+		// not a template, so std::nth_element doesn't find it ambiguous with the global swap
+		friend void swap( Photon& a, Photon& b )
+		{
+			const Photon t = a;
+			a = b;
+			b = t;
+		}
+	};
+
+	u32 photonCount;	// emitted per build, over all the lights
+	u32 gatherCount;	// nearest photons in an estimate
+	f32 gatherRadius;	// furthest photon in an estimate
+
+	// stage timings of the last build, and what it stored
+	f32 emitMs;
+	f32 buildMs;
+	u32 emitted;
+
+	PhotonMap()
+		: photonCount(100000)
+		, gatherCount(128)
+		, gatherRadius(0.5f)
+		, emitMs(0)
+		, buildMs(0)
+		, emitted(0)
+		, built(false)
+	{
+	}
+
+	// the map is built again before the next photon mapped render
+	void clear()
+	{
+		std::vector<Photon>().swap(photons);
+		built = false;
+	}
+
+	bool isBuilt() const
+	{
+		return built;
+	}
+
+	u32 size() const
+	{
+		return u32(photons.size());
+	}
+
+	size_t memoryUsage() const
+	{
+		return photons.capacity() * sizeof(Photon);
+	}
+
+	// takes the photons of every emitting chunk, in order, and sorts them into the tree
+	void build( std::vector<std::vector<Photon> >& chunks )
+	{
+		size_t total = 0;
+		for (u32 i = 0; i < chunks.size(); ++i)
+		{
+			total += chunks[i].size();
+		}
+		photons.clear();
+		photons.reserve(total);
+		for (u32 i = 0; i < chunks.size(); ++i)
+		{
+			photons.insert(photons.end(), chunks[i].begin(), chunks[i].end());
+			std::vector<Photon>().swap(chunks[i]);
+		}
+
+		// the top levels split the array into enough subtrees for every thread, each subtree is balanced by one;
+		// ranges are begin, end pairs
+		std::vector<u32> ranges;
+		ranges.push_back(0);
+		ranges.push_back(u32(photons.size()));
+		while (ranges.size() / 2 < workerCount() * 4 && photons.size() / (ranges.size() / 2) > 1024)
+		{
+			std::vector<u32> split;
+			for (u32 i = 0; i < ranges.size(); i += 2)
+			{
+				const u32 mid = splitRange(ranges[i], ranges[i + 1]);
+				split.push_back(ranges[i]);
+				split.push_back(mid);
+				split.push_back(mid + 1);
+				split.push_back(ranges[i + 1]);
+			}
+			ranges.swap(split);
+		}
+		parallelFor(u32(ranges.size() / 2), 1, [&]( u32 begin, u32 end )
+		{
+			for (u32 i = begin; i < end; ++i)
+			{
+				balance(ranges[i * 2], ranges[i * 2 + 1]);
+			}
+		});
+		built = true;
+	}
+
+	// irradiance at a point from the photons arriving on the side the normal faces
+	Vec3f irradiance( const Vec3f pos, const Vec3f normal ) const
+	{
+		Neighbour heap[MaxGather];
+		u32 found = 0;
+		const u32 k = std::max(1u, std::min(gatherCount, u32(MaxGather)));
+		f32 maxDistSq = gatherRadius * gatherRadius;
+		const f32 p[3] = { pos.x, pos.y, pos.z };
+		if (!photons.empty())
+		{
+			gather(0, u32(photons.size()), p, k, heap, found, maxDistSq);
+		}
+
+		Vec3f sum(0);
+		for (u32 i = 0; i < found; ++i)
+		{
+			const Photon& photon = photons[heap[i].index];
+			if (photon.dir[0] * normal.x + photon.dir[1] * normal.y + photon.dir[2] * normal.z < 0)
+			{
+				sum += Vec3f(photon.power[0], photon.power[1], photon.power[2]);
+			}
+		}
+		return maxDistSq > 0 ? sum * (1 / (Pi * maxDistSq)) : Vec3f(0);
+	}
+
+	// returns true when the map was cleared
+	bool onGui()
+	{
+		bool changed = false;
+
+		ImGui::BeginProperty("Photons");
+		changed |= ImGui::DragInt("", (int*)&photonCount, 1000.f, 1000, 10000000);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Gather count");
+		changed |= ImGui::DragInt("", (int*)&gatherCount, 1.f, 1, MaxGather);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Gather radius");
+		changed |= ImGui::DragFloat("", &gatherRadius, 0.01f, 0.001f, 100.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::Text("%u photons stored of %u, emit %.1f ms, build %.1f ms", size(), emitted, emitMs, buildMs);
+
+		if (changed)
+		{
+			gatherCount = std::min(std::max(gatherCount, 1u), u32(MaxGather));
+			clear();
+		}
+		return changed;
+	}
+
+private:
+	enum { MaxGather = 512 };
+
+	struct Neighbour
+	{
+		f32 distSq;
+		u32 index;
+
+		bool operator<( const Neighbour& other ) const
+		{
+			return distSq < other.distSq;
+		}
+	};
+
+	std::vector<Photon> photons;
+	bool built;
+
+	// the median along the widest axis of the range goes in the middle, then each half the same
+	void balance( const u32 begin, const u32 end )
+	{
+		if (end - begin <= 1)
+		{
+			if (end > begin)
+			{
+				photons[begin].axis = 0;
+			}
+			return;
+		}
+		const u32 mid = splitRange(begin, end);
+		balance(begin, mid);
+		balance(mid + 1, end);
+	}
+
+	// puts the median along the widest axis of the range in its middle, returns where that is
+	u32 splitRange( const u32 begin, const u32 end )
+	{
+		f32 lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		f32 hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (u32 i = begin; i < end; ++i)
+		{
+			for (u32 a = 0; a < 3; ++a)
+			{
+				lo[a] = std::min(lo[a], photons[i].pos[a]);
+				hi[a] = std::max(hi[a], photons[i].pos[a]);
+			}
+		}
+		u32 axis = 0;
+		for (u32 a = 1; a < 3; ++a)
+		{
+			if (hi[a] - lo[a] > hi[axis] - lo[axis])
+			{
+				axis = a;
+			}
+		}
+
+		const u32 mid = (begin + end) / 2;
+		std::nth_element(photons.begin() + begin, photons.begin() + mid, photons.begin() + end, [axis]( const Photon& a, const Photon& b )
+		{
+			return a.pos[axis] < b.pos[axis];
+		});
+		photons[mid].axis = axis;
+		return mid;
+	}
+
+	// the near half first, the far one only if the splitting plane is closer than the k-th photon so far
+	void gather( const u32 begin, const u32 end, const f32 pos[3], const u32 k, Neighbour* heap, u32& found, f32& maxDistSq ) const
+	{
+		const u32 mid = (begin + end) / 2;
+		const Photon& photon = photons[mid];
+		const f32 delta = pos[photon.axis] - photon.pos[photon.axis];
+		if (end - begin > 1)
+		{
+			if (delta < 0)
+			{
+				gather(begin, mid, pos, k, heap, found, maxDistSq);
+			}
+			else if (mid + 1 < end)
+			{
+				gather(mid + 1, end, pos, k, heap, found, maxDistSq);
+			}
+		}
+
+		const f32 dx = pos[0] - photon.pos[0], dy = pos[1] - photon.pos[1], dz = pos[2] - photon.pos[2];
+		const f32 distSq = dx * dx + dy * dy + dz * dz;
+		if (distSq < maxDistSq)
+		{
+			const Neighbour neighbour = { distSq, mid };
+			if (found < k)
+			{
+				heap[found++] = neighbour;
+				std::push_heap(heap, heap + found);
+			}
+			else
+			{
+				std::pop_heap(heap, heap + found);
+				heap[found - 1] = neighbour;
+				std::push_heap(heap, heap + found);
+			}
+			if (found == k)
+			{
+				maxDistSq = heap[0].distSq;
+			}
+		}
+
+		if (end - begin > 1 && delta * delta < maxDistSq)
+		{
+			if (delta < 0)
+			{
+				if (mid + 1 < end)
+				{
+					gather(mid + 1, end, pos, k, heap, found, maxDistSq);
+				}
+			}
+			else
+			{
+				gather(begin, mid, pos, k, heap, found, maxDistSq);
+			}
+		}
+	}
+};
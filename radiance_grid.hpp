@@ -0,0 +1,244 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <math.h>
+
+// A fast, approximate stand-in for the irradiance cache: the indirect irradiance arriving at the surfaces in
+// each cell of a world-space grid, for each of 16 quantized normal directions (octahedral bins), averaged over
+// every path that was traced from there. Shading points add their paths to their cell until it holds
+// maxSamples of them, and read the cell and its neighbours back, trilinearly weighted, so the result is
+// smooth and stops changing once the cells are full, over frames and camera moves alike.
+// The cells are an open addressing hash table of fixed capacity that render threads share without locking:
+// a cell is claimed by swapping its key in, the sums are added with compare and swap. When the table is
+// full, points that find no cell of their own fall back to their neighbours.
+class RadianceGrid
+{
+public:
+	f32 cellSize;		// in world units
+	u32 minSamples;		// paths a cell gets as soon as it is first read
+	u32 maxSamples;		// no more paths are traced once a cell has this many
+
+	RadianceGrid()
+		: cellSize(0.5f)
+		, minSamples(64)
+		, maxSamples(256)
+		, cells(Capacity)
+		, used(0)
+	{
+		clear();
+	}
+
+	// not thread safe, call it between frames
+	void clear()
+	{
+		for (u32 i = 0; i < Capacity; ++i)
+		{
+			Cell& cell = cells[i];
+			cell.key.store(0, std::memory_order_relaxed);
+			cell.count.store(0, std::memory_order_relaxed);
+			cell.sum[0].store(0, std::memory_order_relaxed);
+			cell.sum[1].store(0, std::memory_order_relaxed);
+			cell.sum[2].store(0, std::memory_order_relaxed);
+		}
+		used.store(0, std::memory_order_relaxed);
+	}
+
+	// cells in use
+	u32 size() const
+	{
+		return used.load(std::memory_order_relaxed);
+	}
+
+	static u32 capacity()
+	{
+		return Capacity;
+	}
+
+	// Paths still wanted by the cell of the point (minSamples at least if it has none yet, 0 when it's full).
+	// 'cell' identifies it for add(), -1 when the table has no room left.
+	u32 samplesWanted( const Vec3f pos, const Vec3f normal, i32& cell )
+	{
+		cell = find(keyOf(cellCoords(pos), normalBin(normal)), true);
+		if (cell < 0)
+		{
+			return 0;
+		}
+		const u32 count = cells[cell].count.load(std::memory_order_relaxed);
+		return count >= maxSamples ? 0 : std::max(1u, minSamples > count ? minSamples - count : 1u);
+	}
+
+	// adds 'count' irradiance estimates to a cell
+	void add( const i32 cell, const Vec3f irradianceSum, const u32 count )
+	{
+		Cell& target = cells[cell];
+		for (u32 c = 0; c < 3; ++c)
+		{
+			f32 old = target.sum[c].load(std::memory_order_relaxed);
+			while (!target.sum[c].compare_exchange_weak(old, old + irradianceSum[c], std::memory_order_relaxed))
+			{
+			}
+		}
+		target.count.fetch_add(count, std::memory_order_release);
+	}
+
+	// average of the 8 cells around the point, weighted by their distance, false if none has any path
+	bool lookup( const Vec3f pos, const Vec3f normal, Vec3f& irradiance )
+	{
+		const u32 bin = normalBin(normal);
+		const Vec3f scaled = pos * (1 / cellSize) - Vec3f(0.5f);
+		const f32 fx = floorf(scaled.x), fy = floorf(scaled.y), fz = floorf(scaled.z);
+		const f32 tx = scaled.x - fx, ty = scaled.y - fy, tz = scaled.z - fz;
+		const i64 x = i64(fx), y = i64(fy), z = i64(fz);
+
+		Vec3f sum(0);
+		f32 weightSum = 0;
+		for (u32 corner = 0; corner < 8; ++corner)
+		{
+			const i32 index = find(keyOf(x + (corner & 1), y + (corner >> 1 & 1), z + (corner >> 2), bin), false);
+			if (index < 0)
+			{
+				continue;
+			}
+			const Cell& cell = cells[index];
+			const u32 count = cell.count.load(std::memory_order_acquire);
+			if (count == 0)
+			{
+				continue;
+			}
+			const f32 weight = (corner & 1 ? tx : 1 - tx) * (corner & 2 ? ty : 1 - ty) * (corner & 4 ? tz : 1 - tz);
+			const Vec3f average = Vec3f(cell.sum[0].load(std::memory_order_relaxed), cell.sum[1].load(std::memory_order_relaxed), cell.sum[2].load(std::memory_order_relaxed)) * (1.f / count);
+			sum += average * weight;
+			weightSum += weight;
+		}
+
+		if (weightSum <= 0)
+		{
+			return false;
+		}
+		irradiance = sum * (1 / weightSum);
+		return true;
+	}
+
+	// returns true when the grid was cleared
+	bool onGui()
+	{
+		bool changed = false;
+
+		ImGui::BeginProperty("Grid cell size");
+		changed |= ImGui::DragFloat("", &cellSize, 0.01f, 0.01f, 10.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Grid min samples");
+		changed |= ImGui::DragInt("", (int*)&minSamples, 1.f, 1, 4096);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Grid max samples");
+		changed |= ImGui::DragInt("", (int*)&maxSamples, 1.f, 1, 65536);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::Text("%u / %u grid cells", size(), capacity());
+		if (ImGui::Button("Clear grid"))
+		{
+			changed = true;
+		}
+
+		if (changed)
+		{
+			cellSize = std::max(cellSize, 1e-3f);
+			maxSamples = std::max(maxSamples, minSamples);
+			clear();
+		}
+		return changed;
+	}
+
+private:
+	enum { Capacity = 1 << 18, MaxProbes = 32 };
+
+	struct Cell
+	{
+		std::atomic<u64> key;		// 0 when free
+		std::atomic<u32> count;
+		std::atomic<f32> sum[3];
+	};
+
+	std::vector<Cell> cells;
+	std::atomic<u32> used;
+
+	struct Coords
+	{
+		i64 x, y, z;
+	};
+
+	Coords cellCoords( const Vec3f pos ) const
+	{
+		const Coords coords = { i64(floorf(pos.x / cellSize)), i64(floorf(pos.y / cellSize)), i64(floorf(pos.z / cellSize)) };
+		return coords;
+	}
+
+	// octahedral mapping of the normal on a 4 x 4 grid
+	static u32 normalBin( const Vec3f normal )
+	{
+		const f32 l1 = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+		f32 u = normal.x / l1, v = normal.z / l1;
+		if (normal.y < 0)
+		{
+			const f32 fu = (1 - fabsf(v)) * (u < 0 ? -1 : 1);
+			v = (1 - fabsf(u)) * (v < 0 ? -1 : 1);
+			u = fu;
+		}
+		const u32 bu = std::min(3u, u32((u + 1) * 2));
+		const u32 bv = std::min(3u, u32((v + 1) * 2));
+		return bu + bv * 4;
+	}
+
+	// 19 bits per coordinate, 4 for the normal, and the top bit so no key is 0
+	static u64 keyOf( const i64 x, const i64 y, const i64 z, const u32 bin )
+	{
+		return (u64(x) & 0x7ffff) | (u64(y) & 0x7ffff) << 19 | (u64(z) & 0x7ffff) << 38 | u64(bin) << 57 | 1ull << 63;
+	}
+
+	static u64 keyOf( const Coords coords, const u32 bin )
+	{
+		return keyOf(coords.x, coords.y, coords.z, bin);
+	}
+
+	// index of the cell with that key, claiming a free one if 'create', -1 if there is none
+	i32 find( const u64 key, const bool create )
+	{
+		u64 h = key;
+		h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+		h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+		h ^= h >> 31;
+		for (u32 probe = 0; probe < MaxProbes; ++probe)
+		{
+			const u32 index = u32(h + probe) & (Capacity - 1);
+			Cell& cell = cells[index];
+			u64 current = cell.key.load(std::memory_order_acquire);
+			if (current == key)
+			{
+				return i32(index);
+			}
+			if (current == 0)
+			{
+				if (!create)
+				{
+					return -1;
+				}
+				if (cell.key.compare_exchange_strong(current, key, std::memory_order_acq_rel))
+				{
+					used.fetch_add(1, std::memory_order_relaxed);
+					return i32(index);
+				}
+				if (current == key)
+				{
+					return i32(index);
+				}
+			}
+		}
+		return -1;
+	}
+};
@@ -0,0 +1,1389 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "math/mapped_file.h"
+
+// Binary scene files: a header, a table of chunks, then the chunk data.
+// Arrays are stored SoA, 16-byte aligned, with the sizes of the in-memory types, so loading is
+// one pass over a mapped file with no parsing; the cost is in the page faults.
+// Chunks a loader doesn't know are skipped, which is how the format grows: new chunks (or new
+// chunk versions) are added, old readers ignore them.
+//
+// Text scenes convert to it (see loadSceneText), one item per line:
+//   description "<text>"
+//   camera <x> <y> <z>
+//   light "<name>" point <x> <y> <z> <r> <g> <b> <intensity>
+//   light "<name>" sphere <x> <y> <z> <r> <g> <b> <intensity> <radius>
+//   light "<name>" rect <x> <y> <z> <r> <g> <b> <intensity> <e1x> <e1y> <e1z> <e2x> <e2y> <e2z>
+//   sphere "<name>" <x> <y> <z> <radius> <r> <g> <b> <a> [<material>]
+//   plane "<name>" <x|y|z> <pos> <r> <g> <b> <a> [<material>]
+//   plane "<name>" <x> <y> <z> <nx> <ny> <nz> <r> <g> <b> <a> [<material>]
+//   box "<name>" <min x> <min y> <min z> <max x> <max y> <max z> <r> <g> <b> <a> [<material>]
+//   mesh "<name>" "<file.obj>" <x> <y> <z> <scale> <r> <g> <b> <a> [<material>]
+//   meshasset "<name>" "<file.obj>" <x> <y> <z> <scale>
+//   sphereasset "<name>" <x> <y> <z> <radius>
+//   instance "<name>" "<asset>" <x> <y> <z> <rx> <ry> <rz> <scale> <r> <g> <b> <a> [<material>]
+// '#' starts a comment. OBJ paths are relative to the scene file, the vertices are scaled then
+// offset by x y z. Binary files carry the triangles themselves.
+// <material> is any of 'flat', 'mirror', 'glass [<ior>]' and 'glossy [<roughness>]', diffuse without.
+// Rect lights are centered on x y z and spanned by their two edges. 'light <x> <y> <z>' is the old
+// single white point light, which is also what a scene without light lines gets.
+// Assets are only drawn through instances: every sphereasset line adds a sphere to the named set,
+// instances name their asset (mesh assets first) and are rotated in degrees around x, y then z.
+
+inline constexpr u32 fourCC( char a, char b, char c, char d )
+{
+	return u32(u8(a)) | u32(u8(b)) << 8 | u32(u8(c)) << 16 | u32(u8(d)) << 24;
+}
+
+enum SceneChunkId
+{
+	SceneChunk_Camera = fourCC('C', 'A', 'M', 'R'),		// one SceneFileCamera
+	SceneChunk_Lights = fourCC('L', 'G', 'H', 'T'),		// count SceneFileLight (version 1: a position only)
+	SceneChunk_Materials = fourCC('M', 'A', 'T', 'L'),	// count SceneFileMaterial
+	SceneChunk_Spheres = fourCC('S', 'P', 'H', 'R'),	// SoA: x, y, z, radius, material, name
+	SceneChunk_Planes = fourCC('P', 'L', 'A', 'N'),		// SoA: x, y, z, nx, ny, nz, material, name (version 1: axis, pos, material, name)
+	SceneChunk_Boxes = fourCC('B', 'O', 'X', 'S'),		// SoA: min x, y, z, max x, y, z, material, name
+	SceneChunk_Names = fourCC('N', 'A', 'M', 'E'),		// zero terminated strings, prims store offsets
+	SceneChunk_Info = fourCC('I', 'N', 'F', 'O'),		// the scene description, zero terminated
+	SceneChunk_Bvh = fourCC('B', 'V', 'H', ' '),		// reserved for a prebuilt acceleration structure
+	SceneChunk_Mesh = fourCC('M', 'E', 'S', 'H'),		// one per mesh, count triangles: SceneFileMesh, SoA: x, y, z, then SoA: i0, i1, i2
+	SceneChunk_MeshAsset = fourCC('A', 'M', 'S', 'H'),	// one per instanceable mesh, laid out as a mesh chunk, its material is unused
+	SceneChunk_SphereAsset = fourCC('A', 'S', 'P', 'H'),	// one per sphere set, count spheres: SceneFileSphereSet, SoA: x, y, z, radius
+	SceneChunk_Instances = fourCC('I', 'N', 'S', 'T'),	// SoA: assetType, asset, x, y, z, rx, ry, rz, scale, material, name
+};
+
+enum { SceneFileVersion = 1 };
+enum { SceneFileAlignment = 16 };
+enum { SceneMaterial_Flat = 1 << 0 };
+
+struct SceneFileHeader
+{
+	char magic[4];		// "YSCN"
+	u32 version;
+	u32 chunkCount;
+	u32 reserved;
+};
+
+struct SceneFileChunk
+{
+	u32 id;
+	u32 version;
+	u32 count;
+	u32 reserved;
+	u64 offset;			// from the start of the file, aligned
+	u64 size;
+};
+
+struct SceneFileCamera
+{
+	f32 pos[4];
+};
+
+struct SceneFileLightV1
+{
+	f32 pos[4];
+};
+
+struct SceneFileLight
+{
+	f32 pos[4];
+	f32 color[4];		// rgb, intensity
+	f32 edge1[4];
+	f32 edge2[4];
+	u32 type;
+	f32 radius;
+	u32 name;
+	u32 reserved;
+};
+
+struct SceneFileMesh
+{
+	u32 vertexCount;
+	u32 triangleCount;
+	u32 material;
+	u32 name;
+};
+
+struct SceneFileSphereSet
+{
+	u32 count;
+	u32 name;
+	u32 reserved[2];
+};
+
+// older files have zeros after the flags, a diffuse material
+struct SceneFileMaterial
+{
+	f32 color[4];
+	u32 flags;
+	u32 type;			// MaterialType
+	f32 ior;			// dielectric only, else 0
+	f32 roughness;		// glossy only, else 0
+};
+
+inline u64 alignSceneFile( const u64 offset )
+{
+	return (offset + SceneFileAlignment - 1) & ~u64(SceneFileAlignment - 1);
+}
+
+// byte distance between the arrays of a SoA chunk, every array element is 4 bytes
+inline u64 soaStride( const u32 count )
+{
+	return alignSceneFile(u64(count) * 4);
+}
+
+inline u64 meshChunkSize( const u32 vertexCount, const u32 triangleCount )
+{
+	return sizeof(SceneFileMesh) + soaStride(vertexCount) * 3 + soaStride(triangleCount) * 3;
+}
+
+inline u64 sphereSetChunkSize( const u32 count )
+{
+	return sizeof(SceneFileSphereSet) + soaStride(count) * 4;
+}
+
+
+// chunks are appended to an in-memory image of the file, the table is filled as they go
+class SceneFileWriter
+{
+public:
+	SceneFileWriter( const u32 chunkCount )
+	{
+		SceneFileHeader header;
+		memcpy(header.magic, "YSCN", 4);
+		header.version = SceneFileVersion;
+		header.chunkCount = chunkCount;
+		header.reserved = 0;
+		append(&header, sizeof(header));
+		data.resize(sizeof(header) + chunkCount * sizeof(SceneFileChunk));
+		chunkIndex = 0;
+	}
+
+	// returns the chunk data, zeroed
+	u8* addChunk( const u32 id, const u32 count, const u64 size, const u32 version = 1 )
+	{
+		SceneFileChunk chunk;
+		chunk.id = id;
+		chunk.version = version;
+		chunk.count = count;
+		chunk.reserved = 0;
+		chunk.offset = alignSceneFile(data.size());
+		chunk.size = size;
+		memcpy(&data[sizeof(SceneFileHeader) + chunkIndex * sizeof(SceneFileChunk)], &chunk, sizeof(chunk));
+		++chunkIndex;
+
+		data.resize(size_t(chunk.offset + size));
+		return &data[size_t(chunk.offset)];
+	}
+
+	bool save( const char* filename ) const
+	{
+		FILE* f = fopen(filename, "wb");
+		if (!f)
+		{
+			return false;
+		}
+		bool ok = fwrite(&data[0], 1, data.size(), f) == data.size();
+		return fclose(f) == 0 && ok;
+	}
+
+private:
+	std::vector<u8> data;
+	u32 chunkIndex;
+
+	void append( const void* bytes, const size_t size )
+	{
+		data.insert(data.end(), (const u8*)bytes, (const u8*)bytes + size);
+	}
+};
+
+// materials are deduplicated, prims only store an index
+class SceneMaterialTable
+{
+public:
+	std::vector<SceneFileMaterial> materials;
+
+	u32 add( const Material& source )
+	{
+		SceneFileMaterial material;
+		memset(&material, 0, sizeof(material));
+		memcpy(material.color, source.color.value, sizeof(material.color));
+		material.flags = source.flat ? SceneMaterial_Flat : 0;
+		material.type = source.type;
+		material.ior = source.type == MaterialType_Dielectric ? source.ior : 0;
+		material.roughness = source.type == MaterialType_Glossy ? source.roughness : 0;
+
+		std::string key((const char*)&material, sizeof(material));
+		std::unordered_map<std::string, u32>::iterator it = indices.find(key);
+		if (it != indices.end())
+		{
+			return it->second;
+		}
+		u32 index = u32(materials.size());
+		indices[key] = index;
+		materials.push_back(material);
+		return index;
+	}
+
+private:
+	std::unordered_map<std::string, u32> indices;
+};
+
+inline void applySceneMaterial( Material& material, const SceneFileMaterial& m )
+{
+	material.flat = (m.flags & SceneMaterial_Flat) != 0;
+	material.type = m.type < u32(MaterialType_Count) ? MaterialType(m.type) : MaterialType_Diffuse;
+	if (m.ior > 0)
+	{
+		material.ior = m.ior;
+	}
+	if (m.roughness > 0)
+	{
+		material.roughness = m.roughness;
+	}
+}
+
+// offset of the name in the names chunk
+inline u32 addSceneName( std::vector<char>& names, const char* name )
+{
+	const u32 offset = u32(names.size());
+	names.insert(names.end(), name, name + strlen(name) + 1);
+	return offset;
+}
+
+inline void writeMeshChunk( SceneFileWriter& writer, const u32 id, const Mesh& mesh, const u32 material, const u32 name )
+{
+	const u32 vertexCount = mesh.vertexCount();
+	const u32 triangleCount = mesh.triangleCount();
+	u8* meshData = writer.addChunk(id, triangleCount, meshChunkSize(vertexCount, triangleCount));
+
+	SceneFileMesh header = { vertexCount, triangleCount, material, name };
+	memcpy(meshData, &header, sizeof(header));
+
+	const u64 vertexStride = soaStride(vertexCount);
+	const u64 triangleStride = soaStride(triangleCount);
+	u8* vertices = meshData + sizeof(SceneFileMesh);
+	u8* triangles = vertices + vertexStride * 3;
+	memcpy(vertices + vertexStride * 0, &mesh.x[0], vertexCount * sizeof(f32));
+	memcpy(vertices + vertexStride * 1, &mesh.y[0], vertexCount * sizeof(f32));
+	memcpy(vertices + vertexStride * 2, &mesh.z[0], vertexCount * sizeof(f32));
+	memcpy(triangles + triangleStride * 0, &mesh.i0[0], triangleCount * sizeof(u32));
+	memcpy(triangles + triangleStride * 1, &mesh.i1[0], triangleCount * sizeof(u32));
+	memcpy(triangles + triangleStride * 2, &mesh.i2[0], triangleCount * sizeof(u32));
+}
+
+// the chunk size was checked against the header, false on a vertex index out of bounds
+inline bool readMeshChunk( const u8* meshData, Mesh& mesh )
+{
+	const SceneFileMesh& header = *(const SceneFileMesh*)meshData;
+	const u64 vertexStride = soaStride(header.vertexCount);
+	const u64 triangleStride = soaStride(header.triangleCount);
+	const f32* vertices = (const f32*)(meshData + sizeof(SceneFileMesh));
+	const u32* triangles = (const u32*)(meshData + sizeof(SceneFileMesh) + vertexStride * 3);
+
+	mesh.x.assign(vertices, vertices + header.vertexCount);
+	mesh.y.assign(vertices + vertexStride / 4, vertices + vertexStride / 4 + header.vertexCount);
+	mesh.z.assign(vertices + vertexStride / 2, vertices + vertexStride / 2 + header.vertexCount);
+	mesh.i0.assign(triangles, triangles + header.triangleCount);
+	mesh.i1.assign(triangles + triangleStride / 4, triangles + triangleStride / 4 + header.triangleCount);
+	mesh.i2.assign(triangles + triangleStride / 2, triangles + triangleStride / 2 + header.triangleCount);
+	for (u32 t = 0; t < header.triangleCount; ++t)
+	{
+		if (mesh.i0[t] >= header.vertexCount || mesh.i1[t] >= header.vertexCount || mesh.i2[t] >= header.vertexCount)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool saveSceneBinary( const char* filename, const Scene& scene )
+{
+	const u32 sphereCount = u32(scene.spheres.size());
+	const u32 planeCount = u32(scene.planes.size());
+	const u32 boxCount = u32(scene.boxes.size());
+	const u32 meshCount = u32(scene.meshes.size());
+	const u32 meshAssetCount = u32(scene.meshAssets.size());
+	const u32 sphereAssetCount = u32(scene.sphereAssets.size());
+	const u32 instanceCount = u32(scene.instances.size());
+	const u32 lightCount = u32(scene.lights.size());
+
+	// names and materials first, prims refer to them
+	std::vector<char> names;
+	std::vector<u32> lightNames(lightCount);
+	std::vector<u32> sphereNames(sphereCount), planeNames(planeCount), boxNames(boxCount), meshNames(meshCount);
+	std::vector<u32> meshAssetNames(meshAssetCount), sphereAssetNames(sphereAssetCount), instanceNames(instanceCount);
+	std::vector<u32> sphereMaterials(sphereCount), planeMaterials(planeCount), boxMaterials(boxCount), meshMaterials(meshCount), instanceMaterials(instanceCount);
+	SceneMaterialTable materials;
+	for (u32 i = 0; i < sphereCount; ++i)
+	{
+		sphereNames[i] = addSceneName(names, scene.spheres[i].name);
+		sphereMaterials[i] = materials.add(scene.materials[scene.spheres[i].material]);
+	}
+	for (u32 i = 0; i < planeCount; ++i)
+	{
+		planeNames[i] = addSceneName(names, scene.planes[i].name);
+		planeMaterials[i] = materials.add(scene.materials[scene.planes[i].material]);
+	}
+	for (u32 i = 0; i < boxCount; ++i)
+	{
+		boxNames[i] = addSceneName(names, scene.boxes[i].name);
+		boxMaterials[i] = materials.add(scene.materials[scene.boxes[i].material]);
+	}
+	for (u32 i = 0; i < lightCount; ++i)
+	{
+		lightNames[i] = addSceneName(names, scene.lights[i].name);
+	}
+	for (u32 i = 0; i < meshCount; ++i)
+	{
+		meshNames[i] = addSceneName(names, scene.meshes[i].name);
+		meshMaterials[i] = materials.add(scene.materials[scene.meshes[i].material]);
+	}
+	for (u32 i = 0; i < meshAssetCount; ++i)
+	{
+		meshAssetNames[i] = addSceneName(names, scene.meshAssets[i].name);
+	}
+	for (u32 i = 0; i < sphereAssetCount; ++i)
+	{
+		sphereAssetNames[i] = addSceneName(names, scene.sphereAssets[i].name);
+	}
+	for (u32 i = 0; i < instanceCount; ++i)
+	{
+		instanceNames[i] = addSceneName(names, scene.instances[i].name);
+		instanceMaterials[i] = materials.add(scene.materials[scene.instances[i].material]);
+	}
+
+	SceneFileWriter writer(9 + meshCount + meshAssetCount + sphereAssetCount);
+
+	SceneFileCamera* camera = (SceneFileCamera*)writer.addChunk(SceneChunk_Camera, 1, sizeof(SceneFileCamera));
+	memcpy(camera->pos, scene.camPos.value, sizeof(f32) * 3);
+
+	SceneFileLight* lights = (SceneFileLight*)writer.addChunk(SceneChunk_Lights, lightCount, lightCount * sizeof(SceneFileLight), 2);
+	for (u32 i = 0; i < lightCount; ++i)
+	{
+		const Light& light = scene.lights[i];
+		memcpy(lights[i].pos, light.pos.value, sizeof(f32) * 3);
+		memcpy(lights[i].color, light.color.value, sizeof(f32) * 3);
+		lights[i].color[3] = light.intensity;
+		memcpy(lights[i].edge1, light.edge1.value, sizeof(f32) * 3);
+		memcpy(lights[i].edge2, light.edge2.value, sizeof(f32) * 3);
+		lights[i].type = light.type;
+		lights[i].radius = light.radius;
+		lights[i].name = lightNames[i];
+	}
+
+	const u32 materialCount = u32(materials.materials.size());
+	u8* materialData = writer.addChunk(SceneChunk_Materials, materialCount, materialCount * sizeof(SceneFileMaterial));
+	if (materialCount)
+	{
+		memcpy(materialData, &materials.materials[0], materialCount * sizeof(SceneFileMaterial));
+	}
+
+	const u64 sphereStride = soaStride(sphereCount);
+	u8* sphereData = writer.addChunk(SceneChunk_Spheres, sphereCount, sphereStride * 6);
+	f32* x = (f32*)(sphereData + sphereStride * 0);
+	f32* y = (f32*)(sphereData + sphereStride * 1);
+	f32* z = (f32*)(sphereData + sphereStride * 2);
+	f32* radius = (f32*)(sphereData + sphereStride * 3);
+	for (u32 i = 0; i < sphereCount; ++i)
+	{
+		const SphereGeometry& sphere = scene.sphereGeometry[i];
+		x[i] = sphere.pos.x;
+		y[i] = sphere.pos.y;
+		z[i] = sphere.pos.z;
+		radius[i] = sphere.radius;
+	}
+	if (sphereCount)
+	{
+		memcpy(sphereData + sphereStride * 4, &sphereMaterials[0], sphereCount * sizeof(u32));
+		memcpy(sphereData + sphereStride * 5, &sphereNames[0], sphereCount * sizeof(u32));
+	}
+
+	const u64 planeStride = soaStride(planeCount);
+	u8* planeData = writer.addChunk(SceneChunk_Planes, planeCount, planeStride * 8, 2);
+	for (u32 i = 0; i < planeCount; ++i)
+	{
+		const PlaneGeometry& plane = scene.planeGeometry[i];
+		for (u32 axis = 0; axis < 3; ++axis)
+		{
+			((f32*)(planeData + planeStride * axis))[i] = plane.pos[axis];
+			((f32*)(planeData + planeStride * (3 + axis)))[i] = plane.normal[axis];
+		}
+	}
+	if (planeCount)
+	{
+		memcpy(planeData + planeStride * 6, &planeMaterials[0], planeCount * sizeof(u32));
+		memcpy(planeData + planeStride * 7, &planeNames[0], planeCount * sizeof(u32));
+	}
+
+	const u64 boxStride = soaStride(boxCount);
+	u8* boxData = writer.addChunk(SceneChunk_Boxes, boxCount, boxStride * 8);
+	for (u32 i = 0; i < boxCount; ++i)
+	{
+		const BoxGeometry& box = scene.boxGeometry[i];
+		for (u32 axis = 0; axis < 3; ++axis)
+		{
+			((f32*)(boxData + boxStride * axis))[i] = box.min[axis];
+			((f32*)(boxData + boxStride * (3 + axis)))[i] = box.max[axis];
+		}
+	}
+	if (boxCount)
+	{
+		memcpy(boxData + boxStride * 6, &boxMaterials[0], boxCount * sizeof(u32));
+		memcpy(boxData + boxStride * 7, &boxNames[0], boxCount * sizeof(u32));
+	}
+
+	u8* nameData = writer.addChunk(SceneChunk_Names, u32(names.size()), names.size());
+	if (!names.empty())
+	{
+		memcpy(nameData, &names[0], names.size());
+	}
+
+	const u32 infoSize = u32(scene.description.size() + 1);
+	memcpy(writer.addChunk(SceneChunk_Info, infoSize, infoSize), scene.description.c_str(), infoSize);
+
+	for (u32 i = 0; i < meshCount; ++i)
+	{
+		writeMeshChunk(writer, SceneChunk_Mesh, scene.meshes[i], meshMaterials[i], meshNames[i]);
+	}
+	for (u32 i = 0; i < meshAssetCount; ++i)
+	{
+		writeMeshChunk(writer, SceneChunk_MeshAsset, scene.meshAssets[i], 0, meshAssetNames[i]);
+	}
+
+	for (u32 i = 0; i < sphereAssetCount; ++i)
+	{
+		const SphereSet& set = scene.sphereAssets[i];
+		const u32 count = set.count();
+		u8* setData = writer.addChunk(SceneChunk_SphereAsset, count, sphereSetChunkSize(count));
+
+		SceneFileSphereSet header = { count, sphereAssetNames[i], { 0, 0 } };
+		memcpy(setData, &header, sizeof(header));
+
+		const u64 stride = soaStride(count);
+		u8* soa = setData + sizeof(SceneFileSphereSet);
+		if (count)
+		{
+			memcpy(soa + stride * 0, &set.x[0], count * sizeof(f32));
+			memcpy(soa + stride * 1, &set.y[0], count * sizeof(f32));
+			memcpy(soa + stride * 2, &set.z[0], count * sizeof(f32));
+			memcpy(soa + stride * 3, &set.radius[0], count * sizeof(f32));
+		}
+	}
+
+	const u64 instanceStride = soaStride(instanceCount);
+	u8* instanceData = writer.addChunk(SceneChunk_Instances, instanceCount, instanceStride * 11);
+	u32* assetType = (u32*)(instanceData + instanceStride * 0);
+	u32* asset = (u32*)(instanceData + instanceStride * 1);
+	f32* transform[7];
+	for (u32 k = 0; k < 7; ++k)
+	{
+		transform[k] = (f32*)(instanceData + instanceStride * (2 + k));
+	}
+	for (u32 i = 0; i < instanceCount; ++i)
+	{
+		const Instance& instance = scene.instances[i];
+		assetType[i] = u32(instance.assetType);
+		asset[i] = instance.asset;
+		transform[0][i] = instance.pos.x;
+		transform[1][i] = instance.pos.y;
+		transform[2][i] = instance.pos.z;
+		transform[3][i] = instance.rotation.x;
+		transform[4][i] = instance.rotation.y;
+		transform[5][i] = instance.rotation.z;
+		transform[6][i] = instance.scale;
+	}
+	if (instanceCount)
+	{
+		memcpy(instanceData + instanceStride * 9, &instanceMaterials[0], instanceCount * sizeof(u32));
+		memcpy(instanceData + instanceStride * 10, &instanceNames[0], instanceCount * sizeof(u32));
+	}
+
+	return writer.save(filename);
+}
+
+// fails on anything out of bounds, the file is not trusted
+inline bool loadSceneBinary( const char* filename, Scene& scene )
+{
+	MappedFile file;
+	if (!file.open(filename) || file.size() < sizeof(SceneFileHeader))
+	{
+		fprintf(stderr, "can't open %s\n", filename);
+		return false;
+	}
+	MappedFile::View view = file.map(0, size_t(file.size()));
+	if (!view.data)
+	{
+		fprintf(stderr, "can't map %s\n", filename);
+		return false;
+	}
+	const u8* data = view.data;
+	const u64 fileSize = file.size();
+
+	const SceneFileHeader& header = *(const SceneFileHeader*)data;
+	if (memcmp(header.magic, "YSCN", 4) != 0 || header.version != SceneFileVersion
+		|| sizeof(SceneFileHeader) + u64(header.chunkCount) * sizeof(SceneFileChunk) > fileSize)
+	{
+		fprintf(stderr, "%s is not a version %d scene file\n", filename, SceneFileVersion);
+		file.unmap(view);
+		return false;
+	}
+
+	const SceneFileChunk* chunks = (const SceneFileChunk*)(data + sizeof(SceneFileHeader));
+	const u32 ids[] = { SceneChunk_Camera, SceneChunk_Lights, SceneChunk_Materials, SceneChunk_Spheres, SceneChunk_Planes, SceneChunk_Names, SceneChunk_Info, SceneChunk_Instances, SceneChunk_Boxes };
+	const u32 idCount = sizeof(ids) / sizeof(ids[0]);
+	const SceneFileChunk* known[idCount] = {};
+	std::vector<const SceneFileChunk*> meshChunks, meshAssetChunks, sphereAssetChunks;
+	for (u32 i = 0; i < header.chunkCount; ++i)
+	{
+		const SceneFileChunk& chunk = chunks[i];
+		if (chunk.offset > fileSize || chunk.size > fileSize - chunk.offset || chunk.offset % SceneFileAlignment)
+		{
+			fprintf(stderr, "%s: chunk %u is out of bounds\n", filename, i);
+			file.unmap(view);
+			return false;
+		}
+		for (u32 k = 0; k < idCount; ++k)
+		{
+			if (chunk.id == ids[k] && (chunk.version == 1 || ((chunk.id == SceneChunk_Planes || chunk.id == SceneChunk_Lights) && chunk.version == 2)))
+			{
+				known[k] = &chunk;
+			}
+		}
+		if (chunk.id == SceneChunk_Mesh && chunk.version == 1)
+		{
+			meshChunks.push_back(&chunk);
+		}
+		if (chunk.id == SceneChunk_MeshAsset && chunk.version == 1)
+		{
+			meshAssetChunks.push_back(&chunk);
+		}
+		if (chunk.id == SceneChunk_SphereAsset && chunk.version == 1)
+		{
+			sphereAssetChunks.push_back(&chunk);
+		}
+	}
+	const SceneFileChunk* cameraChunk = known[0];
+	const SceneFileChunk* lightChunk = known[1];
+	const SceneFileChunk* materialChunk = known[2];
+	const SceneFileChunk* sphereChunk = known[3];
+	const SceneFileChunk* planeChunk = known[4];
+	const SceneFileChunk* nameChunk = known[5];
+	const SceneFileChunk* infoChunk = known[6];
+	const SceneFileChunk* instanceChunk = known[7];
+	const SceneFileChunk* boxChunk = known[8];
+
+	const u32 materialCount = materialChunk ? materialChunk->count : 0;
+	const u32 sphereCount = sphereChunk ? sphereChunk->count : 0;
+	const u32 planeCount = planeChunk ? planeChunk->count : 0;
+	const u32 boxCount = boxChunk ? boxChunk->count : 0;
+	const u32 nameSize = nameChunk ? nameChunk->count : 0;
+	const u32 instanceCount = instanceChunk ? instanceChunk->count : 0;
+	bool valid = (!cameraChunk || cameraChunk->size >= sizeof(SceneFileCamera))
+		&& (!lightChunk || lightChunk->size >= lightChunk->count * (lightChunk->version == 1 ? sizeof(SceneFileLightV1) : sizeof(SceneFileLight)))
+		&& (!materialChunk || materialChunk->size >= materialCount * sizeof(SceneFileMaterial))
+		&& (!sphereChunk || sphereChunk->size >= soaStride(sphereCount) * 6)
+		&& (!planeChunk || planeChunk->size >= soaStride(planeCount) * (planeChunk->version == 1 ? 4 : 8))
+		&& (!boxChunk || boxChunk->size >= soaStride(boxCount) * 8)
+		&& (!instanceChunk || instanceChunk->size >= soaStride(instanceCount) * 11)
+		&& (!nameChunk || (nameChunk->size >= nameSize && (nameSize == 0 || data[nameChunk->offset + nameSize - 1] == 0)))
+		&& (!infoChunk || (infoChunk->size >= infoChunk->count && infoChunk->count && data[infoChunk->offset + infoChunk->count - 1] == 0));
+	for (u32 i = 0; i < meshChunks.size() + meshAssetChunks.size() && valid; ++i)
+	{
+		const SceneFileChunk* chunk = i < meshChunks.size() ? meshChunks[i] : meshAssetChunks[i - meshChunks.size()];
+		const SceneFileMesh& mesh = *(const SceneFileMesh*)(data + chunk->offset);
+		valid = chunk->size >= sizeof(SceneFileMesh)
+			&& chunk->size >= meshChunkSize(mesh.vertexCount, mesh.triangleCount);
+	}
+	for (u32 i = 0; i < sphereAssetChunks.size() && valid; ++i)
+	{
+		const SceneFileSphereSet& set = *(const SceneFileSphereSet*)(data + sphereAssetChunks[i]->offset);
+		valid = sphereAssetChunks[i]->size >= sizeof(SceneFileSphereSet)
+			&& sphereAssetChunks[i]->size >= sphereSetChunkSize(set.count);
+	}
+	if (!valid)
+	{
+		fprintf(stderr, "%s: truncated chunk\n", filename);
+		file.unmap(view);
+		return false;
+	}
+
+	const SceneFileMaterial* materials = materialChunk ? (const SceneFileMaterial*)(data + materialChunk->offset) : NULL;
+	const char* names = nameChunk ? (const char*)(data + nameChunk->offset) : NULL;
+
+	// the names are copied once, prims point into the scene's copy
+	scene.nameStorage.assign(names, names + nameSize);
+	scene.nameStorage.push_back(0);
+	const char* noName = &scene.nameStorage[nameSize];
+
+	scene.description = infoChunk ? (const char*)(data + infoChunk->offset) : filename;
+	if (cameraChunk)
+	{
+		const SceneFileCamera& camera = *(const SceneFileCamera*)(data + cameraChunk->offset);
+		scene.camPos = Vec3f(camera.pos[0], camera.pos[1], camera.pos[2]);
+	}
+	scene.lights.clear();
+	if (!lightChunk)
+	{
+		scene.lights.push_back(Light("Light", LightType_Point, Vec3f(0, 3, 0), white, 1));
+	}
+	else if (lightChunk->version == 1)
+	{
+		if (lightChunk->count)
+		{
+			const SceneFileLightV1& light = *(const SceneFileLightV1*)(data + lightChunk->offset);
+			scene.lights.push_back(Light("Light", LightType_Point, Vec3f(light.pos[0], light.pos[1], light.pos[2]), white, 1));
+		}
+	}
+	else
+	{
+		const SceneFileLight* lights = (const SceneFileLight*)(data + lightChunk->offset);
+		for (u32 i = 0; i < lightChunk->count; ++i)
+		{
+			const SceneFileLight& l = lights[i];
+			if (l.type >= u32(LightType_Count))
+			{
+				valid = false;
+				break;
+			}
+			Light light(l.name < nameSize ? &scene.nameStorage[l.name] : noName, LightType(l.type),
+				Vec3f(l.pos[0], l.pos[1], l.pos[2]), Color(l.color[0], l.color[1], l.color[2], 1), l.color[3]);
+			light.radius = l.radius;
+			light.edge1 = Vec3f(l.edge1[0], l.edge1[1], l.edge1[2]);
+			light.edge2 = Vec3f(l.edge2[0], l.edge2[1], l.edge2[2]);
+			scene.lights.push_back(light);
+		}
+	}
+	scene.updateLights();
+
+	scene.clearPrims();
+	scene.sphereGeometry.reserve(sphereCount);
+	scene.spheres.reserve(sphereCount);
+	if (sphereCount)
+	{
+		const u64 stride = soaStride(sphereCount);
+		const u8* soa = data + sphereChunk->offset;
+		const f32* x = (const f32*)(soa + stride * 0);
+		const f32* y = (const f32*)(soa + stride * 1);
+		const f32* z = (const f32*)(soa + stride * 2);
+		const f32* radius = (const f32*)(soa + stride * 3);
+		const u32* material = (const u32*)(soa + stride * 4);
+		const u32* name = (const u32*)(soa + stride * 5);
+		for (u32 i = 0; i < sphereCount; ++i)
+		{
+			if (material[i] >= materialCount)
+			{
+				valid = false;
+				break;
+			}
+			const SceneFileMaterial& m = materials[material[i]];
+			applySceneMaterial(scene.addSphere(name[i] < nameSize ? &scene.nameStorage[name[i]] : noName,
+				SphereGeometry(Vec3f(x[i], y[i], z[i]), radius[i]), Color(m.color[0], m.color[1], m.color[2], m.color[3])), m);
+		}
+	}
+
+	scene.planeGeometry.reserve(planeCount);
+	scene.planes.reserve(planeCount);
+	if (planeCount && valid && planeChunk->version == 1)
+	{
+		const u64 stride = soaStride(planeCount);
+		const u8* soa = data + planeChunk->offset;
+		const u32* axis = (const u32*)(soa + stride * 0);
+		const f32* pos = (const f32*)(soa + stride * 1);
+		const u32* material = (const u32*)(soa + stride * 2);
+		const u32* name = (const u32*)(soa + stride * 3);
+		for (u32 i = 0; i < planeCount; ++i)
+		{
+			if (material[i] >= materialCount || axis[i] > AxisZ)
+			{
+				valid = false;
+				break;
+			}
+			const SceneFileMaterial& m = materials[material[i]];
+			applySceneMaterial(scene.addPlane(name[i] < nameSize ? &scene.nameStorage[name[i]] : noName,
+				PlaneGeometry(axis[i], pos[i]), Color(m.color[0], m.color[1], m.color[2], m.color[3])), m);
+		}
+	}
+	else if (planeCount && valid)
+	{
+		const u64 stride = soaStride(planeCount);
+		const u8* soa = data + planeChunk->offset;
+		const f32* x = (const f32*)(soa + stride * 0);
+		const f32* y = (const f32*)(soa + stride * 1);
+		const f32* z = (const f32*)(soa + stride * 2);
+		const f32* nx = (const f32*)(soa + stride * 3);
+		const f32* ny = (const f32*)(soa + stride * 4);
+		const f32* nz = (const f32*)(soa + stride * 5);
+		const u32* material = (const u32*)(soa + stride * 6);
+		const u32* name = (const u32*)(soa + stride * 7);
+		for (u32 i = 0; i < planeCount; ++i)
+		{
+			if (material[i] >= materialCount)
+			{
+				valid = false;
+				break;
+			}
+			const SceneFileMaterial& m = materials[material[i]];
+			applySceneMaterial(scene.addPlane(name[i] < nameSize ? &scene.nameStorage[name[i]] : noName,
+				PlaneGeometry(Vec3f(x[i], y[i], z[i]), Vec3f(nx[i], ny[i], nz[i])), Color(m.color[0], m.color[1], m.color[2], m.color[3])), m);
+
+			// stored normalized, not normalized again so the file round-trips
+			scene.planeGeometry.back().normal = Vec3f(nx[i], ny[i], nz[i]);
+		}
+	}
+
+	scene.boxGeometry.reserve(boxCount);
+	scene.boxes.reserve(boxCount);
+	if (boxCount && valid)
+	{
+		const u64 stride = soaStride(boxCount);
+		const u8* soa = data + boxChunk->offset;
+		const f32* bounds[6];
+		for (u32 k = 0; k < 6; ++k)
+		{
+			bounds[k] = (const f32*)(soa + stride * k);
+		}
+		const u32* material = (const u32*)(soa + stride * 6);
+		const u32* name = (const u32*)(soa + stride * 7);
+		for (u32 i = 0; i < boxCount; ++i)
+		{
+			if (material[i] >= materialCount)
+			{
+				valid = false;
+				break;
+			}
+			const SceneFileMaterial& m = materials[material[i]];
+			applySceneMaterial(scene.addBox(name[i] < nameSize ? &scene.nameStorage[name[i]] : noName,
+				BoxGeometry(Vec3f(bounds[0][i], bounds[1][i], bounds[2][i]), Vec3f(bounds[3][i], bounds[4][i], bounds[5][i])),
+				Color(m.color[0], m.color[1], m.color[2], m.color[3])), m);
+		}
+	}
+
+	scene.meshes.resize(valid ? meshChunks.size() : 0);
+	for (u32 i = 0; i < scene.meshes.size() && valid; ++i)
+	{
+		const u8* meshData = data + meshChunks[i]->offset;
+		const SceneFileMesh& header = *(const SceneFileMesh*)meshData;
+		if (header.material >= materialCount)
+		{
+			valid = false;
+			break;
+		}
+		const SceneFileMaterial& m = materials[header.material];
+		Mesh& mesh = scene.meshes[i];
+		mesh.name = header.name < nameSize ? &scene.nameStorage[header.name] : noName;
+		mesh.material = scene.addMaterial(Color(m.color[0], m.color[1], m.color[2], m.color[3]));
+		applySceneMaterial(scene.materials[mesh.material], m);
+		valid = readMeshChunk(meshData, mesh);
+	}
+
+	scene.meshAssets.resize(valid ? meshAssetChunks.size() : 0);
+	for (u32 i = 0; i < scene.meshAssets.size() && valid; ++i)
+	{
+		const u8* meshData = data + meshAssetChunks[i]->offset;
+		const SceneFileMesh& header = *(const SceneFileMesh*)meshData;
+		Mesh& mesh = scene.meshAssets[i];
+		mesh.name = header.name < nameSize ? &scene.nameStorage[header.name] : noName;
+		valid = readMeshChunk(meshData, mesh);
+	}
+
+	scene.sphereAssets.resize(valid ? sphereAssetChunks.size() : 0);
+	for (u32 i = 0; i < scene.sphereAssets.size(); ++i)
+	{
+		const u8* setData = data + sphereAssetChunks[i]->offset;
+		const SceneFileSphereSet& header = *(const SceneFileSphereSet*)setData;
+		const u64 stride = soaStride(header.count);
+		const f32* soa = (const f32*)(setData + sizeof(SceneFileSphereSet));
+		SphereSet& set = scene.sphereAssets[i];
+		set.name = header.name < nameSize ? &scene.nameStorage[header.name] : noName;
+		set.x.assign(soa, soa + header.count);
+		set.y.assign(soa + stride / 4, soa + stride / 4 + header.count);
+		set.z.assign(soa + stride / 2, soa + stride / 2 + header.count);
+		set.radius.assign(soa + stride * 3 / 4, soa + stride * 3 / 4 + header.count);
+	}
+
+	scene.instances.reserve(valid ? instanceCount : 0);
+	if (instanceCount && valid)
+	{
+		const u64 stride = soaStride(instanceCount);
+		const u8* soa = data + instanceChunk->offset;
+		const u32* assetType = (const u32*)(soa + stride * 0);
+		const u32* asset = (const u32*)(soa + stride * 1);
+		const f32* transform[7];
+		for (u32 k = 0; k < 7; ++k)
+		{
+			transform[k] = (const f32*)(soa + stride * (2 + k));
+		}
+		const u32* material = (const u32*)(soa + stride * 9);
+		const u32* name = (const u32*)(soa + stride * 10);
+		for (u32 i = 0; i < instanceCount; ++i)
+		{
+			if (material[i] >= materialCount || assetType[i] >= u32(InstanceAsset_Count))
+			{
+				valid = false;
+				break;
+			}
+			const SceneFileMaterial& m = materials[material[i]];
+			scene.instances.push_back(Instance(name[i] < nameSize ? &scene.nameStorage[name[i]] : noName,
+				InstanceAsset(assetType[i]), asset[i],
+				Vec3f(transform[0][i], transform[1][i], transform[2][i]),
+				Vec3f(transform[3][i], transform[4][i], transform[5][i]), transform[6][i],
+				scene.addMaterial(Color(m.color[0], m.color[1], m.color[2], m.color[3]))));
+			applySceneMaterial(scene.materials.back(), m);
+		}
+	}
+
+	file.unmap(view);
+	if (!valid)
+	{
+		fprintf(stderr, "%s: bad material, axis, asset or vertex index\n", filename);
+		scene.clearPrims();
+		return false;
+	}
+
+	// the hierarchies are not stored (yet), they are rebuilt
+	for (u32 i = 0; i < scene.meshes.size(); ++i)
+	{
+		scene.meshes[i].build();
+	}
+	for (u32 i = 0; i < scene.meshAssets.size(); ++i)
+	{
+		scene.meshAssets[i].build();
+	}
+	for (u32 i = 0; i < scene.sphereAssets.size(); ++i)
+	{
+		scene.sphereAssets[i].build();
+	}
+	if (!scene.updateInstances())
+	{
+		fprintf(stderr, "%s: an instance refers to a missing asset\n", filename);
+		scene.clearPrims();
+		return false;
+	}
+	return true;
+}
+
+
+// the words after a prim's color: 'flat', and a material key, glass and glossy optionally followed by
+// their index of refraction and roughness; false on a word that is neither
+inline bool parsePrimMaterial( const char* cursor, Material& material )
+{
+	char word[16];
+	int read = 0;
+	while (sscanf(cursor, " %15s%n", word, &read) == 1)
+	{
+		cursor += read;
+		const int type = findMaterialType(word);
+		if (strcmp(word, "flat") == 0)
+		{
+			material.flat = true;
+		}
+		else if (type >= 0)
+		{
+			material.type = MaterialType(type);
+			f32 value;
+			if ((type == MaterialType_Dielectric || type == MaterialType_Glossy) && sscanf(cursor, " %f%n", &value, &read) == 1)
+			{
+				(type == MaterialType_Dielectric ? material.ior : material.roughness) = value;
+				cursor += read;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// the words parsePrimMaterial reads, with their leading space
+inline std::string primMaterialSuffix( const Material& material )
+{
+	std::string suffix = material.flat ? " flat" : "";
+	if (material.type != MaterialType_Diffuse)
+	{
+		char text[64];
+		if (material.type == MaterialType_Dielectric || material.type == MaterialType_Glossy)
+		{
+			snprintf(text, sizeof(text), " %s %.9g", MaterialTypeKeys[material.type], material.type == MaterialType_Dielectric ? material.ior : material.roughness);
+		}
+		else
+		{
+			snprintf(text, sizeof(text), " %s", MaterialTypeKeys[material.type]);
+		}
+		suffix += text;
+	}
+	return suffix;
+}
+
+// "name" at *cursor, advances past it
+inline bool parseQuoted( const char*& cursor, std::string& out )
+{
+	while (*cursor == ' ' || *cursor == '\t')
+	{
+		++cursor;
+	}
+	if (*cursor != '"')
+	{
+		return false;
+	}
+	const char* end = strchr(cursor + 1, '"');
+	if (!end)
+	{
+		return false;
+	}
+	out.assign(cursor + 1, end);
+	cursor = end + 1;
+	return true;
+}
+
+inline bool isAbsolutePath( const std::string& path )
+{
+	return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+}
+
+// up to and including the last separator, empty for a bare file name
+inline std::string directoryOf( const char* filename )
+{
+	const char* slash = strrchr(filename, '/');
+	const char* backslash = strrchr(filename, '\\');
+	const char* last = backslash > slash ? backslash : slash;
+	return last ? std::string(filename, last + 1) : std::string();
+}
+
+inline bool loadSceneText( const char* filename, Scene& scene )
+{
+	FILE* f = fopen(filename, "r");
+	if (!f)
+	{
+		fprintf(stderr, "can't open %s\n", filename);
+		return false;
+	}
+
+	// names are offsets until all prims are read, the storage moves while it grows
+	std::vector<u32> sphereNames, planeNames, boxNames, meshNames, meshAssetNames, sphereAssetNames, instanceNames, lightNames;
+	std::vector<std::string> instanceAssets;
+	std::unordered_map<std::string, u32> meshAssetIndices, sphereAssetIndices;
+	scene.nameStorage.clear();
+	scene.clearPrims();
+	scene.lights.clear();
+	scene.description = filename;
+	bool lightsRead = false;
+
+	char line[1024];
+	u32 lineIndex = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		++lineIndex;
+		char keyword[16];
+		int consumed = 0;
+		if (sscanf(line, " %15s%n", keyword, &consumed) != 1 || keyword[0] == '#')
+		{
+			continue;
+		}
+		const char* cursor = line + consumed;
+
+		Vec3f v;
+		Color c;
+		std::string name;
+		int read = 0;		// where the numbers end
+		if (strcmp(keyword, "description") == 0)
+		{
+			ok = parseQuoted(cursor, scene.description);
+		}
+		else if (strcmp(keyword, "camera") == 0)
+		{
+			ok = sscanf(cursor, "%f %f %f", &v.x, &v.y, &v.z) == 3;
+			scene.camPos = v;
+		}
+		else if (strcmp(keyword, "light") == 0)
+		{
+			lightsRead = true;
+			Light light;
+			char type[8] = "";
+			if (sscanf(cursor, "%f %f %f", &v.x, &v.y, &v.z) == 3)
+			{
+				name = "Light";
+				light = Light(NULL, LightType_Point, v, white, 1);
+			}
+			else
+			{
+				// the shape follows the common fields
+				ok = parseQuoted(cursor, name)
+					&& sscanf(cursor, " %7s %f %f %f %f %f %f %f%n", type, &v.x, &v.y, &v.z, &c.r, &c.g, &c.b, &light.intensity, &read) == 8
+					&& findLightType(type) >= 0;
+				light = Light(NULL, LightType(std::max(findLightType(type), 0)), v, Color(c.r, c.g, c.b, 1), light.intensity);
+				cursor += read;
+				if (ok && light.type == LightType_Sphere)
+				{
+					ok = sscanf(cursor, "%f", &light.radius) == 1;
+				}
+				if (ok && light.type == LightType_Rect)
+				{
+					ok = sscanf(cursor, "%f %f %f %f %f %f", &light.edge1.x, &light.edge1.y, &light.edge1.z,
+						&light.edge2.x, &light.edge2.y, &light.edge2.z) == 6;
+				}
+			}
+			if (ok)
+			{
+				lightNames.push_back(u32(scene.nameStorage.size()));
+				scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+				scene.lights.push_back(light);
+			}
+		}
+		else if (strcmp(keyword, "sphere") == 0)
+		{
+			f32 radius;
+			ok = parseQuoted(cursor, name)
+				&& sscanf(cursor, "%f %f %f %f %f %f %f %f%n", &v.x, &v.y, &v.z, &radius, &c.r, &c.g, &c.b, &c.a, &read) == 8;
+			if (ok)
+			{
+				sphereNames.push_back(u32(scene.nameStorage.size()));
+				scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+				ok = parsePrimMaterial(cursor + read, scene.addSphere(NULL, SphereGeometry(v, radius), c));
+			}
+		}
+		else if (strcmp(keyword, "plane") == 0)
+		{
+			// an axis and a position on it, or a point and a normal
+			char axis = 0;
+			f32 pos;
+			Vec3f normal;
+			ok = parseQuoted(cursor, name);
+			if (ok && sscanf(cursor, " %c", &axis) == 1 && axis >= 'x' && axis <= 'z')
+			{
+				ok = sscanf(cursor, " %c %f %f %f %f %f%n", &axis, &pos, &c.r, &c.g, &c.b, &c.a, &read) == 6;
+				scene.addPlane(NULL, PlaneGeometry(AxisX + (axis - 'x'), pos), c);
+			}
+			else if (ok)
+			{
+				ok = sscanf(cursor, "%f %f %f %f %f %f %f %f %f %f%n", &v.x, &v.y, &v.z, &normal.x, &normal.y, &normal.z,
+					&c.r, &c.g, &c.b, &c.a, &read) == 10 && normal.dot(normal) > 0;
+				scene.addPlane(NULL, PlaneGeometry(v, normal), c);
+			}
+			if (ok)
+			{
+				planeNames.push_back(u32(scene.nameStorage.size()));
+				scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+				ok = parsePrimMaterial(cursor + read, scene.materials[scene.planes.back().material]);
+			}
+		}
+		else if (strcmp(keyword, "box") == 0)
+		{
+			Vec3f max;
+			ok = parseQuoted(cursor, name)
+				&& sscanf(cursor, "%f %f %f %f %f %f %f %f %f %f%n", &v.x, &v.y, &v.z, &max.x, &max.y, &max.z, &c.r, &c.g, &c.b, &c.a, &read) == 10;
+			if (ok)
+			{
+				boxNames.push_back(u32(scene.nameStorage.size()));
+				scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+				ok = parsePrimMaterial(cursor + read, scene.addBox(NULL, BoxGeometry(v, max), c));
+			}
+		}
+		else if (strcmp(keyword, "mesh") == 0)
+		{
+			std::string path;
+			f32 scale;
+			ok = parseQuoted(cursor, name) && parseQuoted(cursor, path)
+				&& sscanf(cursor, "%f %f %f %f %f %f %f %f%n", &v.x, &v.y, &v.z, &scale, &c.r, &c.g, &c.b, &c.a, &read) == 8;
+			if (ok)
+			{
+				scene.meshes.push_back(Mesh(NULL, scene.addMaterial(c)));
+				Mesh& mesh = scene.meshes.back();
+				ok = loadObj((isAbsolutePath(path) ? path : directoryOf(filename) + path).c_str(), mesh);
+				mesh.transform(v, scale);
+				ok = ok && parsePrimMaterial(cursor + read, scene.materials[mesh.material]);
+				meshNames.push_back(u32(scene.nameStorage.size()));
+				scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+			}
+		}
+		else if (strcmp(keyword, "meshasset") == 0)
+		{
+			std::string path;
+			f32 scale;
+			ok = parseQuoted(cursor, name) && parseQuoted(cursor, path)
+				&& sscanf(cursor, "%f %f %f %f", &v.x, &v.y, &v.z, &scale) == 4;
+			if (ok)
+			{
+				meshAssetIndices.insert(std::make_pair(name, u32(scene.meshAssets.size())));
+				scene.meshAssets.push_back(Mesh());
+				Mesh& mesh = scene.meshAssets.back();
+				ok = loadObj((isAbsolutePath(path) ? path : directoryOf(filename) + path).c_str(), mesh);
+				mesh.transform(v, scale);
+				meshAssetNames.push_back(u32(scene.nameStorage.size()));
+				scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+			}
+		}
+		else if (strcmp(keyword, "sphereasset") == 0)
+		{
+			f32 radius;
+			ok = parseQuoted(cursor, name)
+				&& sscanf(cursor, "%f %f %f %f", &v.x, &v.y, &v.z, &radius) == 4;
+			if (ok)
+			{
+				std::unordered_map<std::string, u32>::iterator it = sphereAssetIndices.find(name);
+				if (it == sphereAssetIndices.end())
+				{
+					it = sphereAssetIndices.insert(std::make_pair(name, u32(scene.sphereAssets.size()))).first;
+					scene.sphereAssets.push_back(SphereSet());
+					sphereAssetNames.push_back(u32(scene.nameStorage.size()));
+					scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+				}
+				scene.sphereAssets[it->second].add(v, radius);
+			}
+		}
+		else if (strcmp(keyword, "instance") == 0)
+		{
+			std::string asset;
+			Vec3f rotation;
+			f32 scale;
+			ok = parseQuoted(cursor, name) && parseQuoted(cursor, asset)
+				&& sscanf(cursor, "%f %f %f %f %f %f %f %f %f %f %f%n", &v.x, &v.y, &v.z, &rotation.x, &rotation.y, &rotation.z, &scale,
+					&c.r, &c.g, &c.b, &c.a, &read) == 11;
+			if (ok)
+			{
+				scene.instances.push_back(Instance(NULL, InstanceAsset_Mesh, 0, v, rotation, scale, scene.addMaterial(c)));
+				ok = parsePrimMaterial(cursor + read, scene.materials.back());
+				instanceAssets.push_back(asset);
+				instanceNames.push_back(u32(scene.nameStorage.size()));
+				scene.nameStorage.insert(scene.nameStorage.end(), name.c_str(), name.c_str() + name.size() + 1);
+			}
+		}
+		else
+		{
+			ok = false;
+		}
+	}
+	fclose(f);
+
+	if (!ok)
+	{
+		fprintf(stderr, "%s(%u): can't parse '%s'\n", filename, lineIndex, strtok(line, "\r\n"));
+		scene.clearPrims();
+		return false;
+	}
+
+	scene.nameStorage.push_back(0);
+	for (u32 i = 0; i < lightNames.size(); ++i)
+	{
+		scene.lights[i].name = &scene.nameStorage[lightNames[i]];
+	}
+	if (!lightsRead)
+	{
+		scene.lights.assign(1, Light("Light", LightType_Point, Vec3f(0, 3, 0), white, 1));
+	}
+	scene.updateLights();
+	for (u32 i = 0; i < scene.spheres.size(); ++i)
+	{
+		scene.spheres[i].name = &scene.nameStorage[sphereNames[i]];
+	}
+	for (u32 i = 0; i < scene.planes.size(); ++i)
+	{
+		scene.planes[i].name = &scene.nameStorage[planeNames[i]];
+	}
+	for (u32 i = 0; i < scene.boxes.size(); ++i)
+	{
+		scene.boxes[i].name = &scene.nameStorage[boxNames[i]];
+	}
+	for (u32 i = 0; i < scene.meshes.size(); ++i)
+	{
+		scene.meshes[i].name = &scene.nameStorage[meshNames[i]];
+		scene.meshes[i].build();
+	}
+	for (u32 i = 0; i < scene.meshAssets.size(); ++i)
+	{
+		scene.meshAssets[i].name = &scene.nameStorage[meshAssetNames[i]];
+		scene.meshAssets[i].build();
+	}
+	for (u32 i = 0; i < scene.sphereAssets.size(); ++i)
+	{
+		scene.sphereAssets[i].name = &scene.nameStorage[sphereAssetNames[i]];
+		scene.sphereAssets[i].build();
+	}
+
+	// assets can be declared after the instances using them
+	for (u32 i = 0; i < scene.instances.size(); ++i)
+	{
+		Instance& instance = scene.instances[i];
+		instance.name = &scene.nameStorage[instanceNames[i]];
+		std::unordered_map<std::string, u32>::const_iterator mesh = meshAssetIndices.find(instanceAssets[i]);
+		std::unordered_map<std::string, u32>::const_iterator spheres = sphereAssetIndices.find(instanceAssets[i]);
+		if (mesh == meshAssetIndices.end() && spheres != sphereAssetIndices.end())
+		{
+			instance.assetType = InstanceAsset_Spheres;
+			instance.asset = spheres->second;
+		}
+		else
+		{
+			instance.asset = mesh != meshAssetIndices.end() ? mesh->second : u32(scene.meshAssets.size());
+		}
+	}
+	if (!scene.updateInstances())
+	{
+		fprintf(stderr, "%s: an instance refers to a missing asset\n", filename);
+		scene.clearPrims();
+		return false;
+	}
+	return true;
+}
+
+// the OBJ file a mesh line refers to, and the transform to apply to it: the mesh's source when it can be
+// reached from the scene file, else a copy written next to it, <scene>.<kind><index>.obj
+inline bool meshFileFor( const char* filename, const Mesh& mesh, const char* kind, const u32 index, std::string& path, Vec3f& offset, f32& scale )
+{
+	const std::string directory = directoryOf(filename);
+	path = mesh.source;
+	offset = mesh.offset;
+	scale = mesh.scale;
+	if (!isAbsolutePath(path) && path.compare(0, directory.size(), directory) == 0)
+	{
+		path = path.substr(directory.size());
+	}
+	else if (!isAbsolutePath(path))
+	{
+		path.clear();
+	}
+	if (!path.empty())
+	{
+		return true;
+	}
+
+	const char* dot = strrchr(filename, '.');
+	char sibling[1024];
+	snprintf(sibling, sizeof(sibling), "%.*s.%s%u.obj", int(dot ? dot - filename : strlen(filename)), filename, kind, index);
+	path = sibling + directory.size();
+	offset = Vec3f(0);
+	scale = 1;
+	return saveObj(sibling, mesh);
+}
+
+inline bool saveSceneText( const char* filename, const Scene& scene )
+{
+	FILE* f = fopen(filename, "w");
+	if (!f)
+	{
+		return false;
+	}
+
+	// %.9g round-trips floats exactly
+	fprintf(f, "# YAouRT scene\n");
+	fprintf(f, "description \"%s\"\n", scene.description.c_str());
+	fprintf(f, "camera %.9g %.9g %.9g\n", scene.camPos.x, scene.camPos.y, scene.camPos.z);
+	for (u32 i = 0; i < scene.lights.size(); ++i)
+	{
+		const Light& l = scene.lights[i];
+		fprintf(f, "light \"%s\" %s %.9g %.9g %.9g %.9g %.9g %.9g %.9g", l.name, LightTypeKeys[l.type], l.pos.x, l.pos.y, l.pos.z,
+			l.color.r, l.color.g, l.color.b, l.intensity);
+		if (l.type == LightType_Sphere)
+		{
+			fprintf(f, " %.9g", l.radius);
+		}
+		if (l.type == LightType_Rect)
+		{
+			fprintf(f, " %.9g %.9g %.9g %.9g %.9g %.9g", l.edge1.x, l.edge1.y, l.edge1.z, l.edge2.x, l.edge2.y, l.edge2.z);
+		}
+		fprintf(f, "\n");
+	}
+	for (u32 i = 0; i < scene.planes.size(); ++i)
+	{
+		const PlaneGeometry& p = scene.planeGeometry[i];
+		const Material& m = scene.materials[scene.planes[i].material];
+		fprintf(f, "plane \"%s\" %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g%s\n", scene.planes[i].name, p.pos.x, p.pos.y, p.pos.z,
+			p.normal.x, p.normal.y, p.normal.z, m.color.r, m.color.g, m.color.b, m.color.a, primMaterialSuffix(m).c_str());
+	}
+	for (u32 i = 0; i < scene.boxes.size(); ++i)
+	{
+		const BoxGeometry& b = scene.boxGeometry[i];
+		const Material& m = scene.materials[scene.boxes[i].material];
+		fprintf(f, "box \"%s\" %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g%s\n", scene.boxes[i].name, b.min.x, b.min.y, b.min.z,
+			b.max.x, b.max.y, b.max.z, m.color.r, m.color.g, m.color.b, m.color.a, primMaterialSuffix(m).c_str());
+	}
+	for (u32 i = 0; i < scene.spheres.size(); ++i)
+	{
+		const SphereGeometry& s = scene.sphereGeometry[i];
+		const Material& m = scene.materials[scene.spheres[i].material];
+		fprintf(f, "sphere \"%s\" %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g%s\n", scene.spheres[i].name, s.pos.x, s.pos.y, s.pos.z, s.radius,
+			m.color.r, m.color.g, m.color.b, m.color.a, primMaterialSuffix(m).c_str());
+	}
+
+	bool ok = true;
+	for (u32 i = 0; i < scene.meshes.size(); ++i)
+	{
+		const Mesh& m = scene.meshes[i];
+		const Material& material = scene.materials[m.material];
+		std::string path;
+		Vec3f offset;
+		f32 scale;
+		ok &= meshFileFor(filename, m, "", i, path, offset, scale);
+		fprintf(f, "mesh \"%s\" \"%s\" %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g%s\n", m.name, path.c_str(), offset.x, offset.y, offset.z, scale,
+			material.color.r, material.color.g, material.color.b, material.color.a, primMaterialSuffix(material).c_str());
+	}
+	for (u32 i = 0; i < scene.meshAssets.size(); ++i)
+	{
+		const Mesh& m = scene.meshAssets[i];
+		std::string path;
+		Vec3f offset;
+		f32 scale;
+		ok &= meshFileFor(filename, m, "asset", i, path, offset, scale);
+		fprintf(f, "meshasset \"%s\" \"%s\" %.9g %.9g %.9g %.9g\n", m.name, path.c_str(), offset.x, offset.y, offset.z, scale);
+	}
+	for (u32 i = 0; i < scene.sphereAssets.size(); ++i)
+	{
+		const SphereSet& set = scene.sphereAssets[i];
+		for (u32 s = 0; s < set.count(); ++s)
+		{
+			fprintf(f, "sphereasset \"%s\" %.9g %.9g %.9g %.9g\n", set.name, set.x[s], set.y[s], set.z[s], set.radius[s]);
+		}
+	}
+	for (u32 i = 0; i < scene.instances.size(); ++i)
+	{
+		const Instance& n = scene.instances[i];
+		const Material& m = scene.materials[n.material];
+		const char* asset = n.assetType == InstanceAsset_Mesh && n.asset < scene.meshAssets.size() ? scene.meshAssets[n.asset].name
+			: n.assetType == InstanceAsset_Spheres && n.asset < scene.sphereAssets.size() ? scene.sphereAssets[n.asset].name
+			: "";
+		fprintf(f, "instance \"%s\" \"%s\" %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g%s\n", n.name, asset,
+			n.pos.x, n.pos.y, n.pos.z, n.rotation.x, n.rotation.y, n.rotation.z, n.scale,
+			m.color.r, m.color.g, m.color.b, m.color.a, primMaterialSuffix(m).c_str());
+	}
+	return fclose(f) == 0 && ok;
+}
+
+// binary or text, told apart by the magic
+inline bool loadScene( const char* filename, Scene& scene )
+{
+	char magic[4] = {};
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "can't open %s\n", filename);
+		return false;
+	}
+	size_t read = fread(magic, 1, 4, f);
+	fclose(f);
+
+	if (read == 4 && memcmp(magic, "YSCN", 4) == 0)
+	{
+		return loadSceneBinary(filename, scene);
+	}
+	return loadSceneText(filename, scene);
+}
+
+// text when the name ends in .txt, binary otherwise
+inline bool saveScene( const char* filename, const Scene& scene )
+{
+	const char* dot = strrchr(filename, '.');
+	if (dot && strcmp(dot, ".txt") == 0)
+	{
+		return saveSceneText(filename, scene);
+	}
+	return saveSceneBinary(filename, scene);
+}
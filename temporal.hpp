@@ -0,0 +1,180 @@
+#pragma once
+
+#include <vector>
+
+#include "framebuffer.hpp"
+
+// Reuses the previous frame when only the camera moved.
+// History samples are forward-projected to the new camera with a z-buffer (render cache style),
+// then pixels that got no sample (holes) or whose sample sits behind a closer neighbour of another
+// prim (disocclusion leaking through a gap) are left for the tracer to retrace.
+// Geometry entering from outside the previous view is not detected, the periodic refresh and the
+// full render once the camera stops take care of it.
+class TemporalCache
+{
+public:
+	enum { InvalidIndex = 0xffffffffu };
+
+	bool enabled;
+	f32 historyWeight;		// weight of the reprojected sample when a refreshed pixel is blended
+	u32 refreshInterval;	// every valid pixel gets retraced once every n reprojected frames
+	f32 depthTolerance;		// relative depth difference tolerated between neighbours
+
+	FrameBuffer history;
+	std::vector<u32> source;	// per pixel, index of the history sample that landed there
+	u32 reusedCount;
+
+	TemporalCache()
+		: enabled(true)
+		, historyWeight(0.5f)
+		, refreshInterval(4)
+		, depthTolerance(0.05f)
+		, reusedCount(0)
+	{
+	}
+
+	// the current frame becomes the history, frame keeps its size but its content is garbage
+	void store( FrameBuffer& frame )
+	{
+		history.swap(frame);
+		frame.resize(history.size());
+	}
+
+	// fills frame with the history samples seen from camPos, returns the number of reused pixels
+	// pixels left with source[i] == InvalidIndex must be retraced
+	u32 reproject( FrameBuffer& frame, const Vec2u imageSize, const Vec3f camPos )
+	{
+		const u32 pixelCount = imageSize.x * imageSize.y;
+		source.assign(pixelCount, InvalidIndex);
+		std::fill(frame.depth.begin(), frame.depth.end(), FLT_MAX);
+
+		splat(frame, imageSize, camPos);
+		rejectDisoccluded(frame, imageSize);
+
+		reusedCount = 0;
+		for (u32 i = 0; i < pixelCount; ++i)
+		{
+			if (source[i] != InvalidIndex)
+			{
+				f32 depth = frame.depth[i];
+				frame.copySample(i, history, source[i]);
+				frame.depth[i] = depth;
+				++reusedCount;
+			}
+		}
+		return reusedCount;
+	}
+
+	bool onGui()
+	{
+		bool changed = false;
+
+		ImGui::BeginProperty("Reproject");
+		changed |= ImGui::Checkbox("", &enabled);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		if (!enabled)
+		{
+			return changed;
+		}
+
+		ImGui::BeginProperty("History weight");
+		changed |= ImGui::SliderFloat("", &historyWeight, 0.f, 1.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Refresh interval");
+		changed |= ImGui::SliderInt("", (int*)&refreshInterval, 1, 16);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Depth tolerance");
+		changed |= ImGui::DragFloat("", &depthTolerance, 0.005f, 0.f, 1.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		return changed;
+	}
+
+private:
+	// inverse of Tracer::primaryDir + Tracer::pixelIndex, keeps the closest sample per pixel
+	void splat( FrameBuffer& frame, const Vec2u imageSize, const Vec3f camPos )
+	{
+		const u32 pixelCount = history.size();
+		for (u32 j = 0; j < pixelCount; ++j)
+		{
+			if (!history.prim[j])
+			{
+				continue;
+			}
+
+			Vec3f d = history.pos[j] - camPos;
+			if (d.z <= 0)
+			{
+				continue;
+			}
+
+			f32 px = (d.x / d.z + 0.5f) * imageSize.x;
+			f32 py = (d.y / d.z + 0.5f) * imageSize.y;
+			i32 ix = i32(floorf(px + 0.5f));
+			i32 iy = i32(floorf(py + 0.5f));
+			if (ix < 0 || iy < 0 || ix >= i32(imageSize.x) || iy >= i32(imageSize.y))
+			{
+				continue;
+			}
+
+			u32 i = ix + (imageSize.y - 1 - iy) * imageSize.x;
+			f32 depth = d.mag();
+			if (depth < frame.depth[i])
+			{
+				frame.depth[i] = depth;
+				source[i] = j;
+			}
+		}
+	}
+
+	void rejectDisoccluded( const FrameBuffer& frame, const Vec2u imageSize )
+	{
+		rejected.assign(source.size(), 0);
+
+		const i32 width = imageSize.x;
+		const i32 height = imageSize.y;
+		for (i32 row = 0; row < height; ++row)
+		{
+			for (i32 col = 0; col < width; ++col)
+			{
+				u32 i = col + row * width;
+				if (source[i] == InvalidIndex)
+				{
+					continue;
+				}
+
+				const Prim* prim = history.prim[source[i]];
+				f32 maxDepth = frame.depth[i] * (1 - depthTolerance);
+
+				for (i32 y = std::max(row - 1, 0); y <= std::min(row + 1, height - 1); ++y)
+				{
+					for (i32 x = std::max(col - 1, 0); x <= std::min(col + 1, width - 1); ++x)
+					{
+						u32 n = x + y * width;
+						if (source[n] != InvalidIndex && history.prim[source[n]] != prim && frame.depth[n] < maxDepth)
+						{
+							rejected[i] = 1;
+						}
+					}
+				}
+			}
+		}
+
+		for (u32 i = 0; i < source.size(); ++i)
+		{
+			if (rejected[i])
+			{
+				source[i] = InvalidIndex;
+			}
+		}
+	}
+
+	std::vector<u8> rejected;
+};
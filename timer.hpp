@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+
+// wall clock stopwatch, used for the per-stage render timings
+class Timer
+{
+public:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	Timer()
+		: start(Clock::now())
+	{
+	}
+
+	void reset()
+	{
+		start = Clock::now();
+	}
+
+	f32 elapsedMs() const
+	{
+		return std::chrono::duration<f32, std::milli>(Clock::now() - start).count();
+	}
+
+private:
+	Clock::time_point start;
+};
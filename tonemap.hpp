@@ -0,0 +1,306 @@
+#pragma once
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+#include <math.h>
+
+#include "parallel.hpp"
+#include "math/cpu_dispatch.h"
+
+enum TonemapOperator
+{
+	TonemapOperator_Clamp,
+	TonemapOperator_Reinhard,
+	TonemapOperator_ACES,
+};
+static const char* TonemapOperatorNames[] = { "Clamp", "Reinhard", "ACES (fitted)" };
+static const int TonemapOperator_Count = sizeof(TonemapOperatorNames) / sizeof(TonemapOperatorNames[0]);
+
+// converts the float radiance buffer to the 8-bit display image
+// exposure, tonemap curve and sRGB encoding are applied to rgb, alpha is only clamped
+// 4 pixels per iteration with SSE, 8 with AVX2 and 16 with AVX-512 as cpu_isa() allows, all giving the same
+// bytes (none of the kernels is fused into FMAs); rows of pixels are spread over all threads
+class Tonemapper
+{
+public:
+	TonemapOperator op;
+	f32 exposure;	// in stops
+	bool srgb;
+
+	Tonemapper()
+		: op(TonemapOperator_Clamp)
+		, exposure(0)
+		, srgb(true)
+	{
+	}
+
+	void apply( const Color* src, RGBA* dst, const u32 pixelCount ) const
+	{
+		const u32 grain = 16 * 1024;
+		parallelFor(pixelCount, grain, [&]( u32 begin, u32 end )
+		{
+			applyRange(src + begin, dst + begin, end - begin);
+		});
+	}
+
+	bool onGui()
+	{
+		bool changed = false;
+
+		ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2,2));
+		ImGui::Columns(2);
+		ImGui::Separator();
+
+		ImGui::BeginProperty("Tonemap");
+		changed |= ImGui::Combo("", (int*)&op, TonemapOperatorNames, TonemapOperator_Count);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Exposure");
+		changed |= ImGui::DragFloat("", &exposure, 0.05f, -10.f, 10.f, "%.2f EV");
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("sRGB");
+		changed |= ImGui::Checkbox("", &srgb);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::Columns(1);
+		ImGui::Separator();
+		ImGui::PopStyleVar();
+
+		return changed;
+	}
+
+private:
+	void applyRange( const Color* src, RGBA* dst, u32 count ) const
+	{
+		switch (cpu_isa())
+		{
+			case CpuIsa_Avx512:
+				applyRangeAvx512(src, dst, count);
+				break;
+			case CpuIsa_Avx2:
+				applyRangeAvx2(src, dst, count);
+				break;
+			case CpuIsa_Sse41:
+				applyRangeSse41(src, dst, count);
+				break;
+			default:
+				applyRangeSse2(src, dst, count);
+				break;
+		}
+	}
+
+	// The tonemap curve and the sRGB encoding of the scaled, non negative color c, written once for every register
+	// width: W is the width in the intrinsic names (empty for SSE), LESS(a, b) the mask of a < b and SELECT(mask, a, b)
+	// b where the mask is set, a elsewhere.
+	// The ACES curve is Narkowicz' 2015 fit. sRGB is a polynomial in x^(1/2), x^(1/4), x^(1/8) fitted to the curve
+	// (Ian Taylor), max error 0.25/255 (at most one 8-bit level off), linear below 0.0031308 as per the spec.
+#define PT_TONEMAP_CURVE(NAME, TARGET, REG, W, LESS, SELECT) \
+	TARGET PT_NO_FMA \
+	REG NAME( const REG c ) const \
+	{ \
+		const REG one = _mm##W##_set1_ps(1.f); \
+		REG mapped = c; \
+		switch (op) \
+		{ \
+			case TonemapOperator_Clamp: \
+				break; \
+			case TonemapOperator_Reinhard: \
+				mapped = _mm##W##_div_ps(c, _mm##W##_add_ps(c, one)); \
+				break; \
+			case TonemapOperator_ACES: \
+			{ \
+				const REG num = _mm##W##_mul_ps(c, _mm##W##_add_ps(_mm##W##_mul_ps(c, _mm##W##_set1_ps(2.51f)), _mm##W##_set1_ps(0.03f))); \
+				const REG den = _mm##W##_add_ps(_mm##W##_mul_ps(c, _mm##W##_add_ps(_mm##W##_mul_ps(c, _mm##W##_set1_ps(2.43f)), _mm##W##_set1_ps(0.59f))), _mm##W##_set1_ps(0.14f)); \
+				mapped = _mm##W##_div_ps(num, den); \
+				break; \
+			} \
+		} \
+		mapped = _mm##W##_min_ps(mapped, one); \
+		if (srgb) \
+		{ \
+			const REG s1 = _mm##W##_sqrt_ps(mapped); \
+			const REG s2 = _mm##W##_sqrt_ps(s1); \
+			const REG s3 = _mm##W##_sqrt_ps(s2); \
+			REG curve = _mm##W##_mul_ps(s1, _mm##W##_set1_ps(0.662002687f)); \
+			curve = _mm##W##_add_ps(curve, _mm##W##_mul_ps(s2, _mm##W##_set1_ps(0.684122060f))); \
+			curve = _mm##W##_sub_ps(curve, _mm##W##_mul_ps(s3, _mm##W##_set1_ps(0.323583601f))); \
+			curve = _mm##W##_sub_ps(curve, _mm##W##_mul_ps(mapped, _mm##W##_set1_ps(0.0225411470f))); \
+			const REG linear = _mm##W##_mul_ps(mapped, _mm##W##_set1_ps(12.92f)); \
+			const auto isLinear = LESS(mapped, _mm##W##_set1_ps(0.0031308f)); \
+			mapped = SELECT(isLinear, curve, linear); \
+		} \
+		return mapped; \
+	}
+
+#define PT_LESS_SSE(a, b) _mm_cmplt_ps(a, b)
+#define PT_LESS_AVX(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OS)
+#define PT_LESS_AVX512(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LT_OS)
+#define PT_SELECT_SSE2(mask, a, b) _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a))
+#define PT_SELECT_SSE41(mask, a, b) _mm_blendv_ps(a, b, mask)
+#define PT_SELECT_AVX(mask, a, b) _mm256_blendv_ps(a, b, mask)
+#define PT_SELECT_AVX512(mask, a, b) _mm512_mask_blend_ps(mask, a, b)
+
+	PT_TONEMAP_CURVE(curveSse2, , __m128, , PT_LESS_SSE, PT_SELECT_SSE2)
+	PT_TONEMAP_CURVE(curveSse41, PT_TARGET("sse4.1"), __m128, , PT_LESS_SSE, PT_SELECT_SSE41)
+	PT_TONEMAP_CURVE(curveAvx2, PT_TARGET("avx2"), __m256, 256, PT_LESS_AVX, PT_SELECT_AVX)
+	PT_TONEMAP_CURVE(curveAvx512, PT_TARGET("avx512f"), __m512, 512, PT_LESS_AVX512, PT_SELECT_AVX512)
+
+#undef PT_TONEMAP_CURVE
+#undef PT_LESS_SSE
+#undef PT_LESS_AVX
+#undef PT_LESS_AVX512
+#undef PT_SELECT_SSE2
+#undef PT_SELECT_SSE41
+#undef PT_SELECT_AVX
+#undef PT_SELECT_AVX512
+
+	// the exposure on rgb, alpha is left as is
+	__m128 exposureScale() const
+	{
+		const f32 e = exp2f(exposure);
+		return _mm_setr_ps(e, e, e, 1.f);
+	}
+
+	// 4 pixels per iteration, packed to bytes together
+	PT_NO_FMA
+	void applyRangeSse2( const Color* src, RGBA* dst, u32 count ) const
+	{
+		const __m128 scale = exposureScale();
+
+		u32 i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i p0 = toUnorm8Sse2(_mm_loadu_ps(src[i + 0].value), scale);
+			__m128i p1 = toUnorm8Sse2(_mm_loadu_ps(src[i + 1].value), scale);
+			__m128i p2 = toUnorm8Sse2(_mm_loadu_ps(src[i + 2].value), scale);
+			__m128i p3 = toUnorm8Sse2(_mm_loadu_ps(src[i + 3].value), scale);
+
+			__m128i p01 = _mm_packs_epi32(p0, p1);
+			__m128i p23 = _mm_packs_epi32(p2, p3);
+			_mm_storeu_si128((__m128i*)&dst[i], _mm_packus_epi16(p01, p23));
+		}
+
+		for (; i < count; ++i)
+		{
+			__m128i p = toUnorm8Sse2(_mm_loadu_ps(src[i].value), scale);
+			p = _mm_packus_epi16(_mm_packs_epi32(p, p), p);
+			*(int*)&dst[i] = _mm_cvtsi128_si32(p);
+		}
+	}
+
+	// returns the 4 channels as ints in [0, 255]: tonemapped rgb, clamped alpha
+	PT_NO_FMA
+	__m128i toUnorm8Sse2( const __m128 color, const __m128 scale ) const
+	{
+		const __m128 rgbMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+		const __m128 c = _mm_max_ps(_mm_mul_ps(color, scale), _mm_setzero_ps());
+		const __m128 mapped = curveSse2(c);
+		const __m128 result = _mm_or_ps(_mm_and_ps(rgbMask, mapped), _mm_andnot_ps(rgbMask, _mm_min_ps(c, _mm_set1_ps(1.f))));
+		return _mm_cvtps_epi32(_mm_mul_ps(result, _mm_set1_ps(255.f)));
+	}
+
+	// the SSE2 loop with blends for the selects, and whatever else the compiler finds in SSE4.1; also the tail
+	// of the wider kernels
+	PT_TARGET("sse4.1") PT_NO_FMA
+	void applyRangeSse41( const Color* src, RGBA* dst, u32 count ) const
+	{
+		const __m128 scale = exposureScale();
+
+		u32 i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i p0 = toUnorm8Sse41(_mm_loadu_ps(src[i + 0].value), scale);
+			__m128i p1 = toUnorm8Sse41(_mm_loadu_ps(src[i + 1].value), scale);
+			__m128i p2 = toUnorm8Sse41(_mm_loadu_ps(src[i + 2].value), scale);
+			__m128i p3 = toUnorm8Sse41(_mm_loadu_ps(src[i + 3].value), scale);
+
+			__m128i p01 = _mm_packs_epi32(p0, p1);
+			__m128i p23 = _mm_packs_epi32(p2, p3);
+			_mm_storeu_si128((__m128i*)&dst[i], _mm_packus_epi16(p01, p23));
+		}
+
+		for (; i < count; ++i)
+		{
+			__m128i p = toUnorm8Sse41(_mm_loadu_ps(src[i].value), scale);
+			p = _mm_packus_epi16(_mm_packs_epi32(p, p), p);
+			*(int*)&dst[i] = _mm_cvtsi128_si32(p);
+		}
+	}
+
+	PT_TARGET("sse4.1") PT_NO_FMA
+	__m128i toUnorm8Sse41( const __m128 color, const __m128 scale ) const
+	{
+		const __m128 c = _mm_max_ps(_mm_mul_ps(color, scale), _mm_setzero_ps());
+		const __m128 result = _mm_blend_ps(curveSse41(c), _mm_min_ps(c, _mm_set1_ps(1.f)), 8);
+		return _mm_cvtps_epi32(_mm_mul_ps(result, _mm_set1_ps(255.f)));
+	}
+
+	// 2 pixels per register, 8 per iteration
+	PT_TARGET("avx2") PT_NO_FMA
+	void applyRangeAvx2( const Color* src, RGBA* dst, u32 count ) const
+	{
+		const __m128 half = exposureScale();
+		const __m256 scale = _mm256_set_m128(half, half);
+		u32 i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256i p01 = toUnorm8Avx2(_mm256_loadu_ps(src[i + 0].value), scale);
+			const __m256i p23 = toUnorm8Avx2(_mm256_loadu_ps(src[i + 2].value), scale);
+			const __m256i p45 = toUnorm8Avx2(_mm256_loadu_ps(src[i + 4].value), scale);
+			const __m256i p67 = toUnorm8Avx2(_mm256_loadu_ps(src[i + 6].value), scale);
+
+			// the packs work within 128-bit halves, which leaves the pixels in the order 0 2 4 6 1 3 5 7
+			const __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(p01, p23), _mm256_packs_epi32(p45, p67));
+			_mm256_storeu_si256((__m256i*)&dst[i], _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+		}
+		applyRangeSse41(src + i, dst + i, count - i);
+	}
+
+	PT_TARGET("avx2") PT_NO_FMA
+	__m256i toUnorm8Avx2( const __m256 color, const __m256 scale ) const
+	{
+		const __m256 c = _mm256_max_ps(_mm256_mul_ps(color, scale), _mm256_setzero_ps());
+		const __m256 result = _mm256_blend_ps(curveAvx2(c), _mm256_min_ps(c, _mm256_set1_ps(1.f)), 0x88);
+		return _mm256_cvtps_epi32(_mm256_mul_ps(result, _mm256_set1_ps(255.f)));
+	}
+
+	// GCC 12 takes the undefined registers the AVX-512 intrinsics start from for uninitialized values
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+	// 4 pixels per register, 16 per iteration, each register narrowed to bytes by a single instruction
+	PT_TARGET("avx512f") PT_NO_FMA
+	void applyRangeAvx512( const Color* src, RGBA* dst, u32 count ) const
+	{
+		const f32 e = exp2f(exposure);
+		const __m512 scale = _mm512_setr_ps(e, e, e, 1.f, e, e, e, 1.f, e, e, e, 1.f, e, e, e, 1.f);
+		u32 i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			_mm_storeu_si128((__m128i*)&dst[i + 0], toUnorm8Avx512(_mm512_loadu_ps(src[i + 0].value), scale));
+			_mm_storeu_si128((__m128i*)&dst[i + 4], toUnorm8Avx512(_mm512_loadu_ps(src[i + 4].value), scale));
+			_mm_storeu_si128((__m128i*)&dst[i + 8], toUnorm8Avx512(_mm512_loadu_ps(src[i + 8].value), scale));
+			_mm_storeu_si128((__m128i*)&dst[i + 12], toUnorm8Avx512(_mm512_loadu_ps(src[i + 12].value), scale));
+		}
+		applyRangeSse41(src + i, dst + i, count - i);
+	}
+
+	// the 4 pixels as bytes
+	PT_TARGET("avx512f") PT_NO_FMA
+	__m128i toUnorm8Avx512( const __m512 color, const __m512 scale ) const
+	{
+		const __m512 c = _mm512_max_ps(_mm512_mul_ps(color, scale), _mm512_setzero_ps());
+		const __m512 result = _mm512_mask_blend_ps(0x8888, curveAvx512(c), _mm512_min_ps(c, _mm512_set1_ps(1.f)));
+		return _mm512_cvtusepi32_epi8(_mm512_cvtps_epi32(_mm512_mul_ps(result, _mm512_set1_ps(255.f))));
+	}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+};
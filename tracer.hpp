@@ -10,6 +10,8 @@
 typedef float f32;
 typedef int i32;
 typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef long long i64;
 typedef unsigned char u8;
 
 template<typename T>
@@ -49,7 +51,7 @@ f32 inverseLerpClamped( f32 from, f32 to, f32 value )
 // both dir and normal are expected normalized
 Vec3f reflect( const Vec3f& dir, const Vec3f& normal )
 {
-	return dir - normal * (2.f * dir.dot(normal));
+	return dir.msub(normal, 2.f * dir.dot(normal));
 }
 
 
@@ -67,6 +69,47 @@ static const size_t AxisY = 1;
 static const size_t AxisZ = 2;
 
 #include <vector>
+#include <string>
+#include <algorithm>
+
+#include "timer.hpp"
+#include "parallel.hpp"
+#include "denoise.hpp"
+#include "tonemap.hpp"
+#include "export.hpp"
+#include "math/random.h"
+
+static constexpr f32 Pi = 3.14159265f;
+static constexpr f32 TwoPi = 6.28318531f;
+
+// tangent and bitangent completing the normalized axis to an orthonormal basis
+void makeBasis( const Vec3f& axis, Vec3f& tangent, Vec3f& bitangent )
+{
+	const Vec3f helper = fabsf(axis.x) < 0.9f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+	tangent = helper.cross(axis).normalized();
+	bitangent = axis.cross(tangent);
+}
+
+// a cosine weighted direction around normal for (u, v) in [0, 1)^2, sin^2 theta is u and phi is 2 pi v;
+// the pdf is cos theta / pi, so the Lambert BSDF times the cosine over the pdf leaves the albedo
+Vec3f cosineHemisphere( const Vec3f& normal, const Vec3f& tangent, const Vec3f& bitangent, const f32 u, const f32 v )
+{
+	const f32 phi = TwoPi * v;
+	return (tangent * cosf(phi) + bitangent * sinf(phi)) * sqrtf(u) + normal * sqrtf(std::max(0.f, 1 - u));
+}
+
+Vec3f cosineHemisphere( const Vec3f& normal, const f32 u, const f32 v )
+{
+	Vec3f tangent, bitangent;
+	makeBasis(normal, tangent, bitangent);
+	return cosineHemisphere(normal, tangent, bitangent, u, v);
+}
+
+Vec3f sampleCosineHemisphere( const Vec3f& normal, Random& random )
+{
+	const f32 u = random.uniform();
+	return cosineHemisphere(normal, u, random.uniform());
+}
 
 
 class Ray
@@ -87,46 +130,167 @@ public:
 
 	Vec3f at( f32 dist ) const
 	{
-		return pos + dir * dist;
+		return pos.madd(dir, dist);
 	}
 };
 
-class Prim
+enum MaterialType
+{
+	MaterialType_Diffuse,
+	MaterialType_Mirror,
+	MaterialType_Dielectric,
+	MaterialType_Glossy,
+};
+static const char* MaterialTypeNames[] = { "Diffuse", "Mirror", "Dielectric", "Glossy" };
+static const char* MaterialTypeKeys[] = { "diffuse", "mirror", "glass", "glossy" };
+static const int MaterialType_Count = sizeof(MaterialTypeNames) / sizeof(MaterialTypeNames[0]);
+
+// by scene file key, -1 if unknown
+inline int findMaterialType( const char* key )
+{
+	for (int i = 0; i < MaterialType_Count; ++i)
+	{
+		if (strcmp(key, MaterialTypeKeys[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Surfaces are Lambert of their color, or one of the specular materials tinted by it: a mirror, a dielectric
+// (glass: reflects and refracts by the Fresnel equations, the normal points out of it) or glossy (a Phong lobe
+// around the mirror direction, wider with the roughness). Flat prims are none of these, they show their color.
+// Every prim has its own, in Scene::materials.
+struct Material
 {
-public:
-	const char* name;
 	Color color;
 	bool flat;
-	
-	Prim() //: this(white)
+	MaterialType type;
+	f32 ior;			// dielectric, index of refraction inside, outside is 1
+	f32 roughness;		// glossy, 0 is a mirror
+
+	Material( const Color _color )
+		: color(_color)
+		, flat(false)
+		, type(MaterialType_Diffuse)
+		, ior(1.5f)
+		, roughness(0.2f)
 	{
 	}
 
-	Prim( const char* _name, const Color _color )
-		: name(_name)
-		, color(_color)
-		, flat(false)
+	// rays leave it in a direction that depends on where they came from
+	bool specular() const
 	{
+		return type != MaterialType_Diffuse && !flat;
 	}
 
-	virtual Vec3f getNormal( const Vec3f hitPos ) const = 0;
+	// Dielectric: the share of light arriving along dir that is reflected (1 under total internal reflection),
+	// and the direction of the refracted part. The normal points outside.
+	f32 fresnel( const Vec3f dir, const Vec3f normal, Vec3f& refracted ) const
+	{
+		f32 cosI = -dir.dot(normal);
+		Vec3f facing = normal;
+		f32 eta = 1 / ior;		// outside over inside
+		if (cosI < 0)
+		{
+			cosI = -cosI;
+			facing = normal * -1.f;
+			eta = ior;
+		}
+		const f32 sin2T = eta * eta * (1 - cosI * cosI);
+		if (sin2T >= 1)
+		{
+			return 1;
+		}
+		const f32 cosT = sqrtf(1 - sin2T);
+		refracted = (dir * eta + facing * (eta * cosI - cosT)).normalized();
+		const f32 rs = (eta * cosI - cosT) / (eta * cosI + cosT);
+		const f32 rp = (cosI - eta * cosT) / (cosI + eta * cosT);
+		return (rs * rs + rp * rp) * 0.5f;
+	}
 
-	Color shade( const Vec3f lightPos, const Ray& ray, const f32 dist ) const
+	// A specular bounce of a ray arriving along dir, for (u, v) in [0, 1)^2: where it leaves, and what it is
+	// multiplied by, false if the surface absorbs it. A dielectric reflects when u is under its reflectance,
+	// which leaves the tint as the weight; a glossy lobe is importance sampled, the Phong BRDF times the cosine
+	// over the pdf is (n + 2) / (n + 1) times the cosine.
+	bool scatter( const Vec3f dir, const Vec3f normal, const f32 u, const f32 v, Vec3f& out, Vec3f& weight ) const
 	{
-		if (flat)
+		const Vec3f tint(color.r, color.g, color.b);
+		const Vec3f facing = dir.dot(normal) > 0 ? normal * -1.f : normal;
+		switch (type)
 		{
-			return color;
+			case MaterialType_Mirror:
+				out = reflect(dir, facing);
+				weight = tint;
+				return true;
+			case MaterialType_Dielectric:
+			{
+				Vec3f refracted;
+				out = u < fresnel(dir, normal, refracted) ? reflect(dir, facing) : refracted;
+				weight = tint;
+				return true;
+			}
+			case MaterialType_Glossy:
+			{
+				const Vec3f mirror = reflect(dir, facing);
+				const f32 r = std::max(roughness, 0.01f);
+				const f32 exponent = 2 / (r * r) - 2;
+				const f32 cosAlpha = powf(u, 1 / (exponent + 1));
+				const f32 sinAlpha = sqrtf(std::max(0.f, 1 - cosAlpha * cosAlpha));
+				const f32 phi = TwoPi * v;
+				Vec3f tangent, bitangent;
+				makeBasis(mirror, tangent, bitangent);
+				out = (tangent * cosf(phi) + bitangent * sinf(phi)) * sinAlpha + mirror * cosAlpha;
+				const f32 cosine = out.dot(facing);
+				if (cosine <= 0)
+				{
+					return false;
+				}
+				weight = tint * ((exponent + 2) / (exponent + 1) * cosine);
+				return true;
+			}
+			default:
+				return false;
 		}
+	}
+
+	bool onGui()
+	{
+		bool changed = false;
 
-		Vec3f hitPos = ray.at(dist);
-		Vec3f hitNormal = getNormal(hitPos);
+		ImGui::BeginProperty("Color");
+		changed |= ImGui::ColorEdit4("", (float*)&color);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
 
-		Vec3f lightNormal = (lightPos - hitPos).normalized();
-		f32 dot = lightNormal.dot(hitNormal);
+		ImGui::BeginProperty("Flat");
+		changed |= ImGui::Checkbox("", &flat);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
 
-		float t = inverseLerpClamped(-1, 1, dot);
-		return lerp(black, color, t);
+		ImGui::BeginProperty("Material");
+		changed |= ImGui::Combo("", (int*)&type, MaterialTypeNames, MaterialType_Count);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		if (type == MaterialType_Dielectric)
+		{
+			ImGui::BeginProperty("IOR");
+			changed |= ImGui::DragFloat("", &ior, 0.01f, 1.f, 4.f);
+			ImGui::NextColumn();
+			ImGui::EndProperty();
+		}
+		if (type == MaterialType_Glossy)
+		{
+			ImGui::BeginProperty("Roughness");
+			changed |= ImGui::DragFloat("", &roughness, 0.01f, 0.01f, 1.f);
+			ImGui::NextColumn();
+			ImGui::EndProperty();
+		}
+		return changed;
 	}
+
 	Color shade( const Vec3f lightPos, const Vec3f hitPos, const Vec3f hitNormal ) const
 	{
 		if (flat)
@@ -142,111 +306,400 @@ public:
 	}
 };
 
-class Sphere : public Prim
+// What the editor and the scene files know of a prim beyond its shape and material. The spheres, planes and
+// boxes are only this, their geometry is at the same index in Scene::sphereGeometry, planeGeometry and
+// boxGeometry; meshes and instances add theirs.
+class Prim
 {
 public:
-	Vec3f pos;
-	f32 radius;
-	
-	Sphere()
+	const char* name;
+	u32 material;		// in Scene::materials
+
+	Prim()
+		: name(NULL)
+		, material(0)
 	{
 	}
 
-	Sphere( const char* _name, Vec3f _pos, f32 _radius, Color _color )
-		: Prim(_name, _color)
-		, pos(_pos)
-		, radius(_radius)
+	Prim( const char* _name, const u32 _material )
+		: name(_name)
+		, material(_material)
+	{
+	}
+};
+
+// The geometry of the spheres, planes and boxes, which is all the intersection loops read of them (20 or 32 bytes
+// apiece); the scene reaches for the prim and its material only once one is hit.
+struct SphereGeometry
+{
+	Vec3f pos;
+	f32 radius;
+
+	SphereGeometry( const Vec3f _pos, const f32 _radius )
+		: pos(_pos), radius(_radius)
 	{
 	}
 
-	bool intersect( const Ray& ray, f32& dist )
+	bool intersect( const Ray& ray, f32& dist, const bool fastMath ) const
 	{
-		return intersect_sphere(dist, ray.dir, ray.pos, pos, radius);
+		return fastMath ? intersect_sphere<true>(dist, ray.dir, ray.pos, pos, radius) : intersect_sphere(dist, ray.dir, ray.pos, pos, radius);
 	}
 
-	virtual Vec3f getNormal( const Vec3f hitPos ) const
+	// normalized with normalized_fast under Scene::fastMath
+	Vec3f normalAt( const Vec3f hitPos, const bool fastMath ) const
 	{
-		return (hitPos - pos).normalized();
+		return fastMath ? normalized_fast(hitPos - pos) : (hitPos - pos).normalized();
 	}
 };
 
-class Plane : public Prim
+// A point on the plane and its unit normal, in any orientation.
+struct PlaneGeometry
 {
-public:
-	size_t axis;
-	f32 pos;
-	
-	Plane()
+	Vec3f pos;
+	Vec3f normal;
+
+	// perpendicular to an axis, through 'pos' on it, facing the origin (or -axis when pos is 0)
+	PlaneGeometry( size_t _axis, f32 _pos )
+		: pos(0.f)
+		, normal(0.f)
 	{
+		pos[_axis] = _pos;
+		if (_pos == 0.0f)
+		{
+			normal[_axis] = -1;
+		}
+		else
+		{
+			normal[_axis] = -_pos;
+			normal = normal.normalized();
+		}
 	}
 
-	Plane( const char* _name, size_t _axis, f32 _pos, Color _color )
-		: Prim(_name, _color)
-		, axis(_axis)
-		, pos(_pos)
+	PlaneGeometry( const Vec3f _pos, const Vec3f _normal )
+		: pos(_pos)
+		, normal(_normal.normalized())
 	{
 	}
 
 	bool intersect( const Ray& ray, f32& dist ) const
 	{
-		return intersect_plane(dist, ray.dir, ray.pos, axis, pos);
+		return intersect_plane(dist, ray.dir, ray.pos, pos, normal);
 	}
+};
 
-	Vec3f normal() const
+// Axis aligned, solid: a ray starting inside hits its far side.
+struct BoxGeometry
+{
+	Vec3f min;
+	Vec3f max;
+
+	BoxGeometry( const Vec3f _min, const Vec3f _max )
+		: min(_min), max(_max)
 	{
-		Vec3f normal;
-		if (pos == 0.0f)
+	}
+
+	bool intersect( const Ray& ray, f32& dist, const bool fastMath ) const
+	{
+		const __m128 pos = _mm_setr_ps(ray.pos.x, ray.pos.y, ray.pos.z, 0);
+		const __m128 dir = _mm_setr_ps(ray.dir.x, ray.dir.y, ray.dir.z, 1);
+		const __m128 invDir = fastMath ? rcp_fast4(dir) : _mm_div_ps(_mm_set1_ps(1), dir);
+		f32 tNear = 0;
+		f32 tFar = FLT_MAX;
+		if (!intersect_box(tNear, tFar, pos, invDir, min.value, max.value))
 		{
-			normal[axis] = -1;
+			return false;
 		}
-		else
+		f32 d = tNear > 0 ? tNear : tFar;
+		if (d > dist)
 		{
-			normal[axis] = -pos;
-			normal = normal.normalized();
+			return false;
 		}
-		return normal;
+		dist = d;
+		return true;
 	}
 
-	virtual Vec3f getNormal( const Vec3f hitPos ) const
+	// the face the hit is nearest to, relative to the box's size on each axis
+	Vec3f normalAt( const Vec3f hitPos ) const
 	{
-		return normal();
+		const Vec3f center = (min + max) * 0.5f;
+		const Vec3f extent = (max - min) * 0.5f;
+		u32 axis = 0;
+		f32 nearest = -1;
+		for (u32 a = 0; a < 3; ++a)
+		{
+			f32 d = fabsf(hitPos[a] - center[a]) / std::max(extent[a], 1e-6f);
+			if (d > nearest)
+			{
+				nearest = d;
+				axis = a;
+			}
+		}
+		Vec3f normal(0.f);
+		normal[axis] = hitPos[axis] > center[axis] ? 1.f : -1.f;
+		return normal;
 	}
 };
 
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "instance.hpp"
+#include "lights.hpp"
+#include "math/alias_table.h"
+#include "irradiance_cache.hpp"
+#include "radiance_grid.hpp"
+#include "photon_map.hpp"
+
 enum ShadingModel
 {
 	ShadingModel_Lambert,
 	ShadingModel_LambertWithShadow,
 	ShadingModel_GI_normal,
 	ShadingModel_GI_reflect,
+	ShadingModel_AmbientOcclusion,
+	ShadingModel_Path,
+	ShadingModel_PathBsdf,
+	ShadingModel_PathCached,
+	ShadingModel_PathGrid,
+	ShadingModel_Photon,
 };
-static const char* ShadingModelNames[] = { "Lambert", "Lambert with shadows", "GI (normal)", "GI (reflect)" };
+static const char* ShadingModelNames[] = { "Lambert", "Lambert with shadows", "GI (normal)", "GI (reflect)", "Ambient occlusion", "Path traced", "Path traced (BSDF sampling only)", "Path traced (irradiance cache)", "Path traced (radiance grid)", "Photon map" };
+static const char* ShadingModelKeys[] = { "lambert", "shadows", "gi-normal", "gi-reflect", "ao", "path", "path-bsdf", "path-cache", "path-grid", "photon" };
 static const int ShadingModel_Count = sizeof(ShadingModelNames) / sizeof(ShadingModelNames[0]);
 
+// by command line key, -1 if unknown
+inline int findShadingModel( const char* key )
+{
+	for (int i = 0; i < ShadingModel_Count; ++i)
+	{
+		if (strcmp(key, ShadingModelKeys[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// what Scene::onGui touched, a camera-only change lets the tracer reuse the previous frame
+enum SceneChange
+{
+	SceneChange_None = 0,
+	SceneChange_Camera = 1 << 0,
+	SceneChange_Content = 1 << 1,
+};
+
 class Scene
 {
 public:
 	Scene()
 		: shadingModel(ShadingModel_GI_reflect)
 		, giMaxDist(1)
+		, shadowSamples(16)
+		, pathSamples(8)
+		, pathMinBounces(3)
+		, pathMaxBounces(16)
+		, pathSeed(0)
+		, aoSamples(16)
+		, maxRayDepth(8)
+		, fastMath(false)
 	{
 	}
 
 	Vec3f camPos;
-	Vec3f lightPos;
 
-	std::vector<Sphere> spheres;
-	std::vector<Plane> planes;
+	// call updateLights after editing
+	std::vector<Light> lights;
+
+	// The spheres, planes and boxes are split by how often a ray reads them: the intersection loops walk the
+	// geometry arrays, shading reads the material of the one hit, the prims at the same index hold the rest.
+	// Add them with addSphere, addPlane and addBox, remove them all with clearPrims.
+	std::vector<SphereGeometry> sphereGeometry;
+	std::vector<PlaneGeometry> planeGeometry;
+	std::vector<BoxGeometry> boxGeometry;
+	std::vector<Prim> spheres;
+	std::vector<Prim> planes;
+	std::vector<Prim> boxes;
+	std::vector<Mesh> meshes;
+
+	// one per prim, meshes and instances included, by Prim::material
+	std::vector<Material> materials;
+
+	// shared geometry, only drawn through instances, which go in a BVH of their own
+	std::vector<Mesh> meshAssets;
+	std::vector<SphereSet> sphereAssets;
+	std::vector<Instance> instances;
+
+	// names of prims loaded from a file point in here, built-in scenes use literals
+	std::vector<char> nameStorage;
+
+	// where the scene comes from, printed with benchmark results
+	std::string description;
+
+	// copies a name into nameStorage for a prim added on its own, the names already in there follow when it moves
+	const char* storeName( const char* name )
+	{
+		const char* oldBegin = nameStorage.empty() ? NULL : &nameStorage[0];
+		const char* oldEnd = oldBegin + nameStorage.size();
+		const size_t offset = nameStorage.size();
+		nameStorage.insert(nameStorage.end(), name, name + strlen(name) + 1);
+
+		const char* newBegin = &nameStorage[0];
+		if (oldBegin && newBegin != oldBegin)
+		{
+			rebaseNames(spheres, oldBegin, oldEnd, newBegin);
+			rebaseNames(lights, oldBegin, oldEnd, newBegin);
+			rebaseNames(planes, oldBegin, oldEnd, newBegin);
+			rebaseNames(boxes, oldBegin, oldEnd, newBegin);
+			rebaseNames(meshes, oldBegin, oldEnd, newBegin);
+			rebaseNames(meshAssets, oldBegin, oldEnd, newBegin);
+			rebaseNames(sphereAssets, oldBegin, oldEnd, newBegin);
+			rebaseNames(instances, oldBegin, oldEnd, newBegin);
+		}
+		return newBegin + offset;
+	}
+
+	// after adding, moving or removing instances, only the top-level BVH is rebuilt
+	// false if an instance refers to a missing asset, it is kept but never hit
+	bool updateInstances()
+	{
+		bool resolved = true;
+		std::vector<Aabb> instanceBounds(instances.size());
+		for (u32 i = 0; i < instances.size(); ++i)
+		{
+			if (!instances[i].update(meshAssets, sphereAssets))
+			{
+				fprintf(stderr, "instance %s: no %s asset %u\n", instances[i].name, InstanceAssetNames[instances[i].assetType], instances[i].asset);
+				resolved = false;
+			}
+			instanceBounds[i] = instances[i].bounds();
+		}
+		instanceTree.build(instanceBounds.empty() ? NULL : &instanceBounds[0], u32(instanceBounds.size()), 2);
+		return resolved;
+	}
+
+	// a material of the color for a new prim, returns its index
+	u32 addMaterial( const Color color )
+	{
+		materials.push_back(Material(color));
+		return u32(materials.size() - 1);
+	}
+
+	// returns the new prim's material, to set more than its color
+	Material& addSphere( const char* name, const SphereGeometry& geometry, const Color color )
+	{
+		sphereGeometry.push_back(geometry);
+		spheres.push_back(Prim(name, addMaterial(color)));
+		return materials.back();
+	}
+
+	Material& addPlane( const char* name, const PlaneGeometry& geometry, const Color color )
+	{
+		planeGeometry.push_back(geometry);
+		planes.push_back(Prim(name, addMaterial(color)));
+		return materials.back();
+	}
+
+	Material& addBox( const char* name, const BoxGeometry& geometry, const Color color )
+	{
+		boxGeometry.push_back(geometry);
+		boxes.push_back(Prim(name, addMaterial(color)));
+		return materials.back();
+	}
+
+	// everything rays can hit, with the instanced assets and the materials; lights and names stay
+	void clearPrims()
+	{
+		sphereGeometry.clear();
+		planeGeometry.clear();
+		boxGeometry.clear();
+		spheres.clear();
+		planes.clear();
+		boxes.clear();
+		meshes.clear();
+		clearInstances();
+		materials.clear();
+	}
+
+	// lights are picked in proportion to their power
+	void updateLights()
+	{
+		std::vector<f32> powers(lights.size());
+		for (u32 i = 0; i < lights.size(); ++i)
+		{
+			powers[i] = lights[i].power();
+		}
+		lightTable.build(powers.empty() ? NULL : &powers[0], u32(powers.size()));
+
+		// paths can hit area lights
+		areaLights.clear();
+		std::vector<Aabb> lightBounds;
+		for (u32 i = 0; i < lights.size(); ++i)
+		{
+			if (!lights[i].isDelta())
+			{
+				areaLights.push_back(i);
+				lightBounds.push_back(lights[i].bounds());
+			}
+		}
+		lightTree.build(lightBounds.empty() ? NULL : &lightBounds[0], u32(lightBounds.size()), 2);
+	}
+
+	void clearInstances()
+	{
+		meshAssets.clear();
+		sphereAssets.clear();
+		instances.clear();
+		instanceTree.clear();
+	}
+
+	// geometry memory, with what the instances would take if each had its own copy
+	size_t assetMemory( size_t* flattened = NULL ) const
+	{
+		std::vector<size_t> meshSizes(meshAssets.size()), sphereSizes(sphereAssets.size());
+		size_t total = instanceTree.nodes.capacity() * sizeof(BvhNode) + instances.capacity() * sizeof(Instance);
+		for (u32 i = 0; i < meshAssets.size(); ++i)
+		{
+			total += meshSizes[i] = meshAssets[i].memoryUsage();
+		}
+		for (u32 i = 0; i < sphereAssets.size(); ++i)
+		{
+			total += sphereSizes[i] = sphereAssets[i].memoryUsage();
+		}
+		if (flattened)
+		{
+			*flattened = 0;
+			for (u32 i = 0; i < instances.size(); ++i)
+			{
+				const Instance& instance = instances[i];
+				const std::vector<size_t>& sizes = instance.assetType == InstanceAsset_Mesh ? meshSizes : sphereSizes;
+				*flattened += instance.asset < sizes.size() ? sizes[instance.asset] : 0;
+			}
+		}
+		return total;
+	}
+
+	u64 triangleCount() const
+	{
+		u64 count = 0;
+		for (u32 i = 0; i < meshes.size(); ++i)
+		{
+			count += meshes[i].triangleCount();
+		}
+		return count;
+	}
 
 	class Hit
 	{
 	public:
 		Hit()
 			: prim(NULL)
+			, material(0)
+			, subIndex(0)
 		{
 		}
 
 		Prim* prim;
+		u32 material;		// the prim's, in materials
+		u32 subIndex;
 		f32 dist;
 		Vec3f pos;
 		Vec3f normal;
@@ -259,112 +712,1003 @@ public:
 		Hit hit;
 		hit.dist = dist;
 
-		for (u32 i = 0; i < planes.size(); ++i)
+		// where the closest hit so far is, its normal is found there once they are all tested
+		HitArray array = HitArray_None;
+		u32 index = 0;
+
+		for (u32 i = 0; i < planeGeometry.size(); ++i)
 		{
-			if (planes[i].intersect(ray, hit.dist))
+			if (planeGeometry[i].intersect(ray, hit.dist))
 			{
-				hit.prim = &planes[i];
+				array = HitArray_Planes;
+				index = i;
 			}
 		}
 
-		for (u32 i = 0; i < spheres.size(); ++i)
+		for (u32 i = 0; i < sphereGeometry.size(); ++i)
 		{
-			if (spheres[i].intersect(ray, hit.dist))
+			if (sphereGeometry[i].intersect(ray, hit.dist, fastMath))
 			{
-				hit.prim = &spheres[i];
+				array = HitArray_Spheres;
+				index = i;
 			}
 		}
 
-		if (hit.prim)
+		for (u32 i = 0; i < boxGeometry.size(); ++i)
 		{
-			hit.pos = ray.at(hit.dist);
-			hit.normal = hit.prim->getNormal(hit.pos);
+			if (boxGeometry[i].intersect(ray, hit.dist, fastMath))
+			{
+				array = HitArray_Boxes;
+				index = i;
+			}
 		}
 
-		return hit;
-	}
-
-	Hit giBounce( const Vec3f& pos, const Vec3f& dir )
-	{
-		return intersect(Ray(pos + dir * bounceEpsilon, dir), giMaxDist);
-	}
-
+		for (u32 i = 0; i < meshes.size(); ++i)
+		{
+			if (meshes[i].intersect(ray, hit.dist, hit.subIndex))
+			{
+				array = HitArray_Meshes;
+				index = i;
+			}
+		}
 
-	ShadingModel shadingModel;
-	f32 giMaxDist;
-	static const f32 bounceEpsilon = 0.001f;
+		instanceTree.traverse(ray, hit.dist, [&]( u32 first, u32 count, f32& tmax )
+		{
+			for (u32 i = first; i < first + count; ++i)
+			{
+				if (instances[instanceTree.items[i]].intersect(ray, tmax, hit.subIndex))
+				{
+					array = HitArray_Instances;
+					index = instanceTree.items[i];
+				}
+			}
+		});
 
-	Color shade( const Ray& ray )
-	{
-		Hit hit = intersect(ray);
-		if (!hit)
+		if (array == HitArray_None)
 		{
-			return Color();
+			return hit;
 		}
 
+		hit.pos = ray.at(hit.dist);
+		bool twoSided = false;
+		switch (array)
+		{
+			case HitArray_Planes:
+				hit.prim = &planes[index];
+				hit.normal = planeGeometry[index].normal;
+				break;
+			case HitArray_Spheres:
+				hit.prim = &spheres[index];
+				hit.normal = sphereGeometry[index].normalAt(hit.pos, fastMath);
+				break;
+			case HitArray_Boxes:
+				hit.prim = &boxes[index];
+				hit.normal = boxGeometry[index].normalAt(hit.pos);
+				break;
+			case HitArray_Meshes:
+				hit.prim = &meshes[index];
+				hit.normal = fastMath ? meshes[index].getNormalFast(hit.pos, hit.subIndex) : meshes[index].getNormal(hit.pos, hit.subIndex);
+				twoSided = true;
+				break;
+			case HitArray_Instances:
+				hit.prim = &instances[index];
+				hit.normal = fastMath ? instances[index].getNormalFast(hit.pos, hit.subIndex) : instances[index].getNormal(hit.pos, hit.subIndex);
+				twoSided = instances[index].twoSided();
+				break;
+			case HitArray_None:
+				break;
+		}
+		hit.material = hit.prim->material;
 
-		switch (shadingModel)
+		// triangles are two-sided, whatever the winding of the file; glass keeps it, to know its inside
+		if (twoSided && materials[hit.material].type != MaterialType_Dielectric && hit.normal.dot(ray.dir) > 0)
 		{
-			case ShadingModel_Lambert:
-			case ShadingModel_LambertWithShadow:
-				return shade_lambert(ray, hit, shadingModel == ShadingModel_LambertWithShadow);
-			case ShadingModel_GI_normal:
-			case ShadingModel_GI_reflect:
-				return shade_GI(ray, hit, shadingModel == ShadingModel_GI_reflect);
+			hit.normal = hit.normal * -1.f;
 		}
 
-		return magenta;
+		return hit;
 	}
 
-	Color shade_lambert( const Ray& ray, const Hit& hit, bool allowShadows )
+	// any hit closer than dist, for shadow rays: stops at the first one found, no normal
+	bool occluded( const Ray& ray, const f32 dist )
 	{
-		Color pixel;
-
-		bool inShadow = false;
-		if (allowShadows)
+		for (u32 i = 0; i < planeGeometry.size(); ++i)
 		{
-			Ray bounce;
-			bounce.pos = hit.pos;
-			bounce.dir = (lightPos - hit.pos).normalized();
-			f32 dist = (lightPos - hit.pos).mag();
-
-			bounce.pos += bounce.dir * bounceEpsilon;
-			dist -= bounceEpsilon * 2;
+			f32 d = dist;
+			if (planeGeometry[i].intersect(ray, d))
+			{
+				return true;
+			}
+		}
 
-			inShadow = intersect(bounce, dist);
+		for (u32 i = 0; i < sphereGeometry.size(); ++i)
+		{
+			f32 d = dist;
+			if (sphereGeometry[i].intersect(ray, d, fastMath))
+			{
+				return true;
+			}
 		}
 
-		if (inShadow)
+		for (u32 i = 0; i < boxGeometry.size(); ++i)
 		{
-			pixel = black;
+			f32 d = dist;
+			if (boxGeometry[i].intersect(ray, d, fastMath))
+			{
+				return true;
+			}
 		}
-		else
+
+		for (u32 i = 0; i < meshes.size(); ++i)
 		{
-			pixel = hit.prim->shade(lightPos, hit.pos, hit.normal);
+			if (meshes[i].occluded(ray, dist))
+			{
+				return true;
+			}
 		}
 
-		return pixel;
+		return instanceTree.occluded(ray, dist, [&]( u32 first, u32 count, f32 tmax )
+		{
+			for (u32 i = first; i < first + count; ++i)
+			{
+				if (instances[instanceTree.items[i]].occluded(ray, tmax))
+				{
+					return true;
+				}
+			}
+			return false;
+		});
 	}
 
-	Color shade_GI( const Ray& ray, const Hit& hit, bool _reflect )
+	// occluded() for the 4 rays of a packet, returns the mask of those hitting something before their tFar among
+	// 'active'; the meshes, sphere sets and instances are walked once for the whole packet
+	int occluded4( const RayPacket4& rays, const int active )
 	{
-		Color pixel = hit.prim->shade(lightPos, hit.pos, hit.normal);
-
-		if (Hit bounceHit = giBounce(hit.pos, _reflect ? reflect(ray.dir, hit.normal) : hit.normal))
+		int hits = 0;
+		for (u32 i = 0; i < sphereGeometry.size() && (active & ~hits); ++i)
 		{
-			f32 t = inverseLerpClamped(giMaxDist, 0, bounceHit.dist);
-			Color rgb = lerp(pixel, bounceHit.prim->color, t);
-			pixel = Color(rgb.r, rgb.g, rgb.b, pixel.a);
+			hits |= occluded_sphere_packet4(rays, sphereGeometry[i].pos, sphereGeometry[i].radius, active & ~hits);
 		}
 
-		return pixel;
-	}
+		// few and large, one ray at a time
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			if (!(active & ~hits & (1 << lane)))
+			{
+				continue;
+			}
+			const Ray ray(Vec3f(rays.position[0][lane], rays.position[1][lane], rays.position[2][lane]),
+				Vec3f(rays.direction[0][lane], rays.direction[1][lane], rays.direction[2][lane]));
+			for (u32 i = 0; i < planeGeometry.size(); ++i)
+			{
+				f32 d = rays.tFar[lane];
+				if (planeGeometry[i].intersect(ray, d))
+				{
+					hits |= 1 << lane;
+					break;
+				}
+			}
+			for (u32 i = 0; i < boxGeometry.size() && !(hits & (1 << lane)); ++i)
+			{
+				f32 d = rays.tFar[lane];
+				if (boxGeometry[i].intersect(ray, d, fastMath))
+				{
+					hits |= 1 << lane;
+				}
+			}
+		}
 
+		for (u32 i = 0; i < meshes.size() && (active & ~hits); ++i)
+		{
+			hits |= meshes[i].occluded4(rays, active & ~hits);
+		}
 
-	bool onGui()
-	{
-		/*ImGui::Text("%d spheres", spheres.size());
-		for (int i = 0; i < spheres.size(); i++)
+		if (active & ~hits)
+		{
+			hits |= instanceTree.occluded4(rays, active & ~hits, [&]( u32 first, u32 count, int open )
+			{
+				int found = 0;
+				for (u32 i = first; i < first + count && (open & ~found); ++i)
+				{
+					found |= instances[instanceTree.items[i]].occluded4(rays, open & ~found);
+				}
+				return found;
+			});
+		}
+		return hits & active;
+	}
+
+	Hit giBounce( const Vec3f& pos, const Vec3f& dir )
+	{
+		return intersect(Ray(pos.madd(dir, bounceEpsilon), dir), giMaxDist);
+	}
+
+
+	ShadingModel shadingModel;
+	f32 giMaxDist;
+	u32 shadowSamples;		// per shaded point, whatever the number of lights
+	u32 pathSamples;		// paths per shaded point
+	u32 pathMinBounces;		// bounces before Russian roulette
+	u32 pathMaxBounces;
+	u32 pathSeed;			// another seed gives another noise, for independent renders
+	IrradianceCache irradianceCache;	// clear it when the content changes
+	RadianceGrid radianceGrid;			// same
+	PhotonMap photonMap;				// same, it's built again by the next render
+	u32 aoSamples;			// ambient occlusion rays per shaded point, reaching giMaxDist
+	u32 maxRayDepth;		// specular bounces followed by the models other than the path tracer
+	enum { MaxRayDepth = 64 };
+	bool fastMath;			// rsqrt/rcp estimates for the primary directions, sphere and box hits, normals and shadow rays (math/fast_math.h)
+	static constexpr f32 bounceEpsilon = 0.001f;
+
+	Color shade( const Ray& ray )
+	{
+		Hit hit;
+		return shade(ray, hit);
+	}
+
+	// same as above, also returns the primary hit (used by the AA edge detection)
+	// the model is switched on for every ray, the render loops pick a specialized pipeline once instead
+	Color shade( const Ray& ray, Hit& hit )
+	{
+		switch (shadingModel)
+		{
+			case ShadingModel_Lambert:				return shade<ShadingModel_Lambert, true, true>(ray, hit);
+			case ShadingModel_LambertWithShadow:	return shade<ShadingModel_LambertWithShadow, true, true>(ray, hit);
+			case ShadingModel_GI_normal:			return shade<ShadingModel_GI_normal, true, true>(ray, hit);
+			case ShadingModel_GI_reflect:			return shade<ShadingModel_GI_reflect, true, true>(ray, hit);
+			case ShadingModel_AmbientOcclusion:		return shade<ShadingModel_AmbientOcclusion, true, true>(ray, hit);
+			case ShadingModel_Path:					return shade<ShadingModel_Path, true, true>(ray, hit);
+			case ShadingModel_PathBsdf:				return shade<ShadingModel_PathBsdf, true, true>(ray, hit);
+			case ShadingModel_PathCached:			return shade<ShadingModel_PathCached, true, true>(ray, hit);
+			case ShadingModel_PathGrid:				return shade<ShadingModel_PathGrid, true, true>(ray, hit);
+			case ShadingModel_Photon:				return shade<ShadingModel_Photon, true, true>(ray, hit);
+		}
+
+		hit = Hit();
+		return magenta;
+	}
+
+	// A shading pipeline fixed at compile time: the model, and whether the scene has flat prims and specular
+	// prims at all; without them, their tests are left out of every pixel. Models that handle a feature
+	// themselves, or never look at it, only come with it on (see flatSpecialized and specularSpecialized).
+	template<ShadingModel Model, bool Flat, bool Specular>
+	Color shade( const Ray& ray, Hit& hit )
+	{
+		hit = intersect(ray);
+		if (!hit)
+		{
+			return Color();
+		}
+
+		// the path tracer follows specular bounces itself
+		if (specularSpecialized(Model) && Specular && materials[hit.material].specular())
+		{
+			return shade_specular<Model, Flat>(ray, hit);
+		}
+		return shadeSurface<Model, Flat>(ray, hit);
+	}
+
+	// the models with a pipeline without the flat prim test
+	static constexpr bool flatSpecialized( const ShadingModel model )
+	{
+		return model == ShadingModel_Lambert || model == ShadingModel_LambertWithShadow || model == ShadingModel_GI_normal
+			|| model == ShadingModel_GI_reflect || model == ShadingModel_AmbientOcclusion;
+	}
+
+	// the models with a pipeline without the specular bounces, the path tracer always scatters on its own
+	static constexpr bool specularSpecialized( const ShadingModel model )
+	{
+		return model != ShadingModel_Path && model != ShadingModel_PathBsdf;
+	}
+
+	// the models whose pixels carry Monte Carlo noise, a color difference between neighbours isn't an edge
+	static constexpr bool isNoisy( const ShadingModel model )
+	{
+		return model == ShadingModel_AmbientOcclusion || model == ShadingModel_Path || model == ShadingModel_PathBsdf
+			|| model == ShadingModel_PathCached || model == ShadingModel_PathGrid || model == ShadingModel_Photon;
+	}
+
+	// what the pipelines can leave out, checked once per frame
+	bool hasFlatPrims() const
+	{
+		return anyOf(materials, []( const Material& material ) { return material.flat; });
+	}
+
+	bool hasSpecularPrims() const
+	{
+		return anyOf(materials, []( const Material& material ) { return material.specular(); });
+	}
+
+	// Mirrors, glass and glossy surfaces for the models that only shade diffuse surfaces: the rays they send are
+	// followed up to maxRayDepth bounces, and what they find is shaded by the model. Glass sends both its
+	// reflected and refracted rays, so the bounces make a tree; it is walked depth first with a stack of the
+	// rays left to trace, which holds one pending ray per depth at most, so a fixed array on the thread's stack
+	// does, whatever the depth. Rays carrying too little to show, or past the depth, are dropped (black).
+	template<ShadingModel Model, bool Flat>
+	Color shade_specular( const Ray& ray, const Hit& hit )
+	{
+		struct PendingRay
+		{
+			Ray ray;
+			Vec3f weight;
+			u32 depth;
+		};
+		PendingRay stack[MaxRayDepth + 2];
+		u32 count = 0;
+		const u32 depthLimit = std::min(maxRayDepth, u32(MaxRayDepth));
+		Random random(hashPosition(hit.pos), pathSeed);
+
+		Vec3f sum(0);
+		Ray current = ray;
+		Hit currentHit = hit;
+		Vec3f weight(1, 1, 1);
+		u32 depth = 0;
+		for (;;)
+		{
+			if (currentHit)
+			{
+				const Material& material = materials[currentHit.material];
+				if (!material.specular())
+				{
+					const Color c = shadeSurface<Model, Flat>(current, currentHit);
+					sum += weight * Vec3f(c.r, c.g, c.b);
+				}
+				else if (depth < depthLimit)
+				{
+					Vec3f dir, scale;
+					if (material.type == MaterialType_Dielectric)
+					{
+						// both ways, each with its share
+						Vec3f refracted;
+						const f32 reflectance = material.fresnel(current.dir, currentHit.normal, refracted);
+						const Vec3f facing = current.dir.dot(currentHit.normal) > 0 ? currentHit.normal * -1.f : currentHit.normal;
+						const Vec3f tint(material.color.r, material.color.g, material.color.b);
+						pushRay(stack, count, currentHit.pos, reflect(current.dir, facing), weight * tint * reflectance, depth + 1);
+						if (reflectance < 1)
+						{
+							pushRay(stack, count, currentHit.pos, refracted, weight * tint * (1 - reflectance), depth + 1);
+						}
+					}
+					else if (material.scatter(current.dir, currentHit.normal, random.uniform(), random.uniform(), dir, scale))
+					{
+						pushRay(stack, count, currentHit.pos, dir, weight * scale, depth + 1);
+					}
+				}
+			}
+
+			if (count == 0)
+			{
+				break;
+			}
+			const PendingRay& next = stack[--count];
+			current = next.ray;
+			weight = next.weight;
+			depth = next.depth;
+			currentHit = intersect(current);
+		}
+		return Color(sum.r, sum.g, sum.b, materials[hit.material].color.a);
+	}
+
+	// the stack holds one pending ray per depth, plus the one about to be traced
+	template<typename PendingRay>
+	static void pushRay( PendingRay* stack, u32& count, const Vec3f& pos, const Vec3f& dir, const Vec3f& weight, const u32 depth )
+	{
+		if (std::max(weight.r, std::max(weight.g, weight.b)) < 1e-3f || count >= MaxRayDepth + 2)
+		{
+			return;
+		}
+		PendingRay& pending = stack[count++];
+		pending.ray = Ray(pos.madd(dir, bounceEpsilon), dir);
+		pending.weight = weight;
+		pending.depth = depth;
+	}
+
+	// the shading model on a surface that isn't specular, the switch is on a constant
+	template<ShadingModel Model, bool Flat>
+	Color shadeSurface( const Ray& ray, const Hit& hit )
+	{
+		switch (Model)
+		{
+			case ShadingModel_Lambert:
+			case ShadingModel_LambertWithShadow:
+				return shade_lambert<Model == ShadingModel_LambertWithShadow, Flat>(ray, hit);
+			case ShadingModel_GI_normal:
+			case ShadingModel_GI_reflect:
+				return shade_GI<Model == ShadingModel_GI_reflect, Flat>(ray, hit);
+			case ShadingModel_AmbientOcclusion:
+				return shade_ao<Flat>(ray, hit);
+			case ShadingModel_Path:
+			case ShadingModel_PathBsdf:
+				return shade_path(ray, hit, Model == ShadingModel_Path);
+			case ShadingModel_PathCached:
+				return shade_cached(ray, hit);
+			case ShadingModel_PathGrid:
+				return shade_grid(ray, hit);
+			case ShadingModel_Photon:
+				return shade_photon(ray, hit);
+		}
+
+		return magenta;
+	}
+
+	template<bool Shadows, bool Flat>
+	Color shade_lambert( const Ray& ray, const Hit& hit )
+	{
+		return directLight<Shadows, Flat>(hit);
+	}
+
+	// Lambert term of every light, with shadowSamples samples at most whatever the number of lights:
+	// each sample picks a light in proportion to its power (alias table) and a point on it, the points
+	// are stratified on a grid over the light's surface. A lone point light needs one sample.
+	// The samples are seeded with the hit position, so a point always gets the same noise.
+	template<bool Shadows, bool Flat>
+	Color directLight( const Hit& hit )
+	{
+		const Material& material = materials[hit.material];
+		if (Flat && material.flat)
+		{
+			return material.color;
+		}
+		if (lightTable.empty())
+		{
+			return Color(0, 0, 0, material.color.a);
+		}
+
+		const bool single = lights.size() == 1 && lights[0].type == LightType_Point;
+		const u32 side = single ? 1 : std::max(1u, u32(sqrtf(f32(shadowSamples))));
+		const u32 count = side * side;
+		Random random(hashPosition(hit.pos));
+
+		f32 r = 0, g = 0, b = 0;
+		for (u32 s = 0; s < count; ++s)
+		{
+			f32 pdf;
+			const Light& light = lights[lightTable.sample(random.uniform(), pdf)];
+			const f32 u = (f32(s % side) + random.uniform()) / side;
+			const f32 v = (f32(s / side) + random.uniform()) / side;
+			const Vec3f target = light.sample(hit.pos, u, v);
+			if (Shadows && isShadowed(hit.pos, target))
+			{
+				continue;
+			}
+
+			const Color lit = material.shade(target, hit.pos, hit.normal);
+			const f32 weight = light.intensity / (pdf * count);
+			r += lit.r * light.color.r * weight;
+			g += lit.g * light.color.g * weight;
+			b += lit.b * light.color.b * weight;
+		}
+		return Color(r, g, b, material.color.a);
+	}
+
+	bool isShadowed( const Vec3f& pos, const Vec3f& target )
+	{
+		Ray bounce;
+		bounce.pos = pos;
+		f32 dist;
+		if (fastMath)
+		{
+			// one estimate gives both
+			const Vec3f delta = target - pos;
+			const f32 lengthSq = delta.magSq();
+			const f32 inverse = rsqrt_fast(lengthSq);
+			bounce.dir = delta * inverse;
+			dist = lengthSq * inverse;
+		}
+		else
+		{
+			bounce.dir = (target - pos).normalized();
+			dist = (target - pos).mag();
+		}
+
+		bounce.pos = bounce.pos.madd(bounce.dir, bounceEpsilon);
+		dist -= bounceEpsilon * 2;
+
+		return occluded(bounce, dist);
+	}
+
+	template<bool Reflect, bool Flat>
+	Color shade_GI( const Ray& ray, const Hit& hit )
+	{
+		Color pixel = directLight<false, Flat>(hit);
+
+		if (Hit bounceHit = giBounce(hit.pos, Reflect ? reflect(ray.dir, hit.normal) : hit.normal))
+		{
+			f32 t = inverseLerpClamped(giMaxDist, 0, bounceHit.dist);
+			Color rgb = lerp(pixel, materials[bounceHit.material].color, t);
+			pixel = Color(rgb.r, rgb.g, rgb.b, pixel.a);
+		}
+
+		return pixel;
+	}
+
+	// Ambient occlusion: the prim color times the share of aoSamples cosine weighted rays over the hemisphere
+	// that find nothing within giMaxDist. Only whether a ray is blocked matters, so they go through the any-hit
+	// traversal, 4 at a time as a packet: a node is visited once for the rays that enter it.
+	template<bool Flat>
+	Color shade_ao( const Ray& ray, const Hit& hit )
+	{
+		const Material& material = materials[hit.material];
+		if (Flat && material.flat)
+		{
+			return material.color;
+		}
+		const Vec3f normal = hit.normal.dot(ray.dir) > 0 ? hit.normal * -1.f : hit.normal;
+		Vec3f tangent, bitangent;
+		makeBasis(normal, tangent, bitangent);
+		const Vec3f origin = hit.pos.madd(normal, bounceEpsilon);
+
+		// stratified on a grid over the disk the cosine weighted directions project to
+		Random random(hashPosition(hit.pos), pathSeed);
+		const u32 count = std::max(aoSamples, 1u);
+		const u32 side = std::max(1u, u32(sqrtf(f32(count))));
+		u32 open = 0;
+		for (u32 first = 0; first < count; first += 4)
+		{
+			RayPacket4 rays;
+			int active = 0;
+			for (u32 lane = 0; lane < 4; ++lane)
+			{
+				// lanes past the count repeat the last ray, masked out
+				const u32 s = std::min(first + lane, count - 1);
+				const f32 u = (f32(s % side) + random.uniform()) / side;
+				const Vec3f dir = cosineHemisphere(normal, tangent, bitangent, u, (f32(s / side % side) + random.uniform()) / side);
+				set_ray_packet4(rays, lane, origin, dir, giMaxDist);
+				active |= first + lane < count ? 1 << lane : 0;
+			}
+			const int blocked = occluded4(rays, active);
+			for (u32 lane = 0; lane < 4; ++lane)
+			{
+				open += (active & ~blocked) >> lane & 1;
+			}
+		}
+
+		const f32 visibility = f32(open) / count;
+		return Color(material.color.r * visibility, material.color.g * visibility, material.color.b * visibility, material.color.a);
+	}
+
+
+	// Path tracing with physical lights (see Light): Lambert surfaces of the prim color, flat prims glow with theirs.
+	// With light sampling, every bounce also sends a shadow ray towards a light picked by power (next event
+	// estimation); an area light can then be found both ways, each weighted with the power heuristic so the
+	// technique with the lower variance for that direction dominates. Without it, lights are only found when a
+	// bounce happens to hit them, point lights never. Camera rays go through lights, as in the other models.
+	// Past pathMinBounces, a path survives with a probability following its throughput (Russian roulette).
+	Color shade_path( const Ray& ray, const Hit& hit, const bool lightSampling )
+	{
+		Random random(hashPosition(hit.pos), pathSeed);
+		Vec3f sum(0);
+		for (u32 s = 0; s < pathSamples; ++s)
+		{
+			sum += tracePath(ray, hit, lightSampling, random);
+		}
+		sum = sum * (1.f / std::max(pathSamples, 1u));
+		return Color(sum.r, sum.g, sum.b, materials[hit.material].color.a);
+	}
+
+	Vec3f tracePath( Ray ray, Hit hit, const bool lightSampling, Random& random )
+	{
+		Vec3f radiance(0);
+		Vec3f throughput(1, 1, 1);
+		f32 bsdfPdf = 0;		// of the bounce that found hit
+		bool specular = false;	// that bounce was, light sampling couldn't have found what it finds
+
+		for (u32 bounce = 0; ; ++bounce)
+		{
+			u32 lightIndex;
+			f32 lightPdf;
+			if (bounce > 0 && intersectLights(ray, hit ? hit.dist : FLT_MAX, lightIndex, lightPdf))
+			{
+				const f32 weight = lightSampling && !specular ? powerHeuristic(bsdfPdf, lightPdf * lightTable.pdf(lightIndex)) : 1;
+				radiance += throughput * lights[lightIndex].radiance() * weight;
+				break;
+			}
+			if (!hit)
+			{
+				break;
+			}
+
+			const Material& material = materials[hit.material];
+			if (material.flat)
+			{
+				radiance += throughput * Vec3f(material.color.r, material.color.g, material.color.b);
+				break;
+			}
+			if (material.specular())
+			{
+				Vec3f dir, weight;
+				if (bounce + 1 >= pathMaxBounces || !material.scatter(ray.dir, hit.normal, random.uniform(), random.uniform(), dir, weight))
+				{
+					break;
+				}
+				throughput = throughput * weight;
+				specular = true;
+				ray = Ray(hit.pos.madd(dir, bounceEpsilon), dir);
+				hit = intersect(ray);
+				continue;
+			}
+			const Vec3f albedo(material.color.r, material.color.g, material.color.b);
+			const Vec3f normal = hit.normal.dot(ray.dir) > 0 ? hit.normal * -1.f : hit.normal;
+
+			if (lightSampling && !lightTable.empty())
+			{
+				f32 pickPdf, dist, pdf;
+				Vec3f dir, incident;
+				const Light& light = lights[lightTable.sample(random.uniform(), pickPdf)];
+				if (light.sampleIncident(hit.pos, random.uniform(), random.uniform(), dir, dist, incident, pdf))
+				{
+					const f32 cosine = dir.dot(normal);
+					if (cosine > 0 && !isOccluded(hit.pos, dir, dist))
+					{
+						const f32 weight = light.isDelta() ? 1 : powerHeuristic(pdf * pickPdf, cosine * (1 / Pi));
+						radiance += throughput * albedo * incident * (cosine * (1 / Pi) * weight / pickPdf);
+					}
+				}
+			}
+
+			if (bounce + 1 >= pathMaxBounces)
+			{
+				break;
+			}
+			if (bounce >= pathMinBounces)
+			{
+				const f32 survival = std::min(0.95f, std::max(throughput.r, std::max(throughput.g, throughput.b)));
+				if (random.uniform() >= survival)
+				{
+					break;
+				}
+				throughput = throughput * (1 / survival);
+			}
+
+			// cosine weighted, the Lambert BSDF times the cosine over the pdf leaves the albedo
+			const Vec3f dir = sampleCosineHemisphere(normal, random);
+			bsdfPdf = dir.dot(normal) * (1 / Pi);
+			specular = false;
+			throughput = throughput * albedo;
+
+			ray = Ray(hit.pos.madd(dir, bounceEpsilon), dir);
+			hit = intersect(ray);
+		}
+		return radiance;
+	}
+
+	// Direct light sampled at every pixel, indirect irradiance (paths starting with a bounce, which don't count
+	// lights hit by that first bounce) from the irradiance cache. With the cache disabled, every pixel computes
+	// the irradiance a record would have, which is what the cache approximates.
+	Color shade_cached( const Ray& ray, const Hit& hit )
+	{
+		const Material& material = materials[hit.material];
+		if (material.flat)
+		{
+			return material.color;
+		}
+		const Vec3f normal = hit.normal.dot(ray.dir) > 0 ? hit.normal * -1.f : hit.normal;
+
+		Vec3f indirect;
+		if (!irradianceCache.enabled)
+		{
+			indirect = sampleIrradiance(hit.pos, normal).irradiance;
+		}
+		else if (!irradianceCache.lookup(hit.pos, normal, indirect))
+		{
+			IrradianceCache::Record record = sampleIrradiance(hit.pos, normal);
+			irradianceCache.insert(record);
+			indirect = record.irradiance;
+		}
+
+		const Vec3f radiance = Vec3f(material.color.r, material.color.g, material.color.b) * (directIrradiance(hit.pos, normal) + indirect) * (1 / Pi);
+		return Color(radiance.r, radiance.g, radiance.b, material.color.a);
+	}
+
+	// Same as above with the indirect irradiance from the radiance grid: quicker to fill than the cache, as a
+	// point traces a few paths at most, and without its gradients and error control, so it's blurrier and
+	// leaks light around thin walls, a preview of what the cache or the path tracer would show.
+	Color shade_grid( const Ray& ray, const Hit& hit )
+	{
+		const Material& material = materials[hit.material];
+		if (material.flat)
+		{
+			return material.color;
+		}
+		const Vec3f normal = hit.normal.dot(ray.dir) > 0 ? hit.normal * -1.f : hit.normal;
+
+		i32 cell;
+		const u32 wanted = radianceGrid.samplesWanted(hit.pos, normal, cell);
+		Vec3f indirect(0);
+		if (wanted)
+		{
+			Random random(hashPosition(hit.pos), pathSeed);
+			for (u32 s = 0; s < wanted; ++s)
+			{
+				indirect += sampleIndirect(hit.pos, normal, random);
+			}
+			if (cell >= 0)
+			{
+				radianceGrid.add(cell, indirect, wanted);
+			}
+			indirect = indirect * (1.f / wanted);
+		}
+		if (!radianceGrid.lookup(hit.pos, normal, indirect) && !wanted)
+		{
+			// no room in the grid, and none of the neighbours was filled
+			Random random(hashPosition(hit.pos), pathSeed);
+			for (u32 s = 0; s < radianceGrid.minSamples; ++s)
+			{
+				indirect += sampleIndirect(hit.pos, normal, random);
+			}
+			indirect = indirect * (1.f / std::max(radianceGrid.minSamples, 1u));
+		}
+
+		const Vec3f radiance = Vec3f(material.color.r, material.color.g, material.color.b) * (directIrradiance(hit.pos, normal) + indirect) * (1 / Pi);
+		return Color(radiance.r, radiance.g, radiance.b, material.color.a);
+	}
+
+	// Direct light sampled at every pixel, indirect irradiance and caustics estimated from the photon map.
+	// Only lights emit photons, the glow of flat prims isn't part of it.
+	Color shade_photon( const Ray& ray, const Hit& hit )
+	{
+		const Material& material = materials[hit.material];
+		if (material.flat)
+		{
+			return material.color;
+		}
+		const Vec3f normal = hit.normal.dot(ray.dir) > 0 ? hit.normal * -1.f : hit.normal;
+		const Vec3f indirect = photonMap.irradiance(hit.pos, normal);
+
+		const Vec3f radiance = Vec3f(material.color.r, material.color.g, material.color.b) * (directIrradiance(hit.pos, normal) + indirect) * (1 / Pi);
+		return Color(radiance.r, radiance.g, radiance.b, material.color.a);
+	}
+
+	// Emits photonMap.photonCount photons from the lights, picked by power, and stores where they land after a
+	// bounce at least, since direct light is sampled at every pixel. Chunks of photons are traced in parallel,
+	// each with its own random sequence, and merged in order, so the map doesn't depend on the thread count.
+	void buildPhotonMap()
+	{
+		Timer timer;
+		const u32 count = lightTable.empty() ? 0 : photonMap.photonCount;
+		const u32 grain = 4096;
+		std::vector<std::vector<PhotonMap::Photon> > chunks((count + grain - 1) / grain);
+		parallelFor(count, grain, [&]( u32 begin, u32 end )
+		{
+			std::vector<PhotonMap::Photon>& stored = chunks[begin / grain];
+			Random random(begin, pathSeed);
+			for (u32 i = begin; i < end; ++i)
+			{
+				f32 pickPdf;
+				const Light& light = lights[lightTable.sample(random.uniform(), pickPdf)];
+				Ray ray;
+				const f32 u1 = random.uniform(), u2 = random.uniform(), u3 = random.uniform(), u4 = random.uniform();
+				light.sampleEmission(u1, u2, u3, u4, ray.pos, ray.dir);
+				tracePhoton(ray, light.flux() * (1 / (pickPdf * count)), random, stored);
+			}
+		});
+		photonMap.emitMs = timer.elapsedMs();
+		photonMap.emitted = count;
+
+		timer.reset();
+		photonMap.build(chunks);
+		photonMap.buildMs = timer.elapsedMs();
+	}
+
+	// Lambert bounces until Russian roulette on the albedo absorbs the photon; flat prims absorb it. Specular
+	// surfaces pass it on without keeping it, so what lands through glass or off a mirror makes caustics.
+	void tracePhoton( Ray ray, Vec3f power, Random& random, std::vector<PhotonMap::Photon>& stored )
+	{
+		for (u32 bounce = 0; bounce < pathMaxBounces; ++bounce)
+		{
+			const Hit hit = intersect(ray);
+			if (!hit || materials[hit.material].flat)
+			{
+				return;
+			}
+			if (materials[hit.material].specular())
+			{
+				Vec3f dir, weight;
+				if (!materials[hit.material].scatter(ray.dir, hit.normal, random.uniform(), random.uniform(), dir, weight))
+				{
+					return;
+				}
+				power = power * weight;
+				ray = Ray(hit.pos.madd(dir, bounceEpsilon), dir);
+				continue;
+			}
+			const Vec3f normal = hit.normal.dot(ray.dir) > 0 ? hit.normal * -1.f : hit.normal;
+
+			if (bounce > 0)
+			{
+				const PhotonMap::Photon photon =
+				{
+					{ hit.pos.x, hit.pos.y, hit.pos.z },
+					{ power.r, power.g, power.b },
+					{ ray.dir.x, ray.dir.y, ray.dir.z },
+					0
+				};
+				stored.push_back(photon);
+			}
+
+			// capped as in tracePath: white walls would otherwise keep every photon to pathMaxBounces
+			const Color& albedo = materials[hit.material].color;
+			const f32 survival = std::min(0.95f, std::max(albedo.r, std::max(albedo.g, albedo.b)));
+			if (survival <= 0 || random.uniform() >= survival)
+			{
+				return;
+			}
+			power = power * Vec3f(albedo.r, albedo.g, albedo.b) * (1 / survival);
+
+			ray.dir = sampleCosineHemisphere(normal, random);
+			ray.pos = hit.pos.madd(ray.dir, bounceEpsilon);
+		}
+	}
+
+	// pathSamples light samples, without shadow ray when the light is behind the surface
+	Vec3f directIrradiance( const Vec3f& pos, const Vec3f& normal )
+	{
+		Vec3f direct(0);
+		Random random(hashPosition(pos), pathSeed);
+		for (u32 s = 0; s < pathSamples && !lightTable.empty(); ++s)
+		{
+			f32 pickPdf, dist, pdf;
+			Vec3f dir, incident;
+			const Light& light = lights[lightTable.sample(random.uniform(), pickPdf)];
+			if (light.sampleIncident(pos, random.uniform(), random.uniform(), dir, dist, incident, pdf))
+			{
+				const f32 cosine = dir.dot(normal);
+				if (cosine > 0 && !isOccluded(pos, dir, dist))
+				{
+					direct += incident * (cosine / pickPdf);
+				}
+			}
+		}
+		return direct * (1.f / std::max(pathSamples, 1u));
+	}
+
+	// one estimate of the indirect irradiance: pi times the radiance of a cosine weighted path
+	Vec3f sampleIndirect( const Vec3f& pos, const Vec3f& normal, Random& random )
+	{
+		const Vec3f dir = sampleCosineHemisphere(normal, random);
+		const Ray ray(pos.madd(dir, bounceEpsilon), dir);
+		return tracePath(ray, intersect(ray), true, random) * Pi;
+	}
+
+	// A new cache record: M x N rays stratified over the cosine weighted hemisphere (sin^2 theta and phi
+	// uniform in each cell), with Ward and Heckbert's gradient estimates from the differences between
+	// neighbouring cells. The radius is the harmonic mean distance of the hits, and no more than the distance
+	// over which the translational gradient would change the irradiance by itself.
+	IrradianceCache::Record sampleIrradiance( const Vec3f& pos, const Vec3f& normal )
+	{
+		const u32 m = std::max(2u, u32(sqrtf(irradianceCache.rays / Pi) + 0.5f));
+		const u32 n = std::max(3u, irradianceCache.rays / m);
+		Vec3f tangent, bitangent;
+		makeBasis(normal, tangent, bitangent);
+
+		std::vector<Vec3f> incoming(m * n);
+		std::vector<f32> dists(m * n);
+		std::vector<f32> sinThetas(m * n);
+		Random random(hashPosition(pos), pathSeed);
+		f32 inverseDistSum = 0;
+		IrradianceCache::Record record;
+		record.pos = pos;
+		record.normal = normal;
+		record.irradiance = Vec3f(0);
+		for (u32 c = 0; c < 3; ++c)
+		{
+			record.rotation[c] = Vec3f(0);
+			record.translation[c] = Vec3f(0);
+		}
+
+		for (u32 k = 0; k < n; ++k)
+		{
+			for (u32 j = 0; j < m; ++j)
+			{
+				const f32 sinTheta = sqrtf((j + random.uniform()) / m);
+				const f32 cosTheta = sqrtf(std::max(0.f, 1 - sinTheta * sinTheta));
+				const f32 phi = TwoPi * (k + random.uniform()) / n;
+				const Vec3f side = tangent * cosf(phi) + bitangent * sinf(phi);
+				const Vec3f dir = side * sinTheta + normal * cosTheta;
+
+				const Ray ray(pos.madd(dir, bounceEpsilon), dir);
+				const Hit hit = intersect(ray);
+				const Vec3f radiance = tracePath(ray, hit, true, random);
+				const u32 i = j + k * m;
+				incoming[i] = radiance;
+				dists[i] = hit ? hit.dist : FLT_MAX;
+				sinThetas[i] = sinTheta;
+				inverseDistSum += 1 / dists[i];
+				record.irradiance += radiance;
+
+				// rotating the normal tilts the cosine weights
+				const Vec3f perpendicular = tangent * -sinf(phi) + bitangent * cosf(phi);
+				const f32 tanTheta = sinTheta / std::max(cosTheta, 1e-3f);
+				for (u32 c = 0; c < 3; ++c)
+				{
+					record.rotation[c] += perpendicular * (tanTheta * radiance[c]);
+				}
+			}
+		}
+		const f32 cellWeight = Pi / (m * n);
+		record.irradiance = record.irradiance * cellWeight;
+		for (u32 c = 0; c < 3; ++c)
+		{
+			record.rotation[c] = record.rotation[c] * cellWeight;
+		}
+
+		// moving the point shifts the cell walls: theta walls between j - 1 and j, phi walls between k - 1 and k;
+		// hits closer than the smallest record spacing (in corners) count as that far
+		const f32 nearest = irradianceCache.minSpacing;
+		for (u32 k = 0; k < n; ++k)
+		{
+			const f32 phi = TwoPi * k / n;
+			const Vec3f u = tangent * cosf(phi) + bitangent * sinf(phi);
+			const Vec3f v = tangent * -sinf(phi) + bitangent * cosf(phi);
+			const u32 previousK = (k + n - 1) % n;
+			for (u32 j = 0; j < m; ++j)
+			{
+				const f32 sinMinus = sqrtf(f32(j) / m);
+				const f32 cosMinus = sqrtf(1 - f32(j) / m);
+				const u32 i = j + k * m;
+				if (j > 0)
+				{
+					const u32 below = i - 1;
+					const f32 wall = TwoPi / n * sinMinus * cosMinus * cosMinus / std::max(nearest, std::min(dists[i], dists[below]));
+					for (u32 c = 0; c < 3; ++c)
+					{
+						record.translation[c] += u * (wall * (incoming[i][c] - incoming[below][c]));
+					}
+				}
+				const u32 beside = j + previousK * m;
+				const f32 wall = 0.5f / m / (std::max(sinThetas[i], 1e-3f) * std::max(nearest, std::min(dists[i], dists[beside])));
+				for (u32 c = 0; c < 3; ++c)
+				{
+					record.translation[c] += v * (wall * (incoming[i][c] - incoming[beside][c]));
+				}
+			}
+		}
+
+		record.radius = inverseDistSum > 0 ? (m * n) / inverseDistSum : FLT_MAX;
+		const f32 brightness = record.irradiance.r + record.irradiance.g + record.irradiance.b;
+		const f32 slope = (record.translation[0] + record.translation[1] + record.translation[2]).mag();
+		if (slope > 0)
+		{
+			record.radius = std::min(record.radius, brightness / slope);
+		}
+		return record;
+	}
+
+	static f32 powerHeuristic( const f32 pdf, const f32 otherPdf )
+	{
+		return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+	}
+
+	// nearest area light closer than dist, lights aren't in the prim BVHs
+	bool intersectLights( const Ray& ray, const f32 dist, u32& lightIndex, f32& pdf ) const
+	{
+		bool hit = false;
+		f32 nearest = dist;
+		lightTree.traverse(ray, nearest, [&]( u32 first, u32 count, f32& tmax )
+		{
+			for (u32 i = first; i < first + count; ++i)
+			{
+				const u32 light = areaLights[lightTree.items[i]];
+				if (lights[light].intersect(ray, tmax, pdf))
+				{
+					lightIndex = light;
+					hit = true;
+				}
+			}
+		});
+		return hit;
+	}
+
+	bool isOccluded( const Vec3f& pos, const Vec3f& dir, const f32 dist )
+	{
+		return occluded(Ray(pos.madd(dir, bounceEpsilon), dir), dist - bounceEpsilon * 2);
+	}
+
+
+	u32 onGui()
+	{
+		/*ImGui::Text("%d spheres", spheres.size());
+		for (int i = 0; i < spheres.size(); i++)
 		{
 			const Sphere& sphere = spheres[i];
 			ImGui::TextColored(
@@ -375,6 +1719,7 @@ public:
 
 
 		bool changed = false;
+		bool cameraChanged = false;
 
 		ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2,2));
 		ImGui::Columns(2);
@@ -391,88 +1736,333 @@ public:
 		ImGui::EndProperty();
 
 		ImGui::BeginProperty("Camera");
-		changed |= ImGui::DragFloat3("", (float*)&camPos, 0.1f);
+		cameraChanged |= ImGui::DragFloat3("", (float*)&camPos, 0.1f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Shadow samples");
+		changed |= ImGui::DragInt("", (int*)&shadowSamples, 1.f, 1, 256);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Path samples");
+		changed |= ImGui::DragInt("", (int*)&pathSamples, 1.f, 1, 4096);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("Path bounces");
+		changed |= ImGui::DragInt("", (int*)&pathMaxBounces, 1.f, 1, 64);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("AO samples");
+		changed |= ImGui::DragInt("", (int*)&aoSamples, 1.f, 1, 1024);
 		ImGui::NextColumn();
 		ImGui::EndProperty();
 
-		ImGui::BeginProperty("Light");
-		changed |= ImGui::DragFloat3("", (float*)&lightPos, 0.1f);
+		ImGui::BeginProperty("Ray depth");
+		changed |= ImGui::DragInt("", (int*)&maxRayDepth, 1.f, 0, MaxRayDepth);
 		ImGui::NextColumn();
 		ImGui::EndProperty();
 
-		if (ImGui::BeginProperty("Spheres", true))
+		ImGui::BeginProperty("Fast math");
+		changed |= ImGui::Checkbox("", &fastMath);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		changed |= irradianceCache.onGui();
+		changed |= radianceGrid.onGui();
+		changed |= photonMap.onGui();
+
+		bool lightsChanged = false;
+		if (ImGui::BeginProperty("Lights", true))
+		{
+			for (u32 i = 0; i < lights.size(); i++)
+			{
+				Light& light = lights[i];
+
+				if (ImGui::BeginProperty(light.name, true))
+				{
+					ImGui::BeginProperty("Type");
+					lightsChanged |= ImGui::Combo("", (int*)&light.type, LightTypeNames, LightType_Count);
+					ImGui::NextColumn();
+					ImGui::EndProperty();
+
+					ImGui::BeginProperty("Pos");
+					lightsChanged |= ImGui::DragFloat3("", (float*)&light.pos, 0.1f);
+					ImGui::NextColumn();
+					ImGui::EndProperty();
+
+					if (light.type == LightType_Sphere)
+					{
+						ImGui::BeginProperty("Radius");
+						lightsChanged |= ImGui::DragFloat("", &light.radius, 0.01f, 0.f, 10.f);
+						ImGui::NextColumn();
+						ImGui::EndProperty();
+					}
+					if (light.type == LightType_Rect)
+					{
+						ImGui::BeginProperty("Edge 1");
+						lightsChanged |= ImGui::DragFloat3("", (float*)&light.edge1, 0.1f);
+						ImGui::NextColumn();
+						ImGui::EndProperty();
+
+						ImGui::BeginProperty("Edge 2");
+						lightsChanged |= ImGui::DragFloat3("", (float*)&light.edge2, 0.1f);
+						ImGui::NextColumn();
+						ImGui::EndProperty();
+					}
+
+					ImGui::BeginProperty("Color");
+					lightsChanged |= ImGui::ColorEdit3("", (float*)&light.color);
+					ImGui::NextColumn();
+					ImGui::EndProperty();
+
+					ImGui::BeginProperty("Intensity");
+					lightsChanged |= ImGui::DragFloat("", &light.intensity, 0.01f, 0.f, 100.f);
+					ImGui::NextColumn();
+					ImGui::EndProperty();
+				}
+				ImGui::EndProperty();
+			}
+		}
+		ImGui::EndProperty();
+
+		if (lightsChanged)
+		{
+			updateLights();
+			changed = true;
+		}
+
+		if (ImGui::BeginProperty("Spheres", true))
+		{
+			for (u32 i = 0; i < spheres.size(); i++)
+			{
+				SphereGeometry& sphere = sphereGeometry[i];
+
+				//char label[32];sprintf(label, "Sphere %d", i);
+				if (ImGui::BeginProperty(spheres[i].name, true))
+				{
+					ImGui::BeginProperty("Pos");
+					changed |= ImGui::DragFloat3("", (float*)&sphere.pos, 0.1f);
+					ImGui::NextColumn();
+					ImGui::EndProperty();
+
+					ImGui::BeginProperty("Radius");
+					changed |= ImGui::DragFloat("", &sphere.radius, 0.1f, 0.1f, 10.f);
+					ImGui::NextColumn();
+					ImGui::EndProperty();
+
+					changed |= materials[spheres[i].material].onGui();
+				}
+				ImGui::EndProperty();
+			}
+		}
+		ImGui::EndProperty();
+
+		if (ImGui::BeginProperty("Planes", true))
 		{
-			for (u32 i = 0; i < spheres.size(); i++)
+			for (u32 i = 0; i < planes.size(); i++)
 			{
-				Sphere& sphere = spheres[i];
+				PlaneGeometry& plane = planeGeometry[i];
 
-				//char label[32];sprintf(label, "Sphere %d", i);
-				if (ImGui::BeginProperty(sphere.name, true))
+				if (ImGui::BeginProperty(planes[i].name, true))
 				{
 					ImGui::BeginProperty("Pos");
-					changed |= ImGui::DragFloat3("", (float*)&sphere.pos, 0.1f);
+					changed |= ImGui::DragFloat3("", (float*)&plane.pos, 0.1f);
 					ImGui::NextColumn();
 					ImGui::EndProperty();
 
-					ImGui::BeginProperty("Radius");
-					changed |= ImGui::DragFloat("", &sphere.radius, 0.1f, 0.1f, 10.f);
+					ImGui::BeginProperty("Normal");
+					if (ImGui::DragFloat3("", (float*)&plane.normal, 0.01f, -1.f, 1.f))
+					{
+						Vec3f normal(plane.normal.x, plane.normal.y, plane.normal.z);
+						plane.normal = normal.dot(normal) > 0 ? normal.normalized() : Vec3f(0, 1, 0);
+						changed = true;
+					}
 					ImGui::NextColumn();
 					ImGui::EndProperty();
 
-					ImGui::BeginProperty("Color");
-					changed |= ImGui::ColorEdit4("", (float*)&sphere.color);
+					changed |= materials[planes[i].material].onGui();
+				}
+				ImGui::EndProperty();
+			}
+		}
+		ImGui::EndProperty();
+
+		if (ImGui::BeginProperty("Boxes", true))
+		{
+			for (u32 i = 0; i < boxes.size(); i++)
+			{
+				BoxGeometry& box = boxGeometry[i];
+
+				if (ImGui::BeginProperty(boxes[i].name, true))
+				{
+					ImGui::BeginProperty("Min");
+					changed |= ImGui::DragFloat3("", (float*)&box.min, 0.1f);
 					ImGui::NextColumn();
 					ImGui::EndProperty();
 
-					ImGui::BeginProperty("Flat");
-					changed |= ImGui::Checkbox("", &sphere.flat);
+					ImGui::BeginProperty("Max");
+					changed |= ImGui::DragFloat3("", (float*)&box.max, 0.1f);
 					ImGui::NextColumn();
 					ImGui::EndProperty();
+
+					changed |= materials[boxes[i].material].onGui();
 				}
 				ImGui::EndProperty();
 			}
 		}
 		ImGui::EndProperty();
 
-		if (ImGui::BeginProperty("Planes", true))
+		if (ImGui::BeginProperty("Meshes", true))
 		{
-			for (u32 i = 0; i < planes.size(); i++)
+			for (u32 i = 0; i < meshes.size(); i++)
+			{
+				Mesh& mesh = meshes[i];
+
+				if (ImGui::BeginProperty(mesh.name, true))
+				{
+					ImGui::BeginProperty("Triangles");
+					ImGui::Text("%u (%u vertices, %u BVH nodes)", mesh.triangleCount(), mesh.vertexCount(), mesh.nodeCount());
+					ImGui::NextColumn();
+					ImGui::EndProperty();
+
+					changed |= materials[mesh.material].onGui();
+				}
+				ImGui::EndProperty();
+			}
+		}
+		ImGui::EndProperty();
+
+		// moving instances only rebuilds the top level, the assets are untouched
+		bool instancesMoved = false;
+		if (ImGui::BeginProperty("Instances", true))
+		{
+			for (u32 i = 0; i < instances.size(); i++)
 			{
-				Plane& plane = planes[i];
+				Instance& instance = instances[i];
 
-				if (ImGui::BeginProperty(plane.name, true))
+				if (ImGui::BeginProperty(instance.name, true))
 				{
-					static const char* axes[3] = { "X", "Y", "Z" };
-					ImGui::BeginProperty("Axis");
-					changed |= ImGui::Combo("", (int*)&plane.axis, axes, 3);
+					ImGui::BeginProperty("Asset");
+					ImGui::Text("%s %u", InstanceAssetNames[instance.assetType], instance.asset);
 					ImGui::NextColumn();
 					ImGui::EndProperty();
 
 					ImGui::BeginProperty("Pos");
-					changed |= ImGui::DragFloat("", &plane.pos, 0.1f);
+					instancesMoved |= ImGui::DragFloat3("", (float*)&instance.pos, 0.1f);
 					ImGui::NextColumn();
 					ImGui::EndProperty();
 
-					ImGui::BeginProperty("Color");
-					changed |= ImGui::ColorEdit4("", (float*)&plane.color);
+					ImGui::BeginProperty("Rotation");
+					instancesMoved |= ImGui::DragFloat3("", (float*)&instance.rotation, 1.f);
 					ImGui::NextColumn();
 					ImGui::EndProperty();
 
-					ImGui::BeginProperty("Flat");
-					changed |= ImGui::Checkbox("", &plane.flat);
+					ImGui::BeginProperty("Scale");
+					instancesMoved |= ImGui::DragFloat("", &instance.scale, 0.01f, 0.01f, 100.f);
 					ImGui::NextColumn();
 					ImGui::EndProperty();
+
+					changed |= materials[instance.material].onGui();
 				}
 				ImGui::EndProperty();
 			}
 		}
 		ImGui::EndProperty();
 
+		if (instancesMoved)
+		{
+			updateInstances();
+			changed = true;
+		}
 		ImGui::Columns(1);
 		ImGui::Separator();
 		ImGui::PopStyleVar();
 
-		return changed;
+		return (changed ? SceneChange_Content : SceneChange_None) | (cameraChanged ? SceneChange_Camera : SceneChange_None);
+	}
+
+private:
+	// which array intersect() found the closest hit in
+	enum HitArray
+	{
+		HitArray_None,
+		HitArray_Planes,
+		HitArray_Spheres,
+		HitArray_Boxes,
+		HitArray_Meshes,
+		HitArray_Instances,
+	};
+
+	Bvh instanceTree;
+	AliasTable lightTable;
+	Bvh lightTree;
+	std::vector<u32> areaLights;	// lights in lightTree, by item
+
+	// seeds the light samples of a shaded point
+	static u64 hashPosition( const Vec3f& pos )
+	{
+		u32 bits[3];
+		memcpy(bits, pos.value, sizeof(bits));
+		u64 h = (u64(bits[0]) << 32 | bits[1]) ^ (u64(bits[2]) * 0x9e3779b97f4a7c15ull);
+		h ^= h >> 30;
+		h *= 0xbf58476d1ce4e5b9ull;
+		h ^= h >> 27;
+		h *= 0x94d049bb133111ebull;
+		return h ^ (h >> 31);
+	}
+
+	template<typename T>
+	static void rebaseNames( std::vector<T>& prims, const char* oldBegin, const char* oldEnd, const char* newBegin )
+	{
+		for (u32 i = 0; i < prims.size(); ++i)
+		{
+			if (prims[i].name >= oldBegin && prims[i].name < oldEnd)
+			{
+				prims[i].name = newBegin + (prims[i].name - oldBegin);
+			}
+		}
+	}
+
+	template<typename T, typename F>
+	static bool anyOf( const std::vector<T>& items, const F& test )
+	{
+		for (u32 i = 0; i < items.size(); ++i)
+		{
+			if (test(items[i]))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+#include "objloader.hpp"
+#include "scenefile.hpp"
+#include "generator.hpp"
+#include "framebuffer.hpp"
+#include "temporal.hpp"
+#include "gputexture.hpp"
+
+// shades a camera ray with a pipeline fixed at compile time, the render loops are instantiated for each
+template<ShadingModel Model, bool Flat, bool Specular>
+struct ShadeAs
+{
+	Color operator()( Scene& scene, const Ray& ray, Scene::Hit& hit ) const
+	{
+		return scene.shade<Model, Flat, Specular>(ray, hit);
+	}
+};
+
+// the same through the per-ray switch on the scene's model
+struct ShadeAny
+{
+	Color operator()( Scene& scene, const Ray& ray, Scene::Hit& hit ) const
+	{
+		return scene.shade(ray, hit);
 	}
 };
 
@@ -480,16 +2070,66 @@ class Tracer
 {
 public:
 	Vec2u imageSize;
-	Vec2f imageSizeInv;
 	RGBA* image;
-	GLuint glTextureID;
+	GpuTexture texture;
+
+	// the camera frames viewSize pixels, the image is the rectangle at viewOffset (from the bottom left) in it
+	// both match the image, unless it is a band of a larger picture
+	Vec2u viewSize;
+	Vec2u viewOffset;
+	Vec2f viewSizeInv;
 
 	Scene scene;
 
+	FrameBuffer frame;
+	std::vector<u8> edgeMask;
+
+	// adaptive anti-aliasing: only pixels on a prim or color discontinuity get extra rays
+	bool aaEnabled;
+	f32 aaThreshold;
+	u32 aaGridSize;
+	u32 aaRefinedCount;
+
+	// the render loops are picked once per frame for the shading model and the scene, off switches per ray
+	bool specializedShading;
+
+	SceneGenerator generator;
+	Denoiser denoiser;
+	// the denoiser's output, frame.radiance stays noisy for the temporal history, empty with the denoiser off
+	std::vector<Color> denoised;
+	Tonemapper tonemapper;
+	Exporter exporter;
+
+	// camera moves reuse the previous frame, the image is refined with a full render once the camera stops
+	TemporalCache temporal;
+	bool approximate;
+	u32 frameIndex;
+	u32 retracedCount;
+
+	struct Timings
+	{
+		f32 reproject;
+		f32 primary;
+		f32 aa;
+		f32 denoise;
+		f32 tonemap;
+		f32 upload;
+		f32 total;
+	};
+	Timings timings;
+
 	Tracer()
 		: image(NULL)
-		, glTextureID(0)
+		, aaEnabled(true)
+		, aaThreshold(0.1f)
+		, aaGridSize(3)
+		, aaRefinedCount(0)
+		, specializedShading(true)
+		, approximate(false)
+		, frameIndex(0)
+		, retracedCount(0)
 	{
+		memset(&timings, 0, sizeof(timings));
 	}
 	~Tracer()
 	{
@@ -501,86 +2141,499 @@ public:
 		freeImage();
 
 		imageSize = _imageSize;
-		imageSizeInv = Vec2f(1.f / imageSize.x, 1.f / imageSize.y);
+		setView(imageSize, Vec2u(0));
 
+		// the image and per-pixel buffers are indexed with u32, larger pictures are rendered in bands
 		u32 pixelCount = imageSize.x * imageSize.y;
 		image = new RGBA[pixelCount];
+
+		frame.resize(pixelCount);
+		edgeMask.resize(pixelCount);
+	}
+	void setView( const Vec2u size, const Vec2u offset )
+	{
+		viewSize = size;
+		viewOffset = offset;
+		viewSizeInv = Vec2f(1.f / viewSize.x, 1.f / viewSize.y);
 	}
 	void freeImage()
 	{
 		if (image)
 		{
 			delete[] image;
+			image = NULL;
 		}
 	}
 
+	// the image and every per-pixel buffer, the denoiser's and the temporal history included
+	size_t imageMemory() const
+	{
+		return (image ? size_t(imageSize.x) * imageSize.y * sizeof(RGBA) : 0)
+			+ frame.memoryUsage()
+			+ edgeMask.capacity() * sizeof(u8)
+			+ denoised.capacity() * sizeof(Color)
+			+ denoiser.memoryUsage()
+			+ temporal.history.memoryUsage()
+			+ temporal.source.capacity() * sizeof(u32);
+	}
+
 	void initScene()
 	{
 		scene.camPos = Vec3f(0, 3, -8);
-		scene.lightPos = Vec3f(0, 3, 0);
+		scene.lights.assign(1, Light("Light", LightType_Point, Vec3f(0, 3, 0), white, 1));
+		scene.updateLights();
+		scene.irradianceCache.clear();
+		scene.radianceGrid.clear();
+		scene.photonMap.clear();
+
+		scene.clearPrims();
+		scene.addPlane("bottom", PlaneGeometry(AxisY, -0.0001f), white);
+		scene.addPlane("top", PlaneGeometry(AxisY, +6), white);
+		scene.addPlane("back", PlaneGeometry(AxisZ, +4), white);
+		scene.addPlane("left", PlaneGeometry(AxisX, -4), red);
+		scene.addPlane("right", PlaneGeometry(AxisX, +4), green);
+
+		scene.addSphere("Sphere 0", SphereGeometry(Vec3f(-1, +1, -0.5f), 1), cyan);
+		scene.addSphere("Sphere 1", SphereGeometry(Vec3f(+1, +1, +0.5f), 1), yellow);
+
+		scene.description = "built-in";
+	}
 
-		scene.planes.clear();
-		scene.planes.push_back(Plane("bottom", AxisY, -0.0001f, white));
-		scene.planes.push_back(Plane("top", AxisY, +6, white));
-		scene.planes.push_back(Plane("back", AxisZ, +4, white));
-		scene.planes.push_back(Plane("left", AxisX, -4, red));
-		scene.planes.push_back(Plane("right", AxisX, +4, green));
+	u32 pixelIndex( u32 ix, u32 iy ) const
+	{
+		return ix + (imageSize.y - 1 - iy) * imageSize.x;
+	}
 
-		scene.spheres.clear();
-		scene.spheres.push_back(Sphere("Sphere 0", Vec3f(-1, +1, -0.5f), 1, cyan));
-		scene.spheres.push_back(Sphere("Sphere 1", Vec3f(+1, +1, +0.5f), 1, yellow));
+	// through the corner of pixel (ix, iy), plus a sub-pixel offset
+	// the view offset is added to the integer part so bands of a picture trace exactly the same rays
+	Vec3f primaryDir( u32 ix, u32 iy, f32 ox = 0, f32 oy = 0 ) const
+	{
+		f32 px = f32(ix + viewOffset.x) + ox;
+		f32 py = f32(iy + viewOffset.y) + oy;
+		const Vec3f dir(px * viewSizeInv.x - 0.5f, py * viewSizeInv.y - 0.5f, 1);
+		return scene.fastMath ? normalized_fast(dir) : dir.normalized();
 	}
 
 	void render()
 	{
-		Ray ray;
-		ray.pos = scene.camPos;
+		Timer total;
+		Timer stage;
+
+		timings.reproject = 0;
+		updatePhotonMap();
+		stage.reset();
+		renderPrimary();
+		timings.primary = stage.elapsedMs();
+
+		stage.reset();
+		aaRefinedCount = 0;
+		if (aaEnabled)
+		{
+			findEdges();
+			refineEdges();
+		}
+		timings.aa = stage.elapsedMs();
+
+		stage.reset();
+		denoise();
+		timings.denoise = stage.elapsedMs();
+
+		stage.reset();
+		resolve();
+		timings.tonemap = stage.elapsedMs();
+
+		timings.total = total.elapsedMs();
+		approximate = false;
+	}
+
+	// the photon model needs the map before its first pixel; its build time is in the map, not the primary time
+	void updatePhotonMap()
+	{
+		if (scene.shadingModel == ShadingModel_Photon && !scene.photonMap.isBuilt())
+		{
+			scene.buildPhotonMap();
+		}
+	}
+
+	// camera-only change: reuse the previous frame where it is still valid, retrace the rest
+	// no AA here, the full render once the camera stops brings it back
+	void renderReprojected()
+	{
+		Timer total;
+		Timer stage;
+
+		temporal.store(frame);
+		temporal.reproject(frame, imageSize, scene.camPos);
+		timings.reproject = stage.elapsedMs();
+
+		updatePhotonMap();
+		stage.reset();
+		retraceInvalid();
+		timings.primary = stage.elapsedMs();
+
+		timings.aa = 0;
+		aaRefinedCount = 0;
+
+		stage.reset();
+		denoise();
+		timings.denoise = stage.elapsedMs();
+
+		stage.reset();
+		resolve();
+		timings.tonemap = stage.elapsedMs();
+
+		timings.total = total.elapsedMs();
+		approximate = true;
+		++frameIndex;
+	}
+
+	// traces the pixels the reprojection rejected, plus an interleaved subset of the valid ones
+	// so view dependent shading catches up; those are blended with their history
+	void retraceInvalid()
+	{
+		runPass(Pass_Retrace);
+	}
+
+	template<typename Shader>
+	void retraceInvalidWith( const Shader& shade )
+	{
+		const u32 interval = std::max(temporal.refreshInterval, 1u);
+		const u32 refreshSlot = frameIndex % interval;
+
+		std::atomic<u32> retraced(0);
+		parallelFor(imageSize.y, 4, [&]( u32 rowBegin, u32 rowEnd )
+		{
+			Ray ray;
+			ray.pos = scene.camPos;
+
+			u32 count = 0;
+			for (u32 iy = rowBegin; iy < rowEnd; ++iy)
+			{
+				for (u32 ix = 0; ix < imageSize.x; ++ix)
+				{
+					u32 iPixel = pixelIndex(ix, iy);
+					bool reused = temporal.source[iPixel] != TemporalCache::InvalidIndex;
+					if (reused && (ix + iy * 3) % interval != refreshSlot)
+					{
+						continue;
+					}
+
+					ray.dir = primaryDir(ix, iy);
+
+					Scene::Hit hit;
+					Color pixel = shade(scene, ray, hit);
+					if (reused)
+					{
+						pixel = lerp(pixel, frame.radiance[iPixel], temporal.historyWeight);
+					}
+					frame.setSample(iPixel, pixel, hit, scene);
+					++count;
+				}
+			}
+			retraced += count;
+		});
+		retracedCount = retraced;
+	}
+
+	void denoise()
+	{
+		if (denoiser.enabled)
+		{
+			denoised.resize(frame.radiance.size());
+			denoiser.apply(imageSize, &frame.radiance[0], &denoised[0], &frame.normal[0], &frame.depth[0], &frame.albedo[0]);
+		}
+		else
+		{
+			denoised.clear();
+		}
+	}
+
+	// the radiance that is tonemapped and exported
+	const Color* outputRadiance() const
+	{
+		return denoised.empty() ? &frame.radiance[0] : &denoised[0];
+	}
+
+	// one ray per pixel, keeps the hit prim and surface around for the edge detection and denoiser
+	// rows go to all cores, with meshes of millions of triangles every ray is worth it
+	void renderPrimary()
+	{
+		runPass(Pass_Primary);
+	}
+
+	template<typename Shader>
+	void renderPrimaryWith( const Shader& shade )
+	{
+		parallelFor(imageSize.y, 4, [&]( u32 rowBegin, u32 rowEnd )
+		{
+			Ray ray;
+			ray.pos = scene.camPos;
+
+			for (u32 iy = rowBegin; iy < rowEnd; ++iy)
+			{
+				for (u32 ix = 0; ix < imageSize.x; ++ix)
+				{
+					ray.dir = primaryDir(ix, iy);
+
+					Scene::Hit hit;
+					Color pixel = shade(scene, ray, hit);
+					frame.setSample(pixelIndex(ix, iy), pixel, hit, scene);
+				}
+			}
+		});
+	}
 
-		for (u32 ix = 0; ix < imageSize.x; ++ix)
+	// a silhouette or a change of prim, or a color step above aaThreshold where the colors are noise-free
+	bool isEdge( u32 a, u32 b ) const
+	{
+		if (frame.prim[a] != frame.prim[b])
+		{
+			return true;
+		}
+		if (Scene::isNoisy(scene.shadingModel))
 		{
-			f32 x = ix * imageSizeInv.x - 0.5f;
+			return false;
+		}
+
+		Color delta = frame.radiance[a] - frame.radiance[b];
+		f32 maxDelta = fabsf(delta.r);
+		maxDelta = std::max(maxDelta, fabsf(delta.g));
+		maxDelta = std::max(maxDelta, fabsf(delta.b));
+		return maxDelta > aaThreshold;
+	}
+
+	// flag both sides of every discontinuity with the right and bottom neighbours
+	void findEdges()
+	{
+		std::fill(edgeMask.begin(), edgeMask.end(), 0);
 
-			for (u32 iy = 0; iy < imageSize.y; ++iy)
+		for (u32 row = 0; row < imageSize.y; ++row)
+		{
+			for (u32 col = 0; col < imageSize.x; ++col)
 			{
-				f32 y = iy * imageSizeInv.y - 0.5f;
+				u32 i = col + row * imageSize.x;
+
+				if (col + 1 < imageSize.x && isEdge(i, i + 1))
+				{
+					edgeMask[i] = edgeMask[i + 1] = 1;
+				}
+				if (row + 1 < imageSize.y && isEdge(i, i + imageSize.x))
+				{
+					edgeMask[i] = edgeMask[i + imageSize.x] = 1;
+				}
+			}
+		}
+	}
+
+	// replace flagged pixels by the average of a grid of sub-pixel rays centered on the original sample
+	void refineEdges()
+	{
+		runPass(Pass_Refine);
+	}
 
-				ray.dir = Vec3f(x, y, 1).normalized();
+	template<typename Shader>
+	void refineEdgesWith( const Shader& shade )
+	{
+		const u32 grid = std::max(aaGridSize, 2u);
+		const f32 step = 1.f / grid;
+		const f32 weight = 1.f / (grid * grid);
 
-				Color pixel = scene.shade(ray);
+		std::atomic<u32> refined(0);
+		parallelFor(imageSize.y, 4, [&]( u32 rowBegin, u32 rowEnd )
+		{
+			Ray ray;
+			ray.pos = scene.camPos;
 
-				u32 iPixel = ix + (imageSize.y - 1 - iy) * imageSize.x;
-				RGBA rgba(u8(pixel.r * 255), u8(pixel.g * 255), u8(pixel.b * 255), u8(pixel.a * 255));
-				image[iPixel] = rgba;
+			u32 count = 0;
+			for (u32 iy = rowBegin; iy < rowEnd; ++iy)
+			{
+				for (u32 ix = 0; ix < imageSize.x; ++ix)
+				{
+					u32 iPixel = pixelIndex(ix, iy);
+					if (!edgeMask[iPixel])
+					{
+						continue;
+					}
+
+					Color sum(0);
+					for (u32 sy = 0; sy < grid; ++sy)
+					{
+						for (u32 sx = 0; sx < grid; ++sx)
+						{
+							f32 ox = (sx + 0.5f) * step - 0.5f;
+							f32 oy = (sy + 0.5f) * step - 0.5f;
+							ray.dir = primaryDir(ix, iy, ox, oy);
+							Scene::Hit hit;
+							sum += shade(scene, ray, hit);
+						}
+					}
+
+					frame.radiance[iPixel] = sum * weight;
+					++count;
+				}
 			}
+			refined += count;
+		});
+		aaRefinedCount += refined;
+	}
+
+	// the render loops tracing rays, each instantiated for every shading pipeline
+	enum Pass
+	{
+		Pass_Primary,
+		Pass_Retrace,
+		Pass_Refine,
+	};
+
+	// picks the pipeline for the scene once, the loop calls it for every ray
+	void runPass( const Pass pass )
+	{
+		if (!specializedShading)
+		{
+			runPassWith(pass, ShadeAny());
+			return;
+		}
+
+		const bool flat = scene.hasFlatPrims();
+		const bool specular = scene.hasSpecularPrims();
+		switch (scene.shadingModel)
+		{
+			case ShadingModel_Lambert:				runPassAs<ShadingModel_Lambert>(pass, flat, specular); break;
+			case ShadingModel_LambertWithShadow:	runPassAs<ShadingModel_LambertWithShadow>(pass, flat, specular); break;
+			case ShadingModel_GI_normal:			runPassAs<ShadingModel_GI_normal>(pass, flat, specular); break;
+			case ShadingModel_GI_reflect:			runPassAs<ShadingModel_GI_reflect>(pass, flat, specular); break;
+			case ShadingModel_AmbientOcclusion:		runPassAs<ShadingModel_AmbientOcclusion>(pass, flat, specular); break;
+			case ShadingModel_Path:					runPassAs<ShadingModel_Path>(pass, flat, specular); break;
+			case ShadingModel_PathBsdf:				runPassAs<ShadingModel_PathBsdf>(pass, flat, specular); break;
+			case ShadingModel_PathCached:			runPassAs<ShadingModel_PathCached>(pass, flat, specular); break;
+			case ShadingModel_PathGrid:				runPassAs<ShadingModel_PathGrid>(pass, flat, specular); break;
+			case ShadingModel_Photon:				runPassAs<ShadingModel_Photon>(pass, flat, specular); break;
 		}
 	}
 
-	void uploadToGPU()
+	// features the model's pipelines don't specialize on are always on, so they share one instantiation
+	template<ShadingModel Model>
+	void runPassAs( const Pass pass, const bool flat, const bool specular )
+	{
+		constexpr bool flatAlways = !Scene::flatSpecialized(Model);
+		constexpr bool specularAlways = !Scene::specularSpecialized(Model);
+		if (flat || flatAlways)
+		{
+			if (specular || specularAlways)
+			{
+				runPassWith(pass, ShadeAs<Model, true, true>());
+			}
+			else
+			{
+				runPassWith(pass, ShadeAs<Model, true, specularAlways>());
+			}
+		}
+		else if (specular || specularAlways)
+		{
+			runPassWith(pass, ShadeAs<Model, flatAlways, true>());
+		}
+		else
+		{
+			runPassWith(pass, ShadeAs<Model, flatAlways, specularAlways>());
+		}
+	}
+
+	template<typename Shader>
+	void runPassWith( const Pass pass, const Shader& shade )
+	{
+		switch (pass)
+		{
+			case Pass_Primary:
+				renderPrimaryWith(shade);
+				break;
+			case Pass_Retrace:
+				retraceInvalidWith(shade);
+				break;
+			case Pass_Refine:
+				refineEdgesWith(shade);
+				break;
+		}
+	}
+
+	// radiance -> display image
+	void resolve()
+	{
+		tonemapper.apply(outputRadiance(), image, imageSize.x * imageSize.y);
+	}
+
+	f32 aaRefinedPercent() const
+	{
+		return 100.f * aaRefinedCount / (imageSize.x * imageSize.y);
+	}
+
+	bool renderSettingsOnGui()
 	{
-		if (glTextureID == 0)
+		bool changed = false;
+
+		ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2,2));
+		ImGui::Columns(2);
+		ImGui::Separator();
+
+		ImGui::BeginProperty("Adaptive AA");
+		changed |= ImGui::Checkbox("", &aaEnabled);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("AA threshold");
+		changed |= ImGui::DragFloat("", &aaThreshold, 0.01f, 0.f, 1.f);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		ImGui::BeginProperty("AA grid");
+		changed |= ImGui::SliderInt("", (int*)&aaGridSize, 2, 8);
+		ImGui::NextColumn();
+		ImGui::EndProperty();
+
+		changed |= denoiser.onGui();
+		changed |= temporal.onGui();
+
+		ImGui::Columns(1);
+		ImGui::Separator();
+		ImGui::PopStyleVar();
+
+		if (aaEnabled)
+		{
+			ImGui::Text("AA: %.1f%% pixels refined (%u extra rays)", aaRefinedPercent(), aaRefinedCount * aaGridSize * aaGridSize);
+		}
+
+		ImGui::Text("Render %.2f ms%s", timings.total, approximate ? " (reprojected)" : "");
+		if (approximate)
 		{
-			glGenTextures(1, &glTextureID);
-			glBindTexture(GL_TEXTURE_2D, glTextureID);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			ImGui::Text("  reproject %.2f ms, %.1f%% reused, %.1f%% retraced", timings.reproject,
+				100.f * temporal.reusedCount / (imageSize.x * imageSize.y), 100.f * retracedCount / (imageSize.x * imageSize.y));
 		}
+		ImGui::Text("  primary %.2f ms", timings.primary);
+		ImGui::Text("  AA %.2f ms", timings.aa);
+		ImGui::Text("  denoise %.2f ms", timings.denoise);
+		ImGui::Text("  tonemap %.2f ms", timings.tonemap);
+		ImGui::Text("Upload %.2f ms, %u/%u tiles, %u KB", timings.upload, texture.dirtyTileCount, texture.tileCount, texture.uploadedBytes / 1024);
 
-		glBindTexture(GL_TEXTURE_2D, glTextureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageSize.x, imageSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+		return changed;
+	}
+
+	void uploadToGPU()
+	{
+		Timer stage;
+		texture.upload(image, imageSize);
+		timings.upload = stage.elapsedMs();
 	}
 
-	int dumpToPng()
+	// snapshots the current image, encoding and writing happen in the background
+	bool exportImage()
 	{
-		//int stbi_write_png(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes);
-		const u32 channelCount = 4;
-		return stbi_write_png("out.png", imageSize.x, imageSize.y, channelCount, image, imageSize.x * channelCount);
+		return exporter.start(image, outputRadiance(), imageSize);
 	}
 
 
+	// the scene is set up by the caller (see setupScene)
 	void init()
 	{
 		initImage(Vec2u(256, 256));
-		initScene();
 		render();
 		uploadToGPU();
 
@@ -589,6 +2642,12 @@ public:
 		style.GrabRounding = 3;
 	}
 
+	// the GL objects go while the context is still there, the Tracer itself outlives it
+	void shutdown()
+	{
+		texture.release();
+	}
+
 	void update()
 	{
 		static bool show_test_window = false;
@@ -600,15 +2659,43 @@ public:
 			//ImGui::Text("glTextureID %d", glTextureID);
 			//ImGui::Text("sizeof(RGBA) %d", sizeof(RGBA));
 
-			if (scene.onGui())
+			u32 sceneChange = scene.onGui();
+			if (generator.onGui())
+			{
+				generator.generate(scene);
+				sceneChange |= SceneChange_Content;
+			}
+			if (sceneChange & SceneChange_Content)
+			{
+				scene.irradianceCache.clear();
+				scene.radianceGrid.clear();
+				scene.photonMap.clear();
+			}
+			ImGui::Text("Scene: %s, %u spheres, %u planes, %u boxes, %llu triangles, %u instances, %u lights", scene.description.c_str(), u32(scene.spheres.size()), u32(scene.planes.size()), u32(scene.boxes.size()), scene.triangleCount(), u32(scene.instances.size()), u32(scene.lights.size()));
+
+			bool settingsChanged = renderSettingsOnGui();
+			if (sceneChange == SceneChange_Camera && !settingsChanged && temporal.enabled)
+			{
+				renderReprojected();
+				uploadToGPU();
+			}
+			else if (sceneChange || settingsChanged || (approximate && !ImGui::IsAnyItemActive()))
 			{
 				render();
 				uploadToGPU();
 			}
 
-			if (ImGui::Button("Dump to PNG"))
+			if (tonemapper.onGui())
+			{
+				Timer stage;
+				resolve();
+				timings.tonemap = stage.elapsedMs();
+				uploadToGPU();
+			}
+
+			if (exporter.onGui())
 			{
-				dumpToPng();
+				exportImage();
 			}
 
 			ImGui::Checkbox("ImGui demo", &show_test_window);
@@ -619,7 +2706,7 @@ public:
 		ImGui::SetNextWindowSize(ImVec2(300,300), ImGuiSetCond_FirstUseEver);
 		ImGui::Begin("Render");
 		{
-			ImGui::Image((ImTextureID)glTextureID, ImVec2((float)imageSize.x, (float)imageSize.y));
+			ImGui::Image((ImTextureID)texture.id, ImVec2((float)imageSize.x, (float)imageSize.y));
 		}
 		ImGui::End();
 